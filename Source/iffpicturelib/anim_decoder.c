@@ -0,0 +1,687 @@
+/*
+** anim_decoder.c - FORM ANIM Playback Implementation (Internal to Library)
+**
+** A FORM ANIM holds a full FORM ILBM for the first frame followed by one
+** FORM ILBM per frame carrying an ANHD header and a DLTA chunk. The first
+** BODY is kept as planes in a double buffer and every DLTA is applied to
+** those planes in place, so a frame costs only the bytes that changed.
+** The regular ILBM/HAM/EHB decoders then convert the planes to RGB.
+**
+** DEEP files with a DCHG chunk share the playback API: each DLOC/DBOD
+** pair after the first is one frame, decoded by DecodeNextDEEPFrame().
+**
+** Supported delta compressions (ANHD operation):
+** - 0: full BODY (raw, ByteRun1 or VDAT)
+** - 5: byte vertical delta, optionally XOR
+** - 7: short/long vertical delta, separate opcode and data lists
+** - 8: short/long vertical delta, opcodes and data interleaved
+*/
+
+#include "iffpicture_private.h"
+#include "/debug.h"
+#include <proto/exec.h>
+#include <proto/iffparse.h>
+
+#define RowBytes(w) ((((w) + 15) >> 4) << 1)  /* Round up to 16-bit boundary */
+
+/* Address of one row of one plane in a contiguous (plane-major) plane buffer */
+#define PlaneRow(planes, plane, row, rowBytes, height) \
+    ((planes) + ((ULONG)(plane) * (height) + (row)) * (rowBytes))
+
+/* Read a big-endian longword */
+#define GetBE32(p) (((ULONG)(p)[0] << 24) | ((ULONG)(p)[1] << 16) | \
+                    ((ULONG)(p)[2] << 8) | (ULONG)(p)[3])
+
+/* Pointer table sizes at the start of a DLTA chunk */
+#define DLTA_PTRS_OP5   16  /* One list per plane */
+#define DLTA_PTRS_OP7   8   /* Opcode lists; data lists follow */
+#define DLTA_PTRS_OP8   8   /* Eight used of sixteen */
+
+/* DeltaStream - bounded read cursor into a DLTA chunk */
+struct DeltaStream {
+    const UBYTE *ptr;
+    const UBYTE *end;
+};
+
+/* DeltaExtent - bytes and rows written by one delta */
+struct DeltaExtent {
+    UWORD minCol, maxCol;   /* Byte columns, inclusive */
+    UWORD minRow, maxRow;   /* Rows, inclusive */
+    BOOL empty;
+};
+
+/*
+** AllocIFFAnim - Allocate empty ANIM playback state
+** Returns: Pointer to new IFFAnim or NULL on failure
+*/
+struct IFFAnim *AllocIFFAnim(struct IFFPicture *picture)
+{
+    return (struct IFFAnim *)AllocPictureMem(picture, sizeof(struct IFFAnim), MEMF_PUBLIC | MEMF_CLEAR);
+}
+
+/*
+** FreeIFFAnim - Free ANIM playback state and its buffers
+*/
+VOID FreeIFFAnim(struct IFFPicture *picture, struct IFFAnim *anim)
+{
+    UWORD i;
+    
+    if (!anim) {
+        return;
+    }
+    
+    for (i = 0; i < 2; i++) {
+        if (anim->planes[i]) {
+            FreePictureMem(picture, anim->planes[i], anim->planeDataSize);
+        }
+    }
+    if (anim->dlta) {
+        FreePictureMem(picture, anim->dlta, anim->dltaSize);
+    }
+    FreePictureMem(picture, anim, sizeof(struct IFFAnim));
+}
+
+/*
+** SetFullRect - Set a rectangle to cover the whole image
+*/
+static VOID SetFullRect(struct IFFPicture *picture, struct AnimRect *rect)
+{
+    rect->x = 0;
+    rect->y = 0;
+    rect->w = picture->bmhd->w;
+    rect->h = picture->bmhd->h;
+}
+
+/*
+** UnionRect - Grow dest to also cover src
+*/
+static VOID UnionRect(struct AnimRect *dest, const struct AnimRect *src)
+{
+    UWORD x1, y1;
+    
+    if (src->w == 0 || src->h == 0) {
+        return;
+    }
+    if (dest->w == 0 || dest->h == 0) {
+        *dest = *src;
+        return;
+    }
+    
+    x1 = (UWORD)(dest->x + dest->w);
+    y1 = (UWORD)(dest->y + dest->h);
+    if (src->x + src->w > x1) x1 = (UWORD)(src->x + src->w);
+    if (src->y + src->h > y1) y1 = (UWORD)(src->y + src->h);
+    if (src->x < dest->x) dest->x = src->x;
+    if (src->y < dest->y) dest->y = src->y;
+    dest->w = (UWORD)(x1 - dest->x);
+    dest->h = (UWORD)(y1 - dest->y);
+}
+
+/*
+** GetAnimPlanes - Get the planes holding the current frame
+** Returns: Plane buffer owned by the animation, or NULL on error
+**
+** On first use this allocates the double buffer and reads the first
+** frame's BODY into it; both buffers start out with the same image.
+*/
+UBYTE *GetAnimPlanes(struct IFFPicture *picture)
+{
+    struct IFFAnim *anim;
+    UWORD height;
+    
+    anim = picture->anim;
+    if (anim->loaded) {
+        return anim->planes[anim->shown];
+    }
+    
+    height = picture->bmhd->h;
+    anim->rowBytes = RowBytes(picture->bmhd->w);
+    anim->numPlanes = picture->bmhd->nPlanes;
+    if (picture->bmhd->masking == mskHasMask) {
+        anim->numPlanes++;
+    }
+    anim->planeDataSize = (ULONG)anim->numPlanes * height * anim->rowBytes;
+    
+    anim->planes[0] = (UBYTE *)AllocPictureMem(picture, anim->planeDataSize, MEMF_PUBLIC | MEMF_CLEAR);
+    anim->planes[1] = (UBYTE *)AllocPictureMem(picture, anim->planeDataSize, MEMF_PUBLIC | MEMF_CLEAR);
+    if (!anim->planes[0] || !anim->planes[1]) {
+        SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate ANIM plane buffers");
+        return NULL;
+    }
+    
+    if (ReadILBMPlanes(picture, anim->planes[0], anim->rowBytes, height, anim->numPlanes) != RETURN_OK) {
+        return NULL; /* Error already set */
+    }
+    CopyMem(anim->planes[0], anim->planes[1], anim->planeDataSize);
+    
+    anim->shown = 0;
+    anim->loaded = TRUE;
+    SetFullRect(picture, &anim->frameRect);
+    
+    return anim->planes[0];
+}
+
+/*
+** ReadANHD - Read the ANHD chunk of the current frame
+** Returns: RETURN_OK on success, RETURN_FAIL if missing or short
+*/
+static LONG ReadANHD(struct IFFPicture *picture)
+{
+    struct StoredProperty *sp;
+    struct AnimHeader *anhd;
+    const UBYTE *src;
+    
+    sp = FindProp(picture->iff, ID_ILBM, ID_ANHD);
+    if (!sp || sp->sp_Size < 24) {
+        picture->anim->hasANHD = FALSE;
+        SetIFFPictureError(picture, IFFPICTURE_BADFILE, "ANIM frame has no ANHD chunk");
+        return RETURN_FAIL;
+    }
+    
+    src = (const UBYTE *)sp->sp_Data;
+    anhd = &picture->anim->anhd;
+    anhd->operation = src[0];
+    anhd->mask = src[1];
+    anhd->w = (UWORD)((src[2] << 8) | src[3]);
+    anhd->h = (UWORD)((src[4] << 8) | src[5]);
+    anhd->x = (WORD)((src[6] << 8) | src[7]);
+    anhd->y = (WORD)((src[8] << 8) | src[9]);
+    anhd->abstime = GetBE32(src + 10);
+    anhd->reltime = GetBE32(src + 14);
+    anhd->interleave = src[18];
+    anhd->pad0 = src[19];
+    anhd->bits = GetBE32(src + 20);
+    picture->anim->hasANHD = TRUE;
+    
+    DEBUG_PRINTF3("DEBUG: ReadANHD - op=%ld interleave=%ld bits=0x%08lx\n",
+                  (ULONG)anhd->operation, (ULONG)anhd->interleave, anhd->bits);
+    
+    return RETURN_OK;
+}
+
+/*
+** GetDeltaUnit - Read a 1, 2 or 4 byte big-endian value from a DLTA stream
+** Returns: TRUE on success, FALSE if the stream is exhausted
+*/
+static BOOL GetDeltaUnit(struct DeltaStream *ds, UWORD size, ULONG *value)
+{
+    const UBYTE *p;
+    
+    if ((ULONG)(ds->end - ds->ptr) < size) {
+        return FALSE;
+    }
+    
+    p = ds->ptr;
+    if (size == 1) {
+        *value = p[0];
+    } else if (size == 2) {
+        *value = ((ULONG)p[0] << 8) | p[1];
+    } else {
+        *value = GetBE32(p);
+    }
+    ds->ptr += size;
+    
+    return TRUE;
+}
+
+/*
+** PutDeltaUnit - Store (or XOR) a 1, 2 or 4 byte value into a plane
+*/
+static VOID PutDeltaUnit(UBYTE *dest, UWORD size, ULONG value, BOOL xorMode)
+{
+    UWORD i;
+    UBYTE b;
+    
+    for (i = 0; i < size; i++) {
+        b = (UBYTE)(value >> ((size - 1 - i) * 8));
+        if (xorMode) {
+            dest[i] ^= b;
+        } else {
+            dest[i] = b;
+        }
+    }
+}
+
+/*
+** MarkExtent - Record that rows [row, row+count) of a column were written
+*/
+static VOID MarkExtent(struct DeltaExtent *ext, UWORD col, UWORD size, UWORD row, UWORD count)
+{
+    if (count == 0) {
+        return;
+    }
+    if (ext->empty) {
+        ext->minCol = col;
+        ext->maxCol = (UWORD)(col + size - 1);
+        ext->minRow = row;
+        ext->maxRow = (UWORD)(row + count - 1);
+        ext->empty = FALSE;
+        return;
+    }
+    if (col < ext->minCol) ext->minCol = col;
+    if (col + size - 1 > ext->maxCol) ext->maxCol = (UWORD)(col + size - 1);
+    if (row < ext->minRow) ext->minRow = row;
+    if (row + count - 1 > ext->maxRow) ext->maxRow = (UWORD)(row + count - 1);
+}
+
+/*
+** ApplyDeltaColumn - Apply one column of a vertical delta
+** Returns: TRUE on success, FALSE if the data is corrupt
+**
+** All three vertical compressions share this layout: an op count, then
+** ops that skip rows (1..0x7f), copy literal values (high bit set, low
+** bits = count) or repeat one value (0, count, value). Ops and counts are
+** opSize wide; values are dataSize wide and come from the data stream,
+** which is the op stream itself for op 5 and op 8.
+*/
+static BOOL ApplyDeltaColumn(struct DeltaStream *ops, struct DeltaStream *data,
+                             UWORD opSize, UWORD dataSize, BOOL xorMode,
+                             UBYTE *dest, UWORD rowBytes, UWORD height,
+                             UWORD col, struct DeltaExtent *ext)
+{
+    ULONG opCount, op, count, value, uniqFlag;
+    ULONG row;
+    
+    uniqFlag = 1UL << (opSize * 8 - 1);
+    row = 0;
+    
+    if (!GetDeltaUnit(ops, opSize, &opCount)) {
+        return FALSE;
+    }
+    
+    while (opCount--) {
+        if (!GetDeltaUnit(ops, opSize, &op)) {
+            return FALSE;
+        }
+        
+        if (op == 0) {
+            /* Same op: one value repeated down the column */
+            if (!GetDeltaUnit(ops, opSize, &count) || !GetDeltaUnit(data, dataSize, &value)) {
+                return FALSE;
+            }
+            if (row + count > height) {
+                return FALSE;
+            }
+            MarkExtent(ext, col, dataSize, (UWORD)row, (UWORD)count);
+            row += count;
+            while (count--) {
+                PutDeltaUnit(dest, dataSize, value, xorMode);
+                dest += rowBytes;
+            }
+        } else if (op & uniqFlag) {
+            /* Uniq op: literal values down the column */
+            count = op & ~uniqFlag;
+            if (row + count > height) {
+                return FALSE;
+            }
+            MarkExtent(ext, col, dataSize, (UWORD)row, (UWORD)count);
+            row += count;
+            while (count--) {
+                if (!GetDeltaUnit(data, dataSize, &value)) {
+                    return FALSE;
+                }
+                PutDeltaUnit(dest, dataSize, value, xorMode);
+                dest += rowBytes;
+            }
+        } else {
+            /* Skip op: leave rows unchanged */
+            if (row + op > height) {
+                return FALSE;
+            }
+            row += op;
+            dest += op * rowBytes;
+        }
+    }
+    
+    return TRUE;
+}
+
+/*
+** ApplyDelta - Apply the DLTA chunk in anim->dlta to a plane buffer
+** Returns: RETURN_OK on success, RETURN_FAIL on error
+*/
+static LONG ApplyDelta(struct IFFPicture *picture, UBYTE *planes, ULONG dltaSize,
+                       struct DeltaExtent *ext)
+{
+    struct IFFAnim *anim;
+    struct DeltaStream ops, data;
+    const UBYTE *dlta;
+    UBYTE *base;
+    ULONG opOffset, dataOffset;
+    UWORD plane, numLists, col, unit;
+    UWORD rowBytes, height, depth;
+    BOOL longData, xorMode;
+    UBYTE operation;
+    
+    anim = picture->anim;
+    dlta = anim->dlta;
+    rowBytes = anim->rowBytes;
+    height = picture->bmhd->h;
+    depth = picture->bmhd->nPlanes;
+    operation = anim->anhd.operation;
+    longData = (BOOL)((anim->anhd.bits & ANIMF_LONGDATA) != 0);
+    xorMode = (BOOL)((anim->anhd.bits & ANIMF_XOR) != 0);
+    
+    switch (operation) {
+        case ANIM_OP_BYTEVERT:
+            numLists = DLTA_PTRS_OP5;
+            break;
+        case ANIM_OP_SHORTLONG7:
+            numLists = DLTA_PTRS_OP7;
+            break;
+        case ANIM_OP_SHORTLONG8:
+            numLists = DLTA_PTRS_OP8;
+            break;
+        default:
+            SetIFFPictureError(picture, IFFPICTURE_UNSUPPORTED, "Unsupported ANIM delta compression");
+            return RETURN_FAIL;
+    }
+    
+    /* Op 7 has a second table of data list pointers */
+    if (dltaSize < (ULONG)numLists * 4 * (operation == ANIM_OP_SHORTLONG7 ? 2 : 1)) {
+        SetIFFPictureError(picture, IFFPICTURE_BADFILE, "DLTA chunk too small");
+        return RETURN_FAIL;
+    }
+    
+    for (plane = 0; plane < depth && plane < numLists; plane++) {
+        opOffset = GetBE32(dlta + plane * 4);
+        if (opOffset == 0) {
+            continue; /* Plane unchanged */
+        }
+        if (opOffset >= dltaSize) {
+            SetIFFPictureError(picture, IFFPICTURE_BADFILE, "DLTA plane pointer out of range");
+            return RETURN_FAIL;
+        }
+        
+        ops.ptr = dlta + opOffset;
+        ops.end = dlta + dltaSize;
+        base = PlaneRow(planes, plane, 0, rowBytes, height);
+        
+        if (operation == ANIM_OP_SHORTLONG7) {
+            dataOffset = GetBE32(dlta + (DLTA_PTRS_OP7 + plane) * 4);
+            if (dataOffset >= dltaSize) {
+                SetIFFPictureError(picture, IFFPICTURE_BADFILE, "DLTA data pointer out of range");
+                return RETURN_FAIL;
+            }
+            data.ptr = dlta + dataOffset;
+            data.end = dlta + dltaSize;
+        }
+        
+        for (col = 0; col < rowBytes; col += unit) {
+            if (operation == ANIM_OP_BYTEVERT) {
+                unit = 1;
+                if (!ApplyDeltaColumn(&ops, &ops, 1, 1, xorMode, base + col,
+                                      rowBytes, height, col, ext)) {
+                    break;
+                }
+                continue;
+            }
+            
+            /* Long data still ends in a word column when rowBytes % 4 == 2 */
+            unit = (UWORD)((longData && col + 4 <= rowBytes) ? 4 : 2);
+            if (operation == ANIM_OP_SHORTLONG7) {
+                if (!ApplyDeltaColumn(&ops, &data, 1, unit, FALSE, base + col,
+                                      rowBytes, height, col, ext)) {
+                    break;
+                }
+            } else {
+                if (!ApplyDeltaColumn(&ops, &ops, unit, unit, FALSE, base + col,
+                                      rowBytes, height, col, ext)) {
+                    break;
+                }
+            }
+        }
+        
+        if (col < rowBytes) {
+            SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Corrupt ANIM delta data");
+            return RETURN_FAIL;
+        }
+    }
+    
+    return RETURN_OK;
+}
+
+/*
+** ReadDLTA - Read the current DLTA chunk into the reusable staging buffer
+** Returns: Number of bytes read, or -1 on error (error already set)
+*/
+static LONG ReadDLTA(struct IFFPicture *picture, ULONG size)
+{
+    struct IFFAnim *anim;
+    
+    anim = picture->anim;
+    if (size > anim->dltaSize) {
+        if (anim->dlta) {
+            FreePictureMem(picture, anim->dlta, anim->dltaSize);
+        }
+        anim->dltaSize = size;
+        anim->dlta = (UBYTE *)AllocPictureMem(picture, size, MEMF_PUBLIC);
+        if (!anim->dlta) {
+            anim->dltaSize = 0;
+            SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate DLTA buffer");
+            return -1;
+        }
+    }
+    
+    if (ReadChunkBytes(picture->iff, anim->dlta, size) != (LONG)size) {
+        SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Failed to read DLTA chunk");
+        return -1;
+    }
+    
+    return (LONG)size;
+}
+
+/*
+** ReplaceCMAP - Pick up a CMAP stored in the current frame, if any
+** Returns: RETURN_OK on success, RETURN_FAIL on error
+*/
+static LONG ReplaceCMAP(struct IFFPicture *picture)
+{
+    if (!FindProp(picture->iff, ID_ILBM, ID_CMAP)) {
+        return RETURN_OK;
+    }
+    
+    FreeColorMap(picture);
+    
+    return ReadCMAP(picture);
+}
+
+/*
+** IsAnimation - Check whether the picture is a FORM ANIM
+** Returns: TRUE for animations, FALSE otherwise
+*/
+BOOL IsAnimation(struct IFFPicture *picture)
+{
+    if (!picture) {
+        return FALSE;
+    }
+    return (BOOL)(picture->anim != NULL);
+}
+
+/*
+** DecodeNextFrame - Apply the next ANIM frame and decode it
+** Returns: RETURN_OK on success, RETURN_WARN at end of animation,
+**          RETURN_FAIL on error
+*/
+LONG DecodeNextFrame(struct IFFPicture *picture)
+{
+    struct IFFAnim *anim;
+    struct ContextNode *cn;
+    struct DeltaExtent ext;
+    struct AnimRect rect;
+    UWORD target, interleave;
+    LONG error;
+    
+    if (!picture || !picture->anim || !picture->iff) {
+        if (picture) {
+            SetIFFPictureError(picture, IFFPICTURE_INVALID, "Picture is not an open animation");
+        }
+        return RETURN_FAIL;
+    }
+    
+    anim = picture->anim;
+    if (!anim->loaded || !picture->isDecoded) {
+        SetIFFPictureError(picture, IFFPICTURE_INVALID, "First ANIM frame not decoded");
+        return RETURN_FAIL;
+    }
+    
+    /* The first frame's metadata chunks leave scope as the parse moves on */
+    LoadMeta(picture);
+    
+    /* DEEP animations update the canvas one DLOC/DBOD tile at a time */
+    if (picture->formtype == ID_DEEP) {
+        return DecodeNextDEEPFrame(picture);
+    }
+    
+    /* Scan to the next frame's BODY or DLTA */
+    error = ParseIFF(picture->iff, IFFPARSE_SCAN);
+    if (error == IFFERR_EOF) {
+        return RETURN_WARN;
+    }
+    if (error != 0) {
+        SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Failed to parse ANIM frame");
+        return RETURN_FAIL;
+    }
+    
+    cn = CurrentChunk(picture->iff);
+    if (!cn || (cn->cn_ID != ID_DLTA && cn->cn_ID != ID_BODY)) {
+        SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Expected DLTA or BODY in ANIM frame");
+        return RETURN_FAIL;
+    }
+    
+    if (cn->cn_ID == ID_DLTA && ReadANHD(picture) != RETURN_OK) {
+        return RETURN_FAIL; /* Error already set */
+    }
+    if (cn->cn_ID == ID_BODY) {
+        /* Key frames may omit ANHD */
+        if (FindProp(picture->iff, ID_ILBM, ID_ANHD)) {
+            ReadANHD(picture);
+        } else {
+            anim->hasANHD = FALSE;
+        }
+    }
+    
+    if (ReplaceCMAP(picture) != RETURN_OK) {
+        return RETURN_FAIL; /* Error already set */
+    }
+    
+    /* Deltas normally apply to the frame two back, i.e. the hidden buffer */
+    interleave = anim->hasANHD ? anim->anhd.interleave : 1;
+    if (interleave == 0 || interleave > 2) {
+        interleave = 2;
+    }
+    target = (interleave == 1) ? anim->shown : (UWORD)(1 - anim->shown);
+    
+    if (cn->cn_ID == ID_BODY) {
+        if (ReadILBMPlanes(picture, anim->planes[target], anim->rowBytes,
+                           picture->bmhd->h, anim->numPlanes) != RETURN_OK) {
+            return RETURN_FAIL; /* Error already set */
+        }
+        /* A key frame restarts the double buffer with both halves equal */
+        CopyMem(anim->planes[target], anim->planes[1 - target], anim->planeDataSize);
+        SetFullRect(picture, &anim->frameRect);
+        rect.x = rect.y = rect.w = rect.h = 0;
+    } else {
+        if (ReadDLTA(picture, (ULONG)cn->cn_Size) < 0) {
+            return RETURN_FAIL; /* Error already set */
+        }
+        ext.empty = TRUE;
+        if (ApplyDelta(picture, anim->planes[target], (ULONG)cn->cn_Size, &ext) != RETURN_OK) {
+            return RETURN_FAIL; /* Error already set */
+        }
+        if (ext.empty) {
+            rect.x = rect.y = rect.w = rect.h = 0;
+        } else {
+            rect.x = (UWORD)(ext.minCol * 8);
+            rect.y = ext.minRow;
+            rect.w = (UWORD)((ext.maxCol + 1) * 8 - rect.x);
+            rect.h = (UWORD)(ext.maxRow + 1 - ext.minRow);
+            if (rect.x + rect.w > picture->bmhd->w) {
+                rect.w = (UWORD)(picture->bmhd->w - rect.x);
+            }
+        }
+    }
+    
+    /* With double buffering the target also lacks the previous delta */
+    if (cn->cn_ID == ID_DLTA) {
+        anim->frameRect = rect;
+        if (interleave == 2) {
+            UnionRect(&anim->frameRect, &anim->lastDelta);
+        }
+    }
+    anim->lastDelta = rect;
+    anim->shown = target;
+    anim->frame++;
+    
+    DEBUG_PRINTF4("DEBUG: DecodeNextFrame - frame %ld, rect %ldx%ld at y=%ld\n",
+                  anim->frame, (ULONG)anim->frameRect.w, (ULONG)anim->frameRect.h,
+                  (ULONG)anim->frameRect.y);
+    
+    /* Decode the updated planes, replacing the previous frame's output */
+    FreePixelData(picture);
+    FreePaletteIndices(picture);
+    picture->isDecoded = FALSE;
+    
+    return Decode(picture);
+}
+
+/*
+** GetFrameNumber - Get the number of the frame currently decoded
+** Returns: Frame number (0 for the first frame and for still images)
+*/
+ULONG GetFrameNumber(struct IFFPicture *picture)
+{
+    if (!picture || !picture->anim) {
+        return 0;
+    }
+    return picture->anim->frame;
+}
+
+/*
+** GetANHD - Get the ANHD header of the current frame
+** Returns: Pointer to AnimHeader or NULL if the frame has none
+*/
+struct AnimHeader *GetANHD(struct IFFPicture *picture)
+{
+    if (!picture || !picture->anim || !picture->anim->hasANHD) {
+        return NULL;
+    }
+    return &picture->anim->anhd;
+}
+
+/*
+** GetFrameDelay - Get how long the current frame is shown
+** The delay is *num / *den seconds; 0 if the file does not give one
+*/
+VOID GetFrameDelay(struct IFFPicture *picture, ULONG *num, ULONG *den)
+{
+    *num = 0;
+    *den = 1;
+    if (!picture || !picture->anim) {
+        return;
+    }
+    
+    if (picture->formtype == ID_DEEP) {
+        /* DCHG FrameRate is in milliseconds, -1 marks non-animated frames */
+        if (picture->dchg && picture->dchg->FrameRate > 0) {
+            *num = (ULONG)picture->dchg->FrameRate;
+            *den = 1000;
+        }
+    } else if (picture->anim->hasANHD) {
+        /* ANHD reltime is in jiffies */
+        *num = picture->anim->anhd.reltime;
+        *den = 60;
+    }
+}
+
+/*
+** GetFrameRect - Get the area that changed since the previous frame
+** Returns: Pointer to AnimRect or NULL if not an animation
+*/
+struct AnimRect *GetFrameRect(struct IFFPicture *picture)
+{
+    if (!picture || !picture->anim) {
+        return NULL;
+    }
+    return &picture->anim->frameRect;
+}
@@ -35,6 +35,7 @@ static LONG ConvertRGBToBitPlanes(struct IFFPicture *picture, struct BitMap *bit
     UBYTE bitMask;
     ULONG rgbIndex;
     UBYTE *planePtr;
+    struct InverseCMap *icm;
     ULONG i;
     
     if (!picture || !bitmap || !picture->pixelData || !picture->bmhd) {
@@ -55,6 +56,16 @@ static LONG ConvertRGBToBitPlanes(struct IFFPicture *picture, struct BitMap *bit
         numColors = picture->cmap->numcolors;
     }
     
+    /* Palette lookups go through an inverse colour map instead of a scan per pixel */
+    icm = NULL;
+    if (cmapData && numColors > 0) {
+        icm = AllocInverseCMap(cmapData, numColors, picture->cmap->is4Bit);
+        if (!icm) {
+            SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Cannot allocate inverse colour map");
+            return RETURN_FAIL;
+        }
+    }
+    
     /* Clear all bitplanes first */
     for (plane = 0; plane < depth; plane++) {
         if (bitmap->Planes[plane]) {
@@ -80,41 +91,8 @@ static LONG ConvertRGBToBitPlanes(struct IFFPicture *picture, struct BitMap *bit
                 b = rgbData[rgbIndex + 2];
                 
                 /* Find closest palette match if palette available */
-                if (cmapData && numColors > 0) {
-                    ULONG bestMatch;
-                    ULONG bestDist;
-                    ULONG dist;
-                    ULONG j;
-                    LONG dr, dg, db;
-                    
-                    bestMatch = 0;
-                    bestDist = 0xFFFFFFFFUL;
-                    
-                    for (j = 0; j < numColors; j++) {
-                        UBYTE pr, pg, pb;
-                        pr = cmapData[j * 3];
-                        pg = cmapData[j * 3 + 1];
-                        pb = cmapData[j * 3 + 2];
-                        
-                        /* Handle 4-bit palette scaling */
-                        if (picture->cmap->is4Bit) {
-                            pr |= (pr >> 4);
-                            pg |= (pg >> 4);
-                            pb |= (pb >> 4);
-                        }
-                        
-                        dr = (LONG)r - (LONG)pr;
-                        dg = (LONG)g - (LONG)pg;
-                        db = (LONG)b - (LONG)pb;
-                        dist = (ULONG)(dr * dr + dg * dg + db * db);
-                        
-                        if (dist < bestDist) {
-                            bestDist = dist;
-                            bestMatch = j;
-                        }
-                    }
-                    
-                    pixelIndex = (UBYTE)bestMatch;
+                if (icm) {
+                    pixelIndex = MapRGBToIndex(icm, r, g, b);
                 } else {
                     /* No palette - convert RGB to index based on depth */
                     /* Simple quantization */
@@ -148,6 +126,7 @@ static LONG ConvertRGBToBitPlanes(struct IFFPicture *picture, struct BitMap *bit
         }
     }
     
+    FreeInverseCMap(icm);
     return RETURN_OK;
 }
 
@@ -165,6 +144,7 @@ static LONG ConvertRGBToChunky(struct IFFPicture *picture, struct BitMap *bitmap
     ULONG chunkyIndex;
     UBYTE *cmapData;
     ULONG numColors;
+    struct InverseCMap *icm;
     struct Library *GraphicsBase;
     ULONG gfxVersion;
     
@@ -192,9 +172,20 @@ static LONG ConvertRGBToChunky(struct IFFPicture *picture, struct BitMap *bitmap
         numColors = picture->cmap->numcolors;
     }
     
+    /* Palette lookups go through an inverse colour map instead of a scan per pixel */
+    icm = NULL;
+    if (cmapData && numColors > 0) {
+        icm = AllocInverseCMap(cmapData, numColors, picture->cmap->is4Bit);
+        if (!icm) {
+            SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Cannot allocate inverse colour map");
+            return RETURN_FAIL;
+        }
+    }
+    
     /* Allocate chunky buffer (8-bit per pixel) */
     chunkyData = (UBYTE *)AllocMem((ULONG)width * height, MEMF_PUBLIC | MEMF_CLEAR);
     if (!chunkyData) {
+        FreeInverseCMap(icm);
         return RETURN_FAIL;
     }
     
@@ -213,41 +204,8 @@ static LONG ConvertRGBToChunky(struct IFFPicture *picture, struct BitMap *bitmap
                 b = rgbData[rgbIndex + 2];
                 
                 /* Find closest palette match if palette available */
-                if (cmapData && numColors > 0) {
-                    ULONG bestMatch;
-                    ULONG bestDist;
-                    ULONG dist;
-                    ULONG j;
-                    LONG dr, dg, db;
-                    
-                    bestMatch = 0;
-                    bestDist = 0xFFFFFFFFUL;
-                    
-                    for (j = 0; j < numColors; j++) {
-                        UBYTE pr, pg, pb;
-                        pr = cmapData[j * 3];
-                        pg = cmapData[j * 3 + 1];
-                        pb = cmapData[j * 3 + 2];
-                        
-                        /* Handle 4-bit palette scaling */
-                        if (picture->cmap->is4Bit) {
-                            pr |= (pr >> 4);
-                            pg |= (pg >> 4);
-                            pb |= (pb >> 4);
-                        }
-                        
-                        dr = (LONG)r - (LONG)pr;
-                        dg = (LONG)g - (LONG)pg;
-                        db = (LONG)b - (LONG)pb;
-                        dist = (ULONG)(dr * dr + dg * dg + db * db);
-                        
-                        if (dist < bestDist) {
-                            bestDist = dist;
-                            bestMatch = j;
-                        }
-                    }
-                    
-                    pixelIndex = (UBYTE)bestMatch;
+                if (icm) {
+                    pixelIndex = MapRGBToIndex(icm, r, g, b);
                 } else {
                     /* No palette - use RGB directly (quantize to 8-bit) */
                     pixelIndex = (UBYTE)((r >> 5) * 32 + (g >> 5) * 4 + (b >> 6));
@@ -268,6 +226,7 @@ static LONG ConvertRGBToChunky(struct IFFPicture *picture, struct BitMap *bitmap
         ConvertRGBToBitPlanes(picture, bitmap);
     }
     
+    FreeInverseCMap(icm);
     FreeMem(chunkyData, (ULONG)width * height);
     return RETURN_OK;
 }
@@ -0,0 +1,225 @@
+/*
+** color_map.c - Inverse Colour Map (Internal to Library)
+**
+** Maps RGB colours back to palette indices for the PNG encoder and the
+** bitmap renderer without scanning the whole palette for every pixel.
+** Colours that are in the palette are found through a small hash table,
+** which covers images that were decoded from that same palette. Any other
+** colour goes to a 15-bit RGB cube whose cells are filled in the first
+** time they are hit with the entry nearest to the centre of the cell, so
+** such colours may be off from the exact nearest entry by up to 4 levels
+** per gun. Runs of the same colour are caught before either lookup.
+**
+** The same hash table counts the distinct colours of RGB data for the
+** PNG palette reduction (CountRGBColors()).
+*/
+
+#include "iffpicture_private.h"
+#include <proto/exec.h>
+
+/* Hash slot for a colour key - the table is at most half full, so probing is short */
+#define ICMHash(key) (((key) ^ ((key) >> 9) ^ ((key) >> 18)) & (ICM_HASHSIZE - 1))
+
+/* Hash key of a colour - ICM_VALID keeps every key non-zero */
+#define ICMKey(r, g, b) (ICM_VALID | ((ULONG)(r) << 16) | ((ULONG)(g) << 8) | (ULONG)(b))
+
+/* 5:5:5 cube cell of a colour */
+#define ICMCell(r, g, b) ((((ULONG)(r) >> 3) << 10) | (((ULONG)(g) >> 3) << 5) | ((ULONG)(b) >> 3))
+
+/*
+** FindSlot - Find a colour key in a hash table (internal helper)
+** Returns: Slot holding key, or the empty slot where it belongs
+** hashKey has ICM_HASHSIZE entries, 0 for an empty slot, and must never
+** be full - it holds at most 256 keys
+*/
+static ULONG FindSlot(const ULONG *hashKey, ULONG key)
+{
+    ULONG slot;
+    
+    slot = ICMHash(key);
+    while (hashKey[slot] && hashKey[slot] != key) {
+        slot = (slot + 1) & (ICM_HASHSIZE - 1);
+    }
+    return slot;
+}
+
+/*
+** FindNearestColor - Scan the palette for the closest entry (internal helper)
+** Returns: Index with the smallest squared RGB distance, the lowest on a tie
+*/
+static UBYTE FindNearestColor(struct InverseCMap *icm, UBYTE r, UBYTE g, UBYTE b)
+{
+    const UBYTE *entry;
+    ULONG bestMatch;
+    ULONG bestDist;
+    ULONG dist;
+    ULONG i;
+    LONG dr, dg, db;
+    
+    bestMatch = 0;
+    bestDist = 0xFFFFFFFFUL;
+    entry = icm->palette;
+    for (i = 0; i < icm->numColors; i++, entry += 3) {
+        dr = (LONG)r - (LONG)entry[0];
+        dg = (LONG)g - (LONG)entry[1];
+        db = (LONG)b - (LONG)entry[2];
+        dist = (ULONG)(dr * dr + dg * dg + db * db);
+        if (dist < bestDist) {
+            bestDist = dist;
+            bestMatch = i;
+            if (dist == 0) {
+                break;
+            }
+        }
+    }
+    return (UBYTE)bestMatch;
+}
+
+/*
+** AllocInverseCMap - Build an inverse colour map for a palette (internal)
+** Returns: Map to pass to MapRGBToIndex(), or NULL if out of memory
+** palette holds numColors RGB triplets; with is4Bit set each gun only uses
+** the high nibble and is scaled to 8 bits first, as for CMAP data. At
+** most 256 entries are used.
+*/
+struct InverseCMap *AllocInverseCMap(const UBYTE *palette, ULONG numColors, BOOL is4Bit)
+{
+    struct InverseCMap *icm;
+    UBYTE *entry;
+    ULONG key;
+    ULONG slot;
+    ULONG i;
+    
+    if (!palette || numColors == 0) {
+        return NULL;
+    }
+    if (numColors > 256) {
+        numColors = 256;
+    }
+    
+    /* MEMF_CLEAR empties the hash table and marks every cube cell unfilled */
+    icm = (struct InverseCMap *)AllocMem(sizeof(struct InverseCMap), MEMF_PUBLIC | MEMF_CLEAR);
+    if (!icm) {
+        return NULL;
+    }
+    icm->numColors = numColors;
+    
+    entry = icm->palette;
+    for (i = 0; i < numColors; i++, entry += 3, palette += 3) {
+        entry[0] = palette[0];
+        entry[1] = palette[1];
+        entry[2] = palette[2];
+        if (is4Bit) {
+            entry[0] |= (UBYTE)(entry[0] >> 4);
+            entry[1] |= (UBYTE)(entry[1] >> 4);
+            entry[2] |= (UBYTE)(entry[2] >> 4);
+        }
+        
+        /* The first of several equal entries wins, as with a full scan */
+        key = ICMKey(entry[0], entry[1], entry[2]);
+        slot = FindSlot(icm->hashKey, key);
+        if (!icm->hashKey[slot]) {
+            icm->hashKey[slot] = key;
+            icm->hashIndex[slot] = (UBYTE)i;
+        }
+    }
+    
+    /* No key has ICM_VALID clear, so the first lookup always misses here */
+    icm->lastKey = 0;
+    return icm;
+}
+
+/*
+** MapRGBToIndex - Find the palette index for an RGB colour (internal)
+** Returns: Index of the entry equal to the colour if there is one,
+** otherwise the entry nearest to the colour's 15-bit cube cell
+*/
+UBYTE MapRGBToIndex(struct InverseCMap *icm, UBYTE r, UBYTE g, UBYTE b)
+{
+    ULONG key;
+    ULONG slot;
+    ULONG cell;
+    
+    key = ICMKey(r, g, b);
+    if (key == icm->lastKey) {
+        return icm->lastIndex;
+    }
+    icm->lastKey = key;
+    
+    /* Exact match - colours that came from this palette end here */
+    slot = FindSlot(icm->hashKey, key);
+    if (icm->hashKey[slot]) {
+        icm->lastIndex = icm->hashIndex[slot];
+        return icm->lastIndex;
+    }
+    
+    /* Nearest match for the cube cell, found on first use */
+    cell = ICMCell(r, g, b);
+    if (!(icm->cubeFilled[cell >> 5] & (1UL << (cell & 31)))) {
+        icm->cube[cell] = FindNearestColor(icm, (UBYTE)((r & 0xF8) | 4),
+                                           (UBYTE)((g & 0xF8) | 4), (UBYTE)((b & 0xF8) | 4));
+        icm->cubeFilled[cell >> 5] |= 1UL << (cell & 31);
+    }
+    icm->lastIndex = icm->cube[cell];
+    return icm->lastIndex;
+}
+
+/*
+** FreeInverseCMap - Free a map from AllocInverseCMap() (internal)
+*/
+VOID FreeInverseCMap(struct InverseCMap *icm)
+{
+    if (icm) {
+        FreeMem(icm, sizeof(struct InverseCMap));
+    }
+}
+
+/*
+** CountRGBColors - Collect the distinct colours of RGB data (internal)
+** Returns: Number of colours, ICM_MAXCOLORS + 1 as soon as there are
+** more than ICM_MAXCOLORS, or -1 if out of memory
+**
+** rgb holds pixelCount RGB triplets. The colours go to colors, which has
+** room for ICM_MAXCOLORS RGB triplets, in order of first use.
+*/
+LONG CountRGBColors(const UBYTE *rgb, ULONG pixelCount, UBYTE *colors)
+{
+    ULONG *hashKey;
+    ULONG numColors;
+    ULONG key;
+    ULONG lastKey;
+    ULONG slot;
+    ULONG i;
+    
+    /* MEMF_CLEAR empties the table */
+    hashKey = (ULONG *)AllocMem(ICM_HASHSIZE * sizeof(ULONG), MEMF_PUBLIC | MEMF_CLEAR);
+    if (!hashKey) {
+        return -1;
+    }
+    
+    numColors = 0;
+    lastKey = 0;
+    for (i = 0; i < pixelCount; i++, rgb += 3) {
+        key = ICMKey(rgb[0], rgb[1], rgb[2]);
+        if (key == lastKey) {
+            continue;
+        }
+        lastKey = key;
+        
+        slot = FindSlot(hashKey, key);
+        if (!hashKey[slot]) {
+            if (numColors == ICM_MAXCOLORS) {
+                numColors++;
+                break;
+            }
+            hashKey[slot] = key;
+            colors[numColors * 3] = rgb[0];
+            colors[numColors * 3 + 1] = rgb[1];
+            colors[numColors * 3 + 2] = rgb[2];
+            numColors++;
+        }
+    }
+    
+    FreeMem(hashKey, ICM_HASHSIZE * sizeof(ULONG));
+    return (LONG)numColors;
+}
@@ -11,8 +11,15 @@
 #include <proto/dos.h>
 #include <proto/iffparse.h>
 #include <proto/utility.h>
+#include <clib/alib_protos.h>
 
-/* Library base is defined in main.c */
+/* Puddles for IFFALLOC_POOL - larger allocations get their own memory */
+#define POOL_PUDDLESIZE     16384
+#define POOL_THRESHOLD      4096
+
+/* Library base is opened by the application (main.c) before any picture
+ * is used and only read here; iffparse.library keeps all parse state in
+ * the IFFHandle, so one base serves every task */
 extern struct Library *IFFParseBase;
 
 /* Forward declarations for internal functions */
@@ -30,7 +37,14 @@ LONG ReadDLOC(struct IFFPicture *picture);
 LONG ReadDBOD(struct IFFPicture *picture);
 LONG ReadDCHG(struct IFFPicture *picture);
 LONG ReadTVDC(struct IFFPicture *picture);
-static VOID FreeIFFPictureMeta(struct IFFPictureMeta *meta);
+static LONG MakeDEEPBMHD(struct IFFPicture *picture);
+static VOID FreeIFFPictureMeta(struct IFFPicture *picture, struct IFFPictureMeta *meta);
+static VOID FreeImageData(struct IFFPicture *picture);
+static VOID FreeSpareBuffers(struct IFFPicture *picture);
+static VOID DeclareMetaChunks(struct IFFPicture *picture, ULONG formType);
+static LONG DeclareFormChunks(struct IFFPicture *picture, ULONG formType);
+static LONG ReadFORM(struct IFFPicture *picture, ULONG formType);
+static LONG FindNextFORM(struct IFFPicture *picture);
 
 /*
 ** AllocIFFPicture - Allocate a new IFFPicture object
@@ -55,6 +69,15 @@ struct IFFPicture *AllocIFFPicture(VOID)
     picture->formtype = 0;
     picture->pixelData = NULL;
     picture->pixelDataSize = 0;
+    picture->pixelDataAlloc = 0;
+    picture->paletteIndices = NULL;
+    picture->paletteIndicesSize = 0;
+    picture->paletteIndicesAlloc = 0;
+    picture->cmapAlloc = 0;
+    picture->spareBMHD = NULL;
+    picture->spareCMap = NULL;
+    picture->spareCMapAlloc = 0;
+    picture->spareMeta = NULL;
     picture->hasAlpha = FALSE;
     picture->isHAM = FALSE;
     picture->isEHB = FALSE;
@@ -72,6 +95,18 @@ struct IFFPicture *AllocIFFPicture(VOID)
     picture->fxhd = NULL;
     picture->gphd = NULL;
     picture->ychd = NULL;
+    picture->linePalette = NULL;
+    picture->anim = NULL;
+    picture->containerType = 0;
+    picture->imageIndex = 0;
+    picture->memStream = NULL;
+    picture->prefetch = NULL;
+    picture->allocType = IFFALLOC_SYSTEM;
+    picture->allocator = NULL;
+    picture->memPool = NULL;
+    picture->arena = NULL;
+    picture->readMeta = TRUE;
+    picture->metaPending = FALSE;
     
     return picture;
 }
@@ -96,90 +131,473 @@ VOID FreeIFFPicture(struct IFFPicture *picture)
      * iffparse.library pattern. The caller must close the file handle with Close()
      * after calling CloseIFFPicture(). */
     
-    /* Free bitmap header */
-    if (picture->bmhd) {
-        FreeMem(picture->bmhd, sizeof(struct BitMapHeader));
-        picture->bmhd = NULL;
+    /* Free everything read or decoded for the current image */
+    FreeImageData(picture);
+    FreeSpareBuffers(picture);
+    ReleasePictureMem(picture);
+    
+    /* Free picture structure */
+    FreeMem(picture, sizeof(struct IFFPicture));
+}
+
+/*
+** ResetIFFPicture - Clear an IFFPicture so it can load another file
+** Follows iffparse.library pattern: the object outlives each OpenIFF/CloseIFF
+**
+** Closes the IFF stream if it is still open (the file handle stays the
+** caller's to Close()) and drops everything read from the last file,
+** leaving the object as AllocIFFPicture() returned it. The pixel and
+** palette index buffers are kept and reused when the next image fits,
+** and so are the BMHD, the CMAP with its colours and the metadata
+** structure, so converting many files with one IFFPicture settles down
+** to no allocations for any of them. Metadata strings are sized per
+** chunk and are freed. With IFFALLOC_ARENA everything is released
+** instead, buffers included.
+*/
+VOID ResetIFFPicture(struct IFFPicture *picture)
+{
+    if (!picture) {
+        return;
+    }
+    
+    if (picture->iff) {
+        CloseIFFPicture(picture);
     }
     
+    FreeImageData(picture);
+    if (picture->allocType == IFFALLOC_ARENA) {
+        FreeSpareBuffers(picture);
+        ReleasePictureMem(picture);
+    }
+    
+    picture->formtype = 0;
+    picture->containerType = 0;
+    picture->imageIndex = 0;
+    picture->isLoaded = FALSE;
+    picture->lastError = IFFPICTURE_OK;
+    picture->errorString[0] = '\0';
+}
+
+/*
+** SetIFFPictureAllocator - Select the allocator for everything the picture owns
+** Returns: RETURN_OK, or RETURN_FAIL if a stream is open, the type is
+**          unknown or the exec pool cannot be created
+*/
+LONG SetIFFPictureAllocator(struct IFFPicture *picture, ULONG type, struct IFFAllocator *custom)
+{
+    APTR pool;
+    
+    if (!picture) {
+        return RETURN_FAIL;
+    }
+    if (picture->iff) {
+        SetIFFPictureError(picture, IFFPICTURE_ERROR, "Cannot change allocator while a stream is open");
+        return RETURN_FAIL;
+    }
+    if (type > IFFALLOC_CUSTOM ||
+        (type == IFFALLOC_CUSTOM && (!custom || !custom->ia_Alloc || !custom->ia_Free))) {
+        SetIFFPictureError(picture, IFFPICTURE_INVALID, "Invalid allocator");
+        return RETURN_FAIL;
+    }
+    
+    /* Create the pool first so a failure leaves the old allocator in place */
+    pool = NULL;
+    if (type == IFFALLOC_POOL) {
+        pool = CreatePool(MEMF_PUBLIC, POOL_PUDDLESIZE, POOL_THRESHOLD);
+        if (!pool) {
+            SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to create memory pool");
+            return RETURN_FAIL;
+        }
+    }
+    
+    /* Everything held must go back to the allocator it came from */
+    FreeImageData(picture);
+    FreeSpareBuffers(picture);
+    ReleasePictureMem(picture);
+    
+    picture->allocType = type;
+    picture->allocator = (type == IFFALLOC_CUSTOM) ? custom : NULL;
+    picture->memPool = pool;
+    return RETURN_OK;
+}
+
+/*
+** FreeImageData - Free all chunk data and decoded pixels of the current image (internal helper)
+** Leaves the IFF handle, error state and CAT/LIST position alone, so the
+** next FORM of a container can be read into the same IFFPicture
+*/
+static VOID FreeImageData(struct IFFPicture *picture)
+{
+    /* Free bitmap header */
+    FreeBMHD(picture);
+    
     /* Free FAXX headers */
     if (picture->fxhd) {
-        FreeMem(picture->fxhd, sizeof(struct FaxHeader));
+        FreePictureMem(picture, picture->fxhd, sizeof(struct FaxHeader));
         picture->fxhd = NULL;
     }
     if (picture->gphd) {
-        FreeMem(picture->gphd, sizeof(struct GPHDHeader));
+        FreePictureMem(picture, picture->gphd, sizeof(struct GPHDHeader));
         picture->gphd = NULL;
     }
     
     /* Free YUVN header */
     if (picture->ychd) {
-        FreeMem(picture->ychd, sizeof(struct YCHDHeader));
+        FreePictureMem(picture, picture->ychd, sizeof(struct YCHDHeader));
         picture->ychd = NULL;
     }
     
     /* Free DEEP headers */
     if (picture->dgbl) {
-        FreeMem(picture->dgbl, sizeof(struct DGBLHeader));
+        FreePictureMem(picture, picture->dgbl, sizeof(struct DGBLHeader));
         picture->dgbl = NULL;
     }
     if (picture->dpel) {
         if (picture->dpel->typedepth) {
-            FreeMem(picture->dpel->typedepth, picture->dpel->nElements * sizeof(struct TypeDepth));
+            FreePictureMem(picture, picture->dpel->typedepth, picture->dpel->nElements * sizeof(struct TypeDepth));
         }
-        FreeMem(picture->dpel, sizeof(struct DPELHeader));
+        FreePictureMem(picture, picture->dpel, sizeof(struct DPELHeader));
         picture->dpel = NULL;
     }
     if (picture->dloc) {
-        FreeMem(picture->dloc, sizeof(struct DLOCHeader));
+        FreePictureMem(picture, picture->dloc, sizeof(struct DLOCHeader));
         picture->dloc = NULL;
     }
     if (picture->dchg) {
-        FreeMem(picture->dchg, sizeof(struct DCHGHeader));
+        FreePictureMem(picture, picture->dchg, sizeof(struct DCHGHeader));
         picture->dchg = NULL;
     }
     if (picture->tvdc) {
-        FreeMem(picture->tvdc, sizeof(struct TVDCHeader));
+        FreePictureMem(picture, picture->tvdc, sizeof(struct TVDCHeader));
         picture->tvdc = NULL;
     }
     
     /* Free color map */
-    if (picture->cmap) {
-        if (picture->cmap->data) {
-            FreeMem(picture->cmap->data, picture->cmap->numcolors * 3);
-        }
-        FreeMem(picture->cmap, sizeof(struct IFFColorMap));
-        picture->cmap = NULL;
-    }
+    FreeColorMap(picture);
     
     /* Free pixel data */
-    if (picture->pixelData) {
-        FreeMem(picture->pixelData, picture->pixelDataSize);
-        picture->pixelData = NULL;
-        picture->pixelDataSize = 0;
-    }
+    FreePixelData(picture);
     
     /* Free palette indices */
-    if (picture->paletteIndices) {
-        FreeMem(picture->paletteIndices, picture->paletteIndicesSize);
-        picture->paletteIndices = NULL;
-        picture->paletteIndicesSize = 0;
+    FreePaletteIndices(picture);
+    
+    /* Free per-scanline palette */
+    if (picture->linePalette) {
+        FreeLinePalette(picture, picture->linePalette);
+        picture->linePalette = NULL;
+    }
+    
+    /* Free ANIM playback state */
+    if (picture->anim) {
+        FreeIFFAnim(picture, picture->anim);
+        picture->anim = NULL;
     }
     
     /* Free metadata structure if allocated */
     if (picture->metadata) {
-        FreeIFFPictureMeta(picture->metadata);
+        FreeIFFPictureMeta(picture, picture->metadata);
         picture->metadata = NULL;
     }
+    picture->metaPending = FALSE;
     
-    /* Free picture structure */
-    FreeMem(picture, sizeof(struct IFFPicture));
+    /* Reset format analysis for the next image */
+    picture->viewportmodes = 0;
+    picture->hasAlpha = FALSE;
+    picture->isHAM = FALSE;
+    picture->isEHB = FALSE;
+    picture->isCompressed = FALSE;
+    picture->isIndexed = FALSE;
+    picture->isGrayscale = FALSE;
+    picture->isDecoded = FALSE;
+    picture->bodyChunkSize = 0;
+    picture->bodyChunkPosition = 0;
+    picture->dbodChunkSize = 0;
+    picture->dbodChunkPosition = 0;
+    picture->faxxCompression = 0;
+}
+
+/*
+** FreeSpareBuffers - Free the buffers and structures kept for reuse (internal helper)
+*/
+static VOID FreeSpareBuffers(struct IFFPicture *picture)
+{
+    ULONG i;
+    
+    for (i = 0; i < IMAGE_SPARES; i++) {
+        if (picture->spareBuffer[i]) {
+            FreePictureMem(picture, picture->spareBuffer[i], picture->spareSize[i]);
+            picture->spareBuffer[i] = NULL;
+            picture->spareSize[i] = 0;
+        }
+    }
+    
+    if (picture->spareBMHD) {
+        FreePictureMem(picture, picture->spareBMHD, sizeof(struct BitMapHeader));
+        picture->spareBMHD = NULL;
+    }
+    if (picture->spareCMap) {
+        if (picture->spareCMap->data) {
+            FreePictureMem(picture, picture->spareCMap->data, picture->spareCMapAlloc);
+        }
+        FreePictureMem(picture, picture->spareCMap, sizeof(struct IFFColorMap));
+        picture->spareCMap = NULL;
+        picture->spareCMapAlloc = 0;
+    }
+    if (picture->spareMeta) {
+        FreePictureMem(picture, picture->spareMeta, sizeof(struct IFFPictureMeta));
+        picture->spareMeta = NULL;
+    }
+}
+
+/*
+** TakeSpareBuffer - Get an image buffer of at least size bytes (internal helper)
+** Returns: Buffer or NULL, with the size actually allocated in *allocSize
+** The smallest spare that fits is reused, otherwise a new one is allocated;
+** the first size bytes are cleared only if flags has MEMF_CLEAR
+*/
+static UBYTE *TakeSpareBuffer(struct IFFPicture *picture, ULONG size, ULONG flags, ULONG *allocSize)
+{
+    UBYTE *buffer;
+    ULONG i;
+    LONG best;
+    
+    *allocSize = 0;
+    if (size == 0) {
+        return NULL;
+    }
+    
+    best = -1;
+    for (i = 0; i < IMAGE_SPARES; i++) {
+        if (picture->spareBuffer[i] && picture->spareSize[i] >= size &&
+            (best < 0 || picture->spareSize[i] < picture->spareSize[best])) {
+            best = (LONG)i;
+        }
+    }
+    
+    if (best >= 0) {
+        buffer = picture->spareBuffer[best];
+        *allocSize = picture->spareSize[best];
+        picture->spareBuffer[best] = NULL;
+        picture->spareSize[best] = 0;
+        if (flags & MEMF_CLEAR) {
+            ClearBuffer(buffer, size);
+        }
+        return buffer;
+    }
+    
+    buffer = (UBYTE *)AllocPictureMem(picture, size, MEMF_PUBLIC | flags);
+    if (!buffer) {
+        /* Spares too small to use are only in the way now */
+        FreeSpareBuffers(picture);
+        buffer = (UBYTE *)AllocPictureMem(picture, size, MEMF_PUBLIC | flags);
+    }
+    if (buffer) {
+        *allocSize = size;
+    }
+    return buffer;
+}
+
+/*
+** KeepSpareBuffer - Keep an image buffer for reuse (internal helper)
+** Fills an empty slot or replaces a smaller spare, otherwise frees it
+*/
+static VOID KeepSpareBuffer(struct IFFPicture *picture, UBYTE *buffer, ULONG allocSize)
+{
+    ULONG i;
+    ULONG smallest;
+    
+    smallest = 0;
+    for (i = 0; i < IMAGE_SPARES; i++) {
+        if (!picture->spareBuffer[i]) {
+            picture->spareBuffer[i] = buffer;
+            picture->spareSize[i] = allocSize;
+            return;
+        }
+        if (picture->spareSize[i] < picture->spareSize[smallest]) {
+            smallest = i;
+        }
+    }
+    
+    if (picture->spareSize[smallest] < allocSize) {
+        FreePictureMem(picture, picture->spareBuffer[smallest], picture->spareSize[smallest]);
+        picture->spareBuffer[smallest] = buffer;
+        picture->spareSize[smallest] = allocSize;
+    } else {
+        FreePictureMem(picture, buffer, allocSize);
+    }
+}
+
+/*
+** AllocBMHD - Get a cleared BitMapHeader for the current image (internal)
+** Returns: BitMapHeader or NULL if out of memory
+** Reuses the one kept by FreeBMHD() if there is one. The caller sets
+** picture->bmhd once it is filled in.
+*/
+struct BitMapHeader *AllocBMHD(struct IFFPicture *picture)
+{
+    struct BitMapHeader *bmhd;
+    
+    bmhd = picture->spareBMHD;
+    if (bmhd) {
+        picture->spareBMHD = NULL;
+        ClearBuffer((UBYTE *)bmhd, sizeof(struct BitMapHeader));
+        return bmhd;
+    }
+    
+    return (struct BitMapHeader *)AllocPictureMem(picture, sizeof(struct BitMapHeader), MEMF_PUBLIC | MEMF_CLEAR);
+}
+
+/*
+** FreeBMHD - Drop picture->bmhd, keeping it for the next AllocBMHD() (internal)
+*/
+VOID FreeBMHD(struct IFFPicture *picture)
+{
+    if (!picture->bmhd) {
+        return;
+    }
+    
+    if (picture->spareBMHD) {
+        FreePictureMem(picture, picture->bmhd, sizeof(struct BitMapHeader));
+    } else {
+        picture->spareBMHD = picture->bmhd;
+    }
+    picture->bmhd = NULL;
+}
+
+/*
+** AllocColorMap - Replace picture->cmap with one of numcolors entries (internal)
+** Returns: picture->cmap or NULL if out of memory
+**
+** The kept ColorMap and its colour buffer are reused when the buffer is
+** large enough. numcolors is set and is4Bit cleared; the colours are
+** left for the caller to fill in.
+*/
+struct IFFColorMap *AllocColorMap(struct IFFPicture *picture, ULONG numcolors)
+{
+    struct IFFColorMap *cmap;
+    ULONG size;
+    ULONG alloc;
+    
+    FreeColorMap(picture);
+    
+    size = numcolors * 3;
+    cmap = picture->spareCMap;
+    alloc = picture->spareCMapAlloc;
+    picture->spareCMap = NULL;
+    picture->spareCMapAlloc = 0;
+    
+    if (cmap && alloc < size) {
+        if (cmap->data) {
+            FreePictureMem(picture, cmap->data, alloc);
+        }
+        cmap->data = NULL;
+        alloc = 0;
+    }
+    if (!cmap) {
+        cmap = (struct IFFColorMap *)AllocPictureMem(picture, sizeof(struct IFFColorMap), MEMF_PUBLIC | MEMF_CLEAR);
+        if (!cmap) {
+            return NULL;
+        }
+    }
+    if (!cmap->data) {
+        cmap->data = (UBYTE *)AllocPictureMem(picture, size, MEMF_PUBLIC);
+        if (!cmap->data) {
+            FreePictureMem(picture, cmap, sizeof(struct IFFColorMap));
+            return NULL;
+        }
+        alloc = size;
+    }
+    
+    cmap->numcolors = numcolors;
+    cmap->is4Bit = FALSE;
+    picture->cmap = cmap;
+    picture->cmapAlloc = alloc;
+    return cmap;
+}
+
+/*
+** FreeColorMap - Drop picture->cmap, keeping it for the next AllocColorMap() (internal)
+*/
+VOID FreeColorMap(struct IFFPicture *picture)
+{
+    struct IFFColorMap *cmap;
+    
+    cmap = picture->cmap;
+    if (!cmap) {
+        return;
+    }
+    
+    if (picture->spareCMap) {
+        if (cmap->data) {
+            FreePictureMem(picture, cmap->data, picture->cmapAlloc);
+        }
+        FreePictureMem(picture, cmap, sizeof(struct IFFColorMap));
+    } else {
+        picture->spareCMap = cmap;
+        picture->spareCMapAlloc = picture->cmapAlloc;
+    }
+    picture->cmap = NULL;
+    picture->cmapAlloc = 0;
+}
+
+/*
+** AllocPixelData - Allocate the decoded pixel buffer (internal)
+** Returns: picture->pixelData or NULL if out of memory
+** Replaces any current buffer; pixelDataSize is set to size. Pass
+** MEMF_CLEAR unless the decoder writes every byte itself.
+*/
+UBYTE *AllocPixelData(struct IFFPicture *picture, ULONG size, ULONG flags)
+{
+    FreePixelData(picture);
+    picture->pixelData = TakeSpareBuffer(picture, size, flags, &picture->pixelDataAlloc);
+    picture->pixelDataSize = picture->pixelData ? size : 0;
+    return picture->pixelData;
+}
+
+/*
+** FreePixelData - Release the decoded pixel buffer for reuse (internal)
+*/
+VOID FreePixelData(struct IFFPicture *picture)
+{
+    if (picture->pixelData) {
+        KeepSpareBuffer(picture, picture->pixelData, picture->pixelDataAlloc);
+        picture->pixelData = NULL;
+        picture->pixelDataSize = 0;
+        picture->pixelDataAlloc = 0;
+    }
+}
+
+/*
+** AllocPaletteIndices - Allocate the palette index buffer (internal)
+** Returns: picture->paletteIndices or NULL if out of memory
+*/
+UBYTE *AllocPaletteIndices(struct IFFPicture *picture, ULONG size, ULONG flags)
+{
+    FreePaletteIndices(picture);
+    picture->paletteIndices = TakeSpareBuffer(picture, size, flags, &picture->paletteIndicesAlloc);
+    picture->paletteIndicesSize = picture->paletteIndices ? size : 0;
+    return picture->paletteIndices;
+}
+
+/*
+** FreePaletteIndices - Release the palette index buffer for reuse (internal)
+*/
+VOID FreePaletteIndices(struct IFFPicture *picture)
+{
+    if (picture->paletteIndices) {
+        KeepSpareBuffer(picture, picture->paletteIndices, picture->paletteIndicesAlloc);
+        picture->paletteIndices = NULL;
+        picture->paletteIndicesSize = 0;
+        picture->paletteIndicesAlloc = 0;
+    }
 }
 
 /*
 ** FreeIFFPictureMeta - Free metadata structure and all its contents (internal helper)
+** The structure itself is kept for the next AllocIFFPictureMeta() if
+** there is room; the strings and arrays it points to are always freed
 */
-static VOID FreeIFFPictureMeta(struct IFFPictureMeta *meta)
+static VOID FreeIFFPictureMeta(struct IFFPicture *picture, struct IFFPictureMeta *meta)
 {
     ULONG i;
     
@@ -189,124 +607,128 @@ static VOID FreeIFFPictureMeta(struct IFFPictureMeta *meta)
     
     /* Free standard metadata */
     if (meta->grab) {
-        FreeMem(meta->grab, sizeof(struct Point2D));
+        FreePictureMem(picture, meta->grab, sizeof(struct Point2D));
     }
     if (meta->dest) {
-        FreeMem(meta->dest, sizeof(struct DestMerge));
+        FreePictureMem(picture, meta->dest, sizeof(struct DestMerge));
     }
     if (meta->sprt) {
-        FreeMem(meta->sprt, sizeof(UWORD));
+        FreePictureMem(picture, meta->sprt, sizeof(UWORD));
     }
     if (meta->crngArray) {
-        FreeMem(meta->crngArray, meta->crngCount * sizeof(struct CRange));
+        FreePictureMem(picture, meta->crngArray, meta->crngCount * sizeof(struct CRange));
     }
     if (meta->copyright) {
-        FreeMem(meta->copyright, meta->copyrightSize);
+        FreePictureMem(picture, meta->copyright, meta->copyrightSize);
     }
     if (meta->author) {
-        FreeMem(meta->author, meta->authorSize);
+        FreePictureMem(picture, meta->author, meta->authorSize);
     }
     if (meta->annotationArray) {
         for (i = 0; i < meta->annotationCount; i++) {
             if (meta->annotationArray[i] && meta->annotationSizes) {
-                FreeMem(meta->annotationArray[i], meta->annotationSizes[i]);
+                FreePictureMem(picture, meta->annotationArray[i], meta->annotationSizes[i]);
             }
         }
-        FreeMem(meta->annotationArray, meta->annotationCount * sizeof(STRPTR));
+        FreePictureMem(picture, meta->annotationArray, meta->annotationCount * sizeof(STRPTR));
     }
     if (meta->annotationSizes) {
-        FreeMem(meta->annotationSizes, meta->annotationCount * sizeof(ULONG));
+        FreePictureMem(picture, meta->annotationSizes, meta->annotationCount * sizeof(ULONG));
     }
     if (meta->textArray) {
         for (i = 0; i < meta->textCount; i++) {
             if (meta->textArray[i] && meta->textSizes) {
-                FreeMem(meta->textArray[i], meta->textSizes[i]);
+                FreePictureMem(picture, meta->textArray[i], meta->textSizes[i]);
             }
         }
-        FreeMem(meta->textArray, meta->textCount * sizeof(STRPTR));
+        FreePictureMem(picture, meta->textArray, meta->textCount * sizeof(STRPTR));
     }
     if (meta->textSizes) {
-        FreeMem(meta->textSizes, meta->textCount * sizeof(ULONG));
+        FreePictureMem(picture, meta->textSizes, meta->textCount * sizeof(ULONG));
     }
     if (meta->fver) {
-        FreeMem(meta->fver, meta->fverSize);
+        FreePictureMem(picture, meta->fver, meta->fverSize);
     }
     /* Free extended metadata */
     if (meta->exifArray) {
         for (i = 0; i < meta->exifCount; i++) {
             if (meta->exifArray[i] && meta->exifSizes) {
-                FreeMem(meta->exifArray[i], meta->exifSizes[i]);
+                FreePictureMem(picture, meta->exifArray[i], meta->exifSizes[i]);
             }
         }
-        FreeMem(meta->exifArray, meta->exifCount * sizeof(UBYTE *));
+        FreePictureMem(picture, meta->exifArray, meta->exifCount * sizeof(UBYTE *));
     }
     if (meta->exifSizes) {
-        FreeMem(meta->exifSizes, meta->exifCount * sizeof(ULONG));
+        FreePictureMem(picture, meta->exifSizes, meta->exifCount * sizeof(ULONG));
     }
     if (meta->iptcArray) {
         for (i = 0; i < meta->iptcCount; i++) {
             if (meta->iptcArray[i] && meta->iptcSizes) {
-                FreeMem(meta->iptcArray[i], meta->iptcSizes[i]);
+                FreePictureMem(picture, meta->iptcArray[i], meta->iptcSizes[i]);
             }
         }
-        FreeMem(meta->iptcArray, meta->iptcCount * sizeof(UBYTE *));
+        FreePictureMem(picture, meta->iptcArray, meta->iptcCount * sizeof(UBYTE *));
     }
     if (meta->iptcSizes) {
-        FreeMem(meta->iptcSizes, meta->iptcCount * sizeof(ULONG));
+        FreePictureMem(picture, meta->iptcSizes, meta->iptcCount * sizeof(ULONG));
     }
     if (meta->xmp0Array) {
         for (i = 0; i < meta->xmp0Count; i++) {
             if (meta->xmp0Array[i] && meta->xmp0Sizes) {
-                FreeMem(meta->xmp0Array[i], meta->xmp0Sizes[i]);
+                FreePictureMem(picture, meta->xmp0Array[i], meta->xmp0Sizes[i]);
             }
         }
-        FreeMem(meta->xmp0Array, meta->xmp0Count * sizeof(UBYTE *));
+        FreePictureMem(picture, meta->xmp0Array, meta->xmp0Count * sizeof(UBYTE *));
     }
     if (meta->xmp0Sizes) {
-        FreeMem(meta->xmp0Sizes, meta->xmp0Count * sizeof(ULONG));
+        FreePictureMem(picture, meta->xmp0Sizes, meta->xmp0Count * sizeof(ULONG));
     }
     if (meta->xmp1) {
-        FreeMem(meta->xmp1, meta->xmp1Size);
+        FreePictureMem(picture, meta->xmp1, meta->xmp1Size);
     }
     if (meta->iccpArray) {
         for (i = 0; i < meta->iccpCount; i++) {
             if (meta->iccpArray[i] && meta->iccpSizes) {
-                FreeMem(meta->iccpArray[i], meta->iccpSizes[i]);
+                FreePictureMem(picture, meta->iccpArray[i], meta->iccpSizes[i]);
             }
         }
-        FreeMem(meta->iccpArray, meta->iccpCount * sizeof(UBYTE *));
+        FreePictureMem(picture, meta->iccpArray, meta->iccpCount * sizeof(UBYTE *));
     }
     if (meta->iccpSizes) {
-        FreeMem(meta->iccpSizes, meta->iccpCount * sizeof(ULONG));
+        FreePictureMem(picture, meta->iccpSizes, meta->iccpCount * sizeof(ULONG));
     }
     if (meta->iccnArray) {
         for (i = 0; i < meta->iccnCount; i++) {
             if (meta->iccnArray[i] && meta->iccnSizes) {
-                FreeMem(meta->iccnArray[i], meta->iccnSizes[i]);
+                FreePictureMem(picture, meta->iccnArray[i], meta->iccnSizes[i]);
             }
         }
-        FreeMem(meta->iccnArray, meta->iccnCount * sizeof(STRPTR));
+        FreePictureMem(picture, meta->iccnArray, meta->iccnCount * sizeof(STRPTR));
     }
     if (meta->iccnSizes) {
-        FreeMem(meta->iccnSizes, meta->iccnCount * sizeof(ULONG));
+        FreePictureMem(picture, meta->iccnSizes, meta->iccnCount * sizeof(ULONG));
     }
     if (meta->geotArray) {
         for (i = 0; i < meta->geotCount; i++) {
             if (meta->geotArray[i] && meta->geotSizes) {
-                FreeMem(meta->geotArray[i], meta->geotSizes[i]);
+                FreePictureMem(picture, meta->geotArray[i], meta->geotSizes[i]);
             }
         }
-        FreeMem(meta->geotArray, meta->geotCount * sizeof(UBYTE *));
+        FreePictureMem(picture, meta->geotArray, meta->geotCount * sizeof(UBYTE *));
     }
     if (meta->geotSizes) {
-        FreeMem(meta->geotSizes, meta->geotCount * sizeof(ULONG));
+        FreePictureMem(picture, meta->geotSizes, meta->geotCount * sizeof(ULONG));
     }
     if (meta->geofArray) {
-        FreeMem(meta->geofArray, meta->geofCount * sizeof(ULONG));
+        FreePictureMem(picture, meta->geofArray, meta->geofCount * sizeof(ULONG));
     }
     
-    /* Free the metadata structure itself */
-    FreeMem(meta, sizeof(struct IFFPictureMeta));
+    /* Keep the metadata structure itself, or free it */
+    if (picture->spareMeta) {
+        FreePictureMem(picture, meta, sizeof(struct IFFPictureMeta));
+    } else {
+        picture->spareMeta = meta;
+    }
 }
 
 /*
@@ -364,13 +786,410 @@ VOID InitIFFPictureasDOS(struct IFFPicture *picture)
     InitIFFasDOS(iff);
 }
 
+/*
+** MemStreamHook - Custom stream hook reading from a memory buffer (internal helper)
+** Returns: 0 on success, or an IFFERR_* code
+** Called through HookEntry by iffparse.library for each stream command
+*/
+static ULONG MemStreamHook(struct Hook *hook, struct IFFHandle *iff, struct IFFStreamCmd *cmd)
+{
+    struct IFFMemStream *ms;
+    LONG n;
+    
+    ms = (struct IFFMemStream *)hook->h_Data;
+    n = cmd->sc_NBytes;
+    
+    switch (cmd->sc_Command) {
+        case IFFCMD_READ:
+            if (n < 0 || (ULONG)n > ms->length - ms->position) {
+                return (ULONG)IFFERR_READ;
+            }
+            CopyMem((APTR)(ms->buffer + ms->position), cmd->sc_Buf, n);
+            ms->position += n;
+            return 0;
+        case IFFCMD_SEEK:
+            /* Seeks are relative to the current position */
+            if ((n < 0 && (ULONG)-n > ms->position) ||
+                (n > 0 && (ULONG)n > ms->length - ms->position)) {
+                return (ULONG)IFFERR_SEEK;
+            }
+            ms->position += n;
+            return 0;
+        case IFFCMD_INIT:
+        case IFFCMD_CLEANUP:
+            return 0;
+        default:
+            return (ULONG)IFFERR_WRITE; /* Memory streams are read-only */
+    }
+}
+
+/*
+** InitIFFPictureasMemory - Initialize IFFPicture to read from a memory buffer
+** Follows iffparse.library pattern: InitIFF with a custom stream hook
+**
+** The buffer holds a complete IFF file and is read in place; it must stay
+** valid until CloseIFFPicture(). Unlike InitIFFPictureasDOS() there is no
+** iff_Stream to set, so OpenIFFPicture() can be called straight away.
+**
+** Example usage:
+**   picture = AllocIFFPicture();
+**   InitIFFPictureasMemory(picture, buffer, length);
+**   OpenIFFPicture(picture, IFFF_READ);
+*/
+VOID InitIFFPictureasMemory(struct IFFPicture *picture, const UBYTE *buffer, ULONG length)
+{
+    struct IFFHandle *iff;
+    struct IFFMemStream *ms;
+    
+    if (!picture) {
+        return;
+    }
+    
+    if (!buffer || length < 12) {
+        SetIFFPictureError(picture, IFFPICTURE_INVALID, "Memory buffer too small for an IFF file");
+        return;
+    }
+    
+    /* Allocate IFF handle */
+    iff = AllocIFF();
+    if (!iff) {
+        SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Cannot allocate IFF handle");
+        return;
+    }
+    
+    ms = (struct IFFMemStream *)AllocPictureMem(picture, sizeof(struct IFFMemStream), MEMF_PUBLIC | MEMF_CLEAR);
+    if (!ms) {
+        FreeIFF(iff);
+        SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Cannot allocate memory stream");
+        return;
+    }
+    
+    ms->buffer = buffer;
+    ms->length = length;
+    ms->position = 0;
+    ms->hook.h_Entry = (HOOKFUNC)HookEntry;
+    ms->hook.h_SubEntry = (HOOKFUNC)MemStreamHook;
+    ms->hook.h_Data = (APTR)ms;
+    
+    picture->iff = iff;
+    picture->memStream = ms;
+    
+    /* The stream is the buffer, so iff_Stream is set here rather than by the caller */
+    iff->iff_Stream = (ULONG)ms;
+    InitIFF(iff, IFFF_FSEEK | IFFF_RSEEK, &ms->hook);
+}
+
+/*
+** InitIFFPictureasBuffered - Initialize IFFPicture from a file read into memory
+** Returns: RETURN_OK when buffered, RETURN_WARN to fall back, RETURN_FAIL on error
+**
+** Reads the whole file with a single Read() into a buffer owned by the
+** picture and sets it up as a memory stream, so the plane-per-chunk
+** formats can be used in place (see MapChunkData()) instead of being
+** copied chunk by chunk. Files larger than maxSize, or whose size cannot be found, are
+** left alone with the file position rewound: RETURN_WARN means carry on
+** with InitIFFPictureasDOS(). The file handle is not needed afterwards.
+**
+** Example usage:
+**   if (InitIFFPictureasBuffered(picture, filehandle, maxSize) == RETURN_WARN) {
+**       InitIFFPictureasDOS(picture);
+**       picture->iff->iff_Stream = (ULONG)filehandle;
+**   }
+**   OpenIFFPicture(picture, IFFF_READ);
+*/
+LONG InitIFFPictureasBuffered(struct IFFPicture *picture, BPTR filehandle, ULONG maxSize)
+{
+    LONG start;
+    LONG size;
+    UBYTE *buffer;
+    
+    if (!picture || !filehandle) {
+        return RETURN_FAIL;
+    }
+    
+    /* Find the file size: Seek() returns the previous position */
+    start = Seek(filehandle, 0, OFFSET_END);
+    if (start < 0) {
+        return RETURN_WARN; /* Not seekable (pipe or console) */
+    }
+    size = Seek(filehandle, start, OFFSET_BEGINNING);
+    if (size < 0) {
+        SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Cannot seek in file");
+        return RETURN_FAIL;
+    }
+    size -= start;
+    if (size < 12 || (ULONG)size > maxSize) {
+        return RETURN_WARN;
+    }
+    
+    buffer = (UBYTE *)AllocPictureMem(picture, (ULONG)size, MEMF_PUBLIC);
+    if (!buffer) {
+        return RETURN_WARN; /* Not worth failing over - stream it instead */
+    }
+    
+    if (Read(filehandle, buffer, size) != size) {
+        FreePictureMem(picture, buffer, (ULONG)size);
+        SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Failed to read file");
+        return RETURN_FAIL;
+    }
+    
+    InitIFFPictureasMemory(picture, buffer, (ULONG)size);
+    if (!picture->memStream) {
+        FreePictureMem(picture, buffer, (ULONG)size);
+        return RETURN_FAIL;
+    }
+    
+    picture->memStream->ownBuffer = buffer;
+    picture->memStream->ownSize = (ULONG)size;
+    return RETURN_OK;
+}
+
+/*
+** MapChunkData - Get the unread bytes of the current chunk in place
+** Returns: Pointer into the stream buffer, or NULL
+**
+** Only memory streams can do this; for DOS streams, or when fewer than
+** size bytes are left in the chunk, NULL is returned and the caller reads
+** with ReadChunkBytes() as usual. The stream position is not moved, so
+** the next ParseIFF() skips the chunk exactly as if it had been read.
+** The data stays valid until CloseIFFPicture().
+**
+** Only the ACBM and YUVN decoders use this. ILBM BODY, DEEP DBOD and
+** FAXX PAGE are decoded row by row straight from ReadChunkBytes(),
+** where ByteRun1, raw rows and the DEEP/FAXX codecs share one reader,
+** so those still copy out of a memory stream.
+*/
+const UBYTE *MapChunkData(struct IFFPicture *picture, ULONG size)
+{
+    struct IFFMemStream *ms;
+    struct ContextNode *cn;
+    
+    if (!picture || !picture->memStream || !picture->iff) {
+        return NULL;
+    }
+    
+    ms = picture->memStream;
+    cn = CurrentChunk(picture->iff);
+    if (!cn || cn->cn_Scan > cn->cn_Size || size > (ULONG)(cn->cn_Size - cn->cn_Scan)) {
+        return NULL;
+    }
+    if (size > ms->length - ms->position) {
+        return NULL;
+    }
+    
+    return ms->buffer + ms->position;
+}
+
+/* Read a big-endian longword - the buffer need not be word aligned */
+#define GetBE32(p) (((ULONG)(p)[0] << 24) | ((ULONG)(p)[1] << 16) | \
+                    ((ULONG)(p)[2] << 8) | (ULONG)(p)[3])
+
+/* Group chunks carry a type and contain other chunks */
+#define IsGroupID(id) ((id) == ID_FORM || (id) == ID_CAT || \
+                       (id) == ID_LIST || (id) == ID_PROP)
+
+#define TOC_MAXDEPTH        8   /* Nesting of FORM/CAT/LIST/PROP groups */
+
+/* TOCWalk - position of the chunk index scan in a memory stream */
+struct TOCWalk {
+    const UBYTE *buffer;
+    ULONG length;
+    ULONG position;                     /* Offset of the next chunk header */
+    ULONG groupType[TOC_MAXDEPTH];      /* Type of each enclosing group */
+    ULONG groupEnd[TOC_MAXDEPTH];       /* Offset just past it (padded) */
+    UWORD depth;
+};
+
+/*
+** NextTOCEntry - Step to the next chunk, entering groups, like IFFPARSE_STEP
+** Returns: RETURN_OK with *entry filled in, RETURN_WARN at the end of the
+**          file, RETURN_FAIL if the file is truncated or malformed
+**
+** A group chunk (FORM, CAT, LIST or PROP) comes first with its own type
+** and the chunks inside it follow. Odd-length chunks are padded.
+*/
+static LONG NextTOCEntry(struct TOCWalk *walk, struct ChunkTOCEntry *entry)
+{
+    const UBYTE *header;
+    ULONG limit;
+    ULONG size;
+    ULONG padded;
+    
+    /* Leave every group whose end has been reached */
+    while (walk->depth > 0 && walk->position >= walk->groupEnd[walk->depth - 1]) {
+        walk->position = walk->groupEnd[walk->depth - 1];
+        walk->depth--;
+    }
+    
+    limit = (walk->depth > 0) ? walk->groupEnd[walk->depth - 1] : walk->length;
+    if (walk->position >= limit) {
+        return RETURN_WARN;
+    }
+    if (limit - walk->position < 8) {
+        return RETURN_FAIL;
+    }
+    
+    header = walk->buffer + walk->position;
+    size = GetBE32(header + 4);
+    if (size > limit - walk->position - 8) {
+        return RETURN_FAIL;
+    }
+    
+    /* Tolerate a missing pad byte after the last chunk of the file */
+    padded = size + (size & 1);
+    if (padded > limit - walk->position - 8) {
+        padded = size;
+    }
+    
+    entry->id = GetBE32(header);
+    entry->offset = walk->position;
+    entry->depth = walk->depth;
+    
+    if (IsGroupID(entry->id)) {
+        if (size < 4 || walk->depth >= TOC_MAXDEPTH) {
+            return RETURN_FAIL;
+        }
+        entry->type = GetBE32(header + 8);
+        entry->size = size - 4;
+        walk->groupType[walk->depth] = entry->type;
+        walk->groupEnd[walk->depth] = walk->position + 8 + padded;
+        walk->depth++;
+        walk->position += 12;
+    } else {
+        entry->type = (walk->depth > 0) ? walk->groupType[walk->depth - 1] : 0;
+        entry->size = size;
+        walk->position += 8 + padded;
+    }
+    
+    return RETURN_OK;
+}
+
+/*
+** BuildChunkTOC - Index every chunk of a memory stream in one scan
+** Returns: RETURN_OK when the index is available, RETURN_FAIL otherwise
+**
+** Walks the buffer directly, without iffparse.library, and records ID,
+** offset, size and nesting of each chunk, groups included. The index
+** lives with the stream and is built once; later calls return straight
+** away. A truncated file keeps the entries found before the damage.
+*/
+LONG BuildChunkTOC(struct IFFPicture *picture)
+{
+    struct IFFMemStream *ms;
+    struct TOCWalk walk;
+    struct ChunkTOCEntry ref;
+    struct ChunkTOCEntry *grown;
+    ULONG newMax;
+    
+    if (!picture || !picture->memStream) {
+        return RETURN_FAIL;
+    }
+    
+    ms = picture->memStream;
+    if (ms->toc) {
+        return RETURN_OK;
+    }
+    if (!ms->buffer) {
+        return RETURN_FAIL;
+    }
+    
+    walk.buffer = ms->buffer;
+    walk.length = ms->length;
+    walk.position = 0;
+    walk.depth = 0;
+    
+    while (NextTOCEntry(&walk, &ref) == RETURN_OK) {
+        /* Grow the index by doubling */
+        if (ms->tocCount == ms->tocMax) {
+            newMax = ms->tocMax ? ms->tocMax * 2 : 32;
+            grown = (struct ChunkTOCEntry *)AllocPictureMem(picture, newMax * sizeof(struct ChunkTOCEntry), MEMF_PUBLIC);
+            if (!grown) {
+                break;
+            }
+            if (ms->toc) {
+                CopyMem(ms->toc, grown, ms->tocCount * sizeof(struct ChunkTOCEntry));
+                FreePictureMem(picture, ms->toc, ms->tocMax * sizeof(struct ChunkTOCEntry));
+            }
+            ms->toc = grown;
+            ms->tocMax = newMax;
+        }
+        
+        ms->toc[ms->tocCount++] = ref;
+    }
+    
+    return ms->toc ? RETURN_OK : RETURN_FAIL;
+}
+
+/*
+** FindFORMChunk - Find a chunk of the current FORM through the chunk index
+** Returns: Pointer to the chunk contents in the buffer, or NULL
+**
+** Looks among the chunks of the FORM that holds the current chunk, before
+** or after it, so decoders can take chunks in any order without stepping
+** iffparse through them. NULL is returned for DOS streams, when the FORM
+** has no such chunk, or when it is shorter than size bytes. The iffparse
+** position is not moved.
+*/
+const UBYTE *FindFORMChunk(struct IFFPicture *picture, ULONG id, ULONG size)
+{
+    struct IFFMemStream *ms;
+    struct ContextNode *cn;
+    struct ChunkTOCEntry *entry;
+    ULONG offset;
+    ULONG i;
+    ULONG form;
+    UWORD depth;
+    
+    if (!picture || !picture->memStream || !picture->iff) {
+        return NULL;
+    }
+    if (BuildChunkTOC(picture) != RETURN_OK) {
+        return NULL;
+    }
+    
+    ms = picture->memStream;
+    cn = CurrentChunk(picture->iff);
+    if (!cn || ms->position < (ULONG)cn->cn_Scan + 8) {
+        return NULL;
+    }
+    
+    /* The current chunk's header sits just before what has been read of it */
+    offset = ms->position - cn->cn_Scan - 8;
+    for (i = 0; i < ms->tocCount; i++) {
+        if (ms->toc[i].offset == offset && ms->toc[i].id == cn->cn_ID) {
+            break;
+        }
+    }
+    if (i == ms->tocCount || ms->toc[i].depth == 0) {
+        return NULL;
+    }
+    
+    /* Back up to the enclosing FORM, then search its direct children */
+    depth = ms->toc[i].depth;
+    form = i;
+    while (form > 0 && ms->toc[form].depth >= depth) {
+        form--;
+    }
+    for (i = form + 1; i < ms->tocCount && ms->toc[i].depth >= depth; i++) {
+        entry = &ms->toc[i];
+        if (entry->depth == depth && entry->id == id) {
+            if (entry->size < size) {
+                return NULL;
+            }
+            return ms->buffer + entry->offset + 8;
+        }
+    }
+    return NULL;
+}
+
 /*
 ** OpenIFFPicture - Prepare IFFPicture to read or write a new IFF stream
 ** Returns: RETURN_OK on success, RETURN_FAIL on error
 ** Follows iffparse.library pattern: OpenIFF
 ** 
 ** The IFFPicture must have been initialized with InitIFFPictureasDOS()
-** and iff_Stream must be set to a valid BPTR file handle.
+** and iff_Stream must be set to a valid BPTR file handle, or initialized
+** with InitIFFPictureasMemory().
 ** 
 ** rwMode: IFFF_READ or IFFF_WRITE
 */
@@ -417,20 +1236,43 @@ VOID CloseIFFPicture(struct IFFPicture *picture)
     
     /* Close IFF handle if open */
     if (picture->iff) {
+        /* Stored metadata chunks go with the handle - copy them out first */
+        LoadMeta(picture);
         CloseIFF(picture->iff);
         FreeIFF(picture->iff);
         picture->iff = NULL;
     }
+    
+    /* Free memory stream state - the buffer belongs to the caller unless buffered */
+    if (picture->memStream) {
+        if (picture->memStream->ownBuffer) {
+            FreePictureMem(picture, picture->memStream->ownBuffer, picture->memStream->ownSize);
+        }
+        if (picture->memStream->toc) {
+            FreePictureMem(picture, picture->memStream->toc, picture->memStream->tocMax * sizeof(struct ChunkTOCEntry));
+        }
+        FreePictureMem(picture, picture->memStream, sizeof(struct IFFMemStream));
+        picture->memStream = NULL;
+    }
+    
+    /* Collect outstanding read-ahead packets before the caller closes the file */
+    if (picture->prefetch) {
+        FreePrefetch(picture);
+    }
 }
 
 /*
 ** ParseIFFPicture - Parse IFF structure and read chunks
 ** Returns: RETURN_OK on success, RETURN_FAIL on error
 ** Follows iffparse.library pattern: ParseIFF
+**
+** A CAT or LIST is accepted as well; the first supported FORM in it is
+** read and NextIFFPicture() moves on to the following ones.
 */
 LONG ParseIFFPicture(struct IFFPicture *picture)
 {
     LONG error;
+    LONG result;
     struct ContextNode *cn;
     ULONG formType;
     
@@ -449,16 +1291,87 @@ LONG ParseIFFPicture(struct IFFPicture *picture)
     }
     
     cn = CurrentChunk(picture->iff);
-    if (!cn || cn->cn_ID != ID_FORM) {
+    if (cn && (cn->cn_ID == ID_CAT || cn->cn_ID == ID_LIST)) {
+        /* Container - read its first picture FORM, NextIFFPicture() reads the rest */
+        picture->containerType = cn->cn_ID;
+        picture->imageIndex = 0;
+        result = FindNextFORM(picture);
+        if (result != RETURN_OK) {
+            if (result == RETURN_WARN) {
+                SetIFFPictureError(picture, IFFPICTURE_UNSUPPORTED, "No supported FORM in CAT or LIST");
+            }
+            return RETURN_FAIL;
+        }
+        cn = CurrentChunk(picture->iff);
+    } else if (!cn || cn->cn_ID != ID_FORM) {
         SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Not a valid IFF FORM file");
         return RETURN_FAIL;
     }
     
     formType = cn->cn_Type;
-    picture->formtype = formType;
     
     DEBUG_PRINTF1("DEBUG: ParseIFFPicture - FORM type = 0x%08lx\n", formType);
     
+    /* A FORM ANIM is a sequence of FORM ILBM frames - parse the first one as ILBM */
+    if (formType == ID_ANIM) {
+        picture->anim = AllocIFFAnim(picture);
+        if (!picture->anim) {
+            SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate ANIM state");
+            return RETURN_FAIL;
+        }
+        formType = ID_ILBM;
+    }
+    
+    return ReadFORM(picture, formType);
+}
+
+/*
+** DeclareMetaChunks - Declare the metadata chunks of one FORM type (internal helper)
+** Nothing is declared when metadata is turned off, so iffparse.library
+** skips those chunks without reading them
+*/
+static VOID DeclareMetaChunks(struct IFFPicture *picture, ULONG formType)
+{
+    if (!picture->readMeta) {
+        return;
+    }
+    
+    if (formType == ID_ILBM || formType == ID_PBM) {
+        /* Single instance */
+        PropChunk(picture->iff, formType, ID_GRAB);
+        PropChunk(picture->iff, formType, ID_DEST);
+        PropChunk(picture->iff, formType, ID_SPRT);
+        PropChunk(picture->iff, formType, ID_COPYRIGHT);
+        PropChunk(picture->iff, formType, ID_AUTH);
+        PropChunk(picture->iff, formType, ID_FVER);
+        /* Can appear multiple times - use CollectionChunk */
+        CollectionChunk(picture->iff, formType, ID_CRNG);
+        CollectionChunk(picture->iff, formType, ID_ANNO);
+        CollectionChunk(picture->iff, formType, ID_TEXT);
+    }
+    
+    /* Extended metadata chunks - can appear in any FORM type */
+    CollectionChunk(picture->iff, formType, ID_EXIF);
+    CollectionChunk(picture->iff, formType, ID_IPTC);
+    CollectionChunk(picture->iff, formType, ID_XMP0);
+    PropChunk(picture->iff, formType, ID_XMP1);  /* XMP1 may occur only once */
+    CollectionChunk(picture->iff, formType, ID_ICCP);
+    CollectionChunk(picture->iff, formType, ID_ICCN);
+    CollectionChunk(picture->iff, formType, ID_GEOT);
+    CollectionChunk(picture->iff, formType, ID_GEOF);
+}
+
+/*
+** DeclareFormChunks - Declare property and stop chunks for one FORM type (internal helper)
+** Returns: RETURN_OK on success, RETURN_FAIL on error
+**
+** Also used for PROP chunks in a LIST, so shared BMHD, CMAP etc. are
+** stored where FindProp() sees them from the FORMs that follow.
+*/
+static LONG DeclareFormChunks(struct IFFPicture *picture, ULONG formType)
+{
+    LONG error;
+    
     /* Set up property chunks based on form type */
     if (formType == ID_FAXX) {
         /* FAXX uses FXHD (required) and PAGE (required) chunks */
@@ -480,30 +1393,24 @@ LONG ParseIFFPicture(struct IFFPicture *picture)
         }
         PropChunk(picture->iff, formType, ID_CMAP);
         PropChunk(picture->iff, formType, ID_CAMG);
-        /* Metadata chunks (optional) - single instance */
-        PropChunk(picture->iff, formType, ID_GRAB);
-        PropChunk(picture->iff, formType, ID_DEST);
-        PropChunk(picture->iff, formType, ID_SPRT);
-        PropChunk(picture->iff, formType, ID_COPYRIGHT);
-        PropChunk(picture->iff, formType, ID_AUTH);
-        /* Metadata chunks that can appear multiple times - use CollectionChunk */
-        CollectionChunk(picture->iff, formType, ID_CRNG);
-        CollectionChunk(picture->iff, formType, ID_ANNO);
-        CollectionChunk(picture->iff, formType, ID_TEXT);
-        PropChunk(picture->iff, formType, ID_FVER);
-        /* Extended metadata chunks - can appear in any FORM type */
-        CollectionChunk(picture->iff, formType, ID_EXIF);
-        CollectionChunk(picture->iff, formType, ID_IPTC);
-        CollectionChunk(picture->iff, formType, ID_XMP0);
-        PropChunk(picture->iff, formType, ID_XMP1);  /* XMP1 may occur only once */
-        CollectionChunk(picture->iff, formType, ID_ICCP);
-        CollectionChunk(picture->iff, formType, ID_ICCN);
-        CollectionChunk(picture->iff, formType, ID_GEOT);
-        CollectionChunk(picture->iff, formType, ID_GEOF);
+        /* Per-scanline palette chunks (optional) */
+        PropChunk(picture->iff, formType, ID_PCHG);
+        PropChunk(picture->iff, formType, ID_SHAM);
+        PropChunk(picture->iff, formType, ID_CTBL);
+        /* Metadata chunks (optional) */
+        DeclareMetaChunks(picture, formType);
         if ((error = StopChunk(picture->iff, formType, ID_BODY)) != 0) {
             SetIFFPictureError(picture, IFFPICTURE_ERROR, "Failed to set StopChunk for BODY");
             return RETURN_FAIL;
         }
+        /* ANIM frames after the first carry ANHD and DLTA instead of BODY */
+        if (picture->anim) {
+            PropChunk(picture->iff, formType, ID_ANHD);
+            if ((error = StopChunk(picture->iff, formType, ID_DLTA)) != 0) {
+                SetIFFPictureError(picture, IFFPICTURE_ERROR, "Failed to set StopChunk for DLTA");
+                return RETURN_FAIL;
+            }
+        }
     } else if (formType == ID_ACBM) {
         /* ACBM uses ABIT chunk instead of BODY */
         if ((error = PropChunk(picture->iff, formType, ID_BMHD)) != 0) {
@@ -512,15 +1419,8 @@ LONG ParseIFFPicture(struct IFFPicture *picture)
         }
         PropChunk(picture->iff, formType, ID_CMAP);
         PropChunk(picture->iff, formType, ID_CAMG);
-        /* Extended metadata chunks - can appear in any FORM type */
-        CollectionChunk(picture->iff, formType, ID_EXIF);
-        CollectionChunk(picture->iff, formType, ID_IPTC);
-        CollectionChunk(picture->iff, formType, ID_XMP0);
-        PropChunk(picture->iff, formType, ID_XMP1);  /* XMP1 may occur only once */
-        CollectionChunk(picture->iff, formType, ID_ICCP);
-        CollectionChunk(picture->iff, formType, ID_ICCN);
-        CollectionChunk(picture->iff, formType, ID_GEOT);
-        CollectionChunk(picture->iff, formType, ID_GEOF);
+        /* Metadata chunks (optional) */
+        DeclareMetaChunks(picture, formType);
         if ((error = StopChunk(picture->iff, formType, ID_ABIT)) != 0) {
             SetIFFPictureError(picture, IFFPICTURE_ERROR, "Failed to set StopChunk for ABIT");
             return RETURN_FAIL;
@@ -532,15 +1432,8 @@ LONG ParseIFFPicture(struct IFFPicture *picture)
             return RETURN_FAIL;
         }
         PropChunk(picture->iff, formType, ID_CMAP); /* Optional */
-        /* Extended metadata chunks - can appear in any FORM type */
-        CollectionChunk(picture->iff, formType, ID_EXIF);
-        CollectionChunk(picture->iff, formType, ID_IPTC);
-        CollectionChunk(picture->iff, formType, ID_XMP0);
-        PropChunk(picture->iff, formType, ID_XMP1);  /* XMP1 may occur only once */
-        CollectionChunk(picture->iff, formType, ID_ICCP);
-        CollectionChunk(picture->iff, formType, ID_ICCN);
-        CollectionChunk(picture->iff, formType, ID_GEOT);
-        CollectionChunk(picture->iff, formType, ID_GEOF);
+        /* Metadata chunks (optional) */
+        DeclareMetaChunks(picture, formType);
         if ((error = StopChunk(picture->iff, formType, ID_BODY)) != 0) {
             SetIFFPictureError(picture, IFFPICTURE_ERROR, "Failed to set StopChunk for BODY");
             return RETURN_FAIL;
@@ -558,19 +1451,17 @@ LONG ParseIFFPicture(struct IFFPicture *picture)
         PropChunk(picture->iff, formType, ID_DLOC);  /* Optional */
         PropChunk(picture->iff, formType, ID_DCHG);  /* Optional (animation) */
         PropChunk(picture->iff, formType, ID_TVDC);  /* Optional (TVPaint compression) */
-        /* Extended metadata chunks - can appear in any FORM type */
-        CollectionChunk(picture->iff, formType, ID_EXIF);
-        CollectionChunk(picture->iff, formType, ID_IPTC);
-        CollectionChunk(picture->iff, formType, ID_XMP0);
-        PropChunk(picture->iff, formType, ID_XMP1);  /* XMP1 may occur only once */
-        CollectionChunk(picture->iff, formType, ID_ICCP);
-        CollectionChunk(picture->iff, formType, ID_ICCN);
-        CollectionChunk(picture->iff, formType, ID_GEOT);
-        CollectionChunk(picture->iff, formType, ID_GEOF);
+        /* Metadata chunks (optional) */
+        DeclareMetaChunks(picture, formType);
         if ((error = StopChunk(picture->iff, formType, ID_DBOD)) != 0) {
             SetIFFPictureError(picture, IFFPICTURE_ERROR, "Failed to set StopChunk for DBOD");
             return RETURN_FAIL;
         }
+        /* Tiled bodies have several DLOC/DBOD pairs - stop at the end of the FORM */
+        if ((error = StopOnExit(picture->iff, formType, ID_FORM)) != 0) {
+            SetIFFPictureError(picture, IFFPICTURE_ERROR, "Failed to set StopOnExit for DEEP");
+            return RETURN_FAIL;
+        }
     } else if (formType == ID_YUVN) {
         /* YUVN uses YCHD header and DATY, DATU, DATV, DATA chunks */
         if ((error = PropChunk(picture->iff, formType, ID_YCHD)) != 0) {
@@ -579,15 +1470,8 @@ LONG ParseIFFPicture(struct IFFPicture *picture)
         }
         PropChunk(picture->iff, formType, ID_AUTH); /* Optional */
         CollectionChunk(picture->iff, formType, ID_ANNO); /* Optional, can appear multiple times */
-        /* Extended metadata chunks - can appear in any FORM type */
-        CollectionChunk(picture->iff, formType, ID_EXIF);
-        CollectionChunk(picture->iff, formType, ID_IPTC);
-        CollectionChunk(picture->iff, formType, ID_XMP0);
-        PropChunk(picture->iff, formType, ID_XMP1);  /* XMP1 may occur only once */
-        CollectionChunk(picture->iff, formType, ID_ICCP);
-        CollectionChunk(picture->iff, formType, ID_ICCN);
-        CollectionChunk(picture->iff, formType, ID_GEOT);
-        CollectionChunk(picture->iff, formType, ID_GEOF);
+        /* Metadata chunks (optional) */
+        DeclareMetaChunks(picture, formType);
         /* Stop at data chunks - DATY, DATU, DATV, DATA (optional alpha) must appear in this order */
         if ((error = StopChunk(picture->iff, formType, ID_DATY)) != 0) {
             SetIFFPictureError(picture, IFFPICTURE_ERROR, "Failed to set StopChunk for DATY");
@@ -600,6 +1484,24 @@ LONG ParseIFFPicture(struct IFFPicture *picture)
         return RETURN_FAIL;
     }
     
+    return RETURN_OK;
+}
+
+/*
+** ReadFORM - Read the property chunks of the FORM just entered (internal helper)
+** Returns: RETURN_OK on success, RETURN_FAIL on error
+** Parses up to the FORM's data chunk, which the decoders read later
+*/
+static LONG ReadFORM(struct IFFPicture *picture, ULONG formType)
+{
+    LONG error;
+    
+    picture->formtype = formType;
+    
+    if (DeclareFormChunks(picture, formType) != RETURN_OK) {
+        return RETURN_FAIL; /* Error already set */
+    }
+    
     /* Parse the file until we hit the data chunk */
     error = ParseIFF(picture->iff, IFFPARSE_SCAN);
     if (error != 0 && error != IFFERR_EOC) {
@@ -615,33 +1517,16 @@ LONG ParseIFFPicture(struct IFFPicture *picture)
         }
         /* Create default black/white CMAP for FAXX if not already present */
         if (!picture->cmap) {
-            struct IFFColorMap *cmap;
             UBYTE *data;
             
-            /* Allocate ColorMap structure - use public memory (not chip RAM) */
-            cmap = (struct IFFColorMap *)AllocMem(sizeof(struct IFFColorMap), MEMF_PUBLIC | MEMF_CLEAR);
-            if (!cmap) {
-                /* Clean up BMHD allocated by ReadFXHD */
-                if (picture->bmhd) {
-                    FreeMem(picture->bmhd, sizeof(struct BitMapHeader));
-                    picture->bmhd = NULL;
-                }
-                SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate default ColorMap for FAXX");
-                return RETURN_FAIL;
-            }
-            
             /* Allocate 2-color palette (black and white) - 6 bytes */
-            data = (UBYTE *)AllocMem(6, MEMF_PUBLIC | MEMF_CLEAR);
-            if (!data) {
-                FreeMem(cmap, sizeof(struct IFFColorMap));
+            if (!AllocColorMap(picture, 2)) {
                 /* Clean up BMHD allocated by ReadFXHD */
-                if (picture->bmhd) {
-                    FreeMem(picture->bmhd, sizeof(struct BitMapHeader));
-                    picture->bmhd = NULL;
-                }
-                SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate default ColorMap data for FAXX");
+                FreeBMHD(picture);
+                SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate default ColorMap for FAXX");
                 return RETURN_FAIL;
             }
+            data = picture->cmap->data;
             
             /* Create black (index 0) and white (index 1) palette */
             data[0] = 0;   /* Black R */
@@ -651,11 +1536,6 @@ LONG ParseIFFPicture(struct IFFPicture *picture)
             data[4] = 255; /* White G */
             data[5] = 255; /* White B */
             
-            cmap->data = data;
-            cmap->numcolors = 2;
-            cmap->is4Bit = FALSE;
-            
-            picture->cmap = cmap;
             picture->isIndexed = TRUE;
             
             DEBUG_PUTSTR("DEBUG: ReadCMAP - Created default black/white CMAP for FAXX\n");
@@ -668,17 +1548,8 @@ LONG ParseIFFPicture(struct IFFPicture *picture)
         
         if (ReadPAGE(picture) != RETURN_OK) {
             /* Clean up on error */
-            if (picture->cmap) {
-                if (picture->cmap->data) {
-                    FreeMem(picture->cmap->data, picture->cmap->numcolors * 3);
-                }
-                FreeMem(picture->cmap, sizeof(struct IFFColorMap));
-                picture->cmap = NULL;
-            }
-            if (picture->bmhd) {
-                FreeMem(picture->bmhd, sizeof(struct BitMapHeader));
-                picture->bmhd = NULL;
-            }
+            FreeColorMap(picture);
+            FreeBMHD(picture);
             return RETURN_FAIL; /* Error already set */
         }
     } else if (formType == ID_YUVN) {
@@ -687,8 +1558,8 @@ LONG ParseIFFPicture(struct IFFPicture *picture)
             return RETURN_FAIL; /* Error already set */
         }
         
-        /* Read and store metadata chunks */
-        ReadAllMeta(picture);
+        /* Metadata is copied out of the stored chunks on first use */
+        picture->metaPending = picture->readMeta;
         
         /* YUVN data chunks are read during decoding, not during parsing */
         /* We just need to ensure the YCHD is loaded */
@@ -704,8 +1575,22 @@ LONG ParseIFFPicture(struct IFFPicture *picture)
         ReadDCHG(picture); /* DCHG is optional, don't fail if missing */
         ReadTVDC(picture); /* TVDC is optional, don't fail if missing */
         
-        /* Read and store metadata chunks */
-        ReadAllMeta(picture);
+        /* Describe the composited canvas with a BMHD, as FAXX does */
+        if (MakeDEEPBMHD(picture) != RETURN_OK) {
+            return RETURN_FAIL; /* Error already set */
+        }
+        
+        /* With DCHG every DLOC/DBOD pair after the first is an animation frame */
+        if (picture->dchg && !picture->anim) {
+            picture->anim = AllocIFFAnim(picture);
+            if (!picture->anim) {
+                SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate DEEP animation state");
+                return RETURN_FAIL;
+            }
+        }
+        
+        /* Metadata is copied out of the stored chunks on first use */
+        picture->metaPending = picture->readMeta;
         
         /* Read DBOD chunk */
         if (ReadDBOD(picture) != RETURN_OK) {
@@ -724,8 +1609,13 @@ LONG ParseIFFPicture(struct IFFPicture *picture)
             picture->isIndexed = FALSE;
         }
         
-        /* Read and store metadata chunks */
-        ReadAllMeta(picture);
+        /* Per-scanline palette changes (PCHG/SHAM/CTBL) are optional */
+        if (formType == ID_ILBM && picture->bmhd->nPlanes != 24) {
+            ReadLinePalette(picture);
+        }
+        
+        /* Metadata is copied out of the stored chunks on first use */
+        picture->metaPending = picture->readMeta;
         
         /* Read BODY or ABIT chunk depending on format */
         if (formType == ID_ACBM) {
@@ -743,6 +1633,101 @@ LONG ParseIFFPicture(struct IFFPicture *picture)
     return RETURN_OK;
 }
 
+/*
+** IsPictureForm - Check whether a FORM type is one the decoders handle (internal helper)
+*/
+static BOOL IsPictureForm(ULONG formType)
+{
+    return (BOOL)(formType == ID_ILBM || formType == ID_PBM || formType == ID_ACBM ||
+                  formType == ID_RGBN || formType == ID_RGB8 || formType == ID_DEEP ||
+                  formType == ID_YUVN || formType == ID_FAXX);
+}
+
+/*
+** FindNextFORM - Step through a CAT or LIST to its next picture FORM (internal helper)
+** Returns: RETURN_OK when positioned in a FORM, RETURN_WARN at the end of
+**          the file, RETURN_FAIL on error
+**
+** Only FORMs and PROPs directly inside a CAT or LIST count. The rest of
+** the previous FORM, FORMs nested in other FORMs (e.g. ANIM frames) and
+** unsupported FORM types are stepped over without being read.
+*/
+static LONG FindNextFORM(struct IFFPicture *picture)
+{
+    LONG error;
+    struct ContextNode *cn;
+    struct ContextNode *parent;
+    
+    for (;;) {
+        error = ParseIFF(picture->iff, IFFPARSE_STEP);
+        if (error == IFFERR_EOC) {
+            continue; /* Leaving a chunk or context */
+        }
+        if (error == IFFERR_EOF) {
+            return RETURN_WARN;
+        }
+        if (error != 0) {
+            SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Failed to parse CAT or LIST");
+            return RETURN_FAIL;
+        }
+        
+        cn = CurrentChunk(picture->iff);
+        if (!cn || !IsPictureForm(cn->cn_Type)) {
+            continue;
+        }
+        parent = ParentChunk(cn);
+        if (!parent || (parent->cn_ID != ID_CAT && parent->cn_ID != ID_LIST)) {
+            continue;
+        }
+        
+        if (cn->cn_ID == ID_PROP) {
+            /* Shared properties - iffparse stores them in the enclosing LIST */
+            if (DeclareFormChunks(picture, cn->cn_Type) != RETURN_OK) {
+                return RETURN_FAIL; /* Error already set */
+            }
+        } else if (cn->cn_ID == ID_FORM) {
+            DEBUG_PRINTF1("DEBUG: FindNextFORM - FORM type = 0x%08lx\n", cn->cn_Type);
+            return RETURN_OK;
+        }
+    }
+}
+
+/*
+** NextIFFPicture - Read the next picture of a CAT or LIST
+** Returns: RETURN_OK when a picture was read, RETURN_WARN when there
+**          are no more pictures, RETURN_FAIL on error
+**
+** Frees the current image and continues from where the parser stopped,
+** so the file is only read once from start to end.
+*/
+LONG NextIFFPicture(struct IFFPicture *picture)
+{
+    LONG result;
+    
+    if (!picture || !picture->iff) {
+        if (picture) {
+            SetIFFPictureError(picture, IFFPICTURE_INVALID, "Picture not opened");
+        }
+        return RETURN_FAIL;
+    }
+    
+    /* A plain FORM file holds exactly one picture */
+    if (!picture->containerType) {
+        return RETURN_WARN;
+    }
+    
+    FreeImageData(picture);
+    picture->isLoaded = FALSE;
+    
+    result = FindNextFORM(picture);
+    if (result != RETURN_OK) {
+        return result;
+    }
+    
+    picture->imageIndex++;
+    return ReadFORM(picture, CurrentChunk(picture->iff)->cn_Type);
+}
+
 /*
 ** Getter functions - return values from picture structure
 ** Following iffparse.library pattern: Get* functions
@@ -811,6 +1796,22 @@ ULONG GetFormType(struct IFFPicture *picture)
     return picture->formtype;
 }
 
+ULONG GetContainerType(struct IFFPicture *picture)
+{
+    if (!picture) {
+        return 0;
+    }
+    return picture->containerType;
+}
+
+ULONG GetImageIndex(struct IFFPicture *picture)
+{
+    if (!picture) {
+        return 0;
+    }
+    return picture->imageIndex;
+}
+
 ULONG GetVPModes(struct IFFPicture *picture)
 {
     if (!picture) {
@@ -922,35 +1923,202 @@ BOOL IsCompressed(struct IFFPicture *picture)
 /*
 ** GetImageInfo - Get all core image properties in a single structure
 ** Returns: Pointer to IFFImageInfo structure, or NULL if picture is invalid
-** The structure is allocated statically and remains valid until the next
-** call to GetImageInfo() or until the IFFPicture is freed.
+** The structure is part of the IFFPicture and remains valid until the
+** next call to GetImageInfo() on it or until the IFFPicture is freed.
 */
 struct IFFImageInfo *GetImageInfo(struct IFFPicture *picture)
 {
-    static struct IFFImageInfo info;
+    struct IFFImageInfo *info;
     
     if (!picture) {
         return NULL;
     }
+    info = &picture->info;
     
     /* Populate structure with all core properties */
-    info.width = GetWidth(picture);
-    info.height = GetHeight(picture);
-    info.depth = GetDepth(picture);
-    info.formType = GetFormType(picture);
-    info.viewportModes = GetVPModes(picture);
-    info.compressedSize = picture->bodyChunkSize;      /* Compressed data size (BODY chunk) */
-    info.decodedSize = GetPixelDataSize(picture);      /* Decoded pixel data size */
-    info.hasAlpha = HasAlpha(picture);
-    info.isHAM = IsHAM(picture);
-    info.isEHB = IsEHB(picture);
-    info.isCompressed = IsCompressed(picture);
-    info.isIndexed = picture->isIndexed;
-    info.isGrayscale = picture->isGrayscale;
-    info.isLoaded = picture->isLoaded;
-    info.isDecoded = picture->isDecoded;
-    
-    return &info;
+    info->width = GetWidth(picture);
+    info->height = GetHeight(picture);
+    info->depth = GetDepth(picture);
+    info->formType = GetFormType(picture);
+    info->viewportModes = GetVPModes(picture);
+    info->compressedSize = picture->bodyChunkSize;      /* Compressed data size (BODY chunk) */
+    info->decodedSize = GetPixelDataSize(picture);      /* Decoded pixel data size */
+    info->hasAlpha = HasAlpha(picture);
+    info->isHAM = IsHAM(picture);
+    info->isEHB = IsEHB(picture);
+    info->isCompressed = IsCompressed(picture);
+    info->isIndexed = picture->isIndexed;
+    info->isGrayscale = picture->isGrayscale;
+    info->isLoaded = picture->isLoaded;
+    info->isDecoded = picture->isDecoded;
+    info->compression = picture->bmhd ? picture->bmhd->compression : 0;
+    info->masking = picture->bmhd ? picture->bmhd->masking : mskNone;
+    
+    return info;
+}
+
+/* Largest header chunk ProbeIFFPicture() reads (DPEL with a few elements) */
+#define PROBE_CHUNK_MAX 64
+
+/* Read a big-endian word or longword from a probe buffer */
+#define ProbeWord(p) ((UWORD)(((UWORD)(p)[0] << 8) | (p)[1]))
+#define ProbeLong(p) (((ULONG)(p)[0] << 24) | ((ULONG)(p)[1] << 16) | \
+                      ((ULONG)(p)[2] << 8) | (ULONG)(p)[3])
+
+/*
+** ProbeIFFPicture - Read the header of an IFF picture without loading it
+** Returns: RETURN_OK when a picture header was found, RETURN_FAIL otherwise
+**
+** Walks the chunks from the current file position with Read() and Seek(),
+** reading only the small header chunks (BMHD, CAMG, YCHD, FXHD, DGBL,
+** DPEL) and stopping at the image data chunk, whose size is returned in
+** compressedSize. CAT, LIST and ANIM are entered and the first picture
+** in them is described. No IFFPicture or iffparse.library is needed.
+** isLoaded and isDecoded are always FALSE.
+*/
+LONG ProbeIFFPicture(BPTR filehandle, struct IFFImageInfo *info)
+{
+    UBYTE header[12];
+    UBYTE data[PROBE_CHUNK_MAX];
+    ULONG id;
+    ULONG size;
+    ULONG skip;
+    LONG got;
+    ULONG i;
+    BOOL found;
+    
+    if (!filehandle || !info) {
+        return RETURN_FAIL;
+    }
+    
+    info->width = 0;
+    info->height = 0;
+    info->depth = 0;
+    info->formType = 0;
+    info->viewportModes = 0;
+    info->compressedSize = 0;
+    info->decodedSize = 0;
+    info->hasAlpha = FALSE;
+    info->isHAM = FALSE;
+    info->isEHB = FALSE;
+    info->isCompressed = FALSE;
+    info->isIndexed = FALSE;
+    info->isGrayscale = FALSE;
+    info->isLoaded = FALSE;
+    info->isDecoded = FALSE;
+    info->compression = 0;
+    info->masking = mskNone;
+    found = FALSE;
+    
+    /* The file must start with a group chunk */
+    if (Read(filehandle, header, 12) != 12) {
+        return RETURN_FAIL;
+    }
+    id = ProbeLong(header);
+    if (id != ID_FORM && id != ID_CAT && id != ID_LIST) {
+        return RETURN_FAIL;
+    }
+    if (id == ID_FORM) {
+        if (!IsPictureForm(ProbeLong(header + 8)) && ProbeLong(header + 8) != ID_ANIM) {
+            return RETURN_FAIL;
+        }
+        if (IsPictureForm(ProbeLong(header + 8))) {
+            info->formType = ProbeLong(header + 8);
+        }
+    }
+    
+    for (;;) {
+        if (Read(filehandle, header, 8) != 8) {
+            break;
+        }
+        id = ProbeLong(header);
+        size = ProbeLong(header + 4);
+        
+        /* Enter groups that can hold pictures, step over any other */
+        if (id == ID_FORM || id == ID_CAT || id == ID_LIST || id == ID_PROP) {
+            if (size < 4 || Read(filehandle, header + 8, 4) != 4) {
+                break;
+            }
+            if (id == ID_CAT || id == ID_LIST || ProbeLong(header + 8) == ID_ANIM ||
+                IsPictureForm(ProbeLong(header + 8))) {
+                if (id == ID_FORM && !info->formType && IsPictureForm(ProbeLong(header + 8))) {
+                    info->formType = ProbeLong(header + 8);
+                }
+                continue;
+            }
+            skip = size - 4;
+        } else if (id == ID_BODY || id == ID_ABIT || id == ID_PAGE ||
+                   id == ID_DATY || id == ID_DBOD) {
+            /* Image data - everything needed comes before it */
+            info->compressedSize = size;
+            found = (BOOL)(info->formType != 0);
+            break;
+        } else if (id == ID_BMHD || id == ID_CAMG || id == ID_YCHD ||
+                   id == ID_FXHD || id == ID_DGBL || id == ID_DPEL) {
+            got = (LONG)((size < PROBE_CHUNK_MAX) ? size : PROBE_CHUNK_MAX);
+            if (Read(filehandle, data, got) != got) {
+                break;
+            }
+            skip = size - (ULONG)got;
+            
+            if (id == ID_BMHD && got >= 20) {
+                info->width = ProbeWord(data);
+                info->height = ProbeWord(data + 2);
+                info->depth = data[8];
+                info->masking = data[9];
+                info->compression = data[10];
+            } else if (id == ID_CAMG && got >= 4) {
+                info->viewportModes = ProbeLong(data);
+            } else if (id == ID_YCHD && got >= 18) {
+                info->width = ProbeWord(data);
+                info->height = ProbeWord(data + 2);
+                info->compression = data[14];
+                info->isGrayscale = (BOOL)(data[16] == YCHD_MODE_400 || data[16] == YCHD_MODE_200);
+                info->depth = info->isGrayscale ? 8 : 24;
+            } else if (id == ID_FXHD && got >= 9) {
+                info->width = ProbeWord(data);
+                info->height = ProbeWord(data + 2);
+                info->compression = data[8];
+                info->depth = 1;
+                info->isGrayscale = TRUE;
+            } else if (id == ID_DGBL && got >= 6) {
+                info->width = ProbeWord(data);
+                info->height = ProbeWord(data + 2);
+                info->compression = (UBYTE)ProbeWord(data + 4);
+            } else if (id == ID_DPEL && got >= 4) {
+                info->depth = 0;
+                for (i = 0; i < ProbeLong(data) && 8 + i * 4 <= (ULONG)got; i++) {
+                    info->depth += ProbeWord(data + 4 + i * 4 + 2);
+                    if (ProbeWord(data + 4 + i * 4) == DEEP_TYPE_ALPHA) {
+                        info->hasAlpha = TRUE;
+                    }
+                }
+            }
+        } else {
+            skip = size;
+        }
+        
+        /* Step over the rest of the chunk and its pad byte */
+        skip += (size & 1);
+        if (skip && Seek(filehandle, (LONG)skip, OFFSET_CURRENT) < 0) {
+            break;
+        }
+    }
+    
+    if (!found) {
+        return RETURN_FAIL;
+    }
+    
+    info->isCompressed = (BOOL)(info->compression != 0);
+    /* Same rule as ReadBMHD() - a transparent colour becomes tRNS, not alpha */
+    if (info->masking == mskHasMask) {
+        info->hasAlpha = TRUE;
+    }
+    info->isHAM = (BOOL)((info->viewportModes & vmHAM) != 0);
+    info->isEHB = (BOOL)((info->viewportModes & vmEXTRA_HALFBRITE) != 0);
+    info->isIndexed = (BOOL)((info->formType == ID_ILBM || info->formType == ID_PBM ||
+                              info->formType == ID_ACBM) && !info->isHAM && info->depth <= 8);
+    return RETURN_OK;
 }
 
 /*
@@ -986,7 +2154,7 @@ LONG ReadBMHD(struct IFFPicture *picture)
     }
     
     /* Allocate BMHD structure - use public memory (not chip RAM) */
-    bmhd = (struct BitMapHeader *)AllocMem(sizeof(struct BitMapHeader), MEMF_PUBLIC | MEMF_CLEAR);
+    bmhd = AllocBMHD(picture);
     if (!bmhd) {
         SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate BitMapHeader");
         return RETURN_FAIL;
@@ -1069,7 +2237,7 @@ LONG ReadYCHD(struct IFFPicture *picture)
     }
     
     /* Allocate YCHD structure - use public memory (not chip RAM) */
-    ychd = (struct YCHDHeader *)AllocMem(sizeof(struct YCHDHeader), MEMF_PUBLIC | MEMF_CLEAR);
+    ychd = (struct YCHDHeader *)AllocPictureMem(picture, sizeof(struct YCHDHeader), MEMF_PUBLIC | MEMF_CLEAR);
     if (!ychd) {
         SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate YCHDHeader");
         return RETURN_FAIL;
@@ -1200,20 +2368,13 @@ LONG ReadCMAP(struct IFFPicture *picture)
         return RETURN_OK;
     }
     
-    /* Allocate IFFColorMap structure - use public memory (not chip RAM) */
-    cmap = (struct IFFColorMap *)AllocMem(sizeof(struct IFFColorMap), MEMF_PUBLIC | MEMF_CLEAR);
+    /* Allocate IFFColorMap and its color data - use public memory (not chip RAM) */
+    cmap = AllocColorMap(picture, numcolors);
     if (!cmap) {
         SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate ColorMap");
         return RETURN_FAIL;
     }
-    
-    /* Allocate color data - use public memory (not chip RAM) */
-    data = (UBYTE *)AllocMem(sp->sp_Size, MEMF_PUBLIC | MEMF_CLEAR);
-    if (!data) {
-        FreeMem(cmap, sizeof(struct IFFColorMap));
-        SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate ColorMap data");
-        return RETURN_FAIL;
-    }
+    data = cmap->data;
     
     /* Copy color data */
     CopyMem(sp->sp_Data, data, sp->sp_Size);
@@ -1228,11 +2389,7 @@ LONG ReadCMAP(struct IFFPicture *picture)
         }
     }
     
-    cmap->data = data;
-    cmap->numcolors = numcolors;
     cmap->is4Bit = allShifted;
-    
-    picture->cmap = cmap;
     picture->isIndexed = TRUE;
     
     DEBUG_PRINTF2("DEBUG: ReadCMAP - Loaded %ld colors, is4Bit=%ld\n",
@@ -1403,25 +2560,22 @@ LONG ReadFXHD(struct IFFPicture *picture)
     
     /* Free existing FXHD and BMHD if present (shouldn't happen, but be safe) */
     if (picture->fxhd) {
-        FreeMem(picture->fxhd, sizeof(struct FaxHeader));
+        FreePictureMem(picture, picture->fxhd, sizeof(struct FaxHeader));
         picture->fxhd = NULL;
     }
-    if (picture->bmhd) {
-        FreeMem(picture->bmhd, sizeof(struct BitMapHeader));
-        picture->bmhd = NULL;
-    }
+    FreeBMHD(picture);
     
     /* Allocate FaxHeader structure - use public memory (not chip RAM) */
-    picture->fxhd = (struct FaxHeader *)AllocMem(sizeof(struct FaxHeader), MEMF_PUBLIC | MEMF_CLEAR);
+    picture->fxhd = (struct FaxHeader *)AllocPictureMem(picture, sizeof(struct FaxHeader), MEMF_PUBLIC | MEMF_CLEAR);
     if (!picture->fxhd) {
         SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate FaxHeader");
         return RETURN_FAIL;
     }
     
     /* Allocate BMHD structure for compatibility - use public memory (not chip RAM) */
-    bmhd = (struct BitMapHeader *)AllocMem(sizeof(struct BitMapHeader), MEMF_PUBLIC | MEMF_CLEAR);
+    bmhd = AllocBMHD(picture);
     if (!bmhd) {
-        FreeMem(picture->fxhd, sizeof(struct FaxHeader));
+        FreePictureMem(picture, picture->fxhd, sizeof(struct FaxHeader));
         picture->fxhd = NULL;
         SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate BitMapHeader");
         return RETURN_FAIL;
@@ -1528,12 +2682,12 @@ LONG ReadGPHD(struct IFFPicture *picture)
     
     /* Free existing GPHD if present */
     if (picture->gphd) {
-        FreeMem(picture->gphd, sizeof(struct GPHDHeader));
+        FreePictureMem(picture, picture->gphd, sizeof(struct GPHDHeader));
         picture->gphd = NULL;
     }
     
     /* Allocate GPHDHeader structure - use public memory (not chip RAM) */
-    picture->gphd = (struct GPHDHeader *)AllocMem(sizeof(struct GPHDHeader), MEMF_PUBLIC | MEMF_CLEAR);
+    picture->gphd = (struct GPHDHeader *)AllocPictureMem(picture, sizeof(struct GPHDHeader), MEMF_PUBLIC | MEMF_CLEAR);
     if (!picture->gphd) {
         SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate GPHDHeader");
         return RETURN_FAIL;
@@ -1681,7 +2835,7 @@ LONG ReadDGBL(struct IFFPicture *picture)
     }
     
     /* Allocate DGBL structure */
-    dgbl = (struct DGBLHeader *)AllocMem(sizeof(struct DGBLHeader), MEMF_PUBLIC | MEMF_CLEAR);
+    dgbl = (struct DGBLHeader *)AllocPictureMem(picture, sizeof(struct DGBLHeader), MEMF_PUBLIC | MEMF_CLEAR);
     if (!dgbl) {
         SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate DGBLHeader");
         return RETURN_FAIL;
@@ -1735,7 +2889,7 @@ LONG ReadDPEL(struct IFFPicture *picture)
     }
     
     /* Allocate DPEL structure */
-    dpel = (struct DPELHeader *)AllocMem(sizeof(struct DPELHeader), MEMF_PUBLIC | MEMF_CLEAR);
+    dpel = (struct DPELHeader *)AllocPictureMem(picture, sizeof(struct DPELHeader), MEMF_PUBLIC | MEMF_CLEAR);
     if (!dpel) {
         SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate DPELHeader");
         return RETURN_FAIL;
@@ -1748,16 +2902,16 @@ LONG ReadDPEL(struct IFFPicture *picture)
     /* Check that we have enough data for nElements TypeDepth structures */
     expectedSize = 4 + (dpel->nElements * 4); /* 4 bytes per TypeDepth (2 UWORDs) */
     if (sp->sp_Size < expectedSize) {
-        FreeMem(dpel, sizeof(struct DPELHeader));
+        FreePictureMem(picture, dpel, sizeof(struct DPELHeader));
         SetIFFPictureError(picture, IFFPICTURE_BADFILE, "DPEL chunk too small for nElements");
         return RETURN_FAIL;
     }
     
     /* Allocate TypeDepth array */
     if (dpel->nElements > 0) {
-        dpel->typedepth = (struct TypeDepth *)AllocMem(dpel->nElements * sizeof(struct TypeDepth), MEMF_PUBLIC | MEMF_CLEAR);
+        dpel->typedepth = (struct TypeDepth *)AllocPictureMem(picture, dpel->nElements * sizeof(struct TypeDepth), MEMF_PUBLIC | MEMF_CLEAR);
         if (!dpel->typedepth) {
-            FreeMem(dpel, sizeof(struct DPELHeader));
+            FreePictureMem(picture, dpel, sizeof(struct DPELHeader));
             SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate TypeDepth array");
             return RETURN_FAIL;
         }
@@ -1810,7 +2964,7 @@ LONG ReadDLOC(struct IFFPicture *picture)
     }
     
     /* Allocate DLOC structure */
-    dloc = (struct DLOCHeader *)AllocMem(sizeof(struct DLOCHeader), MEMF_PUBLIC | MEMF_CLEAR);
+    dloc = (struct DLOCHeader *)AllocPictureMem(picture, sizeof(struct DLOCHeader), MEMF_PUBLIC | MEMF_CLEAR);
     if (!dloc) {
         SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate DLOCHeader");
         return RETURN_FAIL;
@@ -1896,7 +3050,7 @@ LONG ReadDCHG(struct IFFPicture *picture)
     }
     
     /* Allocate DCHG structure */
-    dchg = (struct DCHGHeader *)AllocMem(sizeof(struct DCHGHeader), MEMF_PUBLIC | MEMF_CLEAR);
+    dchg = (struct DCHGHeader *)AllocPictureMem(picture, sizeof(struct DCHGHeader), MEMF_PUBLIC | MEMF_CLEAR);
     if (!dchg) {
         SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate DCHGHeader");
         return RETURN_FAIL;
@@ -1911,6 +3065,62 @@ LONG ReadDCHG(struct IFFPicture *picture)
     return RETURN_OK;
 }
 
+/*
+** MakeDEEPBMHD - Build a BMHD describing a DEEP picture's canvas (internal helper)
+** Returns: RETURN_OK on success, RETURN_FAIL on error
+**
+** The canvas is the DGBL display size, grown to cover the first DLOC if
+** that reaches further. All DLOC/DBOD tiles are composited into it, so
+** GetWidth(), Decode() and the PNG encoder can use the BMHD as for ILBM.
+*/
+static LONG MakeDEEPBMHD(struct IFFPicture *picture)
+{
+    struct BitMapHeader *bmhd;
+    ULONG width, height;
+    ULONG bits;
+    ULONG i;
+    
+    width = picture->dgbl->DisplayWidth;
+    height = picture->dgbl->DisplayHeight;
+    if (picture->dloc) {
+        if (picture->dloc->x >= 0 && (ULONG)picture->dloc->x + picture->dloc->w > width) {
+            width = (ULONG)picture->dloc->x + picture->dloc->w;
+        }
+        if (picture->dloc->y >= 0 && (ULONG)picture->dloc->y + picture->dloc->h > height) {
+            height = (ULONG)picture->dloc->y + picture->dloc->h;
+        }
+    }
+    if (width == 0 || height == 0 || width > 0xFFFF || height > 0xFFFF) {
+        SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Invalid DEEP display size");
+        return RETURN_FAIL;
+    }
+    
+    bits = 0;
+    for (i = 0; i < picture->dpel->nElements; i++) {
+        bits += picture->dpel->typedepth[i].cBitDepth;
+    }
+    
+    FreeBMHD(picture);
+    bmhd = AllocBMHD(picture);
+    if (!bmhd) {
+        SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate BitMapHeader");
+        return RETURN_FAIL;
+    }
+    
+    bmhd->w = (UWORD)width;
+    bmhd->h = (UWORD)height;
+    bmhd->nPlanes = (UBYTE)(bits > 255 ? 255 : bits);
+    bmhd->masking = mskNone;
+    bmhd->compression = cmpNone; /* DEEP compression is in DGBL */
+    bmhd->xAspect = picture->dgbl->xAspect;
+    bmhd->yAspect = picture->dgbl->yAspect;
+    bmhd->pageWidth = picture->dgbl->DisplayWidth;
+    bmhd->pageHeight = picture->dgbl->DisplayHeight;
+    
+    picture->bmhd = bmhd;
+    return RETURN_OK;
+}
+
 /*
 ** ReadTVDC - Read TVDC chunk (TVPaint Deep Compression)
 ** Returns: RETURN_OK on success, RETURN_FAIL on error (optional chunk)
@@ -1944,7 +3154,7 @@ LONG ReadTVDC(struct IFFPicture *picture)
     }
     
     /* Allocate TVDC structure */
-    tvdc = (struct TVDCHeader *)AllocMem(sizeof(struct TVDCHeader), MEMF_PUBLIC | MEMF_CLEAR);
+    tvdc = (struct TVDCHeader *)AllocPictureMem(picture, sizeof(struct TVDCHeader), MEMF_PUBLIC | MEMF_CLEAR);
     if (!tvdc) {
         SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate TVDCHeader");
         return RETURN_FAIL;
@@ -1966,11 +3176,18 @@ LONG ReadTVDC(struct IFFPicture *picture)
 ** AllocIFFPictureMeta - Allocate metadata structure on demand (internal helper)
 ** Returns: Pointer to allocated metadata structure or NULL on failure
 */
-static struct IFFPictureMeta *AllocIFFPictureMeta(VOID)
+static struct IFFPictureMeta *AllocIFFPictureMeta(struct IFFPicture *picture)
 {
     struct IFFPictureMeta *meta;
     
-    meta = (struct IFFPictureMeta *)AllocMem(sizeof(struct IFFPictureMeta), MEMF_PUBLIC | MEMF_CLEAR);
+    meta = picture->spareMeta;
+    if (meta) {
+        picture->spareMeta = NULL;
+        ClearBuffer((UBYTE *)meta, sizeof(struct IFFPictureMeta));
+        return meta;
+    }
+    
+    meta = (struct IFFPictureMeta *)AllocPictureMem(picture, sizeof(struct IFFPictureMeta), MEMF_PUBLIC | MEMF_CLEAR);
     if (!meta) {
         return NULL;
     }
@@ -1990,7 +3207,7 @@ static struct IFFPictureMeta *EnsureMeta(struct IFFPicture *picture)
     }
     
     if (!picture->metadata) {
-        picture->metadata = AllocIFFPictureMeta();
+        picture->metadata = AllocIFFPictureMeta(picture);
     }
     
     return picture->metadata;
@@ -1998,7 +3215,7 @@ static struct IFFPictureMeta *EnsureMeta(struct IFFPicture *picture)
 
 /*
 ** ReadAllMeta - Read and store all metadata chunks in IFFPicture structure
-** This function is called after ParseIFFPicture() to extract metadata
+** Called through LoadMeta() while the stored chunks of the image are still in scope
 ** All memory is owned by IFFPicture and freed by FreeIFFPicture()
 ** Metadata structure is allocated on demand when first metadata chunk is found
 */
@@ -2023,7 +3240,7 @@ VOID ReadAllMeta(struct IFFPicture *picture)
     if (sp && sp->sp_Size >= 4) {
         meta = EnsureMeta(picture);
         if (meta) {
-            meta->grab = (struct Point2D *)AllocMem(sizeof(struct Point2D), MEMF_PUBLIC | MEMF_CLEAR);
+            meta->grab = (struct Point2D *)AllocPictureMem(picture, sizeof(struct Point2D), MEMF_PUBLIC);
             if (meta->grab) {
                 src = (UBYTE *)sp->sp_Data;
                 meta->grab->x = (WORD)((src[0] << 8) | src[1]);
@@ -2037,7 +3254,7 @@ VOID ReadAllMeta(struct IFFPicture *picture)
     if (sp && sp->sp_Size >= 8) {
         meta = EnsureMeta(picture);
         if (meta) {
-            meta->dest = (struct DestMerge *)AllocMem(sizeof(struct DestMerge), MEMF_PUBLIC | MEMF_CLEAR);
+            meta->dest = (struct DestMerge *)AllocPictureMem(picture, sizeof(struct DestMerge), MEMF_PUBLIC);
             if (meta->dest) {
                 src = (UBYTE *)sp->sp_Data;
                 meta->dest->depth = src[0];
@@ -2054,7 +3271,7 @@ VOID ReadAllMeta(struct IFFPicture *picture)
     if (sp && sp->sp_Size >= 2) {
         meta = EnsureMeta(picture);
         if (meta) {
-            meta->sprt = (UWORD *)AllocMem(sizeof(UWORD), MEMF_PUBLIC | MEMF_CLEAR);
+            meta->sprt = (UWORD *)AllocPictureMem(picture, sizeof(UWORD), MEMF_PUBLIC);
             if (meta->sprt) {
                 src = (UBYTE *)sp->sp_Data;
                 *meta->sprt = (UWORD)((src[0] << 8) | src[1]);
@@ -2076,7 +3293,7 @@ VOID ReadAllMeta(struct IFFPicture *picture)
             meta = EnsureMeta(picture);
             if (meta) {
                 meta->crngCount = count;
-                meta->crngArray = (struct CRange *)AllocMem(count * sizeof(struct CRange), MEMF_PUBLIC | MEMF_CLEAR);
+                meta->crngArray = (struct CRange *)AllocPictureMem(picture, count * sizeof(struct CRange), MEMF_PUBLIC);
                 if (meta->crngArray) {
                     ci = FindCollection(picture->iff, picture->formtype, ID_CRNG);
                     for (i = 0; i < count && ci; i++, ci = ci->ci_Next) {
@@ -2087,6 +3304,13 @@ VOID ReadAllMeta(struct IFFPicture *picture)
                             meta->crngArray[i].flags = (WORD)((src[4] << 8) | src[5]);
                             meta->crngArray[i].low = src[6];
                             meta->crngArray[i].high = src[7];
+                        } else {
+                            /* Short chunk - an inactive range */
+                            meta->crngArray[i].pad1 = 0;
+                            meta->crngArray[i].rate = 0;
+                            meta->crngArray[i].flags = 0;
+                            meta->crngArray[i].low = 0;
+                            meta->crngArray[i].high = 0;
                         }
                     }
                     /* Store first instance pointer for convenience */
@@ -2102,7 +3326,7 @@ VOID ReadAllMeta(struct IFFPicture *picture)
         meta = EnsureMeta(picture);
         if (meta) {
             meta->copyrightSize = sp->sp_Size + 1;
-            meta->copyright = (STRPTR)AllocMem(meta->copyrightSize, MEMF_PUBLIC | MEMF_CLEAR);
+            meta->copyright = (STRPTR)AllocPictureMem(picture, meta->copyrightSize, MEMF_PUBLIC);
             if (meta->copyright) {
                 CopyMem(sp->sp_Data, meta->copyright, sp->sp_Size);
                 meta->copyright[sp->sp_Size] = '\0';
@@ -2116,7 +3340,7 @@ VOID ReadAllMeta(struct IFFPicture *picture)
         meta = EnsureMeta(picture);
         if (meta) {
             meta->authorSize = sp->sp_Size + 1;
-            meta->author = (STRPTR)AllocMem(meta->authorSize, MEMF_PUBLIC | MEMF_CLEAR);
+            meta->author = (STRPTR)AllocPictureMem(picture, meta->authorSize, MEMF_PUBLIC);
             if (meta->author) {
                 CopyMem(sp->sp_Data, meta->author, sp->sp_Size);
                 meta->author[sp->sp_Size] = '\0';
@@ -2137,14 +3361,14 @@ VOID ReadAllMeta(struct IFFPicture *picture)
             meta = EnsureMeta(picture);
             if (meta) {
                 meta->annotationCount = count;
-                meta->annotationArray = (STRPTR *)AllocMem(count * sizeof(STRPTR), MEMF_PUBLIC | MEMF_CLEAR);
-                meta->annotationSizes = (ULONG *)AllocMem(count * sizeof(ULONG), MEMF_PUBLIC | MEMF_CLEAR);
+                meta->annotationArray = (STRPTR *)AllocPictureMem(picture, count * sizeof(STRPTR), MEMF_PUBLIC | MEMF_CLEAR);
+                meta->annotationSizes = (ULONG *)AllocPictureMem(picture, count * sizeof(ULONG), MEMF_PUBLIC | MEMF_CLEAR);
                 if (meta->annotationArray && meta->annotationSizes) {
                     ci = FindCollection(picture->iff, picture->formtype, ID_ANNO);
                     for (i = 0; i < count && ci; i++, ci = ci->ci_Next) {
                         if (ci->ci_Size > 0) {
                             meta->annotationSizes[i] = ci->ci_Size + 1;
-                            meta->annotationArray[i] = (STRPTR)AllocMem(meta->annotationSizes[i], MEMF_PUBLIC | MEMF_CLEAR);
+                            meta->annotationArray[i] = (STRPTR)AllocPictureMem(picture, meta->annotationSizes[i], MEMF_PUBLIC);
                             if (meta->annotationArray[i]) {
                                 CopyMem(ci->ci_Data, meta->annotationArray[i], ci->ci_Size);
                                 meta->annotationArray[i][ci->ci_Size] = '\0';
@@ -2173,14 +3397,14 @@ VOID ReadAllMeta(struct IFFPicture *picture)
             meta = EnsureMeta(picture);
             if (meta) {
                 meta->textCount = count;
-                meta->textArray = (STRPTR *)AllocMem(count * sizeof(STRPTR), MEMF_PUBLIC | MEMF_CLEAR);
-                meta->textSizes = (ULONG *)AllocMem(count * sizeof(ULONG), MEMF_PUBLIC | MEMF_CLEAR);
+                meta->textArray = (STRPTR *)AllocPictureMem(picture, count * sizeof(STRPTR), MEMF_PUBLIC | MEMF_CLEAR);
+                meta->textSizes = (ULONG *)AllocPictureMem(picture, count * sizeof(ULONG), MEMF_PUBLIC | MEMF_CLEAR);
                 if (meta->textArray && meta->textSizes) {
                     ci = FindCollection(picture->iff, picture->formtype, ID_TEXT);
                     for (i = 0; i < count && ci; i++, ci = ci->ci_Next) {
                         if (ci->ci_Size > 0) {
                             meta->textSizes[i] = ci->ci_Size + 1;
-                            meta->textArray[i] = (STRPTR)AllocMem(meta->textSizes[i], MEMF_PUBLIC | MEMF_CLEAR);
+                            meta->textArray[i] = (STRPTR)AllocPictureMem(picture, meta->textSizes[i], MEMF_PUBLIC);
                             if (meta->textArray[i]) {
                                 CopyMem(ci->ci_Data, meta->textArray[i], ci->ci_Size);
                                 meta->textArray[i][ci->ci_Size] = '\0';
@@ -2202,7 +3426,7 @@ VOID ReadAllMeta(struct IFFPicture *picture)
         meta = EnsureMeta(picture);
         if (meta) {
             meta->fverSize = sp->sp_Size + 1;
-            meta->fver = (STRPTR)AllocMem(meta->fverSize, MEMF_PUBLIC | MEMF_CLEAR);
+            meta->fver = (STRPTR)AllocPictureMem(picture, meta->fverSize, MEMF_PUBLIC);
             if (meta->fver) {
                 CopyMem(sp->sp_Data, meta->fver, sp->sp_Size);
                 meta->fver[sp->sp_Size] = '\0';
@@ -2223,14 +3447,14 @@ VOID ReadAllMeta(struct IFFPicture *picture)
             meta = EnsureMeta(picture);
             if (meta) {
                 meta->exifCount = count;
-                meta->exifArray = (UBYTE **)AllocMem(count * sizeof(UBYTE *), MEMF_PUBLIC | MEMF_CLEAR);
-                meta->exifSizes = (ULONG *)AllocMem(count * sizeof(ULONG), MEMF_PUBLIC | MEMF_CLEAR);
+                meta->exifArray = (UBYTE **)AllocPictureMem(picture, count * sizeof(UBYTE *), MEMF_PUBLIC | MEMF_CLEAR);
+                meta->exifSizes = (ULONG *)AllocPictureMem(picture, count * sizeof(ULONG), MEMF_PUBLIC | MEMF_CLEAR);
                 if (meta->exifArray && meta->exifSizes) {
                     ci = FindCollection(picture->iff, picture->formtype, ID_EXIF);
                     for (i = 0; i < count && ci; i++, ci = ci->ci_Next) {
                         if (ci->ci_Size > 0) {
                             meta->exifSizes[i] = ci->ci_Size;
-                            meta->exifArray[i] = (UBYTE *)AllocMem(ci->ci_Size, MEMF_PUBLIC | MEMF_CLEAR);
+                            meta->exifArray[i] = (UBYTE *)AllocPictureMem(picture, ci->ci_Size, MEMF_PUBLIC);
                             if (meta->exifArray[i]) {
                                 CopyMem(ci->ci_Data, meta->exifArray[i], ci->ci_Size);
                             }
@@ -2259,14 +3483,14 @@ VOID ReadAllMeta(struct IFFPicture *picture)
             meta = EnsureMeta(picture);
             if (meta) {
                 meta->iptcCount = count;
-                meta->iptcArray = (UBYTE **)AllocMem(count * sizeof(UBYTE *), MEMF_PUBLIC | MEMF_CLEAR);
-                meta->iptcSizes = (ULONG *)AllocMem(count * sizeof(ULONG), MEMF_PUBLIC | MEMF_CLEAR);
+                meta->iptcArray = (UBYTE **)AllocPictureMem(picture, count * sizeof(UBYTE *), MEMF_PUBLIC | MEMF_CLEAR);
+                meta->iptcSizes = (ULONG *)AllocPictureMem(picture, count * sizeof(ULONG), MEMF_PUBLIC | MEMF_CLEAR);
                 if (meta->iptcArray && meta->iptcSizes) {
                     ci = FindCollection(picture->iff, picture->formtype, ID_IPTC);
                     for (i = 0; i < count && ci; i++, ci = ci->ci_Next) {
                         if (ci->ci_Size > 0) {
                             meta->iptcSizes[i] = ci->ci_Size;
-                            meta->iptcArray[i] = (UBYTE *)AllocMem(ci->ci_Size, MEMF_PUBLIC | MEMF_CLEAR);
+                            meta->iptcArray[i] = (UBYTE *)AllocPictureMem(picture, ci->ci_Size, MEMF_PUBLIC);
                             if (meta->iptcArray[i]) {
                                 CopyMem(ci->ci_Data, meta->iptcArray[i], ci->ci_Size);
                             }
@@ -2295,14 +3519,14 @@ VOID ReadAllMeta(struct IFFPicture *picture)
             meta = EnsureMeta(picture);
             if (meta) {
                 meta->xmp0Count = count;
-                meta->xmp0Array = (UBYTE **)AllocMem(count * sizeof(UBYTE *), MEMF_PUBLIC | MEMF_CLEAR);
-                meta->xmp0Sizes = (ULONG *)AllocMem(count * sizeof(ULONG), MEMF_PUBLIC | MEMF_CLEAR);
+                meta->xmp0Array = (UBYTE **)AllocPictureMem(picture, count * sizeof(UBYTE *), MEMF_PUBLIC | MEMF_CLEAR);
+                meta->xmp0Sizes = (ULONG *)AllocPictureMem(picture, count * sizeof(ULONG), MEMF_PUBLIC | MEMF_CLEAR);
                 if (meta->xmp0Array && meta->xmp0Sizes) {
                     ci = FindCollection(picture->iff, picture->formtype, ID_XMP0);
                     for (i = 0; i < count && ci; i++, ci = ci->ci_Next) {
                         if (ci->ci_Size > 0) {
                             meta->xmp0Sizes[i] = ci->ci_Size;
-                            meta->xmp0Array[i] = (UBYTE *)AllocMem(ci->ci_Size, MEMF_PUBLIC | MEMF_CLEAR);
+                            meta->xmp0Array[i] = (UBYTE *)AllocPictureMem(picture, ci->ci_Size, MEMF_PUBLIC);
                             if (meta->xmp0Array[i]) {
                                 CopyMem(ci->ci_Data, meta->xmp0Array[i], ci->ci_Size);
                             }
@@ -2324,7 +3548,7 @@ VOID ReadAllMeta(struct IFFPicture *picture)
         meta = EnsureMeta(picture);
         if (meta) {
             meta->xmp1Size = sp->sp_Size;
-            meta->xmp1 = (UBYTE *)AllocMem(meta->xmp1Size, MEMF_PUBLIC | MEMF_CLEAR);
+            meta->xmp1 = (UBYTE *)AllocPictureMem(picture, meta->xmp1Size, MEMF_PUBLIC);
             if (meta->xmp1) {
                 CopyMem(sp->sp_Data, meta->xmp1, sp->sp_Size);
             }
@@ -2344,14 +3568,14 @@ VOID ReadAllMeta(struct IFFPicture *picture)
             meta = EnsureMeta(picture);
             if (meta) {
                 meta->iccpCount = count;
-                meta->iccpArray = (UBYTE **)AllocMem(count * sizeof(UBYTE *), MEMF_PUBLIC | MEMF_CLEAR);
-                meta->iccpSizes = (ULONG *)AllocMem(count * sizeof(ULONG), MEMF_PUBLIC | MEMF_CLEAR);
+                meta->iccpArray = (UBYTE **)AllocPictureMem(picture, count * sizeof(UBYTE *), MEMF_PUBLIC | MEMF_CLEAR);
+                meta->iccpSizes = (ULONG *)AllocPictureMem(picture, count * sizeof(ULONG), MEMF_PUBLIC | MEMF_CLEAR);
                 if (meta->iccpArray && meta->iccpSizes) {
                     ci = FindCollection(picture->iff, picture->formtype, ID_ICCP);
                     for (i = 0; i < count && ci; i++, ci = ci->ci_Next) {
                         if (ci->ci_Size > 0) {
                             meta->iccpSizes[i] = ci->ci_Size;
-                            meta->iccpArray[i] = (UBYTE *)AllocMem(ci->ci_Size, MEMF_PUBLIC | MEMF_CLEAR);
+                            meta->iccpArray[i] = (UBYTE *)AllocPictureMem(picture, ci->ci_Size, MEMF_PUBLIC);
                             if (meta->iccpArray[i]) {
                                 CopyMem(ci->ci_Data, meta->iccpArray[i], ci->ci_Size);
                             }
@@ -2380,14 +3604,14 @@ VOID ReadAllMeta(struct IFFPicture *picture)
             meta = EnsureMeta(picture);
             if (meta) {
                 meta->iccnCount = count;
-                meta->iccnArray = (STRPTR *)AllocMem(count * sizeof(STRPTR), MEMF_PUBLIC | MEMF_CLEAR);
-                meta->iccnSizes = (ULONG *)AllocMem(count * sizeof(ULONG), MEMF_PUBLIC | MEMF_CLEAR);
+                meta->iccnArray = (STRPTR *)AllocPictureMem(picture, count * sizeof(STRPTR), MEMF_PUBLIC | MEMF_CLEAR);
+                meta->iccnSizes = (ULONG *)AllocPictureMem(picture, count * sizeof(ULONG), MEMF_PUBLIC | MEMF_CLEAR);
                 if (meta->iccnArray && meta->iccnSizes) {
                     ci = FindCollection(picture->iff, picture->formtype, ID_ICCN);
                     for (i = 0; i < count && ci; i++, ci = ci->ci_Next) {
                         if (ci->ci_Size > 0) {
                             meta->iccnSizes[i] = ci->ci_Size + 1;
-                            meta->iccnArray[i] = (STRPTR)AllocMem(meta->iccnSizes[i], MEMF_PUBLIC | MEMF_CLEAR);
+                            meta->iccnArray[i] = (STRPTR)AllocPictureMem(picture, meta->iccnSizes[i], MEMF_PUBLIC);
                             if (meta->iccnArray[i]) {
                                 CopyMem(ci->ci_Data, meta->iccnArray[i], ci->ci_Size);
                                 meta->iccnArray[i][ci->ci_Size] = '\0';
@@ -2417,14 +3641,14 @@ VOID ReadAllMeta(struct IFFPicture *picture)
             meta = EnsureMeta(picture);
             if (meta) {
                 meta->geotCount = count;
-                meta->geotArray = (UBYTE **)AllocMem(count * sizeof(UBYTE *), MEMF_PUBLIC | MEMF_CLEAR);
-                meta->geotSizes = (ULONG *)AllocMem(count * sizeof(ULONG), MEMF_PUBLIC | MEMF_CLEAR);
+                meta->geotArray = (UBYTE **)AllocPictureMem(picture, count * sizeof(UBYTE *), MEMF_PUBLIC | MEMF_CLEAR);
+                meta->geotSizes = (ULONG *)AllocPictureMem(picture, count * sizeof(ULONG), MEMF_PUBLIC | MEMF_CLEAR);
                 if (meta->geotArray && meta->geotSizes) {
                     ci = FindCollection(picture->iff, picture->formtype, ID_GEOT);
                     for (i = 0; i < count && ci; i++, ci = ci->ci_Next) {
                         if (ci->ci_Size > 0) {
                             meta->geotSizes[i] = ci->ci_Size;
-                            meta->geotArray[i] = (UBYTE *)AllocMem(ci->ci_Size, MEMF_PUBLIC | MEMF_CLEAR);
+                            meta->geotArray[i] = (UBYTE *)AllocPictureMem(picture, ci->ci_Size, MEMF_PUBLIC);
                             if (meta->geotArray[i]) {
                                 CopyMem(ci->ci_Data, meta->geotArray[i], ci->ci_Size);
                             }
@@ -2453,7 +3677,7 @@ VOID ReadAllMeta(struct IFFPicture *picture)
             meta = EnsureMeta(picture);
             if (meta) {
                 meta->geofCount = count;
-                meta->geofArray = (ULONG *)AllocMem(count * sizeof(ULONG), MEMF_PUBLIC | MEMF_CLEAR);
+                meta->geofArray = (ULONG *)AllocPictureMem(picture, count * sizeof(ULONG), MEMF_PUBLIC);
                 if (meta->geofArray) {
                     ci = FindCollection(picture->iff, picture->formtype, ID_GEOF);
                     for (i = 0; i < count && ci; i++, ci = ci->ci_Next) {
@@ -2472,6 +3696,35 @@ VOID ReadAllMeta(struct IFFPicture *picture)
     }
 }
 
+/*
+** LoadMeta - Copy the metadata of the current image on first use (internal)
+** Returns: Pointer to the metadata structure, or NULL if there is none
+**
+** ParseIFFPicture() only notes that the stored chunks hold metadata; the
+** copies are made when a metadata function asks for them, or just before
+** the chunks go away with the IFF context.
+*/
+struct IFFPictureMeta *LoadMeta(struct IFFPicture *picture)
+{
+    if (picture->metaPending) {
+        picture->metaPending = FALSE;
+        ReadAllMeta(picture);
+    }
+    return picture->metadata;
+}
+
+/*
+** SetIFFPictureMetadata - Choose whether metadata chunks are read at all
+** With FALSE the chunks are skipped while parsing and the metadata
+** functions return NULL. Takes effect from the next ParseIFFPicture().
+*/
+VOID SetIFFPictureMetadata(struct IFFPicture *picture, BOOL read)
+{
+    if (picture) {
+        picture->readMeta = read;
+    }
+}
+
 /*
 ** Decode - Decode image data to RGB
 ** Returns: RETURN_OK on success, RETURN_FAIL on error
@@ -2507,9 +3760,8 @@ LONG Decode(struct IFFPicture *picture)
     
     /* Allocate RGB pixel buffer - use public memory (not chip RAM, we're not rendering to display) */
     /* For YUVN, we'll check for alpha and reallocate if needed in DecodeYUVN() */
-    picture->pixelDataSize = (ULONG)width * height * 3;
-    picture->pixelData = (UBYTE *)AllocMem(picture->pixelDataSize, MEMF_PUBLIC | MEMF_CLEAR);
-    if (!picture->pixelData) {
+    /* Not cleared - the decoders store every pixel, and DEEP clears its own canvas */
+    if (!AllocPixelData(picture, (ULONG)width * height * 3, 0)) {
         SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate pixel data buffer");
         return RETURN_FAIL;
     }
@@ -2556,11 +3808,7 @@ LONG Decode(struct IFFPicture *picture)
         picture->isDecoded = TRUE;
     } else {
         /* Clean up on error */
-        if (picture->pixelData) {
-            FreeMem(picture->pixelData, picture->pixelDataSize);
-            picture->pixelData = NULL;
-            picture->pixelDataSize = 0;
-        }
+        FreePixelData(picture);
     }
     
     return result;
@@ -24,11 +24,40 @@
 struct IFFPicture;      /* Opaque structure - use accessor functions */
 struct BitMapHeader;    /* Public structure defined below */
 struct IFFColorMap;      /* Public structure defined below */
+struct AnimHeader;       /* Public structure defined below */
+struct AnimRect;         /* Public structure defined below */
 struct PNGConfig;        /* Defined in png_encoder.h from libpng */
 /* Note: struct IFFHandle is defined in libraries/iffparse.h */
 
 /*****************************************************************************/
 
+/* Reentrancy
+ *
+ * The library has no writable global or static data. Everything it reads,
+ * decodes or reports, including the error code and string, the
+ * GetImageInfo() result and the lists returned by the ReadAll functions,
+ * lives in the IFFPicture it was called with. Any number of IFFPictures
+ * may therefore be loaded and decoded by different tasks at the same time,
+ * as long as each IFFPicture is only used by one task at a time.
+ *
+ * - IFFParseBase must be opened once, before the first picture is used,
+ *   and stay open until the last one is freed. It is shared by all tasks.
+ * - Pictures initialized with InitIFFPictureasDOS(),
+ *   InitIFFPictureasBuffered() or InitIFFPictureasPrefetch(), and
+ *   ProbeIFFPicture(), call dos.library and must be used from a Process.
+ *   Memory streams make no DOS calls.
+ * - A picture initialized with InitIFFPictureasPrefetch() waits for its
+ *   reads on a message port of the task that initialized it, so only
+ *   that task may use it until CloseIFFPicture().
+ * - The IFFALLOC_POOL and IFFALLOC_ARENA allocators belong to one picture
+ *   and need no locking. An IFFAllocator shared by several pictures must
+ *   do its own locking (e.g. with a SignalSemaphore).
+ * - A memory buffer may be shared by several pictures on different tasks,
+ *   because memory streams only read it.
+ */
+
+/*****************************************************************************/
+
 /* MAKE_ID macro for creating IFF chunk identifiers */
 #define MAKE_ID(a,b,c,d) \
         ((ULONG) (a)<<24 | (ULONG) (b)<<16 | (ULONG) (c)<<8 | (ULONG) (d))
@@ -46,9 +75,57 @@ struct PNGConfig;        /* Defined in png_encoder.h from libpng */
  *                    structure. The structure MUST have already been closed
  *                    with CloseIFFPicture(). Frees all allocated memory
  *                    including BMHD, CMAP, and pixel data.
+ *
+ * ResetIFFPicture() - Returns an IFFPicture to the state AllocIFFPicture()
+ *                     left it in, closing the IFF stream if still open, so
+ *                     it can load the next file. The pixel and palette index
+ *                     buffers are kept and reused when the next image fits;
+ *                     for batch conversion reset one IFFPicture per file
+ *                     rather than allocating a new one. Pointers returned by
+ *                     the getters become invalid.
  */
 struct IFFPicture *AllocIFFPicture(VOID);
 VOID FreeIFFPicture(struct IFFPicture *picture);
+VOID ResetIFFPicture(struct IFFPicture *picture);
+
+/* Memory allocators for SetIFFPictureAllocator()
+ *
+ * IFFALLOC_SYSTEM - AllocMem()/FreeMem() for every allocation (default)
+ * IFFALLOC_POOL   - An exec memory pool owned by the IFFPicture, so the
+ *                   many small chunk and header allocations share puddles;
+ *                   deleted as a whole by FreeIFFPicture()
+ * IFFALLOC_ARENA  - Allocations are carved from large blocks and freeing is
+ *                   a no-op; all blocks are released by ResetIFFPicture()
+ *                   and FreeIFFPicture(), including the reusable buffers
+ * IFFALLOC_CUSTOM - The caller's IFFAllocator callbacks
+ */
+#define IFFALLOC_SYSTEM     0
+#define IFFALLOC_POOL       1
+#define IFFALLOC_ARENA      2
+#define IFFALLOC_CUSTOM     3
+
+/* IFFAllocator - caller supplied allocator for IFFALLOC_CUSTOM
+ * ia_Alloc() gets exec MEMF_ flags and must return memory cleared when
+ * MEMF_CLEAR is set; without it the library fills every byte itself.
+ * ia_Free() is given the size that was allocated.
+ */
+struct IFFAllocator {
+    APTR (*ia_Alloc)(struct IFFAllocator *allocator, ULONG size, ULONG flags);
+    VOID (*ia_Free)(struct IFFAllocator *allocator, APTR memory, ULONG size);
+    APTR ia_UserData;                   /* For the caller's use */
+};
+
+/* SetIFFPictureAllocator() - Selects where an IFFPicture gets its memory.
+ *                            Call after AllocIFFPicture() or
+ *                            ResetIFFPicture(), before a file is opened;
+ *                            anything still held is freed first. custom is
+ *                            only used with IFFALLOC_CUSTOM and must stay
+ *                            valid until the IFFPicture is freed. Returns
+ *                            RETURN_OK, or RETURN_FAIL if a stream is open,
+ *                            the type is unknown or the pool cannot be
+ *                            created (the allocator is left unchanged).
+ */
+LONG SetIFFPictureAllocator(struct IFFPicture *picture, ULONG type, struct IFFAllocator *custom);
 
 /*****************************************************************************/
 
@@ -59,6 +136,42 @@ VOID FreeIFFPicture(struct IFFPicture *picture);
  *                         The iff_Stream field must be set by the caller after
  *                         calling Open() to get a BPTR file handle.
  *
+ * InitIFFPictureasMemory() - Initializes the IFFPicture to read a complete
+ *                            IFF file from a memory buffer instead of a
+ *                            file. The buffer is used in place and must
+ *                            stay valid until CloseIFFPicture(). No
+ *                            iff_Stream needs to be set; call
+ *                            OpenIFFPicture() with IFFF_READ next. Memory
+ *                            streams are read-only.
+ *
+ * InitIFFPictureasBuffered() - Reads a whole file into memory with one
+ *                              Read() and initializes the IFFPicture as a
+ *                              memory stream over it. ACBM and YUVN
+ *                              planes are then decoded in place; ILBM
+ *                              BODY, DEEP DBOD and FAXX PAGE data are
+ *                              still copied out with ReadChunkBytes().
+ *                              The buffer is freed by
+ *                              CloseIFFPicture(). Returns RETURN_WARN,
+ *                              leaving the file rewound, when it is larger
+ *                              than maxSize or not seekable; use
+ *                              InitIFFPictureasDOS() then.
+ *
+ * InitIFFPictureasPrefetch() - Initializes the IFFPicture to read a file
+ *                              through a ring of numBlocks blocks of
+ *                              blockSize bytes (0 picks defaults) that are
+ *                              kept queued at the filesystem handler as
+ *                              asynchronous reads, so the next part of the
+ *                              image is fetched while the current one is
+ *                              decoded. Meant for files too large for
+ *                              InitIFFPictureasBuffered(), especially on
+ *                              slow or network filesystems. iff_Stream is
+ *                              set, and the file handle must stay open
+ *                              until CloseIFFPicture(). Returns
+ *                              RETURN_WARN for NIL:, interactive or
+ *                              unseekable files, or when the ring does not
+ *                              fit in memory; use InitIFFPictureasDOS()
+ *                              then.
+ *
  * OpenIFFPicture() - Prepares an IFFPicture to read or write a new IFF stream.
  *                    The direction of I/O is given by rwMode (IFFF_READ or
  *                    IFFF_WRITE). The IFFPicture must have been initialized
@@ -76,12 +189,27 @@ VOID FreeIFFPicture(struct IFFPicture *picture);
  * ParseIFFPicture() - Parses the IFF file structure and reads property chunks
  *                    (BMHD, CMAP, CAMG, etc.) into the IFFPicture structure.
  *                    Must be called after OpenIFFPicture(). Returns 0 on
- *                    success or an error code on failure.
+ *                    success or an error code on failure. For a CAT or LIST
+ *                    file the first supported FORM inside it is read.
+ *
+ * NextIFFPicture() - Moves on to the next picture FORM of a CAT or LIST and
+ *                    reads its property chunks, replacing the current image
+ *                    (pointers returned by the getters become invalid).
+ *                    PROP chunks of a LIST are inherited by the FORMs that
+ *                    follow them. The file is read in one pass, so decode
+ *                    each picture before calling this. Returns RETURN_OK
+ *                    when a picture was read, RETURN_WARN when there are
+ *                    no more (always for a plain FORM file), or RETURN_FAIL
+ *                    on error.
  */
 VOID InitIFFPictureasDOS(struct IFFPicture *picture);
+VOID InitIFFPictureasMemory(struct IFFPicture *picture, const UBYTE *buffer, ULONG length);
+LONG InitIFFPictureasBuffered(struct IFFPicture *picture, BPTR filehandle, ULONG maxSize);
+LONG InitIFFPictureasPrefetch(struct IFFPicture *picture, BPTR filehandle, ULONG blockSize, ULONG numBlocks);
 LONG OpenIFFPicture(struct IFFPicture *picture, LONG rwMode);
 VOID CloseIFFPicture(struct IFFPicture *picture);
 LONG ParseIFFPicture(struct IFFPicture *picture);
+LONG NextIFFPicture(struct IFFPicture *picture);
 
 /*****************************************************************************/
 
@@ -347,7 +475,18 @@ struct GEOFList {
  * 
  * For chunks that can appear multiple times (CRNG, ANNO, TEXT),
  * use ReadAllX() functions to get all instances.
+ *
+ * The chunks are copied the first time any of these functions is called,
+ * or just before CloseIFFPicture() or DecodeNextFrame() would release them.
+ *
+ * SetIFFPictureMetadata() - With read FALSE the metadata chunks are not
+ *                           declared to iffparse.library, so they are
+ *                           skipped unread while parsing and every
+ *                           function here returns NULL. Call before
+ *                           ParseIFFPicture(); the setting is kept by
+ *                           ResetIFFPicture(). The default is TRUE.
  */
+VOID SetIFFPictureMetadata(struct IFFPicture *picture, BOOL read);
 struct Point2D *ReadGRAB(struct IFFPicture *picture);
 struct DestMerge *ReadDEST(struct IFFPicture *picture);
 UWORD *ReadSPRT(struct IFFPicture *picture);
@@ -396,6 +535,12 @@ struct GEOFList *ReadAllGEOF(struct IFFPicture *picture);
  * GetFormType() - Returns the IFF FORM type identifier (e.g., ID_ILBM, ID_PBM).
  *                 This identifies the image format variant.
  *
+ * GetContainerType() - Returns ID_CAT or ID_LIST if the file is a container
+ *                      read with NextIFFPicture(), or 0 for a single FORM.
+ *
+ * GetImageIndex() - Returns the index of the current picture within a CAT or
+ *                   LIST (0 for the first one).
+ *
  * GetVPModes() - Returns the Amiga viewport mode flags from the CAMG chunk.
  *                The returned ULONG contains flags such as vmHAM, vmEXTRA_HALFBRITE,
  *                vmLACE, vmHIRES, etc. Returns 0 if CAMG chunk is not present.
@@ -430,8 +575,9 @@ struct GEOFList *ReadAllGEOF(struct IFFPicture *picture);
  *                  all core image properties (dimensions, format, flags, etc.)
  *                  in a single structure. This is useful for getting a complete
  *                  overview of the image without making multiple function calls.
- *                  The structure is allocated statically and remains valid until
- *                  the next call to GetImageInfo() or until the IFFPicture is freed.
+ *                  The structure is part of the IFFPicture and remains valid
+ *                  until the next call to GetImageInfo() on that picture or
+ *                  until the IFFPicture is freed.
  *                  Returns NULL if the picture is invalid or not loaded.
  */
 struct IFFHandle *GetIFFHandle(struct IFFPicture *picture);
@@ -439,6 +585,8 @@ UWORD GetWidth(struct IFFPicture *picture);
 UWORD GetHeight(struct IFFPicture *picture);
 UWORD GetDepth(struct IFFPicture *picture);
 ULONG GetFormType(struct IFFPicture *picture);
+ULONG GetContainerType(struct IFFPicture *picture);
+ULONG GetImageIndex(struct IFFPicture *picture);
 ULONG GetVPModes(struct IFFPicture *picture);
 UBYTE GetFAXXCompression(struct IFFPicture *picture);  /* Returns FAXX compression type (0=None, 1=MH, 2=MR, 4=MMR) */
 struct BitMapHeader *GetBMHD(struct IFFPicture *picture);
@@ -470,10 +618,25 @@ struct IFFImageInfo {
     BOOL isGrayscale;           /* TRUE if image is grayscale */
     BOOL isLoaded;              /* TRUE if image has been loaded/parsed */
     BOOL isDecoded;             /* TRUE if image has been decoded */
+    UBYTE compression;          /* Compression byte from the image header */
+    UBYTE masking;              /* BMHD masking (mskNone, mskHasMask, ...) */
 };
 
 struct IFFImageInfo *GetImageInfo(struct IFFPicture *picture);
 
+/* ProbeIFFPicture() - Fills in an IFFImageInfo from the header chunks of a
+ *                     file opened with Open(), without an IFFPicture. Only
+ *                     BMHD, CAMG, YCHD, FXHD, DGBL and DPEL are read;
+ *                     everything else, including the image data, is
+ *                     skipped with Seek(), and the probe stops at the first
+ *                     BODY, ABIT, PAGE, DATY or DBOD (its size is returned
+ *                     in compressedSize). The first picture of a CAT, LIST
+ *                     or ANIM is described. Returns RETURN_OK, or
+ *                     RETURN_FAIL if the file is not a supported picture.
+ *                     The file position is left inside the file.
+ */
+LONG ProbeIFFPicture(BPTR filehandle, struct IFFImageInfo *info);
+
 /*****************************************************************************/
 
 /* Decoding Functions
@@ -549,6 +712,53 @@ VOID FreeRastPort(struct RastPort *rp);
 
 /*****************************************************************************/
 
+/* Animation Functions
+ *
+ * IsAnimation() - Returns TRUE if the file is a FORM ANIM, or a FORM DEEP
+ *                 with a DCHG chunk. For ANIM, ParseIFFPicture() loads the
+ *                 first frame's FORM ILBM, so GetFormType() reports ID_ILBM
+ *                 and all getters and decoders describe that frame. For
+ *                 DEEP, the first DLOC/DBOD pair is the first frame.
+ *
+ * DecodeNextFrame() - Reads the next frame (ANHD plus DLTA, or a full BODY),
+ *                     applies it to the animation's bitplanes and decodes the
+ *                     result, replacing the previous frame's pixel data and
+ *                     palette indices. Deltas are applied incrementally to a
+ *                     planar double buffer, so frames are never rebuilt from
+ *                     scratch. The first frame must have been decoded with
+ *                     Decode() or DecodeToRGB(). Supports delta compressions
+ *                     0 (BODY), 5 (byte vertical) and 7/8 (short/long
+ *                     vertical). For DEEP the next DLOC/DBOD tile is
+ *                     decoded into the existing canvas. Returns RETURN_OK
+ *                     when a frame was decoded,
+ *                     RETURN_WARN at the end of the animation, or RETURN_FAIL
+ *                     on error.
+ *
+ * GetFrameNumber() - Returns the number of the frame currently decoded
+ *                    (0 for the first frame).
+ *
+ * GetANHD() - Returns the ANHD header of the current frame, or NULL if the
+ *             frame has none (usually the first frame). The reltime field
+ *             gives the frame delay in jiffies (1/60 s).
+ *
+ * GetFrameDelay() - Returns how long the current frame is shown, as num/den
+ *                   seconds (ANHD reltime in jiffies, or DCHG FrameRate in
+ *                   milliseconds). Both are 0 and 1 if the file gives none.
+ *
+ * GetFrameRect() - Returns the area, in pixels, that differs from the frame
+ *                  decoded before it. Covers the whole image for the first
+ *                  frame; w and h are 0 if nothing changed. Returns NULL if
+ *                  the picture is not an animation.
+ */
+BOOL IsAnimation(struct IFFPicture *picture);
+LONG DecodeNextFrame(struct IFFPicture *picture);
+ULONG GetFrameNumber(struct IFFPicture *picture);
+struct AnimHeader *GetANHD(struct IFFPicture *picture);
+VOID GetFrameDelay(struct IFFPicture *picture, ULONG *num, ULONG *den);
+struct AnimRect *GetFrameRect(struct IFFPicture *picture);
+
+/*****************************************************************************/
+
 /* Analysis Functions
  *
  * AnalyzeFormat() - Analyzes the loaded IFF image to determine its properties
@@ -637,7 +847,8 @@ struct BitMapHeader {
     UBYTE masking;          /* masking technique (use msk* constants below) */
     UBYTE compression;      /* compression algorithm:
                              *   0 = none
-                             *   1 = ByteRun1 (RLE) */
+                             *   1 = ByteRun1 (RLE)
+                             *   2 = VDAT (vertical word RLE, ILBM/ACBM) */
     UBYTE pad1;             /* unused; ignore on read, write as 0 */
     UWORD transparentColor; /* transparent "color number" (palette index)
                              *   only valid if masking == mskHasTransparentColor */
@@ -912,6 +1123,33 @@ struct TVDCHeader {
 
 /*****************************************************************************/
 
+/* ANIM Header structures - public
+ *
+ * AnimHeader represents the ANHD chunk found in each frame of a FORM ANIM.
+ * It describes how the frame's DLTA chunk is compressed and when the frame
+ * is shown. The chunk is 40 bytes, read field by field from the file.
+ */
+struct AnimHeader {
+    UBYTE operation;    /* Delta compression (0 = BODY, 5, 7, 8; see anim_decoder.c) */
+    UBYTE mask;         /* Planes affected (XOR mode only) */
+    UWORD w, h;         /* Size of the changed area (XOR mode only) */
+    WORD x, y;          /* Position of the changed area (XOR mode only) */
+    ULONG abstime;      /* Jiffies since the first frame (unused by most players) */
+    ULONG reltime;      /* Jiffies (1/60 s) to wait before showing this frame */
+    UBYTE interleave;   /* Frames back the delta applies to; 0 means 2 */
+    UBYTE pad0;
+    ULONG bits;         /* Compression option bits (short/long data, XOR, ...) */
+    UBYTE pad[16];
+};
+
+/* AnimRect structure - a rectangle in pixels */
+struct AnimRect {
+    UWORD x, y;         /* Top left corner */
+    UWORD w, h;         /* Size (0 if empty) */
+};
+
+/*****************************************************************************/
+
 /* IFF Form Type IDs
  *
  * These constants identify the different IFF image format variants.
@@ -943,6 +1181,10 @@ struct TVDCHeader {
  *           Supports CCIR-601-2 standard for PAL and NTSC. Stores Y (luminance)
  *           and optional U, V (color difference) channels. Supports various
  *           subsampling modes (411, 422, 444) and grayscale (400).
+ *
+ * ID_ANIM - Animation: A FORM ANIM holding a FORM ILBM per frame. The first
+ *           frame has a full BODY, later frames an ANHD header and a DLTA
+ *           chunk with the changes. Decoded as ILBM, see IsAnimation().
  */
 #define ID_ILBM    MAKE_ID('I','L','B','M')  /* InterLeaved BitMap */
 #define ID_PBM     MAKE_ID('P','B','M',' ')  /* Packed BitMap */
@@ -952,6 +1194,7 @@ struct TVDCHeader {
 #define ID_ACBM    MAKE_ID('A','C','B','M')  /* Amiga Continuous BitMap */
 #define ID_FAXX    MAKE_ID('F','A','X','X')  /* Facsimile Image */
 #define ID_YUVN    MAKE_ID('Y','U','V','N')  /* YUV format (MacroSystem VLab) */
+#define ID_ANIM    MAKE_ID('A','N','I','M')  /* Animation (FORM ILBM frames) */
 
 /*****************************************************************************/
 
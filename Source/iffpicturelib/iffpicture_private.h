@@ -12,6 +12,7 @@
 #include <exec/types.h>
 #include <exec/memory.h>
 #include <libraries/iffparse.h>
+#include <utility/hooks.h>
 #include <dos/dos.h>
 
 /* IFF Chunk IDs */
@@ -31,6 +32,10 @@
 #define ID_CMYK    0x434D594BUL  /* 'CMYK' */
 #define ID_DCOL    0x44434F4CUL  /* 'DCOL' */
 #define ID_DPI     0x44504920UL  /* 'DPI ' */
+#define ID_VDAT    0x56444154UL  /* 'VDAT' - vertical RLE plane (BODY compression 2) */
+/* ANIM chunk IDs */
+#define ID_ANHD    0x414E4844UL  /* 'ANHD' - animation frame header */
+#define ID_DLTA    0x444C5441UL  /* 'DLTA' - animation delta data */
 /* YUVN chunk IDs */
 #define ID_YCHD    0x59434844UL  /* 'YCHD' - YUVN header */
 #define ID_DATY    0x44415459UL  /* 'DATY' - Y (luminance) data */
@@ -80,6 +85,7 @@
 /* Compression types */
 #define cmpNone         0
 #define cmpByteRun1     1
+#define cmpVDAT         2  /* Vertical word RLE (DPaint IV/V, Brilliance) */
 
 /* DEEP compression types */
 #define DEEP_COMPRESS_NONE         0
@@ -110,6 +116,141 @@
 #define HAMCODE_RED     2
 #define HAMCODE_GREEN   3
 
+/* PCHG compression and flags */
+#define PCHG_COMP_NONE      0
+#define PCHG_COMP_HUFFMAN   1
+#define PCHGF_12BIT         0x0001  /* SmallLineChanges (4 bits per gun) */
+#define PCHGF_32BIT         0x0002  /* BigLineChanges (8 bits per gun) */
+#define PCHGF_USE_ALPHA     0x0004  /* Alpha values present (ignored) */
+
+/* Line palette LUT: 256 registers of 8-bit RGB */
+#define LINEPALETTE_MAXREGS 256
+#define LINEPALETTE_LUTSIZE (LINEPALETTE_MAXREGS * 3)
+
+/* LineColorChange - one palette register change (8-bit components) */
+struct LineColorChange {
+    UBYTE reg;
+    UBYTE red, green, blue;
+};
+
+/* LinePalette - per-row palette changes decoded from PCHG, SHAM or CTBL */
+struct LinePalette {
+    UWORD numRows;                      /* Rows covered (image height) */
+    UWORD numRegs;                      /* Highest register changed + 1 */
+    UWORD lastRow;                      /* Last row closed off while building */
+    ULONG *rowStart;                    /* numRows+1 indexes into changes */
+    ULONG rowStartSize;                 /* Size of rowStart in bytes */
+    struct LineColorChange *changes;    /* Change records, grouped by row */
+    ULONG numChanges;                   /* Number of change records used */
+    ULONG maxChanges;                   /* Number of change records allocated */
+    UBYTE lut[LINEPALETTE_LUTSIZE];     /* Current row's palette (8-bit RGB) */
+};
+
+/* ANIM delta compressions (AnimHeader.operation) */
+#define ANIM_OP_BODY        0   /* Full ILBM BODY */
+#define ANIM_OP_BYTEVERT    5   /* Byte vertical delta */
+#define ANIM_OP_SHORTLONG7  7   /* Short/long vertical delta, separate data list */
+#define ANIM_OP_SHORTLONG8  8   /* Short/long vertical delta, interleaved data */
+
+/* ANIM delta option bits (AnimHeader.bits) */
+#define ANIMF_LONGDATA      0x0001  /* Op 7/8: data is in longwords, not words */
+#define ANIMF_XOR           0x0002  /* Op 5: XOR data into the planes */
+
+/* ChunkTOCEntry - one chunk of a memory stream, in file order */
+struct ChunkTOCEntry {
+    ULONG id;                           /* Chunk ID, or FORM/CAT/LIST/PROP */
+    ULONG type;                         /* FORM type it belongs to (own type for groups) */
+    ULONG offset;                       /* Offset of the chunk header */
+    ULONG size;                         /* Bytes of contents (after the type for groups) */
+    UWORD depth;                        /* Number of enclosing groups */
+};
+
+/* Pixel and palette index buffers an IFFPicture keeps for reuse */
+#define IMAGE_SPARES        2
+
+/* IFFArenaBlock - one block of an IFFALLOC_ARENA allocator, data follows */
+struct IFFArenaBlock {
+    struct IFFArenaBlock *next;         /* Older block, NULL for the first */
+    ULONG size;                         /* Bytes of data in this block */
+    ULONG used;                         /* Bytes handed out so far */
+    ULONG pad;                          /* Keeps the data 8-byte aligned */
+};
+
+/* IFFMemStream - memory buffer stream behind InitIFFPictureasMemory() */
+struct IFFMemStream {
+    struct Hook hook;                   /* iffparse custom stream hook */
+    const UBYTE *buffer;                /* Caller's buffer, not copied */
+    ULONG length;
+    ULONG position;                     /* Next byte iffparse reads */
+    UBYTE *ownBuffer;                   /* File image owned by the library, or NULL */
+    ULONG ownSize;
+    struct ChunkTOCEntry *toc;          /* Chunk index, built on first use */
+    ULONG tocCount;
+    ULONG tocMax;                       /* Entries allocated */
+};
+
+/* IFFPrefetch - asynchronous read-ahead stream behind InitIFFPictureasPrefetch() */
+#define PREFETCH_IDLE       0   /* Empty, not sent to the handler */
+#define PREFETCH_PENDING    1   /* ACTION_READ sent, no reply yet */
+#define PREFETCH_READY      2   /* Reply received, data in the buffer */
+
+struct IFFPrefetchBlock {
+    UBYTE *buffer;
+    struct DosPacket *packet;           /* From AllocDosObject(DOS_STDPKT) */
+    UWORD state;                        /* PREFETCH_xxx */
+    LONG length;                        /* Bytes read into the buffer */
+    LONG offset;                        /* Bytes already handed to iffparse */
+};
+
+struct IFFPrefetch {
+    struct Hook hook;                   /* iffparse custom stream hook */
+    BPTR file;                          /* Caller's file handle, not closed */
+    struct MsgPort *handler;            /* Filesystem handler of the file */
+    LONG handlerArg;                    /* fh_Arg1, identifies the file to the handler */
+    struct MsgPort *replyPort;          /* Packet replies come back here */
+    struct IFFPrefetchBlock *blocks;    /* Ring, read in order from current */
+    ULONG numBlocks;
+    ULONG blockSize;
+    ULONG current;                      /* Block iffparse reads from */
+    LONG position;                      /* File position of the next byte iffparse reads */
+    LONG sentPosition;                  /* File position after the last block sent */
+    BOOL eof;                           /* Short read seen - send no more blocks */
+    LONG error;                         /* dp_Res2 of a failed read, or 0 */
+};
+
+/* InverseCMap - RGB to palette index lookup (color_map.c) */
+#define ICM_MAXCOLORS       256             /* Largest palette */
+#define ICM_HASHSIZE        512             /* Twice the largest palette */
+#define ICM_VALID           0x01000000UL    /* Set in every used hash key */
+
+struct InverseCMap {
+    UBYTE palette[256 * 3];             /* Entries scaled to 8 bits per gun */
+    ULONG numColors;
+    ULONG hashKey[ICM_HASHSIZE];        /* ICM_VALID | RGB, 0 for an empty slot */
+    UBYTE hashIndex[ICM_HASHSIZE];
+    UBYTE cube[32768];                  /* Nearest entry per 5:5:5 cell */
+    ULONG cubeFilled[32768 / 32];       /* One bit per cell that is set */
+    ULONG lastKey;                      /* Last colour looked up and its index */
+    UBYTE lastIndex;
+};
+
+/* IFFAnim - FORM ANIM playback state (anim_decoder.c) */
+struct IFFAnim {
+    UBYTE *planes[2];                   /* Double-buffered plane-major bitplanes */
+    ULONG planeDataSize;                /* Size of each plane buffer */
+    UWORD rowBytes;                     /* Bytes per plane row */
+    UWORD numPlanes;                    /* Planes stored (depth plus mask) */
+    UWORD shown;                        /* Index of the buffer with the current frame */
+    BOOL loaded;                        /* TRUE once the first BODY is in planes[] */
+    ULONG frame;                        /* Current frame number (0 = first BODY) */
+    struct AnimHeader anhd;             /* ANHD of the current frame */
+    BOOL hasANHD;                       /* TRUE if anhd is valid */
+    UBYTE *dlta;                        /* Reusable DLTA staging buffer */
+    ULONG dltaSize;                     /* Size of dlta buffer */
+    struct AnimRect lastDelta;          /* Area touched by the previous delta */
+    struct AnimRect frameRect;          /* Area that differs from the previous frame */
+};
+
 /* IFFPictureMeta structure - metadata storage, allocated on demand */
 struct IFFPictureMeta {
     /* Standard metadata storage - library owns all memory */
@@ -169,6 +310,17 @@ struct IFFPictureMeta {
     ULONG *geof;                        /* GEOF chunk (first instance) - 4-byte chunk ID */
     ULONG geofCount;                    /* Number of GEOF chunks */
     ULONG *geofArray;                   /* Array of all GEOF chunk IDs */
+    /* Lists returned by the ReadAll functions */
+    struct CRangeList crngList;
+    struct TextList annotationList;
+    struct TextList textList;
+    struct BinaryDataList exifList;
+    struct BinaryDataList iptcList;
+    struct BinaryDataList xmp0List;
+    struct BinaryDataList iccpList;
+    struct TextList iccnList;
+    struct BinaryDataList geotList;
+    struct GEOFList geofList;
 };
 
 /* Complete IFFPicture structure - private implementation */
@@ -185,11 +337,30 @@ struct IFFPicture {
     /* Decoded image data */
     UBYTE *pixelData;
     ULONG pixelDataSize;
+    ULONG pixelDataAlloc;               /* Bytes allocated, at least pixelDataSize */
     BOOL hasAlpha;
     
     /* For indexed images: store original palette indices */
     UBYTE *paletteIndices;
     ULONG paletteIndicesSize;
+    ULONG paletteIndicesAlloc;          /* Bytes allocated, at least paletteIndicesSize */
+    
+    /* Image buffers kept for reuse by the next decode or image */
+    UBYTE *spareBuffer[IMAGE_SPARES];
+    ULONG spareSize[IMAGE_SPARES];
+    
+    /* Header and palette structures kept for reuse by the next image */
+    ULONG cmapAlloc;                    /* Bytes allocated at cmap->data */
+    struct BitMapHeader *spareBMHD;
+    struct IFFColorMap *spareCMap;      /* Keeps its data buffer */
+    ULONG spareCMapAlloc;               /* Bytes allocated at spareCMap->data */
+    struct IFFPictureMeta *spareMeta;   /* Structure only, strings are freed */
+    
+    /* Allocator for everything the picture owns - see SetIFFPictureAllocator() */
+    ULONG allocType;                    /* IFFALLOC_xxx */
+    struct IFFAllocator *allocator;     /* Caller's callbacks for IFFALLOC_CUSTOM */
+    APTR memPool;                       /* exec pool for IFFALLOC_POOL */
+    struct IFFArenaBlock *arena;        /* Newest block first for IFFALLOC_ARENA */
     
     /* Format analysis */
     BOOL isHAM;
@@ -222,8 +393,31 @@ struct IFFPicture {
     struct DCHGHeader *dchg;      /* DEEP change buffer (for animation) */
     struct TVDCHeader *tvdc;       /* TVPaint compression table */
     
+    /* Per-scanline palette (PCHG, SHAM, CTBL) - NULL if not present */
+    struct LinePalette *linePalette;
+    
+    /* FORM ANIM playback state - NULL for still images */
+    struct IFFAnim *anim;
+    
+    /* Memory stream state - NULL for DOS streams */
+    struct IFFMemStream *memStream;
+    
+    /* Read-ahead stream state - NULL unless InitIFFPictureasPrefetch() */
+    struct IFFPrefetch *prefetch;
+    
+    /* CAT/LIST iteration - containerType is 0 for a plain FORM file */
+    ULONG containerType;
+    ULONG imageIndex;
+    
     /* Metadata storage - allocated on demand */
     struct IFFPictureMeta *metadata;    /* Metadata structure, NULL if no metadata */
+    
+    /* Metadata is only copied out of the stored chunks when first asked for */
+    BOOL readMeta;                      /* FALSE skips metadata chunks while parsing */
+    BOOL metaPending;                   /* Stored chunks not yet copied to metadata */
+    
+    /* Filled in by GetImageInfo() */
+    struct IFFImageInfo info;
 };
 
 /* Internal function prototypes - declared in image_decoder.c */
@@ -231,6 +425,7 @@ LONG DecodeILBM(struct IFFPicture *picture);
 LONG DecodeHAM(struct IFFPicture *picture);
 LONG DecodeEHB(struct IFFPicture *picture);
 LONG DecodeDEEP(struct IFFPicture *picture);
+LONG DecodeNextDEEPFrame(struct IFFPicture *picture);
 LONG DecodePBM(struct IFFPicture *picture);
 LONG DecodeRGBN(struct IFFPicture *picture);
 LONG DecodeRGB8(struct IFFPicture *picture);
@@ -241,6 +436,7 @@ LONG AnalyzeFormat(struct IFFPicture *picture);
 LONG GetOptimalPNGConfig(struct IFFPicture *picture, struct PNGConfig *config, BOOL opaque);
 VOID SetIFFPictureError(struct IFFPicture *picture, LONG error, const char *message);
 VOID ReadAllMeta(struct IFFPicture *picture);
+struct IFFPictureMeta *LoadMeta(struct IFFPicture *picture);
 
 /* FAXX chunk reader function prototypes - declared in iffpicture.c */
 LONG ReadGPHD(struct IFFPicture *picture);
@@ -254,5 +450,51 @@ LONG ReadDBOD(struct IFFPicture *picture);
 LONG ReadDCHG(struct IFFPicture *picture);
 LONG ReadTVDC(struct IFFPicture *picture);
 
+/* Picture memory allocator - declared in utils.c */
+APTR AllocPictureMem(struct IFFPicture *picture, ULONG size, ULONG flags);
+VOID FreePictureMem(struct IFFPicture *picture, APTR memory, ULONG size);
+VOID ReleasePictureMem(struct IFFPicture *picture);
+VOID ClearBuffer(UBYTE *buffer, ULONG size);
+
+/* Reusable image buffers - declared in iffpicture.c */
+UBYTE *AllocPixelData(struct IFFPicture *picture, ULONG size, ULONG flags);
+VOID FreePixelData(struct IFFPicture *picture);
+UBYTE *AllocPaletteIndices(struct IFFPicture *picture, ULONG size, ULONG flags);
+VOID FreePaletteIndices(struct IFFPicture *picture);
+struct BitMapHeader *AllocBMHD(struct IFFPicture *picture);
+VOID FreeBMHD(struct IFFPicture *picture);
+struct IFFColorMap *AllocColorMap(struct IFFPicture *picture, ULONG numcolors);
+VOID FreeColorMap(struct IFFPicture *picture);
+
+/* In-place chunk access for memory streams - declared in iffpicture.c */
+const UBYTE *MapChunkData(struct IFFPicture *picture, ULONG size);
+LONG BuildChunkTOC(struct IFFPicture *picture);
+const UBYTE *FindFORMChunk(struct IFFPicture *picture, ULONG id, ULONG size);
+
+/* Inverse colour map - declared in color_map.c */
+struct InverseCMap *AllocInverseCMap(const UBYTE *palette, ULONG numColors, BOOL is4Bit);
+UBYTE MapRGBToIndex(struct InverseCMap *icm, UBYTE r, UBYTE g, UBYTE b);
+VOID FreeInverseCMap(struct InverseCMap *icm);
+LONG CountRGBColors(const UBYTE *rgb, ULONG pixelCount, UBYTE *colors);
+
+/* Read-ahead stream - declared in prefetch.c */
+VOID FreePrefetch(struct IFFPicture *picture);
+
+
+/* Line palette (PCHG/SHAM/CTBL) function prototypes - declared in line_palette.c */
+LONG ReadLinePalette(struct IFFPicture *picture);
+VOID FreeLinePalette(struct IFFPicture *picture, struct LinePalette *lp);
+UBYTE *InitLinePaletteLUT(struct IFFPicture *picture, ULONG *numColors);
+VOID ApplyLinePalette(struct LinePalette *lp, UWORD row);
+
+/* ILBM plane reader - declared in image_decoder.c */
+LONG ReadILBMPlanes(struct IFFPicture *picture, UBYTE *planeData,
+                    UWORD rowBytes, UWORD height, UWORD planes);
+
+/* ANIM function prototypes - declared in anim_decoder.c */
+struct IFFAnim *AllocIFFAnim(struct IFFPicture *picture);
+VOID FreeIFFAnim(struct IFFPicture *picture, struct IFFAnim *anim);
+UBYTE *GetAnimPlanes(struct IFFPicture *picture);
+
 #endif /* IFFPICTURE_PRIVATE_H */
 
@@ -121,19 +121,196 @@ LONG AnalyzeFormat(struct IFFPicture *picture)
             }
         }
         picture->isGrayscale = isGray;
-    } else if (!picture->isIndexed && picture->bmhd->nPlanes == 1) {
+    } else if (!picture->isIndexed && picture->bmhd->nPlanes == 1 && !picture->linePalette) {
         /* 1-bit non-indexed images are typically grayscale */
         picture->isGrayscale = TRUE;
     } else if (picture->formtype == ID_RGBN || 
-               picture->formtype == ID_RGB8 || picture->isHAM ||
+               picture->formtype == ID_RGB8 || picture->isHAM || picture->linePalette ||
                (picture->formtype == ID_ILBM && picture->bmhd->nPlanes == 24)) {
-        /* True-color formats are not grayscale by default */
+        /* True-color formats (and per-scanline palettes) are not grayscale by default */
         picture->isGrayscale = FALSE;
     }
     
     return RETURN_OK;
 }
 
+/*
+** CompactPalette - Keep only the palette entries an image uses (internal helper)
+** Returns: RETURN_OK on success, RETURN_FAIL if out of memory
+**
+** used flags the decoded indices that occur. Used entries are renumbered
+** densely in index order and entries with equal RGB are merged; the
+** transparent entry, if not -1, becomes entry 0 and is never merged, so
+** tRNS needs one byte. Sets index_map, allocating it if needed,
+** remap_indices and the bit depth for the remaining count.
+*/
+static LONG CompactPalette(struct PNGConfig *config, UBYTE *used, LONG transparent)
+{
+    struct PNGColor *compact;
+    struct PNGColor *palette;
+    ULONG numColors;
+    ULONG numUsed;
+    ULONG first;
+    ULONG i, j;
+    BOOL identity;
+    
+    numColors = (ULONG)config->num_palette;
+    if (numColors > 256) {
+        numColors = 256;
+    }
+    if (numColors == 0) {
+        return RETURN_OK;
+    }
+    
+    /* Both tables are kept off the stack */
+    if (!config->index_map) {
+        config->index_map = (UBYTE *)AllocMem(256, MEMF_PUBLIC);
+        if (!config->index_map) {
+            return RETURN_FAIL;
+        }
+    }
+    compact = (struct PNGColor *)AllocMem(256 * sizeof(struct PNGColor), MEMF_PUBLIC);
+    if (!compact) {
+        return RETURN_FAIL;
+    }
+    
+    /* The decoder clamps indices past the palette to its last entry */
+    for (i = numColors; i < 256; i++) {
+        if (used[i]) {
+            used[numColors - 1] = TRUE;
+        }
+    }
+    
+    numUsed = 0;
+    if (transparent >= 0) {
+        compact[0] = config->palette[transparent];
+        config->index_map[transparent] = 0;
+        numUsed = 1;
+    }
+    first = numUsed;
+    identity = (BOOL)(transparent <= 0);
+    
+    for (i = 0; i < numColors; i++) {
+        if ((LONG)i == transparent) {
+            continue;
+        }
+        config->index_map[i] = 0;
+        if (!used[i]) {
+            continue;
+        }
+        for (j = first; j < numUsed; j++) {
+            if (compact[j].red == config->palette[i].red &&
+                compact[j].green == config->palette[i].green &&
+                compact[j].blue == config->palette[i].blue) {
+                break;
+            }
+        }
+        if (j == numUsed) {
+            compact[numUsed++] = config->palette[i];
+        }
+        config->index_map[i] = (UBYTE)j;
+        if (j != i) {
+            identity = FALSE;
+        }
+    }
+    for (i = numColors; i < 256; i++) {
+        config->index_map[i] = config->index_map[numColors - 1];
+    }
+    if (numUsed == 0) {
+        FreeMem(compact, 256 * sizeof(struct PNGColor));
+        return RETURN_OK;
+    }
+    
+    /* Used entries already in place only need the unused tail cut off */
+    if (numUsed < (ULONG)config->num_palette) {
+        palette = (struct PNGColor *)AllocMem(numUsed * sizeof(struct PNGColor), MEMF_PUBLIC);
+        if (!palette) {
+            FreeMem(compact, 256 * sizeof(struct PNGColor));
+            return RETURN_FAIL;
+        }
+        CopyMem(compact, palette, numUsed * sizeof(struct PNGColor));
+        FreeMem(config->palette, config->num_palette * sizeof(struct PNGColor));
+        config->palette = palette;
+        config->num_palette = (int)numUsed;
+    } else if (!identity) {
+        CopyMem(compact, config->palette, numUsed * sizeof(struct PNGColor));
+    }
+    FreeMem(compact, 256 * sizeof(struct PNGColor));
+    config->remap_indices = (int)!identity;
+    
+    if (numUsed <= 2) {
+        config->bit_depth = 1;
+    } else if (numUsed <= 4) {
+        config->bit_depth = 2;
+    } else if (numUsed <= 16) {
+        config->bit_depth = 4;
+    } else {
+        config->bit_depth = 8;
+    }
+    
+    DEBUG_PRINTF2("DEBUG: CompactPalette - %ld of %ld palette entries kept\n", numUsed, numColors);
+    return RETURN_OK;
+}
+
+/*
+** ReduceToPalette - Use an exact palette for RGB data with few colours (internal helper)
+** Returns: RETURN_OK whether or not the image fits, RETURN_FAIL if out of memory
+**
+** Collects the distinct colours of the decoded RGB data with
+** CountRGBColors(), which gives up as soon as there are more than 256.
+** Otherwise they become the PNG palette in order of first use, and
+** palette_from_rgb tells the encoder to map the RGB data to it rather
+** than use any decoded indices.
+*/
+static LONG ReduceToPalette(struct IFFPicture *picture, struct PNGConfig *config)
+{
+    UBYTE *colors;
+    LONG numColors;
+    LONG i;
+    
+    colors = (UBYTE *)AllocMem(ICM_MAXCOLORS * 3, MEMF_PUBLIC);
+    if (!colors) {
+        return RETURN_FAIL;
+    }
+    
+    numColors = CountRGBColors(picture->pixelData,
+                               (ULONG)GetWidth(picture) * (ULONG)GetHeight(picture), colors);
+    if (numColors < 0) {
+        FreeMem(colors, ICM_MAXCOLORS * 3);
+        return RETURN_FAIL;
+    }
+    
+    if (numColors > 0 && numColors <= ICM_MAXCOLORS) {
+        config->palette = (struct PNGColor *)AllocMem(numColors * sizeof(struct PNGColor), MEMF_PUBLIC);
+        if (!config->palette) {
+            FreeMem(colors, ICM_MAXCOLORS * 3);
+            return RETURN_FAIL;
+        }
+        for (i = 0; i < numColors; i++) {
+            config->palette[i].red = colors[i * 3];
+            config->palette[i].green = colors[i * 3 + 1];
+            config->palette[i].blue = colors[i * 3 + 2];
+        }
+        config->num_palette = (int)numColors;
+        config->color_type = PNG_COLOR_TYPE_PALETTE;
+        config->palette_from_rgb = TRUE;
+        
+        if (numColors <= 2) {
+            config->bit_depth = 1;
+        } else if (numColors <= 4) {
+            config->bit_depth = 2;
+        } else if (numColors <= 16) {
+            config->bit_depth = 4;
+        } else {
+            config->bit_depth = 8;
+        }
+        DEBUG_PRINTF1("DEBUG: ReduceToPalette - %ld colours, using a palette\n", numColors);
+    }
+    
+    FreeMem(colors, ICM_MAXCOLORS * 3);
+    return RETURN_OK;
+}
+
 /*
 ** GetOptimalPNGConfig - Get optimal PNG configuration (implementation)
 ** Determines the best PNG color type, bit depth, and other settings
@@ -145,6 +322,12 @@ LONG GetOptimalPNGConfig(struct IFFPicture *picture, struct PNGConfig *config, B
 {
     ULONG i;
     ULONG numColors;
+    ULONG depth;
+    ULONG step;
+    UBYTE gray;
+    UBYTE *used;
+    ULONG pixelCount;
+    LONG transparent;
     
     if (!picture || !config || !picture->isLoaded) {
         SetIFFPictureError(picture, IFFPICTURE_INVALID, "Invalid parameters for PNG config");
@@ -170,6 +353,9 @@ LONG GetOptimalPNGConfig(struct IFFPicture *picture, struct PNGConfig *config, B
         config->num_palette = 0;
         config->trans = NULL;
         config->num_trans = 0;
+        config->index_map = NULL;
+        config->remap_indices = FALSE;
+        config->palette_from_rgb = FALSE;
         return RETURN_OK;
     }
     
@@ -191,6 +377,9 @@ LONG GetOptimalPNGConfig(struct IFFPicture *picture, struct PNGConfig *config, B
         config->num_palette = 0;
         config->trans = NULL;
         config->num_trans = 0;
+        config->index_map = NULL;
+        config->remap_indices = FALSE;
+        config->palette_from_rgb = FALSE;
         return RETURN_OK;
     }
     
@@ -213,10 +402,15 @@ LONG GetOptimalPNGConfig(struct IFFPicture *picture, struct PNGConfig *config, B
     config->num_palette = 0;
     config->trans = NULL;
     config->num_trans = 0;
+    config->index_map = NULL;
+    config->remap_indices = FALSE;
+    config->palette_from_rgb = FALSE;
+    config->trans_gray = 0;
     
     /* Determine optimal PNG format based on image characteristics */
     /* 24-bit ILBM (nPlanes == 24) is true-color, not indexed */
-    if (picture->isHAM || picture->isEHB || 
+    /* PCHG/SHAM/CTBL change the palette per row, so need true-color output too */
+    if (picture->isHAM || picture->isEHB || picture->linePalette ||
         picture->formtype == ID_RGBN || picture->formtype == ID_RGB8 ||
         (picture->formtype == ID_ILBM && picture->bmhd->nPlanes == 24)) {
         /* True-color formats - use RGB or RGBA */
@@ -224,24 +418,59 @@ LONG GetOptimalPNGConfig(struct IFFPicture *picture, struct PNGConfig *config, B
         config->bit_depth = 8;
         if (picture->hasAlpha) {
             config->color_type = PNG_COLOR_TYPE_RGBA;
+        } else if (picture->pixelData) {
+            /* Many of these use few colours - write those as a palette image */
+            if (ReduceToPalette(picture, config) != RETURN_OK) {
+                SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate PNG palette");
+                return RETURN_FAIL;
+            }
         }
     } else if (picture->isIndexed && picture->cmap && picture->cmap->data) {
         /* Indexed color image */
         numColors = picture->cmap->numcolors;
         
+        /* Which entries the decoded image uses - one pass over the indices */
+        used = NULL;
+        if (picture->paletteIndices) {
+            used = (UBYTE *)AllocMem(256, MEMF_PUBLIC);
+            if (!used) {
+                SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate palette usage table");
+                return RETURN_FAIL;
+            }
+            for (i = 0; i < 256; i++) {
+                used[i] = FALSE;
+            }
+            pixelCount = (ULONG)GetWidth(picture) * (ULONG)GetHeight(picture);
+            for (i = 0; i < pixelCount; i++) {
+                used[picture->paletteIndices[i]] = TRUE;
+            }
+        }
+        
         if (picture->isGrayscale) {
             /* Grayscale indexed */
             config->color_type = PNG_COLOR_TYPE_GRAY;
             
-            /* Determine optimal bit depth for grayscale */
-            if (numColors <= 2) {
-                config->bit_depth = 1;
-            } else if (numColors <= 4) {
-                config->bit_depth = 2;
-            } else if (numColors <= 16) {
-                config->bit_depth = 4;
-            } else {
-                config->bit_depth = 8;
+            /* Smallest bit depth at which every palette gray is an exact level -
+             * the levels of an n-bit gray are multiples of 255 / (2^n - 1) */
+            config->bit_depth = 8;
+            for (depth = 1; depth < 8; depth <<= 1) {
+                step = 255 / ((1UL << depth) - 1);
+                for (i = 0; i < numColors; i++) {
+                    if (picture->paletteIndices && i < 256 && !used[i]) {
+                        continue;
+                    }
+                    gray = picture->cmap->data[i * 3];
+                    if (picture->cmap->is4Bit) {
+                        gray |= (UBYTE)(gray >> 4);
+                    }
+                    if (gray % step) {
+                        break;
+                    }
+                }
+                if (i == numColors) {
+                    config->bit_depth = (int)depth;
+                    break;
+                }
             }
         } else {
             /* Color indexed */
@@ -264,6 +493,9 @@ LONG GetOptimalPNGConfig(struct IFFPicture *picture, struct PNGConfig *config, B
             /* Use public memory (not chip RAM, we're not rendering to display) */
             config->palette = (struct PNGColor *)AllocMem(numColors * sizeof(struct PNGColor), MEMF_PUBLIC | MEMF_CLEAR);
             if (!config->palette) {
+                if (used) {
+                    FreeMem(used, 256);
+                }
                 SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate PNG palette");
                 return RETURN_FAIL;
             }
@@ -285,22 +517,13 @@ LONG GetOptimalPNGConfig(struct IFFPicture *picture, struct PNGConfig *config, B
         /* Handle transparent color for indexed images */
         /* Only set tRNS if the transparent color index is actually used in the image */
         /* AND if the image has been decoded (so we can check usage) */
+        transparent = -1;
         if (picture->bmhd->masking == mskHasTransparentColor && picture->paletteIndices) {
             UBYTE transparentIndex;
-            ULONG pixelCount;
-            ULONG i;
-            BOOL transparentColorUsed = FALSE;
+            BOOL transparentColorUsed;
             
             transparentIndex = (UBYTE)picture->bmhd->transparentColor;
-            
-            /* Check if transparent color index is actually used in the image */
-            pixelCount = (ULONG)GetWidth(picture) * (ULONG)GetHeight(picture);
-            for (i = 0; i < pixelCount; i++) {
-                if (picture->paletteIndices[i] == transparentIndex) {
-                    transparentColorUsed = TRUE;
-                    break;
-                }
-            }
+            transparentColorUsed = (BOOL)(transparentIndex < numColors && used[transparentIndex]);
             
             /* Only set tRNS if the transparent color is actually used */
             /* Per ILBM specification, when transparentColor is set, that color
@@ -321,10 +544,30 @@ LONG GetOptimalPNGConfig(struct IFFPicture *picture, struct PNGConfig *config, B
                             FreeMem(config->palette, config->num_palette * sizeof(struct PNGColor));
                             config->palette = NULL;
                         }
+                        FreeMem(used, 256);
                         SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate PNG transparency");
                         return RETURN_FAIL;
                     }
-                    config->trans[0] = transparentIndex;
+                    config->trans[0] = 0;
+                    if (config->color_type == PNG_COLOR_TYPE_GRAY) {
+                        UBYTE r, g, b;
+                        
+                        /* Gray tRNS is a sample value - the entry's gray at the
+                         * PNG bit depth, worked out as the encoder does */
+                        r = picture->cmap->data[transparentIndex * 3];
+                        g = picture->cmap->data[transparentIndex * 3 + 1];
+                        b = picture->cmap->data[transparentIndex * 3 + 2];
+                        if (picture->cmap->is4Bit) {
+                            r |= (UBYTE)(r >> 4);
+                            g |= (UBYTE)(g >> 4);
+                            b |= (UBYTE)(b >> 4);
+                        }
+                        config->trans_gray = (int)(((77UL * r + 150UL * g + 29UL * b) >> 8) *
+                                                   ((1UL << config->bit_depth) - 1) + 127) / 255;
+                    } else {
+                        /* Alpha of entry 0 - CompactPalette() moves the transparent colour there */
+                        transparent = (LONG)transparentIndex;
+                    }
                     DEBUG_PRINTF1("DEBUG: GetOptimalPNGConfig - Transparent color index = %ld (used in image, setting tRNS)\n", 
                                  (ULONG)transparentIndex);
                 }
@@ -338,16 +581,43 @@ LONG GetOptimalPNGConfig(struct IFFPicture *picture, struct PNGConfig *config, B
             DEBUG_PRINTF1("DEBUG: GetOptimalPNGConfig - Transparent color index = %ld (image not decoded yet, skipping tRNS)\n", 
                          (ULONG)picture->bmhd->transparentColor);
         }
+        
+        /* Drop unused and duplicate entries, which needs the decoded indices */
+        if (config->color_type == PNG_COLOR_TYPE_PALETTE && picture->paletteIndices) {
+            if (CompactPalette(config, used, transparent) != RETURN_OK) {
+                FreeMem(used, 256);
+                FreeMem(config->palette, config->num_palette * sizeof(struct PNGColor));
+                config->palette = NULL;
+                if (config->trans) {
+                    FreeMem(config->trans, config->num_trans * sizeof(UBYTE));
+                    config->trans = NULL;
+                }
+                if (config->index_map) {
+                    FreeMem(config->index_map, 256);
+                    config->index_map = NULL;
+                }
+                config->num_palette = 0;
+                config->num_trans = 0;
+                SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate PNG palette");
+                return RETURN_FAIL;
+            }
+        }
+        if (used) {
+            FreeMem(used, 256);
+        }
     } else {
         /* Non-indexed, non-true-color (e.g., 1-bit B/W without CMAP) */
         if (picture->isGrayscale) {
             config->color_type = PNG_COLOR_TYPE_GRAY;
+            /* PNG gray is 1, 2, 4 or 8 bits - round other plane counts up */
             if (picture->bmhd->nPlanes == 1) {
                 config->bit_depth = 1;
-            } else if (picture->bmhd->nPlanes <= 8) {
-                config->bit_depth = picture->bmhd->nPlanes;
+            } else if (picture->bmhd->nPlanes == 2) {
+                config->bit_depth = 2;
+            } else if (picture->bmhd->nPlanes <= 4) {
+                config->bit_depth = 4;
             } else {
-                config->bit_depth = 8; /* Fallback */
+                config->bit_depth = 8;
             }
         } else {
             /* Fallback to RGB */
@@ -427,10 +697,10 @@ ULONG BestPictureModeID(struct IFFPicture *picture, struct ViewPort *sourceViewP
             SetIFFPictureError(picture, IFFPICTURE_INVALID, "DGBL or DPEL missing");
             return INVALID_ID;
         }
-        /* Get dimensions from DLOC if present, otherwise from DGBL */
-        if (picture->dloc) {
-            width = picture->dloc->w;
-            height = picture->dloc->h;
+        /* Get dimensions of the composited canvas, otherwise from DGBL */
+        if (picture->bmhd) {
+            width = picture->bmhd->w;
+            height = picture->bmhd->h;
         } else {
             width = picture->dgbl->DisplayWidth;
             height = picture->dgbl->DisplayHeight;
@@ -2,6 +2,14 @@
 ** image_decoder.c - Image Decoder Implementation (Internal to Library)
 **
 ** Decodes IFF bitmap formats to RGB pixel data
+**
+** Row and plane buffers here live only for one call, many of them for one
+** row, so they come straight from AllocMem() whatever allocator the picture
+** uses; the decoded image goes through AllocPixelData()/AllocPaletteIndices().
+**
+** ACBM and YUVN planes come from MapChunkData() when the picture is a
+** memory stream. ILBM BODY, DEEP DBOD and FAXX PAGE are always read with
+** ReadChunkBytes(), so they are copied even from a memory stream.
 */
 
 #include "iffpicture_private.h"
@@ -787,6 +795,277 @@ static LONG DecompressByteRun1(struct IFFHandle *iff, UBYTE *dest, LONG destByte
     return destBytes - bytesLeft;
 }
 
+/* Address of one row of one plane in a contiguous (plane-major) plane buffer */
+#define PlaneRow(planes, plane, row, rowBytes, height) \
+    ((planes) + ((ULONG)(plane) * (height) + (row)) * (rowBytes))
+
+/*
+** DecompressVDAT - Decompress one VDAT chunk into a full bitplane
+** Returns: RETURN_OK on success, RETURN_FAIL on error
+**
+** VDAT (BMHD compression 2, written by DPaint IV/V and Brilliance):
+** - UWORD cmdCount: number of command bytes plus 2
+** - cmdCount-2 signed command bytes
+** - Data words consumed by the commands
+** Commands:
+** - 0: next data word is a count, followed by count literal words
+** - 1: next data word is a count, followed by one word repeated count times
+** - <0: -cmd literal words follow
+** - >=2: next data word is repeated cmd times
+** Words fill the plane column by column: each 16-pixel column is written
+** top to bottom for all rows before moving one word to the right.
+*/
+static LONG DecompressVDAT(const UBYTE *src, ULONG srcSize, UBYTE *plane,
+                           UWORD rowBytes, UWORD height)
+{
+    const UBYTE *cmds;
+    const UBYTE *data;
+    const UBYTE *dataEnd;
+    UBYTE *dst;
+    ULONG cmdCount;
+    ULONG i;
+    LONG count;
+    BYTE cmd;
+    BOOL repeat;
+    UBYTE hi, lo;
+    UWORD x, y;
+    
+    if (srcSize < 2) {
+        return RETURN_FAIL;
+    }
+    
+    cmdCount = ((ULONG)src[0] << 8) | src[1];
+    if (cmdCount < 2 || cmdCount > srcSize) {
+        return RETURN_FAIL;
+    }
+    cmdCount -= 2;
+    cmds = src + 2;
+    data = cmds + cmdCount;
+    dataEnd = src + srcSize;
+    
+    x = 0;
+    y = 0;
+    dst = plane;
+    hi = lo = 0;
+    
+    for (i = 0; i < cmdCount && x < rowBytes; i++) {
+        cmd = (BYTE)cmds[i];
+    
+        if (cmd == 0 || cmd == 1) {
+            /* Explicit word count follows in the data stream */
+            if (data + 2 > dataEnd) {
+                return RETURN_FAIL;
+            }
+            count = (LONG)(((UWORD)data[0] << 8) | data[1]);
+            data += 2;
+            repeat = (BOOL)(cmd == 1);
+        } else if (cmd < 0) {
+            count = -(LONG)cmd;
+            repeat = FALSE;
+        } else {
+            count = (LONG)cmd;
+            repeat = TRUE;
+        }
+    
+        if (repeat) {
+            if (data + 2 > dataEnd) {
+                return RETURN_FAIL;
+            }
+            hi = data[0];
+            lo = data[1];
+            data += 2;
+        }
+    
+        while (count > 0 && x < rowBytes) {
+            if (!repeat) {
+                if (data + 2 > dataEnd) {
+                    return RETURN_FAIL;
+                }
+                hi = data[0];
+                lo = data[1];
+                data += 2;
+            }
+    
+            dst[0] = hi;
+            dst[1] = lo;
+    
+            /* Walk down the current column, wrapping to the next word column */
+            if (++y >= height) {
+                y = 0;
+                x += 2;
+                dst = plane + x;
+            } else {
+                dst += rowBytes;
+            }
+            count--;
+        }
+    }
+    
+    return RETURN_OK;
+}
+
+/*
+** ReadVDATPlanes - Read and decompress VDAT chunks for all planes
+** Returns: RETURN_OK on success, RETURN_FAIL on error
+**
+** The BODY (or ABIT) holds one VDAT chunk per plane, mask plane last.
+** Each plane is decompressed column-wise into planeData, which is laid
+** out contiguously (all rows of plane 0, then plane 1, ...) so the
+** existing row-oriented planar merge can run straight from memory.
+*/
+static LONG ReadVDATPlanes(struct IFFPicture *picture, UBYTE *planeData,
+                           UWORD rowBytes, UWORD height, UWORD planes)
+{
+    UBYTE header[8];
+    UBYTE *chunkData;
+    ULONG chunkDataSize;
+    ULONG chunkID;
+    ULONG chunkSize;
+    UBYTE pad;
+    UWORD plane;
+    
+    chunkData = NULL;
+    chunkDataSize = 0;
+    
+    for (plane = 0; plane < planes; plane++) {
+        if (ReadChunkBytes(picture->iff, header, 8) != 8) {
+            if (chunkData) FreeMem(chunkData, chunkDataSize);
+            SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Failed to read VDAT chunk header");
+            return RETURN_FAIL;
+        }
+    
+        chunkID = ((ULONG)header[0] << 24) | ((ULONG)header[1] << 16) |
+                  ((ULONG)header[2] << 8) | (ULONG)header[3];
+        chunkSize = ((ULONG)header[4] << 24) | ((ULONG)header[5] << 16) |
+                    ((ULONG)header[6] << 8) | (ULONG)header[7];
+        if (chunkID != ID_VDAT || chunkSize < 2) {
+            if (chunkData) FreeMem(chunkData, chunkDataSize);
+            SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Expected VDAT chunk in BODY");
+            return RETURN_FAIL;
+        }
+    
+        /* Reuse the staging buffer across planes, growing it only when needed */
+        if (chunkSize > chunkDataSize) {
+            if (chunkData) FreeMem(chunkData, chunkDataSize);
+            chunkDataSize = chunkSize;
+            chunkData = (UBYTE *)AllocMem(chunkDataSize, MEMF_PUBLIC);
+            if (!chunkData) {
+                SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate VDAT buffer");
+                return RETURN_FAIL;
+            }
+        }
+    
+        if (ReadChunkBytes(picture->iff, chunkData, chunkSize) != (LONG)chunkSize) {
+            FreeMem(chunkData, chunkDataSize);
+            SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Failed to read VDAT chunk data");
+            return RETURN_FAIL;
+        }
+    
+        /* Nested chunks are padded to even length */
+        if (chunkSize & 1) {
+            ReadChunkBytes(picture->iff, &pad, 1);
+        }
+    
+        if (DecompressVDAT(chunkData, chunkSize, PlaneRow(planeData, plane, 0, rowBytes, height),
+                           rowBytes, height) != RETURN_OK) {
+            FreeMem(chunkData, chunkDataSize);
+            SetIFFPictureError(picture, IFFPICTURE_BADFILE, "VDAT decompression failed");
+            return RETURN_FAIL;
+        }
+    }
+    
+    if (chunkData) {
+        FreeMem(chunkData, chunkDataSize);
+    }
+    
+    return RETURN_OK;
+}
+
+/*
+** AllocVDATPlanes - Allocate and fill a contiguous plane buffer from VDAT data
+** Returns: Plane buffer on success, NULL on error (error already set)
+*/
+static UBYTE *AllocVDATPlanes(struct IFFPicture *picture, UWORD rowBytes, UWORD height,
+                              UWORD planes, ULONG *planeDataSize)
+{
+    UBYTE *planeData;
+    
+    *planeDataSize = (ULONG)planes * height * rowBytes;
+    planeData = (UBYTE *)AllocMem(*planeDataSize, MEMF_PUBLIC | MEMF_CLEAR);
+    if (!planeData) {
+        SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate VDAT plane buffer");
+        return NULL;
+    }
+    
+    if (ReadVDATPlanes(picture, planeData, rowBytes, height, planes) != RETURN_OK) {
+        FreeMem(planeData, *planeDataSize);
+        return NULL;
+    }
+    
+    return planeData;
+}
+
+/*
+** ReadILBMPlanes - Read a whole ILBM BODY into a contiguous plane buffer
+** Returns: RETURN_OK on success, RETURN_FAIL on error
+**
+** Used for ANIM key frames, which stay in memory as planes so DLTA
+** chunks can be applied to them. Handles raw, ByteRun1 and VDAT bodies.
+*/
+LONG ReadILBMPlanes(struct IFFPicture *picture, UBYTE *planeData,
+                    UWORD rowBytes, UWORD height, UWORD planes)
+{
+    UWORD row, plane;
+    UBYTE *dest;
+    LONG bytesRead;
+    
+    if (picture->bmhd->compression == cmpVDAT) {
+        return ReadVDATPlanes(picture, planeData, rowBytes, height, planes);
+    }
+    
+    for (row = 0; row < height; row++) {
+        for (plane = 0; plane < planes; plane++) {
+            dest = PlaneRow(planeData, plane, row, rowBytes, height);
+            if (picture->bmhd->compression == cmpByteRun1) {
+                bytesRead = DecompressByteRun1(picture->iff, dest, rowBytes);
+            } else {
+                bytesRead = ReadChunkBytes(picture->iff, dest, rowBytes);
+            }
+            if (bytesRead != rowBytes) {
+                SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Failed to read BODY planes");
+                return RETURN_FAIL;
+            }
+        }
+    }
+    
+    return RETURN_OK;
+}
+
+/*
+** GetWholePlanes - Get all planes of the image as one contiguous buffer
+** Returns: RETURN_OK on success, RETURN_FAIL on error (error already set)
+**
+** *planeData is left NULL when the BODY should be read row by row.
+** *planeDataSize is 0 when the buffer belongs to the animation and must
+** not be freed by the caller.
+*/
+static LONG GetWholePlanes(struct IFFPicture *picture, UWORD rowBytes, UWORD height,
+                           UWORD planes, UBYTE **planeData, ULONG *planeDataSize)
+{
+    *planeData = NULL;
+    *planeDataSize = 0;
+    
+    if (picture->anim) {
+        *planeData = GetAnimPlanes(picture);
+    } else if (picture->bmhd->compression == cmpVDAT) {
+        *planeData = AllocVDATPlanes(picture, rowBytes, height, planes, planeDataSize);
+    } else {
+        return RETURN_OK;
+    }
+    
+    return *planeData ? RETURN_OK : RETURN_FAIL;
+}
+
 /*
 ** DecodeILBM - Decode ILBM format to RGB (internal)
 ** Returns: RETURN_OK on success, RETURN_FAIL on error
@@ -820,6 +1099,9 @@ LONG DecodeILBM(struct IFFPicture *picture)
     ULONG maxColors;
     UBYTE *alphaValues; /* For mask plane alpha channel */
     BOOL is24Bit; /* TRUE if 24-bit ILBM (direct RGB) */
+    UBYTE *wholePlanes; /* Whole-image planes (VDAT or ANIM) */
+    ULONG wholePlanesSize;
+    struct LinePalette *linePalette; /* PCHG/SHAM/CTBL per-row palette */
     
     if (!picture || !picture->bmhd) {
         SetIFFPictureError(picture, IFFPICTURE_INVALID, "Missing BMHD for ILBM decoding");
@@ -847,49 +1129,45 @@ LONG DecodeILBM(struct IFFPicture *picture)
         maxColors = 0;
     }
     
+    /* With a line palette, colors come from a LUT that is updated per row */
+    linePalette = is24Bit ? NULL : picture->linePalette;
+    if (linePalette) {
+        cmapData = InitLinePaletteLUT(picture, &maxColors);
+    }
+    
     DEBUG_PRINTF4("DEBUG: DecodeILBM - Starting decode: %ldx%ld, %ld planes, masking=%ld\n",
                   width, height, depth, picture->bmhd->masking);
     rowBytes = RowBytes(width);
     
-    /* Allocate pixel data buffer */
-    if (picture->bmhd->masking == mskHasMask) {
-        picture->pixelDataSize = (ULONG)width * height * 4; /* RGBA */
-        picture->hasAlpha = TRUE;
-    } else {
-        picture->pixelDataSize = (ULONG)width * height * 3; /* RGB */
-        picture->hasAlpha = FALSE;
-    }
+    /* Replace the RGB buffer Decode() allocated, which may be too small for RGBA */
+    FreePixelData(picture);
     
-    /* Use public memory (not chip RAM, we're not rendering to display) */
-    picture->pixelData = (UBYTE *)AllocMem(picture->pixelDataSize, MEMF_PUBLIC | MEMF_CLEAR);
-    if (!picture->pixelData) {
+    /* Allocate pixel data buffer - RGBA with a mask plane, otherwise RGB */
+    picture->hasAlpha = (BOOL)(picture->bmhd->masking == mskHasMask);
+    if (!AllocPixelData(picture, (ULONG)width * height * (picture->hasAlpha ? 4 : 3), 0)) {
         SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate pixel data buffer");
         return RETURN_FAIL;
     }
     
     /* For indexed images (non-24-bit), also store original palette indices */
-    if (!is24Bit) {
-        picture->paletteIndicesSize = (ULONG)width * height;
-        picture->paletteIndices = (UBYTE *)AllocMem(picture->paletteIndicesSize, MEMF_PUBLIC | MEMF_CLEAR);
-        if (!picture->paletteIndices) {
-            FreeMem(picture->pixelData, picture->pixelDataSize);
+    /* Indices are meaningless when the palette changes per row */
+    if (!is24Bit && !linePalette) {
+        if (!AllocPaletteIndices(picture, (ULONG)width * height, MEMF_CLEAR)) {
+            FreePixelData(picture);
             SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate palette indices buffer");
             return RETURN_FAIL;
         }
         paletteOut = picture->paletteIndices;
     } else {
-        picture->paletteIndices = NULL;
-        picture->paletteIndicesSize = 0;
+        FreePaletteIndices(picture);
         paletteOut = NULL;
     }
     
     /* Allocate buffer for one plane row */
     planeBuffer = (UBYTE *)AllocMem(rowBytes, MEMF_PUBLIC | MEMF_CLEAR);
     if (!planeBuffer) {
-        if (picture->paletteIndices) {
-            FreeMem(picture->paletteIndices, picture->paletteIndicesSize);
-        }
-        FreeMem(picture->pixelData, picture->pixelDataSize);
+        FreePaletteIndices(picture);
+        FreePixelData(picture);
         SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate plane buffer");
         return RETURN_FAIL;
     }
@@ -900,15 +1178,22 @@ LONG DecodeILBM(struct IFFPicture *picture)
         alphaValues = (UBYTE *)AllocMem(width, MEMF_PUBLIC | MEMF_CLEAR);
         if (!alphaValues) {
             FreeMem(planeBuffer, rowBytes);
-            if (picture->paletteIndices) {
-                FreeMem(picture->paletteIndices, picture->paletteIndicesSize);
-            }
-            FreeMem(picture->pixelData, picture->pixelDataSize);
+            FreePaletteIndices(picture);
+            FreePixelData(picture);
             SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate alpha buffer");
             return RETURN_FAIL;
         }
     }
     
+    /* VDAT and ANIM frames hold all planes in memory, so fetch them up front */
+    if (GetWholePlanes(picture, rowBytes, height,
+                       (UWORD)(picture->bmhd->masking == mskHasMask ? depth + 1 : depth),
+                       &wholePlanes, &wholePlanesSize) != RETURN_OK) {
+        FreeMem(planeBuffer, rowBytes);
+        if (alphaValues) FreeMem(alphaValues, width);
+        return RETURN_FAIL;
+    }
+    
     rgbOut = picture->pixelData;
     
     /* Process each row */
@@ -928,13 +1213,16 @@ LONG DecodeILBM(struct IFFPicture *picture)
                 if (bValues) FreeMem(bValues, width);
                 FreeMem(planeBuffer, rowBytes);
                 if (alphaValues) FreeMem(alphaValues, width);
+                if (wholePlanesSize) FreeMem(wholePlanes, wholePlanesSize);
                 SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate 24-bit component buffers");
                 return RETURN_FAIL;
             }
             
             /* Decode Red component (planes 0-7) */
             for (plane = 0; plane < 8; plane++) {
-                if (picture->bmhd->compression == cmpByteRun1) {
+                if (wholePlanes) {
+                    CopyMem(PlaneRow(wholePlanes, plane, row, rowBytes, height), planeBuffer, rowBytes);
+                } else if (picture->bmhd->compression == cmpByteRun1) {
                     bytesRead = DecompressByteRun1(picture->iff, planeBuffer, rowBytes);
                     if (bytesRead != rowBytes) {
                         FreeMem(rValues, width);
@@ -964,7 +1252,9 @@ LONG DecodeILBM(struct IFFPicture *picture)
             
             /* Decode Green component (planes 8-15) */
             for (plane = 8; plane < 16; plane++) {
-                if (picture->bmhd->compression == cmpByteRun1) {
+                if (wholePlanes) {
+                    CopyMem(PlaneRow(wholePlanes, plane, row, rowBytes, height), planeBuffer, rowBytes);
+                } else if (picture->bmhd->compression == cmpByteRun1) {
                     bytesRead = DecompressByteRun1(picture->iff, planeBuffer, rowBytes);
                     if (bytesRead != rowBytes) {
                         FreeMem(rValues, width);
@@ -994,7 +1284,9 @@ LONG DecodeILBM(struct IFFPicture *picture)
             
             /* Decode Blue component (planes 16-23) */
             for (plane = 16; plane < 24; plane++) {
-                if (picture->bmhd->compression == cmpByteRun1) {
+                if (wholePlanes) {
+                    CopyMem(PlaneRow(wholePlanes, plane, row, rowBytes, height), planeBuffer, rowBytes);
+                } else if (picture->bmhd->compression == cmpByteRun1) {
                     bytesRead = DecompressByteRun1(picture->iff, planeBuffer, rowBytes);
                     if (bytesRead != rowBytes) {
                         FreeMem(rValues, width);
@@ -1024,7 +1316,9 @@ LONG DecodeILBM(struct IFFPicture *picture)
             
             /* Read mask plane if present (comes after all data planes) */
             if (picture->bmhd->masking == mskHasMask) {
-                if (picture->bmhd->compression == cmpByteRun1) {
+                if (wholePlanes) {
+                    CopyMem(PlaneRow(wholePlanes, depth, row, rowBytes, height), planeBuffer, rowBytes);
+                } else if (picture->bmhd->compression == cmpByteRun1) {
                     bytesRead = DecompressByteRun1(picture->iff, planeBuffer, rowBytes);
                     if (bytesRead != rowBytes) {
                         FreeMem(rValues, width);
@@ -1076,6 +1370,7 @@ LONG DecodeILBM(struct IFFPicture *picture)
             if (!pixelIndices) {
                 FreeMem(planeBuffer, rowBytes);
                 if (alphaValues) FreeMem(alphaValues, width);
+                if (wholePlanesSize) FreeMem(wholePlanes, wholePlanesSize);
                 SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate pixel indices");
                 return RETURN_FAIL;
             }
@@ -1083,7 +1378,9 @@ LONG DecodeILBM(struct IFFPicture *picture)
             /* Read all data planes for this row (planes 0 through nPlanes-1) */
             for (plane = 0; plane < depth; plane++) {
                 /* Read/decompress plane data */
-                if (picture->bmhd->compression == cmpByteRun1) {
+                if (wholePlanes) {
+                    CopyMem(PlaneRow(wholePlanes, plane, row, rowBytes, height), planeBuffer, rowBytes);
+                } else if (picture->bmhd->compression == cmpByteRun1) {
                     bytesRead = DecompressByteRun1(picture->iff, planeBuffer, rowBytes);
                     if (bytesRead != rowBytes) {
                         FreeMem(pixelIndices, width);
@@ -1111,7 +1408,9 @@ LONG DecodeILBM(struct IFFPicture *picture)
             /* Read mask plane if present (comes after all data planes) */
             if (picture->bmhd->masking == mskHasMask) {
                 /* Read/decompress mask plane */
-                if (picture->bmhd->compression == cmpByteRun1) {
+                if (wholePlanes) {
+                    CopyMem(PlaneRow(wholePlanes, depth, row, rowBytes, height), planeBuffer, rowBytes);
+                } else if (picture->bmhd->compression == cmpByteRun1) {
                     bytesRead = DecompressByteRun1(picture->iff, planeBuffer, rowBytes);
                     if (bytesRead != rowBytes) {
                         FreeMem(pixelIndices, width);
@@ -1135,6 +1434,11 @@ LONG DecodeILBM(struct IFFPicture *picture)
                 ExtractAlphaFromPlane(planeBuffer, alphaValues, width, rowBytes);
             }
             
+            /* Bring the LUT up to date for this row */
+            if (linePalette) {
+                ApplyLinePalette(linePalette, row);
+            }
+            
             /* Convert pixel indices to RGB using CMAP and store original indices */
             for (col = 0; col < width; col++) {
                 pixelIndex = pixelIndices[col];
@@ -1155,7 +1459,7 @@ LONG DecodeILBM(struct IFFPicture *picture)
                 rgbOut[2] = cmapData[pixelIndex * 3 + 2]; /* B */
                 
                 /* Handle 4-bit palette scaling if needed */
-                if (picture->cmap && picture->cmap->is4Bit) {
+                if (picture->cmap && picture->cmap->is4Bit && !linePalette) {
                     rgbOut[0] |= (rgbOut[0] >> 4);
                     rgbOut[1] |= (rgbOut[1] >> 4);
                     rgbOut[2] |= (rgbOut[2] >> 4);
@@ -1178,6 +1482,9 @@ LONG DecodeILBM(struct IFFPicture *picture)
     if (alphaValues) {
         FreeMem(alphaValues, width);
     }
+    if (wholePlanesSize) {
+        FreeMem(wholePlanes, wholePlanesSize);
+    }
     
     return RETURN_OK;
 }
@@ -1209,6 +1516,9 @@ LONG DecodeHAM(struct IFFPicture *picture)
     LONG bytesRead;
     UBYTE *cmapData;
     ULONG maxColors;
+    UBYTE *wholePlanes; /* Whole-image planes (VDAT or ANIM) */
+    ULONG wholePlanesSize;
+    struct LinePalette *linePalette; /* PCHG/SHAM/CTBL per-row palette */
     UBYTE r, g, b;
     
     if (!picture || !picture->bmhd) {
@@ -1240,6 +1550,12 @@ LONG DecodeHAM(struct IFFPicture *picture)
         maxColors = 0;
     }
     
+    /* Sliced HAM and PCHG: base colors come from a LUT updated per row */
+    linePalette = picture->linePalette;
+    if (linePalette) {
+        cmapData = InitLinePaletteLUT(picture, &maxColors);
+    }
+    
     /* Allocate buffer for one plane row */
     planeBuffer = (UBYTE *)AllocMem(rowBytes, MEMF_PUBLIC | MEMF_CLEAR);
     if (!planeBuffer) {
@@ -1247,6 +1563,12 @@ LONG DecodeHAM(struct IFFPicture *picture)
         return RETURN_FAIL;
     }
     
+    /* VDAT and ANIM frames hold all planes in memory, so fetch them up front */
+    if (GetWholePlanes(picture, rowBytes, height, depth, &wholePlanes, &wholePlanesSize) != RETURN_OK) {
+        FreeMem(planeBuffer, rowBytes);
+        return RETURN_FAIL;
+    }
+    
     rgbOut = picture->pixelData;
     
     /* Process each row */
@@ -1255,6 +1577,7 @@ LONG DecodeHAM(struct IFFPicture *picture)
         UBYTE *pixelValues = (UBYTE *)AllocMem(width, MEMF_PUBLIC | MEMF_CLEAR);
         if (!pixelValues) {
             FreeMem(planeBuffer, rowBytes);
+            if (wholePlanesSize) FreeMem(wholePlanes, wholePlanesSize);
             SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate pixel values");
             return RETURN_FAIL;
         }
@@ -1262,7 +1585,9 @@ LONG DecodeHAM(struct IFFPicture *picture)
         /* Read all planes for this row */
         for (plane = 0; plane < depth; plane++) {
             /* Read/decompress plane data */
-            if (picture->bmhd->compression == cmpByteRun1) {
+            if (wholePlanes) {
+                CopyMem(PlaneRow(wholePlanes, plane, row, rowBytes, height), planeBuffer, rowBytes);
+            } else if (picture->bmhd->compression == cmpByteRun1) {
                 bytesRead = DecompressByteRun1(picture->iff, planeBuffer, rowBytes);
                 if (bytesRead != rowBytes) {
                     FreeMem(pixelValues, width);
@@ -1284,6 +1609,11 @@ LONG DecodeHAM(struct IFFPicture *picture)
             ExtractBitsFromPlane(planeBuffer, pixelValues, width, rowBytes, plane);
         }
         
+        /* Bring the LUT up to date for this row */
+        if (linePalette) {
+            ApplyLinePalette(linePalette, row);
+        }
+        
         /* Decode HAM pixels */
         r = g = b = 0; /* Initialize to black */
         for (col = 0; col < width; col++) {
@@ -1300,7 +1630,7 @@ LONG DecodeHAM(struct IFFPicture *picture)
                         b = cmapData[hamIndex * 3 + 2];
                         
                         /* Handle 4-bit palette scaling */
-                        if (picture->cmap && picture->cmap->is4Bit) {
+                        if (picture->cmap && picture->cmap->is4Bit && !linePalette) {
                             r |= (r >> 4);
                             g |= (g >> 4);
                             b |= (b >> 4);
@@ -1338,6 +1668,9 @@ LONG DecodeHAM(struct IFFPicture *picture)
     }
     
     FreeMem(planeBuffer, rowBytes);
+    if (wholePlanesSize) {
+        FreeMem(wholePlanes, wholePlanesSize);
+    }
     return RETURN_OK;
 }
 
@@ -1362,6 +1695,8 @@ LONG DecodeEHB(struct IFFPicture *picture)
     LONG bytesRead;
     UBYTE *cmapData;
     ULONG maxColors;
+    UBYTE *wholePlanes; /* Whole-image planes (VDAT or ANIM) */
+    ULONG wholePlanesSize;
     
     if (!picture || !picture->bmhd || !picture->cmap || !picture->cmap->data) {
         SetIFFPictureError(picture, IFFPICTURE_INVALID, "Missing BMHD or CMAP for EHB decoding");
@@ -1388,6 +1723,12 @@ LONG DecodeEHB(struct IFFPicture *picture)
         return RETURN_FAIL;
     }
     
+    /* VDAT and ANIM frames hold all planes in memory, so fetch them up front */
+    if (GetWholePlanes(picture, rowBytes, height, depth, &wholePlanes, &wholePlanesSize) != RETURN_OK) {
+        FreeMem(planeBuffer, rowBytes);
+        return RETURN_FAIL;
+    }
+    
     rgbOut = picture->pixelData;
     
     /* Process each row */
@@ -1396,6 +1737,7 @@ LONG DecodeEHB(struct IFFPicture *picture)
         UBYTE *pixelIndices = (UBYTE *)AllocMem(width, MEMF_PUBLIC | MEMF_CLEAR);
         if (!pixelIndices) {
             FreeMem(planeBuffer, rowBytes);
+            if (wholePlanesSize) FreeMem(wholePlanes, wholePlanesSize);
             SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate pixel indices");
             return RETURN_FAIL;
         }
@@ -1403,7 +1745,9 @@ LONG DecodeEHB(struct IFFPicture *picture)
         /* Read all planes for this row */
         for (plane = 0; plane < depth; plane++) {
             /* Read/decompress plane data */
-            if (picture->bmhd->compression == cmpByteRun1) {
+            if (wholePlanes) {
+                CopyMem(PlaneRow(wholePlanes, plane, row, rowBytes, height), planeBuffer, rowBytes);
+            } else if (picture->bmhd->compression == cmpByteRun1) {
                 bytesRead = DecompressByteRun1(picture->iff, planeBuffer, rowBytes);
                 if (bytesRead != rowBytes) {
                     FreeMem(pixelIndices, width);
@@ -1460,6 +1804,9 @@ LONG DecodeEHB(struct IFFPicture *picture)
     }
     
     FreeMem(planeBuffer, rowBytes);
+    if (wholePlanesSize) {
+        FreeMem(wholePlanes, wholePlanesSize);
+    }
     return RETURN_OK;
 }
 
@@ -1586,138 +1933,138 @@ static LONG DecompressDEEPTVDC(struct IFFHandle *iff, UBYTE *dest, LONG destByte
 }
 
 /*
-** DecodeDEEP - Decode DEEP format to RGB (internal)
+** DecodeDEEPTile - Decode the DBOD the parser stopped at into the canvas (internal)
 ** Returns: RETURN_OK on success, RETURN_FAIL on error
 **
+** The tile's size and position come from the DLOC read before it, or
+** cover the whole canvas without one. Pixels falling outside the canvas
+** are read but dropped. The canvas area written is returned in rect.
+**
 ** DEEP format stores chunky pixels (consecutive memory locations) with
 ** pixel structure defined by DPEL chunk. Supports various compression types
 ** and pixel component types (RGB, RGBA, YCM, etc.).
 */
-LONG DecodeDEEP(struct IFFPicture *picture)
+static LONG DecodeDEEPTile(struct IFFPicture *picture, struct AnimRect *rect)
 {
     UWORD width, height;
-    UWORD displayWidth, displayHeight;
+    WORD tileX, tileY;
+    UWORD canvasWidth, canvasHeight;
     UWORD compression;
     ULONG nElements;
     ULONG pixelSizeBytes;
     ULONG rowSizeBytes;
+    ULONG outBytes;
     UBYTE *rowBuffer;
+    UBYTE *elementData;
     UBYTE *rgbOut;
     UWORD row, col;
+    LONG canvasX, canvasY;
+    LONG left, top, right, bottom;
     ULONG elem;
     LONG bytesRead;
     ULONG totalBits;
-    ULONG bytesPerPixel;
     ULONG i;
     BOOL hasRed, hasGreen, hasBlue, hasAlpha;
     UBYTE redIdx, greenIdx, blueIdx, alphaIdx;
-    UBYTE redBits, greenBits, blueBits, alphaBits;
-    UBYTE *elementData;
     ULONG elementOffset;
-    ULONG bitOffset;
     ULONG value;
-    UBYTE shift;
+    LONG result;
     
-    if (!picture || !picture->dgbl || !picture->dpel) {
-        SetIFFPictureError(picture, IFFPICTURE_INVALID, "Missing DGBL or DPEL for DEEP decoding");
-        return RETURN_FAIL;
-    }
+    canvasWidth = picture->bmhd->w;
+    canvasHeight = picture->bmhd->h;
     
-    /* Get dimensions from DLOC if present, otherwise from DGBL */
+    /* Tile geometry from DLOC if present, otherwise the whole canvas */
     if (picture->dloc) {
         width = picture->dloc->w;
         height = picture->dloc->h;
+        tileX = picture->dloc->x;
+        tileY = picture->dloc->y;
     } else {
-        width = picture->dgbl->DisplayWidth;
-        height = picture->dgbl->DisplayHeight;
+        width = canvasWidth;
+        height = canvasHeight;
+        tileX = 0;
+        tileY = 0;
     }
     
-    displayWidth = picture->dgbl->DisplayWidth;
-    displayHeight = picture->dgbl->DisplayHeight;
     compression = picture->dgbl->Compression;
     nElements = picture->dpel->nElements;
     
-    if (nElements == 0) {
-        SetIFFPictureError(picture, IFFPICTURE_INVALID, "DPEL has zero elements");
-        return RETURN_FAIL;
-    }
-    
     /* Calculate total bits per pixel and bytes per pixel (padded to byte boundary) */
     totalBits = 0;
     for (i = 0; i < nElements; i++) {
         totalBits += picture->dpel->typedepth[i].cBitDepth;
     }
-    bytesPerPixel = (totalBits + 7) / 8; /* Round up to byte boundary */
-    pixelSizeBytes = bytesPerPixel;
+    pixelSizeBytes = (totalBits + 7) / 8; /* Round up to byte boundary */
     rowSizeBytes = (ULONG)width * pixelSizeBytes;
     
     /* Find RGB/Alpha component indices */
     hasRed = hasGreen = hasBlue = hasAlpha = FALSE;
     redIdx = greenIdx = blueIdx = alphaIdx = 0;
-    redBits = greenBits = blueBits = alphaBits = 0;
     
     for (i = 0; i < nElements; i++) {
         switch (picture->dpel->typedepth[i].cType) {
             case DEEP_TYPE_RED:
                 hasRed = TRUE;
                 redIdx = (UBYTE)i;
-                redBits = (UBYTE)picture->dpel->typedepth[i].cBitDepth;
                 break;
             case DEEP_TYPE_GREEN:
                 hasGreen = TRUE;
                 greenIdx = (UBYTE)i;
-                greenBits = (UBYTE)picture->dpel->typedepth[i].cBitDepth;
                 break;
             case DEEP_TYPE_BLUE:
                 hasBlue = TRUE;
                 blueIdx = (UBYTE)i;
-                blueBits = (UBYTE)picture->dpel->typedepth[i].cBitDepth;
                 break;
             case DEEP_TYPE_ALPHA:
                 hasAlpha = TRUE;
                 alphaIdx = (UBYTE)i;
-                alphaBits = (UBYTE)picture->dpel->typedepth[i].cBitDepth;
                 break;
         }
     }
+    outBytes = picture->hasAlpha ? 4 : 3;
     
-    /* Allocate pixel data buffer (RGB or RGBA) */
-    if (hasAlpha) {
-        picture->pixelDataSize = (ULONG)width * height * 4;
-        picture->hasAlpha = TRUE;
+    /* Clipped canvas area covered by this tile */
+    left = tileX < 0 ? 0 : tileX;
+    top = tileY < 0 ? 0 : tileY;
+    right = (LONG)tileX + width;
+    bottom = (LONG)tileY + height;
+    if (right > canvasWidth) {
+        right = canvasWidth;
+    }
+    if (bottom > canvasHeight) {
+        bottom = canvasHeight;
+    }
+    if (right <= left || bottom <= top) {
+        rect->x = rect->y = rect->w = rect->h = 0;
     } else {
-        picture->pixelDataSize = (ULONG)width * height * 3;
-        picture->hasAlpha = FALSE;
+        rect->x = (UWORD)left;
+        rect->y = (UWORD)top;
+        rect->w = (UWORD)(right - left);
+        rect->h = (UWORD)(bottom - top);
     }
-    picture->pixelData = (UBYTE *)AllocMem(picture->pixelDataSize, MEMF_PUBLIC | MEMF_CLEAR);
-    if (!picture->pixelData) {
-        SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate DEEP pixel data buffer");
-        return RETURN_FAIL;
+    
+    if (rowSizeBytes == 0) {
+        return RETURN_OK; /* Empty tile */
     }
     
-    /* Allocate row buffer for compressed/uncompressed data */
+    /* Allocate row buffer for compressed/uncompressed data and the interleaved pixel row */
     rowBuffer = (UBYTE *)AllocMem(rowSizeBytes, MEMF_PUBLIC | MEMF_CLEAR);
-    if (!rowBuffer) {
-        FreeMem(picture->pixelData, picture->pixelDataSize);
-        picture->pixelData = NULL;
+    elementData = (UBYTE *)AllocMem(rowSizeBytes, MEMF_PUBLIC | MEMF_CLEAR);
+    if (!rowBuffer || !elementData) {
+        if (rowBuffer) {
+            FreeMem(rowBuffer, rowSizeBytes);
+        }
+        if (elementData) {
+            FreeMem(elementData, rowSizeBytes);
+        }
         SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate DEEP row buffer");
         return RETURN_FAIL;
     }
     
-    rgbOut = picture->pixelData;
+    result = RETURN_OK;
     
     /* Process each row - DEEP stores data line by line for each element */
-    for (row = 0; row < height; row++) {
-        /* Allocate buffer for element data for this row */
-        elementData = (UBYTE *)AllocMem(rowSizeBytes, MEMF_PUBLIC | MEMF_CLEAR);
-        if (!elementData) {
-            FreeMem(rowBuffer, rowSizeBytes);
-            FreeMem(picture->pixelData, picture->pixelDataSize);
-            picture->pixelData = NULL;
-            SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate element data buffer");
-            return RETURN_FAIL;
-        }
-        
+    for (row = 0; row < height && result == RETURN_OK; row++) {
         /* Read/decompress each element for this row */
         elementOffset = 0;
         for (elem = 0; elem < nElements; elem++) {
@@ -1730,54 +2077,39 @@ LONG DecodeDEEP(struct IFFPicture *picture)
                 case DEEP_COMPRESS_NONE:
                     bytesRead = ReadChunkBytes(picture->iff, rowBuffer, elementRowBytes);
                     if (bytesRead != elementRowBytes) {
-                        FreeMem(elementData, rowSizeBytes);
-                        FreeMem(rowBuffer, rowSizeBytes);
-                        FreeMem(picture->pixelData, picture->pixelDataSize);
-                        picture->pixelData = NULL;
                         SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Failed to read DEEP element data");
-                        return RETURN_FAIL;
+                        result = RETURN_FAIL;
                     }
                     break;
                 case DEEP_COMPRESS_RUNLENGTH:
                     bytesRead = DecompressDEEPRunLength(picture->iff, rowBuffer, elementRowBytes);
                     if (bytesRead != elementRowBytes) {
-                        FreeMem(elementData, rowSizeBytes);
-                        FreeMem(rowBuffer, rowSizeBytes);
-                        FreeMem(picture->pixelData, picture->pixelDataSize);
-                        picture->pixelData = NULL;
                         SetIFFPictureError(picture, IFFPICTURE_BADFILE, "DEEP RUNLENGTH decompression failed");
-                        return RETURN_FAIL;
+                        result = RETURN_FAIL;
                     }
                     break;
                 case DEEP_COMPRESS_TVDC:
                     if (!picture->tvdc) {
-                        FreeMem(elementData, rowSizeBytes);
-                        FreeMem(rowBuffer, rowSizeBytes);
-                        FreeMem(picture->pixelData, picture->pixelDataSize);
-                        picture->pixelData = NULL;
                         SetIFFPictureError(picture, IFFPICTURE_BADFILE, "TVDC compression requires TVDC chunk");
-                        return RETURN_FAIL;
+                        result = RETURN_FAIL;
+                        break;
                     }
                     bytesRead = DecompressDEEPTVDC(picture->iff, rowBuffer, elementRowBytes, picture->tvdc->table);
                     if (bytesRead < 0) {
-                        FreeMem(elementData, rowSizeBytes);
-                        FreeMem(rowBuffer, rowSizeBytes);
-                        FreeMem(picture->pixelData, picture->pixelDataSize);
-                        picture->pixelData = NULL;
                         SetIFFPictureError(picture, IFFPICTURE_BADFILE, "DEEP TVDC decompression failed");
-                        return RETURN_FAIL;
+                        result = RETURN_FAIL;
                     }
                     break;
                 case DEEP_COMPRESS_HUFFMAN:
                 case DEEP_COMPRESS_DYNAMICHUFF:
                 case DEEP_COMPRESS_JPEG:
                 default:
-                    FreeMem(elementData, rowSizeBytes);
-                    FreeMem(rowBuffer, rowSizeBytes);
-                    FreeMem(picture->pixelData, picture->pixelDataSize);
-                    picture->pixelData = NULL;
                     SetIFFPictureError(picture, IFFPICTURE_UNSUPPORTED, "DEEP compression type not supported");
-                    return RETURN_FAIL;
+                    result = RETURN_FAIL;
+                    break;
+            }
+            if (result != RETURN_OK) {
+                break;
             }
             
             /* Copy element data to element buffer (interleaved by pixel) */
@@ -1788,13 +2120,27 @@ LONG DecodeDEEP(struct IFFPicture *picture)
             }
             elementOffset += elementBytesPerPixel;
         }
+        if (result != RETURN_OK) {
+            break;
+        }
+        
+        /* Rows outside the canvas still had to be read */
+        canvasY = (LONG)tileY + row;
+        if (canvasY < top || canvasY >= bottom) {
+            continue;
+        }
         
         /* Convert element data to RGB/RGBA output */
-            for (col = 0; col < width; col++) {
+        for (col = 0; col < width; col++) {
             UBYTE *pixelData = elementData + col * pixelSizeBytes;
             UBYTE r = 0, g = 0, b = 0, a = 255;
             ULONG byteOffset = 0;
             
+            canvasX = (LONG)tileX + col;
+            if (canvasX < left || canvasX >= right) {
+                continue;
+            }
+            
             /* Extract component values from pixel data (elements stored consecutively) */
             for (elem = 0; elem < nElements; elem++) {
                 UWORD elementBits = picture->dpel->typedepth[elem].cBitDepth;
@@ -1828,21 +2174,148 @@ LONG DecodeDEEP(struct IFFPicture *picture)
             }
             
             /* Write RGB/RGBA output */
+            rgbOut = picture->pixelData + ((ULONG)canvasY * canvasWidth + canvasX) * outBytes;
             rgbOut[0] = r;
             rgbOut[1] = g;
             rgbOut[2] = b;
-            if (hasAlpha) {
+            if (outBytes == 4) {
                 rgbOut[3] = a;
-                rgbOut += 4;
-            } else {
-            rgbOut += 3;
+            }
         }
     }
     
-        FreeMem(elementData, rowSizeBytes);
+    FreeMem(elementData, rowSizeBytes);
+    FreeMem(rowBuffer, rowSizeBytes);
+    return result;
+}
+
+/*
+** NextDEEPTile - Move the parser on to the next DBOD of the FORM DEEP (internal)
+** Returns: RETURN_OK at a DBOD, RETURN_WARN at the end of the FORM,
+**          RETURN_FAIL on error
+*/
+static LONG NextDEEPTile(struct IFFPicture *picture)
+{
+    struct ContextNode *cn;
+    LONG error;
+    
+    /* StopOnExit() makes the scan end with IFFERR_EOC after the last DBOD */
+    error = ParseIFF(picture->iff, IFFPARSE_SCAN);
+    if (error == IFFERR_EOC || error == IFFERR_EOF) {
+        return RETURN_WARN;
+    }
+    if (error != 0) {
+        SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Failed to parse DEEP tiles");
+        return RETURN_FAIL;
+    }
+    
+    cn = CurrentChunk(picture->iff);
+    if (!cn || cn->cn_ID != ID_DBOD) {
+        SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Expected DBOD in DEEP");
+        return RETURN_FAIL;
     }
     
-    FreeMem(rowBuffer, rowSizeBytes);
+    /* Each DBOD is placed by the DLOC stored last */
+    if (picture->dloc) {
+        FreePictureMem(picture, picture->dloc, sizeof(struct DLOCHeader));
+        picture->dloc = NULL;
+    }
+    if (ReadDLOC(picture) != RETURN_OK) {
+        return RETURN_FAIL; /* Error already set */
+    }
+    return ReadDBOD(picture);
+}
+
+/*
+** DecodeDEEP - Decode DEEP format to RGB (internal)
+** Returns: RETURN_OK on success, RETURN_FAIL on error
+**
+** All DLOC/DBOD pairs of the FORM are composited into one canvas of the
+** size given by the BMHD built from DGBL; areas no tile covers stay black
+** (or transparent). With a DCHG chunk the file is an animation instead:
+** only the first tile is decoded here and DecodeNextDEEPFrame() applies
+** each following tile as a new frame.
+*/
+LONG DecodeDEEP(struct IFFPicture *picture)
+{
+    struct AnimRect rect;
+    ULONG i;
+    LONG result;
+    
+    if (!picture || !picture->dgbl || !picture->dpel || !picture->bmhd) {
+        SetIFFPictureError(picture, IFFPICTURE_INVALID, "Missing DGBL or DPEL for DEEP decoding");
+        return RETURN_FAIL;
+    }
+    
+    if (picture->dpel->nElements == 0) {
+        SetIFFPictureError(picture, IFFPICTURE_INVALID, "DPEL has zero elements");
+        return RETURN_FAIL;
+    }
+    
+    /* Replace the RGB buffer from Decode() - the canvas may need an alpha channel */
+    FreePixelData(picture);
+    picture->hasAlpha = FALSE;
+    for (i = 0; i < picture->dpel->nElements; i++) {
+        if (picture->dpel->typedepth[i].cType == DEEP_TYPE_ALPHA) {
+            picture->hasAlpha = TRUE;
+        }
+    }
+    if (!AllocPixelData(picture, (ULONG)picture->bmhd->w * picture->bmhd->h * (picture->hasAlpha ? 4 : 3), MEMF_CLEAR)) {
+        SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate DEEP pixel data buffer");
+        return RETURN_FAIL;
+    }
+    
+    result = DecodeDEEPTile(picture, &rect);
+    
+    if (picture->anim) {
+        if (result == RETURN_OK) {
+            /* The first frame counts as changed everywhere */
+            picture->anim->frameRect.x = 0;
+            picture->anim->frameRect.y = 0;
+            picture->anim->frameRect.w = picture->bmhd->w;
+            picture->anim->frameRect.h = picture->bmhd->h;
+            picture->anim->loaded = TRUE;
+        }
+        return result;
+    }
+    
+    /* Still picture - composite the remaining tiles in file order */
+    while (result == RETURN_OK) {
+        result = NextDEEPTile(picture);
+        if (result == RETURN_OK) {
+            result = DecodeDEEPTile(picture, &rect);
+        }
+    }
+    
+    return (result == RETURN_WARN) ? RETURN_OK : result;
+}
+
+/*
+** DecodeNextDEEPFrame - Apply the next DLOC/DBOD pair of a DEEP animation (internal)
+** Returns: RETURN_OK when a frame was decoded, RETURN_WARN at the end,
+**          RETURN_FAIL on error
+**
+** The tile is decoded straight into the existing canvas, so only the
+** changed area is touched; it becomes the frame's dirty rectangle.
+*/
+LONG DecodeNextDEEPFrame(struct IFFPicture *picture)
+{
+    struct AnimRect rect;
+    LONG result;
+    
+    result = NextDEEPTile(picture);
+    if (result != RETURN_OK) {
+        return result; /* RETURN_WARN at the end of the FORM */
+    }
+    
+    result = DecodeDEEPTile(picture, &rect);
+    if (result != RETURN_OK) {
+        return result;
+    }
+    
+    picture->anim->frameRect = rect;
+    picture->anim->frame++;
+    
     return RETURN_OK;
 }
 
@@ -2251,21 +2724,21 @@ cleanup_error:
 ** ACBM (Amiga Contiguous Bitmap) format:
 ** - Similar to ILBM but stores planes contiguously (all of plane 0, then all of plane 1, etc.)
 ** - Uses ABIT chunk instead of BODY for image data
-** - ACBM does NOT support compression (must be cmpNone)
+** - ACBM supports no compression (cmpNone) or VDAT (cmpVDAT) per plane
 ** - Planes are stored sequentially: all rows of plane 0, then all rows of plane 1, etc.
 */
 LONG DecodeACBM(struct IFFPicture *picture)
 {
     UWORD width, height, depth;
     UWORD rowBytes;
-    UBYTE *planeBuffer;
     UBYTE *rgbOut;
     UWORD row, col, plane;
     UBYTE pixelIndex;
     UBYTE *cmapData;
     ULONG maxColors;
     LONG bytesRead;
-    UBYTE *planeData; /* Temporary buffer to store all plane data */
+    const UBYTE *planeData; /* All plane data, contiguous */
+    UBYTE *planeAlloc; /* Owned copy of planeData, NULL when read in place */
     ULONG planeDataSize;
     ULONG planeOffset;
     UBYTE *pixelIndices;
@@ -2275,9 +2748,9 @@ LONG DecodeACBM(struct IFFPicture *picture)
         return RETURN_FAIL;
     }
     
-    /* ACBM does not support compression */
-    if (picture->bmhd->compression != cmpNone) {
-        SetIFFPictureError(picture, IFFPICTURE_INVALID, "ACBM format does not support compression");
+    /* ACBM only supports uncompressed or VDAT plane data */
+    if (picture->bmhd->compression != cmpNone && picture->bmhd->compression != cmpVDAT) {
+        SetIFFPictureError(picture, IFFPICTURE_INVALID, "ACBM format does not support this compression");
         return RETURN_FAIL;
     }
     
@@ -2293,33 +2766,42 @@ LONG DecodeACBM(struct IFFPicture *picture)
         depth++; /* Mask plane is additional plane */
     }
     
-    /* Allocate buffer to store all plane data (contiguous storage) */
-    planeDataSize = (ULONG)depth * height * rowBytes;
-    planeData = (UBYTE *)AllocMem(planeDataSize, MEMF_PUBLIC | MEMF_CLEAR);
-    if (!planeData) {
-        SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate plane data buffer");
-        return RETURN_FAIL;
+    if (picture->bmhd->compression == cmpVDAT) {
+        /* VDAT planes decompress straight into the same contiguous layout */
+        planeAlloc = AllocVDATPlanes(picture, rowBytes, height, depth, &planeDataSize);
+        if (!planeAlloc) {
+            return RETURN_FAIL;
+        }
+        planeData = planeAlloc;
+    } else {
+        /* ABIT already is the contiguous layout, so use it in place when buffered */
+        planeDataSize = (ULONG)depth * height * rowBytes;
+        planeAlloc = NULL;
+        planeData = MapChunkData(picture, planeDataSize);
     }
     
-    /* Read all plane data from ABIT chunk (contiguous: all rows of plane 0, then plane 1, etc.) */
-    planeOffset = 0;
-    for (plane = 0; plane < depth; plane++) {
-        for (row = 0; row < height; row++) {
-            bytesRead = ReadChunkBytes(picture->iff, planeData + planeOffset, rowBytes);
-            if (bytesRead != rowBytes) {
-                FreeMem(planeData, planeDataSize);
-                SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Failed to read ACBM plane data");
-                return RETURN_FAIL;
-            }
-            planeOffset += rowBytes;
+    if (!planeData) {
+        /* Allocate buffer to store all plane data (contiguous storage) */
+        planeAlloc = (UBYTE *)AllocMem(planeDataSize, MEMF_PUBLIC | MEMF_CLEAR);
+        if (!planeAlloc) {
+            SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate plane data buffer");
+            return RETURN_FAIL;
+        }
+        
+        /* Read all plane data from ABIT chunk (contiguous: all rows of plane 0, then plane 1, etc.) */
+        bytesRead = ReadChunkBytes(picture->iff, planeAlloc, planeDataSize);
+        if (bytesRead != (LONG)planeDataSize) {
+            FreeMem(planeAlloc, planeDataSize);
+            SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Failed to read ACBM plane data");
+            return RETURN_FAIL;
         }
+        planeData = planeAlloc;
     }
     
-    /* Allocate buffer for one plane row (for decoding) */
-    planeBuffer = (UBYTE *)AllocMem(rowBytes, MEMF_PUBLIC | MEMF_CLEAR);
-    if (!planeBuffer) {
-        FreeMem(planeData, planeDataSize);
-        SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate plane buffer");
+    pixelIndices = (UBYTE *)AllocMem(width, MEMF_PUBLIC);
+    if (!pixelIndices) {
+        if (planeAlloc) FreeMem(planeAlloc, planeDataSize);
+        SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate pixel indices");
         return RETURN_FAIL;
     }
     
@@ -2328,12 +2810,8 @@ LONG DecodeACBM(struct IFFPicture *picture)
     /* Process each row - extract interleaved plane data from contiguous storage */
     for (row = 0; row < height; row++) {
         /* Clear pixel indices for this row */
-        pixelIndices = (UBYTE *)AllocMem(width, MEMF_PUBLIC | MEMF_CLEAR);
-        if (!pixelIndices) {
-            FreeMem(planeBuffer, rowBytes);
-            FreeMem(planeData, planeDataSize);
-            SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate pixel indices");
-            return RETURN_FAIL;
+        for (col = 0; col < width; col++) {
+            pixelIndices[col] = 0;
         }
         
         /* Extract all planes for this row from contiguous storage */
@@ -2344,12 +2822,9 @@ LONG DecodeACBM(struct IFFPicture *picture)
                 continue;
             }
             
-            /* Copy row from contiguous plane data */
+            /* Extract bits straight from the contiguous plane data */
             planeOffset = (ULONG)plane * height * rowBytes + (ULONG)row * rowBytes;
-            CopyMem(planeData + planeOffset, planeBuffer, rowBytes);
-            
-            /* Extract bits from this plane to build pixel indices (optimized) */
-            ExtractBitsFromPlane(planeBuffer, pixelIndices, width, rowBytes, plane);
+            ExtractBitsFromPlane(planeData + planeOffset, pixelIndices, width, rowBytes, plane);
         }
         
         /* Convert pixel indices to RGB using CMAP */
@@ -2375,12 +2850,10 @@ LONG DecodeACBM(struct IFFPicture *picture)
             
             rgbOut += 3;
         }
-        
-        FreeMem(pixelIndices, width);
     }
     
-    FreeMem(planeBuffer, rowBytes);
-    FreeMem(planeData, planeDataSize);
+    FreeMem(pixelIndices, width);
+    if (planeAlloc) FreeMem(planeAlloc, planeDataSize);
     return RETURN_OK;
 }
 
@@ -2452,9 +2925,7 @@ LONG DecodeFAXX(struct IFFPicture *picture)
     maxColors = picture->cmap->numcolors;
     
     /* For indexed images, also store original palette indices */
-    picture->paletteIndicesSize = (ULONG)width * height;
-    picture->paletteIndices = (UBYTE *)AllocMem(picture->paletteIndicesSize, MEMF_PUBLIC | MEMF_CLEAR);
-    if (!picture->paletteIndices) {
+    if (!AllocPaletteIndices(picture, (ULONG)width * height, MEMF_CLEAR)) {
         SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate palette indices buffer");
         return RETURN_FAIL;
     }
@@ -2462,8 +2933,7 @@ LONG DecodeFAXX(struct IFFPicture *picture)
     /* Allocate row buffer for reading bit-packed data */
     rowBuffer = (UBYTE *)AllocMem(rowBytes, MEMF_PUBLIC | MEMF_CLEAR);
     if (!rowBuffer) {
-        FreeMem(picture->paletteIndices, picture->paletteIndicesSize);
-        picture->paletteIndices = NULL;
+        FreePaletteIndices(picture);
         SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate row buffer");
         return RETURN_FAIL;
     }
@@ -2474,7 +2944,7 @@ LONG DecodeFAXX(struct IFFPicture *picture)
     /* Check that IFF handle is valid and positioned at PAGE chunk */
     if (!picture->iff) {
         FreeMem(rowBuffer, rowBytes);
-        FreeMem(picture->paletteIndices, picture->paletteIndicesSize);
+        FreePaletteIndices(picture);
         SetIFFPictureError(picture, IFFPICTURE_INVALID, "IFF handle not available");
         return RETURN_FAIL;
     }
@@ -2487,7 +2957,7 @@ LONG DecodeFAXX(struct IFFPicture *picture)
             bytesRead = ReadChunkBytes(picture->iff, rowBuffer, rowBytes);
             if (bytesRead != rowBytes) {
                 FreeMem(rowBuffer, rowBytes);
-                FreeMem(picture->paletteIndices, picture->paletteIndicesSize);
+                FreePaletteIndices(picture);
                 SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Failed to read FAXX row data");
                 return RETURN_FAIL;
             }
@@ -2530,7 +3000,7 @@ LONG DecodeFAXX(struct IFFPicture *picture)
         lineBuffer = (UBYTE *)AllocMem(width, MEMF_PUBLIC | MEMF_CLEAR);
         if (!lineBuffer) {
             FreeMem(rowBuffer, rowBytes);
-            FreeMem(picture->paletteIndices, picture->paletteIndicesSize);
+            FreePaletteIndices(picture);
             SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate line buffer for MH");
             return RETURN_FAIL;
         }
@@ -2539,7 +3009,7 @@ LONG DecodeFAXX(struct IFFPicture *picture)
         if (SkipToEOL(&bs) < 0) {
             FreeMem(lineBuffer, width);
             FreeMem(rowBuffer, rowBytes);
-            FreeMem(picture->paletteIndices, picture->paletteIndicesSize);
+            FreePaletteIndices(picture);
             SetIFFPictureError(picture, IFFPICTURE_BADFILE, "FAXX: Failed to find initial EOL");
             return RETURN_FAIL;
         }
@@ -2613,7 +3083,7 @@ LONG DecodeFAXX(struct IFFPicture *picture)
             if (lineBuffer) FreeMem(lineBuffer, width);
             if (refLine) FreeMem(refLine, width);
             FreeMem(rowBuffer, rowBytes);
-            FreeMem(picture->paletteIndices, picture->paletteIndicesSize);
+            FreePaletteIndices(picture);
             SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate line buffers for MR");
             return RETURN_FAIL;
         }
@@ -2623,7 +3093,7 @@ LONG DecodeFAXX(struct IFFPicture *picture)
             FreeMem(lineBuffer, width);
             FreeMem(refLine, width);
             FreeMem(rowBuffer, rowBytes);
-            FreeMem(picture->paletteIndices, picture->paletteIndicesSize);
+            FreePaletteIndices(picture);
             SetIFFPictureError(picture, IFFPICTURE_BADFILE, "FAXX: Failed to find initial EOL");
             return RETURN_FAIL;
         }
@@ -2633,7 +3103,7 @@ LONG DecodeFAXX(struct IFFPicture *picture)
             FreeMem(lineBuffer, width);
             FreeMem(refLine, width);
             FreeMem(rowBuffer, rowBytes);
-            FreeMem(picture->paletteIndices, picture->paletteIndicesSize);
+            FreePaletteIndices(picture);
             SetIFFPictureError(picture, IFFPICTURE_BADFILE, "FAXX: MR first line decode failed");
             return RETURN_FAIL;
         }
@@ -2750,13 +3220,13 @@ LONG DecodeFAXX(struct IFFPicture *picture)
         /* Modified Modified READ (MMR) - similar to MR but no EOL codes */
         /* For now, treat as MR */
         FreeMem(rowBuffer, rowBytes);
-        FreeMem(picture->paletteIndices, picture->paletteIndicesSize);
+        FreePaletteIndices(picture);
         SetIFFPictureError(picture, IFFPICTURE_UNSUPPORTED, "MMR compression not yet fully implemented");
         return RETURN_FAIL;
     } else {
         /* Should not reach here due to earlier check */
         FreeMem(rowBuffer, rowBytes);
-        FreeMem(picture->paletteIndices, picture->paletteIndicesSize);
+        FreePaletteIndices(picture);
         SetIFFPictureError(picture, IFFPICTURE_UNSUPPORTED, "Unsupported FAXX compression type");
         return RETURN_FAIL;
     }
@@ -2765,6 +3235,46 @@ LONG DecodeFAXX(struct IFFPicture *picture)
     return RETURN_OK;
 }
 
+/*
+** LoadPlaneChunk - Get plane data from the current chunk (internal)
+** Returns: Pointer to size bytes of data, or NULL on error
+**
+** With a buffered stream the data is used in place and *allocSize is 0;
+** otherwise it is read into a new buffer of *allocSize bytes that the
+** caller frees. On a short read, readError is set as the picture error;
+** with readError NULL failures are quiet, for optional chunks.
+*/
+static const UBYTE *LoadPlaneChunk(struct IFFPicture *picture, ULONG size,
+                                   ULONG *allocSize, const char *readError)
+{
+    const UBYTE *mapped;
+    UBYTE *data;
+    
+    *allocSize = 0;
+    mapped = MapChunkData(picture, size);
+    if (mapped) {
+        return mapped;
+    }
+    
+    data = (UBYTE *)AllocMem(size, MEMF_PUBLIC);
+    if (!data) {
+        if (readError) {
+            SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate plane data buffer");
+        }
+        return NULL;
+    }
+    if (ReadChunkBytes(picture->iff, data, size) != (LONG)size) {
+        FreeMem(data, size);
+        if (readError) {
+            SetIFFPictureError(picture, IFFPICTURE_BADFILE, readError);
+        }
+        return NULL;
+    }
+    
+    *allocSize = size;
+    return data;
+}
+
 /*
 ** DecodeYUVN - Decode YUVN format to RGB (internal)
 ** Returns: RETURN_OK on success, RETURN_FAIL on error
@@ -2787,29 +3297,24 @@ LONG DecodeYUVN(struct IFFPicture *picture)
     struct YCHDHeader *ychd;
     UWORD width, height;
     UWORD row, col;
-    UBYTE *yBuf;
-    UBYTE *uBuf;
-    UBYTE *vBuf;
-    UBYTE *yData;
-    UBYTE *uData;
-    UBYTE *vData;
+    const UBYTE *yData;
+    const UBYTE *uData;
+    const UBYTE *vData;
+    ULONG yAlloc, uAlloc, vAlloc, alphaAlloc; /* 0 when read in place */
     UBYTE *rgbOut;
-    LONG bytesRead;
     ULONG uBytes, vBytes;
     ULONG uStep, vStep;
     UBYTE y, u, v;
     LONG r, g, b;
     BOOL isColor;
     BOOL isLores;
-    UBYTE *alphaData;
+    const UBYTE *alphaData;
     BOOL hasAlpha;
-    UBYTE *alphaBuf;
-    ULONG alphaSize;
     struct ContextNode *cn;
-    UBYTE *yRow;
-    UBYTE *uRow;
-    UBYTE *vRow;
-    UBYTE *alphaRow;
+    const UBYTE *yRow;
+    const UBYTE *uRow;
+    const UBYTE *vRow;
+    const UBYTE *alphaRow;
     
     if (!picture || !picture->ychd || !picture->iff) {
         SetIFFPictureError(picture, IFFPICTURE_INVALID, "Missing YCHD or IFF handle for YUVN decoding");
@@ -2862,193 +3367,72 @@ LONG DecodeYUVN(struct IFFPicture *picture)
             return RETURN_FAIL;
     }
     
-    /* Allocate buffers for Y, U, V data */
-    yBuf = (UBYTE *)AllocMem(width, MEMF_PUBLIC | MEMF_CLEAR);
-    if (!yBuf) {
-        SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate Y buffer");
-        return RETURN_FAIL;
-    }
-    
-    if (isColor && uBytes > 0) {
-        uBuf = (UBYTE *)AllocMem(uBytes, MEMF_PUBLIC | MEMF_CLEAR);
-        if (!uBuf) {
-            FreeMem(yBuf, width);
-            SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate U buffer");
-            return RETURN_FAIL;
-        }
-    } else {
-        uBuf = NULL;
-    }
-    
-    if (isColor && vBytes > 0) {
-        vBuf = (UBYTE *)AllocMem(vBytes, MEMF_PUBLIC | MEMF_CLEAR);
-        if (!vBuf) {
-            FreeMem(yBuf, width);
-            if (uBuf) FreeMem(uBuf, uBytes);
-            SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate V buffer");
-            return RETURN_FAIL;
-        }
-    } else {
-        vBuf = NULL;
-    }
+    /* Each plane is a whole chunk, read in one go or used in place */
+    uData = NULL;
+    vData = NULL;
+    uAlloc = 0;
+    vAlloc = 0;
+    alphaData = NULL;
+    alphaAlloc = 0;
     
-    /* Allocate buffers for storing all Y, U, V data */
-    yData = (UBYTE *)AllocMem((ULONG)width * height, MEMF_PUBLIC | MEMF_CLEAR);
+    yData = LoadPlaneChunk(picture, (ULONG)width * height, &yAlloc, "Failed to read DATY data");
     if (!yData) {
-        FreeMem(yBuf, width);
-        if (uBuf) FreeMem(uBuf, uBytes);
-        if (vBuf) FreeMem(vBuf, vBytes);
-        SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate Y data buffer");
         return RETURN_FAIL;
     }
     
-    if (isColor && uBytes > 0) {
-        uData = (UBYTE *)AllocMem((ULONG)uBytes * height, MEMF_PUBLIC | MEMF_CLEAR);
-        if (!uData) {
-            FreeMem(yBuf, width);
-            FreeMem(yData, (ULONG)width * height);
-            if (uBuf) FreeMem(uBuf, uBytes);
-            if (vBuf) FreeMem(vBuf, vBytes);
-            SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate U data buffer");
-            return RETURN_FAIL;
-        }
-    } else {
-        uData = NULL;
-    }
-    
-    if (isColor && vBytes > 0) {
-        vData = (UBYTE *)AllocMem((ULONG)vBytes * height, MEMF_PUBLIC | MEMF_CLEAR);
-        if (!vData) {
-            FreeMem(yBuf, width);
-            FreeMem(yData, (ULONG)width * height);
-            if (uData) FreeMem(uData, (ULONG)uBytes * height);
-            if (uBuf) FreeMem(uBuf, uBytes);
-            if (vBuf) FreeMem(vBuf, vBytes);
-            SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate V data buffer");
-            return RETURN_FAIL;
-        }
-    } else {
-        vData = NULL;
-    }
-    
-    /* Read all DATY rows */
-    for (row = 0; row < height; row++) {
-        bytesRead = ReadChunkBytes(picture->iff, yBuf, width);
-        if (bytesRead != width) {
-            FreeMem(yBuf, width);
-            FreeMem(yData, (ULONG)width * height);
-            if (uData) FreeMem(uData, (ULONG)uBytes * height);
-            if (vData) FreeMem(vData, (ULONG)vBytes * height);
-            if (uBuf) FreeMem(uBuf, uBytes);
-            if (vBuf) FreeMem(vBuf, vBytes);
-            SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Failed to read DATY data");
-            return RETURN_FAIL;
-        }
-        /* Copy row to Y data buffer */
-        CopyMem(yBuf, yData + (ULONG)row * width, width);
-    }
+    hasAlpha = FALSE;
+    cn = NULL;
     
-    /* Parse to DATU chunk if color image */
-    if (isColor && uBytes > 0) {
-        if (ParseIFF(picture->iff, IFFPARSE_STEP) != 0) {
-            FreeMem(yBuf, width);
-            FreeMem(yData, (ULONG)width * height);
-            if (uData) FreeMem(uData, (ULONG)uBytes * height);
-            if (vData) FreeMem(vData, (ULONG)vBytes * height);
-            if (uBuf) FreeMem(uBuf, uBytes);
-            if (vBuf) FreeMem(vBuf, vBytes);
-            SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Failed to find DATU chunk");
-            return RETURN_FAIL;
+    if (picture->memStream) {
+        /* Buffered: take DATU, DATV and DATA straight from the chunk index */
+        if (isColor && uBytes > 0) {
+            uData = FindFORMChunk(picture, ID_DATU, uBytes * height);
+            if (!uData) {
+                SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Failed to find DATU chunk");
+                goto cleanup_error;
+            }
         }
-        
-        /* Read all DATU rows */
-        for (row = 0; row < height; row++) {
-            bytesRead = ReadChunkBytes(picture->iff, uBuf, uBytes);
-            if (bytesRead != uBytes) {
-                FreeMem(yBuf, width);
-                FreeMem(yData, (ULONG)width * height);
-                FreeMem(uData, (ULONG)uBytes * height);
-                if (vData) FreeMem(vData, (ULONG)vBytes * height);
-                FreeMem(uBuf, uBytes);
-                if (vBuf) FreeMem(vBuf, vBytes);
-                SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Failed to read DATU data");
-                return RETURN_FAIL;
+        if (isColor && vBytes > 0) {
+            vData = FindFORMChunk(picture, ID_DATV, vBytes * height);
+            if (!vData) {
+                SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Failed to find DATV chunk");
+                goto cleanup_error;
             }
-            /* Copy row to U data buffer */
-            CopyMem(uBuf, uData + (ULONG)row * uBytes, uBytes);
         }
-    }
-    
-    /* Parse to DATV chunk if color image */
-    if (isColor && vBytes > 0) {
-        if (ParseIFF(picture->iff, IFFPARSE_STEP) != 0) {
-            FreeMem(yBuf, width);
-            FreeMem(yData, (ULONG)width * height);
-            if (uData) FreeMem(uData, (ULONG)uBytes * height);
-            if (vData) FreeMem(vData, (ULONG)vBytes * height);
-            FreeMem(uBuf, uBytes);
-            if (vBuf) FreeMem(vBuf, vBytes);
-            SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Failed to find DATV chunk");
-            return RETURN_FAIL;
+        alphaData = FindFORMChunk(picture, ID_DATA, (ULONG)width * height);
+        hasAlpha = (alphaData != NULL);
+    } else {
+        /* Parse to DATU and DATV chunks if color image */
+        if (isColor && uBytes > 0) {
+            if (ParseIFF(picture->iff, IFFPARSE_STEP) != 0) {
+                SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Failed to find DATU chunk");
+                goto cleanup_error;
+            }
+            uData = LoadPlaneChunk(picture, uBytes * height, &uAlloc, "Failed to read DATU data");
+            if (!uData) {
+                goto cleanup_error;
+            }
         }
         
-        /* Read all DATV rows */
-        for (row = 0; row < height; row++) {
-            bytesRead = ReadChunkBytes(picture->iff, vBuf, vBytes);
-            if (bytesRead != vBytes) {
-                FreeMem(yBuf, width);
-                FreeMem(yData, (ULONG)width * height);
-                if (uData) FreeMem(uData, (ULONG)uBytes * height);
-                FreeMem(vData, (ULONG)vBytes * height);
-                FreeMem(uBuf, uBytes);
-                FreeMem(vBuf, vBytes);
-                SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Failed to read DATV data");
-                return RETURN_FAIL;
+        if (isColor && vBytes > 0) {
+            if (ParseIFF(picture->iff, IFFPARSE_STEP) != 0) {
+                SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Failed to find DATV chunk");
+                goto cleanup_error;
+            }
+            vData = LoadPlaneChunk(picture, vBytes * height, &vAlloc, "Failed to read DATV data");
+            if (!vData) {
+                goto cleanup_error;
             }
-            /* Copy row to V data buffer */
-            CopyMem(vBuf, vData + (ULONG)row * vBytes, vBytes);
         }
-    }
-    
-    /* Check for DATA chunk (alpha channel) after DATV (color) or DATY (grayscale) */
-    hasAlpha = FALSE;
-    alphaData = NULL;
-    alphaBuf = NULL;
-    alphaSize = 0;
-    cn = NULL;
-    
-    /* Try to parse to DATA chunk (optional alpha) */
-    /* For color images, DATA comes after DATV; for grayscale, after DATY */
-    if (ParseIFF(picture->iff, IFFPARSE_STEP) == 0) {
-        cn = CurrentChunk(picture->iff);
-        if (cn && cn->cn_ID == ID_DATA) {
-            /* DATA chunk found - read alpha channel */
-            alphaSize = (ULONG)width * height;
-            alphaData = (UBYTE *)AllocMem(alphaSize, MEMF_PUBLIC | MEMF_CLEAR);
-            if (alphaData) {
-                alphaBuf = (UBYTE *)AllocMem(width, MEMF_PUBLIC | MEMF_CLEAR);
-                if (alphaBuf) {
-                    hasAlpha = TRUE;
-                    /* Read all alpha rows */
-                    for (row = 0; row < height; row++) {
-                        bytesRead = ReadChunkBytes(picture->iff, alphaBuf, width);
-                        if (bytesRead != width) {
-                            /* Error reading alpha - treat as no alpha */
-                            FreeMem(alphaBuf, width);
-                            FreeMem(alphaData, alphaSize);
-                            alphaData = NULL;
-                            hasAlpha = FALSE;
-                            break;
-                        }
-                        /* Copy row to alpha data buffer */
-                        CopyMem(alphaBuf, alphaData + (ULONG)row * width, width);
-                    }
-                    FreeMem(alphaBuf, width);
-                } else {
-                    /* Failed to allocate alpha buffer - no alpha */
-                    FreeMem(alphaData, alphaSize);
-                    alphaData = NULL;
-                }
+        
+        /* Try to parse to DATA chunk (optional alpha) */
+        /* For color images, DATA comes after DATV; for grayscale, after DATY */
+        if (ParseIFF(picture->iff, IFFPARSE_STEP) == 0) {
+            cn = CurrentChunk(picture->iff);
+            if (cn && cn->cn_ID == ID_DATA) {
+                /* DATA chunk found - a short or unreadable one is treated as no alpha */
+                alphaData = LoadPlaneChunk(picture, (ULONG)width * height, &alphaAlloc, NULL);
+                hasAlpha = (alphaData != NULL);
             }
         }
     }
@@ -3056,19 +3440,9 @@ LONG DecodeYUVN(struct IFFPicture *picture)
     /* Reallocate pixel data buffer to include alpha if needed */
     if (hasAlpha && alphaData) {
         /* Free RGB-only buffer and allocate RGBA buffer */
-        FreeMem(picture->pixelData, picture->pixelDataSize);
-        picture->pixelDataSize = (ULONG)width * height * 4;
-        picture->pixelData = (UBYTE *)AllocMem(picture->pixelDataSize, MEMF_PUBLIC | MEMF_CLEAR);
-        if (!picture->pixelData) {
-            FreeMem(yBuf, width);
-            FreeMem(yData, (ULONG)width * height);
-            if (uData) FreeMem(uData, (ULONG)uBytes * height);
-            if (vData) FreeMem(vData, (ULONG)vBytes * height);
-            if (uBuf) FreeMem(uBuf, uBytes);
-            if (vBuf) FreeMem(vBuf, vBytes);
-            FreeMem(alphaData, (ULONG)width * height);
+        if (!AllocPixelData(picture, (ULONG)width * height * 4, 0)) {
             SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate RGBA pixel data buffer");
-            return RETURN_FAIL;
+            goto cleanup_error;
         }
     }
     
@@ -3161,13 +3535,10 @@ LONG DecodeYUVN(struct IFFPicture *picture)
     }
     
     /* Free all buffers */
-    FreeMem(yBuf, width);
-    FreeMem(yData, (ULONG)width * height);
-    if (uData) FreeMem(uData, (ULONG)uBytes * height);
-    if (vData) FreeMem(vData, (ULONG)vBytes * height);
-    if (uBuf) FreeMem(uBuf, uBytes);
-    if (vBuf) FreeMem(vBuf, vBytes);
-    if (alphaData) FreeMem(alphaData, (ULONG)width * height);
+    if (yAlloc) FreeMem((APTR)yData, yAlloc);
+    if (uAlloc) FreeMem((APTR)uData, uAlloc);
+    if (vAlloc) FreeMem((APTR)vData, vAlloc);
+    if (alphaAlloc) FreeMem((APTR)alphaData, alphaAlloc);
     
     /* Set format flags */
     picture->isIndexed = FALSE;
@@ -3176,5 +3547,12 @@ LONG DecodeYUVN(struct IFFPicture *picture)
     picture->hasAlpha = hasAlpha;
     
     return RETURN_OK;
+
+cleanup_error:
+    if (yAlloc) FreeMem((APTR)yData, yAlloc);
+    if (uAlloc) FreeMem((APTR)uData, uAlloc);
+    if (vAlloc) FreeMem((APTR)vData, vAlloc);
+    if (alphaAlloc) FreeMem((APTR)alphaData, alphaAlloc);
+    return RETURN_FAIL;
 }
 
@@ -0,0 +1,546 @@
+/*
+** line_palette.c - Per-Scanline Palette Implementation (Internal to Library)
+**
+** Decodes PCHG (small and big line changes), SHAM and CTBL chunks into
+** compact per-row change records and applies them to a palette LUT as
+** the decoders stream rows
+*/
+
+#include "iffpicture_private.h"
+#include "/debug.h"
+#include <proto/exec.h>
+#include <proto/iffparse.h>
+
+/* Registers per line in SHAM and CTBL chunks */
+#define SHAM_REGS_PER_LINE  16
+
+/* Expand a 4-bit color component to 8 bits */
+#define Expand4(n) ((UBYTE)(((n) << 4) | (n)))
+
+/*
+** AllocLinePalette - Allocate an empty LinePalette for numRows rows
+** Returns: Pointer to new LinePalette or NULL on failure
+*/
+static struct LinePalette *AllocLinePalette(struct IFFPicture *picture, UWORD numRows, ULONG maxChanges)
+{
+    struct LinePalette *lp;
+    
+    lp = (struct LinePalette *)AllocPictureMem(picture, sizeof(struct LinePalette), MEMF_PUBLIC | MEMF_CLEAR);
+    if (!lp) {
+        return NULL;
+    }
+    
+    lp->numRows = numRows;
+    lp->rowStartSize = ((ULONG)numRows + 1) * sizeof(ULONG);
+    lp->rowStart = (ULONG *)AllocPictureMem(picture, lp->rowStartSize, MEMF_PUBLIC | MEMF_CLEAR);
+    if (!lp->rowStart) {
+        FreePictureMem(picture, lp, sizeof(struct LinePalette));
+        return NULL;
+    }
+    
+    if (maxChanges == 0) {
+        maxChanges = 1;
+    }
+    lp->maxChanges = maxChanges;
+    lp->changes = (struct LineColorChange *)AllocPictureMem(picture, maxChanges * sizeof(struct LineColorChange), MEMF_PUBLIC);
+    if (!lp->changes) {
+        FreePictureMem(picture, lp->rowStart, lp->rowStartSize);
+        FreePictureMem(picture, lp, sizeof(struct LinePalette));
+        return NULL;
+    }
+    
+    return lp;
+}
+
+/*
+** FreeLinePalette - Free a LinePalette and its change records
+*/
+VOID FreeLinePalette(struct IFFPicture *picture, struct LinePalette *lp)
+{
+    if (!lp) {
+        return;
+    }
+    
+    if (lp->changes) {
+        FreePictureMem(picture, lp->changes, lp->maxChanges * sizeof(struct LineColorChange));
+    }
+    if (lp->rowStart) {
+        FreePictureMem(picture, lp->rowStart, lp->rowStartSize);
+    }
+    FreePictureMem(picture, lp, sizeof(struct LinePalette));
+}
+
+/*
+** AddLineChange - Append one register change taking effect at row
+** Rows must be added in ascending order; rowStart is filled in lazily
+*/
+static VOID AddLineChange(struct LinePalette *lp, UWORD row, UWORD reg,
+                          UBYTE red, UBYTE green, UBYTE blue)
+{
+    struct LineColorChange *change;
+    
+    if (reg >= LINEPALETTE_MAXREGS || row >= lp->numRows || lp->numChanges >= lp->maxChanges) {
+        return;
+    }
+    
+    /* Close off any rows between the last change and this one */
+    while (lp->lastRow < row) {
+        lp->lastRow++;
+        lp->rowStart[lp->lastRow] = lp->numChanges;
+    }
+    
+    change = &lp->changes[lp->numChanges++];
+    change->reg = (UBYTE)reg;
+    change->red = red;
+    change->green = green;
+    change->blue = blue;
+    
+    if (reg >= lp->numRegs) {
+        lp->numRegs = reg + 1;
+    }
+}
+
+/*
+** FinishLinePalette - Close off rowStart for all remaining rows
+*/
+static VOID FinishLinePalette(struct LinePalette *lp)
+{
+    while (lp->lastRow < lp->numRows) {
+        lp->lastRow++;
+        lp->rowStart[lp->lastRow] = lp->numChanges;
+    }
+}
+
+/*
+** DecompressPCHGHuffman - Expand Huffman-compressed PCHG line data
+** Returns: RETURN_OK on success, RETURN_FAIL if the tree is malformed
+**
+** The root node is the last WORD of the tree table. Negative nodes are
+** relative branch offsets in bytes, leaves have bit 8 set on the
+** 0-branch side. The offsets come straight from the file, so every
+** step is checked against [tree, tree + treeWords) before it is read.
+*/
+static LONG DecompressPCHGHuffman(const UBYTE *src, const UBYTE *srcEnd, UBYTE *dest,
+                                  const WORD *tree, ULONG treeWords, ULONG origSize)
+{
+    const WORD *root;
+    const WORD *p;
+    ULONG i;
+    UWORD bits;
+    UBYTE thisByte;
+    
+    root = &tree[treeWords - 1];
+    p = root;
+    i = 0;
+    bits = 0;
+    thisByte = 0;
+    
+    while (i < origSize) {
+        if (bits == 0) {
+            if (src >= srcEnd) {
+                break; /* Truncated data - remainder stays zero */
+            }
+            thisByte = *src++;
+            bits = 8;
+        }
+        
+        if (thisByte & 0x80) {
+            if (*p >= 0) {
+                *dest++ = (UBYTE)*p;
+                i++;
+                p = root;
+            } else {
+                /* Offset is in bytes, so -*p/2 words back from p */
+                if ((ULONG)(-(LONG)*p / 2) > (ULONG)(p - tree)) {
+                    return RETURN_FAIL;
+                }
+                p += (*p / 2);
+            }
+        } else {
+            if (p == tree) {
+                return RETURN_FAIL;
+            }
+            p--;
+            if (*p > 0 && (*p & 0x100)) {
+                *dest++ = (UBYTE)*p;
+                i++;
+                p = root;
+            }
+        }
+        
+        thisByte <<= 1;
+        bits--;
+    }
+    
+    return RETURN_OK;
+}
+
+/*
+** ParsePCHG - Convert a PCHG chunk into a LinePalette
+** Returns: RETURN_OK on success, RETURN_FAIL on error
+**
+** PCHG layout:
+** - 20-byte PCHGHeader (Compression, Flags, StartLine, LineCount,
+**   ChangedLines, MinReg, MaxReg, MaxChanges, TotalChanges)
+** - Optional PCHGCompHeader + Huffman tree when Compression == 1
+** - Line mask: one bit per line, MSB first, padded to ULONGs
+** - Per changed line: SmallLineChanges (12-bit) or BigLineChanges (8-bit)
+*/
+static LONG ParsePCHG(struct IFFPicture *picture, const UBYTE *chunk, ULONG chunkSize)
+{
+    struct LinePalette *lp;
+    UWORD compression;
+    UWORD flags;
+    WORD startLine;
+    UWORD lineCount;
+    const UBYTE *data;
+    const UBYTE *dataEnd;
+    UBYTE *expanded;
+    ULONG expandedSize;
+    ULONG maskBytes;
+    ULONG line;
+    LONG y;
+    UWORD row;
+    
+    if (chunkSize < 20) {
+        SetIFFPictureError(picture, IFFPICTURE_BADFILE, "PCHG chunk too small");
+        return RETURN_FAIL;
+    }
+    
+    compression = (UWORD)((chunk[0] << 8) | chunk[1]);
+    flags = (UWORD)((chunk[2] << 8) | chunk[3]);
+    startLine = (WORD)((chunk[4] << 8) | chunk[5]);
+    lineCount = (UWORD)((chunk[6] << 8) | chunk[7]);
+    
+    data = chunk + 20;
+    dataEnd = chunk + chunkSize;
+    expanded = NULL;
+    expandedSize = 0;
+    
+    if (compression == PCHG_COMP_HUFFMAN) {
+        ULONG compInfoSize;
+        ULONG treeWords;
+        WORD *tree;
+        ULONG i;
+        
+        if (data + 8 > dataEnd) {
+            SetIFFPictureError(picture, IFFPICTURE_BADFILE, "PCHG compression header truncated");
+            return RETURN_FAIL;
+        }
+        compInfoSize = ((ULONG)data[0] << 24) | ((ULONG)data[1] << 16) |
+                       ((ULONG)data[2] << 8) | (ULONG)data[3];
+        expandedSize = ((ULONG)data[4] << 24) | ((ULONG)data[5] << 16) |
+                       ((ULONG)data[6] << 8) | (ULONG)data[7];
+        data += 8;
+        
+        treeWords = compInfoSize / 2;
+        if (treeWords == 0 || compInfoSize > (ULONG)(dataEnd - data) || expandedSize == 0) {
+            SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Invalid PCHG Huffman tree");
+            return RETURN_FAIL;
+        }
+        
+        tree = (WORD *)AllocPictureMem(picture, treeWords * sizeof(WORD), MEMF_PUBLIC);
+        if (!tree) {
+            SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate PCHG Huffman tree");
+            return RETURN_FAIL;
+        }
+        for (i = 0; i < treeWords; i++) {
+            tree[i] = (WORD)((data[i * 2] << 8) | data[i * 2 + 1]);
+        }
+        data += compInfoSize;
+        
+        expanded = (UBYTE *)AllocPictureMem(picture, expandedSize, MEMF_PUBLIC | MEMF_CLEAR);
+        if (!expanded) {
+            FreePictureMem(picture, tree, treeWords * sizeof(WORD));
+            SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate PCHG line data");
+            return RETURN_FAIL;
+        }
+        
+        if (DecompressPCHGHuffman(data, dataEnd, expanded, tree, treeWords, expandedSize) != RETURN_OK) {
+            FreePictureMem(picture, tree, treeWords * sizeof(WORD));
+            FreePictureMem(picture, expanded, expandedSize);
+            SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Invalid PCHG Huffman tree");
+            return RETURN_FAIL;
+        }
+        FreePictureMem(picture, tree, treeWords * sizeof(WORD));
+        
+        data = expanded;
+        dataEnd = expanded + expandedSize;
+    } else if (compression != PCHG_COMP_NONE) {
+        SetIFFPictureError(picture, IFFPICTURE_UNSUPPORTED, "Unsupported PCHG compression");
+        return RETURN_FAIL;
+    }
+    
+    /* Every change record takes at least two bytes of line data */
+    lp = AllocLinePalette(picture, picture->bmhd->h, (ULONG)(dataEnd - data) / 2);
+    if (!lp) {
+        if (expanded) FreePictureMem(picture, expanded, expandedSize);
+        SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate line palette");
+        return RETURN_FAIL;
+    }
+    
+    maskBytes = (((ULONG)lineCount + 31) >> 5) << 2;
+    if (data + maskBytes > dataEnd) {
+        FreeLinePalette(picture, lp);
+        if (expanded) FreePictureMem(picture, expanded, expandedSize);
+        SetIFFPictureError(picture, IFFPICTURE_BADFILE, "PCHG line mask truncated");
+        return RETURN_FAIL;
+    }
+    
+    {
+        const UBYTE *mask;
+        const UBYTE *p;
+        
+        mask = data;
+        p = data + maskBytes;
+        
+        for (line = 0; line < lineCount; line++) {
+            if (!(mask[line >> 3] & (0x80 >> (line & 7)))) {
+                continue;
+            }
+            
+            /* Changes above the picture take effect before the first row */
+            y = (LONG)startLine + (LONG)line;
+            if (y >= (LONG)lp->numRows) {
+                break;
+            }
+            row = (UWORD)(y < 0 ? 0 : y);
+            
+            if (flags & PCHGF_32BIT) {
+                /* BigLineChanges: UWORD count, then {UWORD reg; UBYTE a, r, b, g} */
+                UWORD count;
+                UWORD c;
+                
+                if (p + 2 > dataEnd) break;
+                count = (UWORD)((p[0] << 8) | p[1]);
+                p += 2;
+                for (c = 0; c < count; c++) {
+                    if (p + 6 > dataEnd) break;
+                    /* Component order in the chunk is Alpha, Red, Blue, Green */
+                    AddLineChange(lp, row, (UWORD)((p[0] << 8) | p[1]), p[3], p[5], p[4]);
+                    p += 6;
+                }
+            } else {
+                /* SmallLineChanges: UBYTE count16, count32, then UWORD 0xRRGB-style words */
+                UWORD count16;
+                UWORD count32;
+                UWORD c;
+                UWORD word;
+                
+                if (p + 2 > dataEnd) break;
+                count16 = p[0];
+                count32 = p[1];
+                p += 2;
+                for (c = 0; c < count16 + count32; c++) {
+                    if (p + 2 > dataEnd) break;
+                    word = (UWORD)((p[0] << 8) | p[1]);
+                    p += 2;
+                    /* Top nibble is the register, offset by 16 for the second group */
+                    AddLineChange(lp, row, (UWORD)((word >> 12) + (c < count16 ? 0 : 16)),
+                                  Expand4((word >> 8) & 0x0F), Expand4((word >> 4) & 0x0F),
+                                  Expand4(word & 0x0F));
+                }
+            }
+        }
+    }
+    
+    FinishLinePalette(lp);
+    if (expanded) {
+        FreePictureMem(picture, expanded, expandedSize);
+    }
+    
+    DEBUG_PRINTF3("DEBUG: ParsePCHG - startLine=%ld lineCount=%ld changes=%ld\n",
+                  (LONG)startLine, (ULONG)lineCount, lp->numChanges);
+    
+    picture->linePalette = lp;
+    return RETURN_OK;
+}
+
+/*
+** ParseLineTable - Convert a SHAM or CTBL chunk into a LinePalette
+** Returns: RETURN_OK on success, RETURN_FAIL on error
+**
+** Both chunks hold 16 12-bit color registers per line (SHAM has a leading
+** version word). Only registers that differ from the previous line are
+** kept, so the LUT is updated incrementally. Interlaced SHAM pictures
+** carry one line of registers per two rows.
+*/
+static LONG ParseLineTable(struct IFFPicture *picture, const UBYTE *table, ULONG tableSize)
+{
+    struct LinePalette *lp;
+    UWORD prev[SHAM_REGS_PER_LINE];
+    ULONG numLines;
+    ULONG rowsPerLine;
+    ULONG line;
+    ULONG row;
+    UWORD reg;
+    UWORD word;
+    
+    numLines = tableSize / (SHAM_REGS_PER_LINE * 2);
+    if (numLines == 0) {
+        SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Line color table too small");
+        return RETURN_FAIL;
+    }
+    
+    rowsPerLine = 1;
+    if (numLines < picture->bmhd->h) {
+        rowsPerLine = ((ULONG)picture->bmhd->h + numLines - 1) / numLines;
+    }
+    
+    lp = AllocLinePalette(picture, picture->bmhd->h, numLines * SHAM_REGS_PER_LINE);
+    if (!lp) {
+        SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Failed to allocate line palette");
+        return RETURN_FAIL;
+    }
+    
+    for (line = 0; line < numLines; line++) {
+        row = line * rowsPerLine;
+        if (row >= lp->numRows) {
+            break;
+        }
+        
+        for (reg = 0; reg < SHAM_REGS_PER_LINE; reg++) {
+            word = (UWORD)((table[0] << 8) | table[1]) & 0x0FFF;
+            table += 2;
+            
+            /* First line loads every register, later lines only deltas */
+            if (line == 0 || word != prev[reg]) {
+                AddLineChange(lp, (UWORD)row, reg, Expand4(word >> 8),
+                              Expand4((word >> 4) & 0x0F), Expand4(word & 0x0F));
+                prev[reg] = word;
+            }
+        }
+    }
+    
+    FinishLinePalette(lp);
+    
+    DEBUG_PRINTF3("DEBUG: ParseLineTable - lines=%ld rowsPerLine=%ld changes=%ld\n",
+                  numLines, rowsPerLine, lp->numChanges);
+    
+    picture->linePalette = lp;
+    return RETURN_OK;
+}
+
+/*
+** ReadLinePalette - Read PCHG, SHAM or CTBL chunk (whichever is present)
+** Returns: RETURN_OK on success or if none present, RETURN_FAIL on error
+** Follows iffparse.library pattern: FindProp
+**
+** PCHG takes precedence over SHAM, SHAM over CTBL. Pictures with a line
+** palette are decoded to true color, so isIndexed is cleared.
+*/
+LONG ReadLinePalette(struct IFFPicture *picture)
+{
+    struct StoredProperty *sp;
+    LONG result;
+    
+    if (!picture || !picture->iff || !picture->bmhd) {
+        if (picture) {
+            SetIFFPictureError(picture, IFFPICTURE_INVALID, "Invalid picture or IFF handle");
+        }
+        return RETURN_FAIL;
+    }
+    
+    if (picture->linePalette) {
+        FreeLinePalette(picture, picture->linePalette);
+        picture->linePalette = NULL;
+    }
+    
+    result = RETURN_OK;
+    if ((sp = FindProp(picture->iff, picture->formtype, ID_PCHG)) != NULL) {
+        result = ParsePCHG(picture, (const UBYTE *)sp->sp_Data, (ULONG)sp->sp_Size);
+    } else if ((sp = FindProp(picture->iff, picture->formtype, ID_SHAM)) != NULL) {
+        const UBYTE *src = (const UBYTE *)sp->sp_Data;
+        
+        /* SHAM version word must be 0 */
+        if (sp->sp_Size < 2 || src[0] != 0 || src[1] != 0) {
+            SetIFFPictureError(picture, IFFPICTURE_UNSUPPORTED, "Unsupported SHAM version");
+            return RETURN_FAIL;
+        }
+        result = ParseLineTable(picture, src + 2, (ULONG)sp->sp_Size - 2);
+        
+        /* Sliced HAM is always HAM6, even without a CAMG chunk */
+        if (result == RETURN_OK && picture->bmhd->nPlanes == 6) {
+            picture->isHAM = TRUE;
+        }
+    } else if ((sp = FindProp(picture->iff, picture->formtype, ID_CTBL)) != NULL) {
+        result = ParseLineTable(picture, (const UBYTE *)sp->sp_Data, (ULONG)sp->sp_Size);
+    } else {
+        DEBUG_PUTSTR("DEBUG: ReadLinePalette - No PCHG/SHAM/CTBL chunk found (optional)\n");
+        return RETURN_OK;
+    }
+    
+    if (result == RETURN_OK && picture->linePalette) {
+        picture->isIndexed = FALSE;
+    }
+    
+    return result;
+}
+
+/*
+** InitLinePaletteLUT - Reset the line palette LUT to the base CMAP
+** Returns: Pointer to the LUT (LINEPALETTE_LUTSIZE bytes of 8-bit RGB),
+**          or NULL if the picture has no line palette
+** numColors receives the number of usable LUT entries (CMAP or changed
+** registers, whichever is larger); unused registers start out black
+*/
+UBYTE *InitLinePaletteLUT(struct IFFPicture *picture, ULONG *numColors)
+{
+    struct LinePalette *lp;
+    ULONG i;
+    ULONG cmapColors;
+    UBYTE *cmapData;
+    
+    if (!picture || !picture->linePalette) {
+        return NULL;
+    }
+    
+    lp = picture->linePalette;
+    for (i = 0; i < LINEPALETTE_LUTSIZE; i++) {
+        lp->lut[i] = 0;
+    }
+    
+    cmapColors = 0;
+    if (picture->cmap && picture->cmap->data) {
+        cmapData = picture->cmap->data;
+        cmapColors = picture->cmap->numcolors;
+        if (cmapColors > LINEPALETTE_MAXREGS) {
+            cmapColors = LINEPALETTE_MAXREGS;
+        }
+        
+        for (i = 0; i < cmapColors * 3; i++) {
+            lp->lut[i] = cmapData[i];
+            if (picture->cmap->is4Bit) {
+                lp->lut[i] |= (lp->lut[i] >> 4);
+            }
+        }
+    }
+    
+    *numColors = (cmapColors > lp->numRegs) ? cmapColors : lp->numRegs;
+    return lp->lut;
+}
+
+/*
+** ApplyLinePalette - Apply the changes recorded for row to the LUT
+** Must be called once per row, in row order, before the row is converted
+*/
+VOID ApplyLinePalette(struct LinePalette *lp, UWORD row)
+{
+    struct LineColorChange *change;
+    struct LineColorChange *end;
+    UBYTE *entry;
+    
+    if (!lp || row >= lp->numRows) {
+        return;
+    }
+    
+    change = &lp->changes[lp->rowStart[row]];
+    end = &lp->changes[lp->rowStart[row + 1]];
+    while (change < end) {
+        entry = &lp->lut[change->reg * 3];
+        entry[0] = change->red;
+        entry[1] = change->green;
+        entry[2] = change->blue;
+        change++;
+    }
+}
@@ -4,6 +4,9 @@
 ** Functions for reading IFF metadata chunks (GRAB, DEST, SPRT, CRNG, text chunks)
 ** All memory is owned by IFFPicture and freed by FreeIFFPicture()
 ** Pointers are valid until FreeIFFPicture() is called
+** The lists returned by the ReadAll functions are kept in the picture's
+** metadata too, so pictures used by different tasks never share one
+** The chunks are copied on the first call to any of these functions
 */
 
 #include "iffpicture_private.h"
@@ -19,7 +22,7 @@
 */
 struct Point2D *ReadGRAB(struct IFFPicture *picture)
 {
-    if (!picture || !picture->metadata) {
+    if (!picture || !LoadMeta(picture)) {
         return NULL;
     }
     
@@ -35,7 +38,7 @@ struct Point2D *ReadGRAB(struct IFFPicture *picture)
 */
 struct DestMerge *ReadDEST(struct IFFPicture *picture)
 {
-    if (!picture || !picture->metadata) {
+    if (!picture || !LoadMeta(picture)) {
         return NULL;
     }
     
@@ -52,7 +55,7 @@ struct DestMerge *ReadDEST(struct IFFPicture *picture)
 */
 UWORD *ReadSPRT(struct IFFPicture *picture)
 {
-    if (!picture || !picture->metadata) {
+    if (!picture || !LoadMeta(picture)) {
         return NULL;
     }
     
@@ -69,7 +72,7 @@ UWORD *ReadSPRT(struct IFFPicture *picture)
 */
 struct CRange *ReadCRNG(struct IFFPicture *picture)
 {
-    if (!picture || !picture->metadata) {
+    if (!picture || !LoadMeta(picture)) {
         return NULL;
     }
     
@@ -86,16 +89,17 @@ struct CRange *ReadCRNG(struct IFFPicture *picture)
 */
 struct CRangeList *ReadAllCRNG(struct IFFPicture *picture)
 {
-    static struct CRangeList result;
+    struct CRangeList *result;
     
-    if (!picture || !picture->metadata || picture->metadata->crngCount == 0) {
+    if (!picture || !LoadMeta(picture) || picture->metadata->crngCount == 0) {
         return NULL;
     }
     
-    result.count = picture->metadata->crngCount;
-    result.ranges = picture->metadata->crngArray;
+    result = &picture->metadata->crngList;
+    result->count = picture->metadata->crngCount;
+    result->ranges = picture->metadata->crngArray;
     
-    return &result;
+    return result;
 }
 
 /*
@@ -106,7 +110,7 @@ struct CRangeList *ReadAllCRNG(struct IFFPicture *picture)
 */
 STRPTR ReadCopyright(struct IFFPicture *picture)
 {
-    if (!picture || !picture->metadata) {
+    if (!picture || !LoadMeta(picture)) {
         return NULL;
     }
     
@@ -122,7 +126,7 @@ STRPTR ReadCopyright(struct IFFPicture *picture)
 */
 STRPTR ReadAuthor(struct IFFPicture *picture)
 {
-    if (!picture || !picture->metadata) {
+    if (!picture || !LoadMeta(picture)) {
         return NULL;
     }
     
@@ -139,7 +143,7 @@ STRPTR ReadAuthor(struct IFFPicture *picture)
 */
 STRPTR ReadAnnotation(struct IFFPicture *picture)
 {
-    if (!picture || !picture->metadata) {
+    if (!picture || !LoadMeta(picture)) {
         return NULL;
     }
     
@@ -156,16 +160,17 @@ STRPTR ReadAnnotation(struct IFFPicture *picture)
 */
 struct TextList *ReadAllAnnotations(struct IFFPicture *picture)
 {
-    static struct TextList result;
+    struct TextList *result;
     
-    if (!picture || !picture->metadata || picture->metadata->annotationCount == 0) {
+    if (!picture || !LoadMeta(picture) || picture->metadata->annotationCount == 0) {
         return NULL;
     }
     
-    result.count = picture->metadata->annotationCount;
-    result.texts = picture->metadata->annotationArray;
+    result = &picture->metadata->annotationList;
+    result->count = picture->metadata->annotationCount;
+    result->texts = picture->metadata->annotationArray;
     
-    return &result;
+    return result;
 }
 
 /*
@@ -177,7 +182,7 @@ struct TextList *ReadAllAnnotations(struct IFFPicture *picture)
 */
 STRPTR ReadText(struct IFFPicture *picture)
 {
-    if (!picture || !picture->metadata) {
+    if (!picture || !LoadMeta(picture)) {
         return NULL;
     }
     
@@ -194,16 +199,17 @@ STRPTR ReadText(struct IFFPicture *picture)
 */
 struct TextList *ReadAllTexts(struct IFFPicture *picture)
 {
-    static struct TextList result;
+    struct TextList *result;
     
-    if (!picture || !picture->metadata || picture->metadata->textCount == 0) {
+    if (!picture || !LoadMeta(picture) || picture->metadata->textCount == 0) {
         return NULL;
     }
     
-    result.count = picture->metadata->textCount;
-    result.texts = picture->metadata->textArray;
+    result = &picture->metadata->textList;
+    result->count = picture->metadata->textCount;
+    result->texts = picture->metadata->textArray;
     
-    return &result;
+    return result;
 }
 
 /*
@@ -216,7 +222,7 @@ struct TextList *ReadAllTexts(struct IFFPicture *picture)
 */
 STRPTR ReadFVER(struct IFFPicture *picture)
 {
-    if (!picture || !picture->metadata) {
+    if (!picture || !LoadMeta(picture)) {
         return NULL;
     }
     
@@ -233,7 +239,7 @@ STRPTR ReadFVER(struct IFFPicture *picture)
 */
 UBYTE *ReadEXIF(struct IFFPicture *picture, ULONG *size)
 {
-    if (!picture || !picture->metadata) {
+    if (!picture || !LoadMeta(picture)) {
         if (size) {
             *size = 0;
         }
@@ -257,17 +263,18 @@ UBYTE *ReadEXIF(struct IFFPicture *picture, ULONG *size)
 */
 struct BinaryDataList *ReadAllEXIF(struct IFFPicture *picture)
 {
-    static struct BinaryDataList result;
+    struct BinaryDataList *result;
     
-    if (!picture || !picture->metadata || picture->metadata->exifCount == 0) {
+    if (!picture || !LoadMeta(picture) || picture->metadata->exifCount == 0) {
         return NULL;
     }
     
-    result.count = picture->metadata->exifCount;
-    result.data = picture->metadata->exifArray;
-    result.sizes = picture->metadata->exifSizes;
+    result = &picture->metadata->exifList;
+    result->count = picture->metadata->exifCount;
+    result->data = picture->metadata->exifArray;
+    result->sizes = picture->metadata->exifSizes;
     
-    return &result;
+    return result;
 }
 
 /*
@@ -279,7 +286,7 @@ struct BinaryDataList *ReadAllEXIF(struct IFFPicture *picture)
 */
 UBYTE *ReadIPTC(struct IFFPicture *picture, ULONG *size)
 {
-    if (!picture || !picture->metadata) {
+    if (!picture || !LoadMeta(picture)) {
         if (size) {
             *size = 0;
         }
@@ -303,17 +310,18 @@ UBYTE *ReadIPTC(struct IFFPicture *picture, ULONG *size)
 */
 struct BinaryDataList *ReadAllIPTC(struct IFFPicture *picture)
 {
-    static struct BinaryDataList result;
+    struct BinaryDataList *result;
     
-    if (!picture || !picture->metadata || picture->metadata->iptcCount == 0) {
+    if (!picture || !LoadMeta(picture) || picture->metadata->iptcCount == 0) {
         return NULL;
     }
     
-    result.count = picture->metadata->iptcCount;
-    result.data = picture->metadata->iptcArray;
-    result.sizes = picture->metadata->iptcSizes;
+    result = &picture->metadata->iptcList;
+    result->count = picture->metadata->iptcCount;
+    result->data = picture->metadata->iptcArray;
+    result->sizes = picture->metadata->iptcSizes;
     
-    return &result;
+    return result;
 }
 
 /*
@@ -326,7 +334,7 @@ struct BinaryDataList *ReadAllIPTC(struct IFFPicture *picture)
 */
 UBYTE *ReadXMP0(struct IFFPicture *picture, ULONG *size)
 {
-    if (!picture || !picture->metadata) {
+    if (!picture || !LoadMeta(picture)) {
         if (size) {
             *size = 0;
         }
@@ -350,17 +358,18 @@ UBYTE *ReadXMP0(struct IFFPicture *picture, ULONG *size)
 */
 struct BinaryDataList *ReadAllXMP0(struct IFFPicture *picture)
 {
-    static struct BinaryDataList result;
+    struct BinaryDataList *result;
     
-    if (!picture || !picture->metadata || picture->metadata->xmp0Count == 0) {
+    if (!picture || !LoadMeta(picture) || picture->metadata->xmp0Count == 0) {
         return NULL;
     }
     
-    result.count = picture->metadata->xmp0Count;
-    result.data = picture->metadata->xmp0Array;
-    result.sizes = picture->metadata->xmp0Sizes;
+    result = &picture->metadata->xmp0List;
+    result->count = picture->metadata->xmp0Count;
+    result->data = picture->metadata->xmp0Array;
+    result->sizes = picture->metadata->xmp0Sizes;
     
-    return &result;
+    return result;
 }
 
 /*
@@ -373,7 +382,7 @@ struct BinaryDataList *ReadAllXMP0(struct IFFPicture *picture)
 */
 UBYTE *ReadXMP1(struct IFFPicture *picture, ULONG *size)
 {
-    if (!picture || !picture->metadata) {
+    if (!picture || !LoadMeta(picture)) {
         if (size) {
             *size = 0;
         }
@@ -397,7 +406,7 @@ UBYTE *ReadXMP1(struct IFFPicture *picture, ULONG *size)
 */
 UBYTE *ReadICCP(struct IFFPicture *picture, ULONG *size)
 {
-    if (!picture || !picture->metadata) {
+    if (!picture || !LoadMeta(picture)) {
         if (size) {
             *size = 0;
         }
@@ -421,17 +430,18 @@ UBYTE *ReadICCP(struct IFFPicture *picture, ULONG *size)
 */
 struct BinaryDataList *ReadAllICCP(struct IFFPicture *picture)
 {
-    static struct BinaryDataList result;
+    struct BinaryDataList *result;
     
-    if (!picture || !picture->metadata || picture->metadata->iccpCount == 0) {
+    if (!picture || !LoadMeta(picture) || picture->metadata->iccpCount == 0) {
         return NULL;
     }
     
-    result.count = picture->metadata->iccpCount;
-    result.data = picture->metadata->iccpArray;
-    result.sizes = picture->metadata->iccpSizes;
+    result = &picture->metadata->iccpList;
+    result->count = picture->metadata->iccpCount;
+    result->data = picture->metadata->iccpArray;
+    result->sizes = picture->metadata->iccpSizes;
     
-    return &result;
+    return result;
 }
 
 /*
@@ -443,7 +453,7 @@ struct BinaryDataList *ReadAllICCP(struct IFFPicture *picture)
 */
 STRPTR ReadICCN(struct IFFPicture *picture)
 {
-    if (!picture || !picture->metadata) {
+    if (!picture || !LoadMeta(picture)) {
         return NULL;
     }
     
@@ -460,16 +470,17 @@ STRPTR ReadICCN(struct IFFPicture *picture)
 */
 struct TextList *ReadAllICCN(struct IFFPicture *picture)
 {
-    static struct TextList result;
+    struct TextList *result;
     
-    if (!picture || !picture->metadata || picture->metadata->iccnCount == 0) {
+    if (!picture || !LoadMeta(picture) || picture->metadata->iccnCount == 0) {
         return NULL;
     }
     
-    result.count = picture->metadata->iccnCount;
-    result.texts = picture->metadata->iccnArray;
+    result = &picture->metadata->iccnList;
+    result->count = picture->metadata->iccnCount;
+    result->texts = picture->metadata->iccnArray;
     
-    return &result;
+    return result;
 }
 
 /*
@@ -481,7 +492,7 @@ struct TextList *ReadAllICCN(struct IFFPicture *picture)
 */
 UBYTE *ReadGEOT(struct IFFPicture *picture, ULONG *size)
 {
-    if (!picture || !picture->metadata) {
+    if (!picture || !LoadMeta(picture)) {
         if (size) {
             *size = 0;
         }
@@ -505,17 +516,18 @@ UBYTE *ReadGEOT(struct IFFPicture *picture, ULONG *size)
 */
 struct BinaryDataList *ReadAllGEOT(struct IFFPicture *picture)
 {
-    static struct BinaryDataList result;
+    struct BinaryDataList *result;
     
-    if (!picture || !picture->metadata || picture->metadata->geotCount == 0) {
+    if (!picture || !LoadMeta(picture) || picture->metadata->geotCount == 0) {
         return NULL;
     }
     
-    result.count = picture->metadata->geotCount;
-    result.data = picture->metadata->geotArray;
-    result.sizes = picture->metadata->geotSizes;
+    result = &picture->metadata->geotList;
+    result->count = picture->metadata->geotCount;
+    result->data = picture->metadata->geotArray;
+    result->sizes = picture->metadata->geotSizes;
     
-    return &result;
+    return result;
 }
 
 /*
@@ -528,7 +540,7 @@ struct BinaryDataList *ReadAllGEOT(struct IFFPicture *picture)
 */
 ULONG *ReadGEOF(struct IFFPicture *picture)
 {
-    if (!picture || !picture->metadata) {
+    if (!picture || !LoadMeta(picture)) {
         return NULL;
     }
     
@@ -545,14 +557,15 @@ ULONG *ReadGEOF(struct IFFPicture *picture)
 */
 struct GEOFList *ReadAllGEOF(struct IFFPicture *picture)
 {
-    static struct GEOFList result;
+    struct GEOFList *result;
     
-    if (!picture || !picture->metadata || picture->metadata->geofCount == 0) {
+    if (!picture || !LoadMeta(picture) || picture->metadata->geofCount == 0) {
         return NULL;
     }
     
-    result.count = picture->metadata->geofCount;
-    result.ids = picture->metadata->geofArray;
+    result = &picture->metadata->geofList;
+    result->count = picture->metadata->geofCount;
+    result->ids = picture->metadata->geofArray;
     
-    return &result;
+    return result;
 }
@@ -0,0 +1,353 @@
+/*
+** prefetch.c - Read-Ahead File Stream (Internal to Library)
+**
+** Keeps a ring of blocks queued at the file's filesystem handler as
+** asynchronous ACTION_READ packets. The handler is a process of its own,
+** so it fetches the next part of the BODY, DBOD or ABIT from disk or
+** network while the decoder works on the part before it. iffparse.library
+** reads through a custom stream hook that copies out of blocks that have
+** come back and sends each emptied block off again for the data after the
+** last one queued. Packets are only sent and collected by the task that
+** called InitIFFPictureasPrefetch(), since the reply port belongs to it.
+*/
+
+#include "iffpicture_private.h"
+#include <dos/dosextens.h>
+#include <proto/exec.h>
+#include <proto/dos.h>
+#include <proto/iffparse.h>
+#include <clib/alib_protos.h>
+
+/* Ring used when the caller passes 0 for blockSize or numBlocks */
+#define PREFETCH_BLOCKSIZE  32768
+#define PREFETCH_NUMBLOCKS  4
+
+/*
+** SendBlock - Queue an ACTION_READ for an empty block (internal helper)
+** The handler reads from its current file position, which is just after
+** the block sent before this one, so blocks come back in ring order
+*/
+static VOID SendBlock(struct IFFPrefetch *pf, struct IFFPrefetchBlock *block)
+{
+    struct DosPacket *dp;
+    
+    dp = block->packet;
+    dp->dp_Type = ACTION_READ;
+    dp->dp_Arg1 = pf->handlerArg;
+    dp->dp_Arg2 = (LONG)block->buffer;
+    dp->dp_Arg3 = (LONG)pf->blockSize;
+    SendPkt(dp, pf->handler, pf->replyPort);
+    
+    block->state = PREFETCH_PENDING;
+    block->length = 0;
+    block->offset = 0;
+    pf->sentPosition += (LONG)pf->blockSize;
+}
+
+/*
+** WaitBlock - Wait until a block sent to the handler has come back (internal helper)
+** Replies for other blocks that arrive meanwhile are collected as well
+*/
+static VOID WaitBlock(struct IFFPrefetch *pf, struct IFFPrefetchBlock *block)
+{
+    struct Message *msg;
+    struct DosPacket *dp;
+    struct IFFPrefetchBlock *done;
+    ULONG i;
+    
+    while (block->state == PREFETCH_PENDING) {
+        WaitPort(pf->replyPort);
+        while ((msg = GetMsg(pf->replyPort)) != NULL) {
+            dp = (struct DosPacket *)msg->mn_Node.ln_Name;
+            for (i = 0; i < pf->numBlocks; i++) {
+                done = &pf->blocks[i];
+                if (done->packet != dp) {
+                    continue;
+                }
+                done->state = PREFETCH_READY;
+                if (dp->dp_Res1 < 0) {
+                    done->length = 0;
+                    if (!pf->error) {
+                        pf->error = dp->dp_Res2;
+                    }
+                } else {
+                    done->length = dp->dp_Res1;
+                }
+                /* A short read is the end of the file */
+                if (done->length < (LONG)pf->blockSize) {
+                    pf->eof = TRUE;
+                }
+                break;
+            }
+        }
+    }
+}
+
+/*
+** TakeBytes - Copy n bytes out of the ring, or skip them if buffer is NULL (internal helper)
+** Returns: 0 on success, -1 at end of file or after a read error
+*/
+static LONG TakeBytes(struct IFFPrefetch *pf, UBYTE *buffer, LONG n)
+{
+    struct IFFPrefetchBlock *block;
+    LONG count;
+    
+    while (n > 0) {
+        block = &pf->blocks[pf->current];
+        if (block->state == PREFETCH_IDLE) {
+            return -1; /* Not sent again after the end of file or an error */
+        }
+        WaitBlock(pf, block);
+        
+        count = block->length - block->offset;
+        if (count <= 0) {
+            return -1;
+        }
+        if (count > n) {
+            count = n;
+        }
+        if (buffer) {
+            CopyMem(block->buffer + block->offset, buffer, (ULONG)count);
+            buffer += count;
+        }
+        block->offset += count;
+        pf->position += count;
+        n -= count;
+        
+        /* Emptied - queue it again for the data after the last block sent */
+        if (block->offset == block->length) {
+            block->state = PREFETCH_IDLE;
+            if (!pf->eof && !pf->error) {
+                SendBlock(pf, block);
+            }
+            pf->current = (pf->current + 1) % pf->numBlocks;
+        }
+    }
+    return 0;
+}
+
+/*
+** DrainBlocks - Collect every outstanding packet and empty the ring (internal helper)
+*/
+static VOID DrainBlocks(struct IFFPrefetch *pf)
+{
+    ULONG i;
+    
+    for (i = 0; i < pf->numBlocks; i++) {
+        WaitBlock(pf, &pf->blocks[i]);
+        pf->blocks[i].state = PREFETCH_IDLE;
+    }
+}
+
+/*
+** RestartBlocks - Move the file to position and fill the whole ring from there (internal helper)
+** Returns: 0 on success, -1 if the file cannot be seeked
+*/
+static LONG RestartBlocks(struct IFFPrefetch *pf, LONG position)
+{
+    ULONG i;
+    
+    DrainBlocks(pf);
+    if (position < 0 || Seek(pf->file, position, OFFSET_BEGINNING) < 0) {
+        return -1;
+    }
+    
+    pf->position = position;
+    pf->sentPosition = position;
+    pf->current = 0;
+    pf->eof = FALSE;
+    pf->error = 0;
+    for (i = 0; i < pf->numBlocks; i++) {
+        SendBlock(pf, &pf->blocks[i]);
+    }
+    return 0;
+}
+
+/*
+** PrefetchHook - Custom stream hook reading from the read-ahead ring (internal helper)
+** Returns: 0 on success, or an IFFERR_* code
+** Called through HookEntry by iffparse.library for each stream command
+*/
+static ULONG PrefetchHook(struct Hook *hook, struct IFFHandle *iff, struct IFFStreamCmd *cmd)
+{
+    struct IFFPrefetch *pf;
+    LONG n;
+    
+    pf = (struct IFFPrefetch *)hook->h_Data;
+    n = cmd->sc_NBytes;
+    
+    switch (cmd->sc_Command) {
+        case IFFCMD_READ:
+            if (n < 0 || TakeBytes(pf, (UBYTE *)cmd->sc_Buf, n) != 0) {
+                return (ULONG)IFFERR_READ;
+            }
+            return 0;
+        case IFFCMD_SEEK:
+            /* Skips over data already queued just use it up; anything
+             * else throws the ring away and starts again at the target */
+            if (n >= 0 && n <= pf->sentPosition - pf->position) {
+                if (TakeBytes(pf, NULL, n) != 0) {
+                    return (ULONG)IFFERR_SEEK;
+                }
+                return 0;
+            }
+            if (RestartBlocks(pf, pf->position + n) != 0) {
+                return (ULONG)IFFERR_SEEK;
+            }
+            return 0;
+        case IFFCMD_INIT:
+        case IFFCMD_CLEANUP:
+            return 0;
+        default:
+            return (ULONG)IFFERR_WRITE; /* Read-ahead streams are read-only */
+    }
+}
+
+/*
+** InitIFFPictureasPrefetch - Initialize IFFPicture to read a file with read-ahead
+** Returns: RETURN_OK when set up, RETURN_WARN to fall back, RETURN_FAIL on error
+**
+** numBlocks blocks of blockSize bytes (0 for either picks a default) are
+** kept queued at the file's handler, starting at the current file
+** position. Files without a handler of their own (NIL:), interactive
+** ones and ones that cannot be seeked, or a ring that does not fit in
+** memory, give RETURN_WARN with the file untouched: carry on with
+** InitIFFPictureasDOS() then. The file handle must stay open until
+** CloseIFFPicture(), which collects the outstanding packets and leaves
+** the file positioned after the last byte read. Like the memory stream,
+** iff_Stream is set here.
+**
+** Example usage:
+**   if (InitIFFPictureasPrefetch(picture, filehandle, 0, 0) == RETURN_WARN) {
+**       InitIFFPictureasDOS(picture);
+**       picture->iff->iff_Stream = (ULONG)filehandle;
+**   }
+**   OpenIFFPicture(picture, IFFF_READ);
+*/
+LONG InitIFFPictureasPrefetch(struct IFFPicture *picture, BPTR filehandle, ULONG blockSize, ULONG numBlocks)
+{
+    struct FileHandle *fh;
+    struct IFFHandle *iff;
+    struct IFFPrefetch *pf;
+    LONG start;
+    ULONG i;
+    
+    if (!picture || !filehandle) {
+        return RETURN_FAIL;
+    }
+    
+    if (blockSize == 0) {
+        blockSize = PREFETCH_BLOCKSIZE;
+    }
+    if (numBlocks == 0) {
+        numBlocks = PREFETCH_NUMBLOCKS;
+    }
+    if (numBlocks < 2) {
+        numBlocks = 2; /* One block being read while another is decoded */
+    }
+    
+    /* Packets go straight to the handler, so it must be a real, seekable file */
+    fh = (struct FileHandle *)BADDR(filehandle);
+    if (!fh->fh_Type || IsInteractive(filehandle)) {
+        return RETURN_WARN;
+    }
+    start = Seek(filehandle, 0, OFFSET_CURRENT);
+    if (start < 0) {
+        return RETURN_WARN;
+    }
+    
+    pf = (struct IFFPrefetch *)AllocPictureMem(picture, sizeof(struct IFFPrefetch), MEMF_PUBLIC | MEMF_CLEAR);
+    if (!pf) {
+        return RETURN_WARN;
+    }
+    picture->prefetch = pf;
+    
+    pf->file = filehandle;
+    pf->handler = fh->fh_Type;
+    pf->handlerArg = fh->fh_Arg1;
+    pf->blockSize = blockSize;
+    pf->numBlocks = numBlocks;
+    pf->position = start;
+    pf->sentPosition = start;
+    
+    /* Not worth failing over if the ring does not fit - stream it instead */
+    pf->replyPort = CreateMsgPort();
+    pf->blocks = (struct IFFPrefetchBlock *)AllocPictureMem(picture, numBlocks * sizeof(struct IFFPrefetchBlock),
+                                                            MEMF_PUBLIC | MEMF_CLEAR);
+    if (!pf->replyPort || !pf->blocks) {
+        FreePrefetch(picture);
+        return RETURN_WARN;
+    }
+    for (i = 0; i < numBlocks; i++) {
+        pf->blocks[i].buffer = (UBYTE *)AllocPictureMem(picture, blockSize, MEMF_PUBLIC);
+        pf->blocks[i].packet = (struct DosPacket *)AllocDosObject(DOS_STDPKT, NULL);
+        if (!pf->blocks[i].buffer || !pf->blocks[i].packet) {
+            FreePrefetch(picture);
+            return RETURN_WARN;
+        }
+    }
+    
+    /* Allocate IFF handle */
+    iff = AllocIFF();
+    if (!iff) {
+        FreePrefetch(picture);
+        SetIFFPictureError(picture, IFFPICTURE_NOMEM, "Cannot allocate IFF handle");
+        return RETURN_FAIL;
+    }
+    
+    if (RestartBlocks(pf, start) != 0) {
+        FreeIFF(iff);
+        FreePrefetch(picture);
+        SetIFFPictureError(picture, IFFPICTURE_BADFILE, "Cannot seek in file");
+        return RETURN_FAIL;
+    }
+    
+    pf->hook.h_Entry = (HOOKFUNC)HookEntry;
+    pf->hook.h_SubEntry = (HOOKFUNC)PrefetchHook;
+    pf->hook.h_Data = (APTR)pf;
+    
+    picture->iff = iff;
+    
+    /* The stream is the ring, so iff_Stream is set here rather than by the caller */
+    iff->iff_Stream = (ULONG)pf;
+    InitIFF(iff, IFFF_FSEEK | IFFF_RSEEK, &pf->hook);
+    return RETURN_OK;
+}
+
+/*
+** FreePrefetch - Collect outstanding packets and free the read-ahead stream (internal)
+** Called by CloseIFFPicture() after FreeIFF(); the file is left positioned
+** after the last byte iffparse read, as it would be for a DOS stream
+*/
+VOID FreePrefetch(struct IFFPicture *picture)
+{
+    struct IFFPrefetch *pf;
+    ULONG i;
+    
+    pf = picture->prefetch;
+    if (!pf) {
+        return;
+    }
+    
+    if (pf->blocks) {
+        if (pf->replyPort) {
+            DrainBlocks(pf);
+        }
+        if (pf->sentPosition != pf->position) {
+            Seek(pf->file, pf->position, OFFSET_BEGINNING);
+        }
+        for (i = 0; i < pf->numBlocks; i++) {
+            if (pf->blocks[i].packet) {
+                FreeDosObject(DOS_STDPKT, pf->blocks[i].packet);
+            }
+            FreePictureMem(picture, pf->blocks[i].buffer, pf->blockSize);
+        }
+        FreePictureMem(picture, pf->blocks, pf->numBlocks * sizeof(struct IFFPrefetchBlock));
+    }
+    if (pf->replyPort) {
+        DeleteMsgPort(pf->replyPort);
+    }
+    
+    FreePictureMem(picture, pf, sizeof(struct IFFPrefetch));
+    picture->prefetch = NULL;
+}
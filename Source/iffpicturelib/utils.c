@@ -2,17 +2,157 @@
 ** utils.c - Utility Functions (Internal to Library)
 **
 ** Helper functions for memory management, format conversion, etc.
-** Currently empty - functions will be added as needed during implementation.
+** Everything an IFFPicture owns is allocated through AllocPictureMem() so
+** the caller can choose the allocator with SetIFFPictureAllocator().
 */
 
 #include "iffpicture_private.h"
 #include <proto/exec.h>
 #include <proto/utility.h>
 
-/* Dummy function to prevent "no externally-known symbols" warning */
-/* This file is kept for future utility functions */
-static VOID DummyUtilsFunction(VOID)
+/* Arena blocks - requests over a quarter block get a block of their own */
+#define ARENA_BLOCKSIZE     32768
+#define ARENA_BIGALLOC      (ARENA_BLOCKSIZE / 4)
+
+/*
+** ClearBuffer - Zero size bytes of longword aligned memory (internal)
+*/
+VOID ClearBuffer(UBYTE *buffer, ULONG size)
+{
+    ULONG *longs;
+    ULONG count;
+    
+    /* All our allocators hand out longword aligned memory, so clear by longwords first */
+    longs = (ULONG *)buffer;
+    for (count = size >> 2; count > 0; count--) {
+        *longs++ = 0;
+    }
+    buffer = (UBYTE *)longs;
+    for (count = size & 3; count > 0; count--) {
+        *buffer++ = 0;
+    }
+}
+
+/*
+** AllocArenaMem - Carve size bytes from the picture's arena (internal helper)
+** Returns: Memory or NULL, cleared only if MEMF_CLEAR is set
+*/
+static APTR AllocArenaMem(struct IFFPicture *picture, ULONG size, ULONG flags)
+{
+    struct IFFArenaBlock *block;
+    ULONG blockSize;
+    UBYTE *memory;
+    
+    /* Keep every allocation 8-byte aligned */
+    size = (size + 7) & ~7UL;
+    
+    block = picture->arena;
+    if (!block || block->size - block->used < size) {
+        blockSize = (size > ARENA_BIGALLOC) ? size : ARENA_BLOCKSIZE;
+        block = (struct IFFArenaBlock *)AllocMem(sizeof(struct IFFArenaBlock) + blockSize,
+                                                 MEMF_PUBLIC);
+        if (!block) {
+            return NULL;
+        }
+        block->size = blockSize;
+        block->used = 0;
+        
+        /* A block of its own goes behind the current one, which still has room */
+        if (size > ARENA_BIGALLOC && picture->arena) {
+            block->next = picture->arena->next;
+            picture->arena->next = block;
+        } else {
+            block->next = picture->arena;
+            picture->arena = block;
+        }
+    }
+    
+    memory = (UBYTE *)(block + 1) + block->used;
+    block->used += size;
+    if (flags & MEMF_CLEAR) {
+        ClearBuffer(memory, size);
+    }
+    return memory;
+}
+
+/*
+** AllocPictureMem - Allocate memory owned by an IFFPicture (internal)
+** Returns: Memory or NULL if out of memory
+** flags are exec MEMF_ flags; the memory is only cleared with MEMF_CLEAR
+*/
+APTR AllocPictureMem(struct IFFPicture *picture, ULONG size, ULONG flags)
 {
-    /* Empty - prevents compiler warning about empty module */
+    APTR memory;
+    
+    if (size == 0) {
+        return NULL;
+    }
+    
+    switch (picture->allocType) {
+        case IFFALLOC_POOL:
+            memory = AllocPooled(picture->memPool, size);
+            if (memory && (flags & MEMF_CLEAR)) {
+                ClearBuffer((UBYTE *)memory, size);
+            }
+            return memory;
+        
+        case IFFALLOC_ARENA:
+            return AllocArenaMem(picture, size, flags);
+        
+        case IFFALLOC_CUSTOM:
+            return picture->allocator->ia_Alloc(picture->allocator, size, flags);
+        
+        default:
+            return AllocMem(size, flags);
+    }
 }
 
+/*
+** FreePictureMem - Free memory from AllocPictureMem() (internal)
+** size must be the size that was allocated; arena memory is only
+** released by ReleasePictureMem()
+*/
+VOID FreePictureMem(struct IFFPicture *picture, APTR memory, ULONG size)
+{
+    if (!memory) {
+        return;
+    }
+    
+    switch (picture->allocType) {
+        case IFFALLOC_POOL:
+            FreePooled(picture->memPool, memory, size);
+            break;
+        
+        case IFFALLOC_ARENA:
+            break;
+        
+        case IFFALLOC_CUSTOM:
+            picture->allocator->ia_Free(picture->allocator, memory, size);
+            break;
+        
+        default:
+            FreeMem(memory, size);
+            break;
+    }
+}
+
+/*
+** ReleasePictureMem - Give back whatever the allocator holds in bulk (internal)
+** Frees the arena blocks and deletes the pool; nothing allocated from
+** either may still be in use. An arena can be used again afterwards.
+*/
+VOID ReleasePictureMem(struct IFFPicture *picture)
+{
+    struct IFFArenaBlock *block;
+    
+    while (picture->arena) {
+        block = picture->arena;
+        picture->arena = block->next;
+        FreeMem(block, sizeof(struct IFFArenaBlock) + block->size);
+    }
+    
+    if (picture->memPool) {
+        DeletePool(picture->memPool);
+        picture->memPool = NULL;
+    }
+}
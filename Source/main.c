@@ -14,21 +14,327 @@ static const char *verstag = "$VER: iff2png 1.4 (2/1/2025)";
 static const char *stack_cookie = "$STACK: 4096";
 long oslibversion  = 40L; 
 
-/* Command-line template - two required positional file arguments and optional FORCE, QUIET, and OPAQUE switches */
-static const char TEMPLATE[] = "SOURCE/A,TARGET/A,FORCE/S,QUIET/S,OPAQUE/S,STRIP=NOMETADATA/S";
+/* Command-line template - two required positional file arguments and optional switches */
+static const char TEMPLATE[] = "SOURCE/A,TARGET,FORCE/S,QUIET/S,OPAQUE/S,STRIP=NOMETADATA/S,FRAMES/S,APNG/S,ALL/S,PROBE/S,LEVEL/K/N,STRATEGY/K,FILTER/K,FAST/S,OPTIMIZE/S,BUDGET/K/N,BUFFER/K/N";
 
 /* Usage string */
-static const char USAGE[] = "Usage: iff2png SOURCE/A TARGET/A [FORCE/S] [QUIET/S] [OPAQUE/S] [STRIP=NOMETADATA/S]\n"
-                             "  SOURCE/A - Input IFF image file\n"
-                             "  TARGET/A - Output PNG file\n"
+static const char USAGE[] = "Usage: iff2png SOURCE/A TARGET [FORCE/S] [QUIET/S] [OPAQUE/S] [STRIP=NOMETADATA/S] [FRAMES/S] [APNG/S] [ALL/S] [PROBE/S] [LEVEL/K/N] [STRATEGY/K] [FILTER/K] [FAST/S] [OPTIMIZE/S] [BUDGET/K/N] [BUFFER/K/N]\n"
+                             "  SOURCE/A - Input IFF image file (a pattern with PROBE)\n"
+                             "  TARGET - Output PNG file, required unless PROBE is given\n"
                              "  FORCE/S - Overwrite existing output file\n"
                              "  QUIET/S - Suppress normal output messages\n"
                              "  OPAQUE/S - Keep color 0 opaque instead of transparent\n"
-                             "  STRIP/S or NOMETADATA/S - Prevents any metadata text from the source being included in the target PNG\n";
+                             "  STRIP/S or NOMETADATA/S - Prevents any metadata text from the source being included in the target PNG\n"
+                             "  FRAMES/S - Write every frame of an ANIM as numbered PNGs (TARGET.0000.png, ...)\n"
+                             "  APNG/S - Write all frames of an ANIM into one animated PNG\n"
+                             "  ALL/S - Write every picture of a CAT or LIST as numbered PNGs\n"
+                             "  PROBE/S - Print the header of every file matching SOURCE, one line each\n"
+                             "  LEVEL/K/N - zlib compression level 0-9 (default chosen per image)\n"
+                             "  STRATEGY/K - zlib strategy: AUTO, DEFAULT, FILTERED, HUFFMAN, RLE or FIXED\n"
+                             "  FILTER/K - PNG row filter: AUTO, NONE, SUB, UP, AVG, PAETH or ALL\n"
+                             "  FAST/S - Favour conversion speed over file size\n"
+                             "  OPTIMIZE/S - Try several filters and strategies and keep the smallest PNG\n"
+                             "  BUDGET/K/N - Seconds OPTIMIZE may spend per image (default no limit)\n"
+                             "  BUFFER/K/N - Kilobytes of PNG data gathered per file write (default 32)\n";
 
 /* Library base - needed for proto includes */
 struct Library *IFFParseBase;
 
+/* Keyword values for the STRATEGY and FILTER options */
+struct OptionName {
+    const char *name;
+    int value;
+};
+
+static const struct OptionName strategyNames[] = {
+    { "AUTO", PNGCONFIG_AUTO },
+    { "DEFAULT", Z_DEFAULT_STRATEGY },
+    { "FILTERED", Z_FILTERED },
+    { "HUFFMAN", Z_HUFFMAN_ONLY },
+    { "RLE", Z_RLE },
+    { "FIXED", Z_FIXED },
+    { NULL, 0 }
+};
+
+static const struct OptionName filterNames[] = {
+    { "AUTO", PNGCONFIG_AUTO },
+    { "NONE", PNG_FILTER_NONE },
+    { "SUB", PNG_FILTER_SUB },
+    { "UP", PNG_FILTER_UP },
+    { "AVG", PNG_FILTER_AVG },
+    { "PAETH", PNG_FILTER_PAETH },
+    { "ALL", PNG_ALL_FILTERS },
+    { NULL, 0 }
+};
+
+/* Files up to this size are read into memory in one go and decoded in place */
+#define MAX_BUFFERED_FILE (2UL * 1024UL * 1024UL)
+
+/* Read-ahead ring for larger files - 4 x 64K queued at the filesystem */
+#define PREFETCH_BLOCKSIZE 65536UL
+#define PREFETCH_BLOCKS 4UL
+
+/*
+** FindOptionName - Look a keyword option value up in a table (case insensitive)
+** Returns: TRUE and sets *value if found, FALSE for an unknown keyword
+*/
+static BOOL FindOptionName(const struct OptionName *names, const char *keyword, int *value)
+{
+    for (; names->name; names++) {
+        if (Stricmp((STRPTR)names->name, (STRPTR)keyword) == 0) {
+            *value = names->value;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/*
+** FindOptionValue - Look the keyword for an option value up in a table
+** Returns: The keyword, or "?" for a value that has none
+*/
+static const char *FindOptionValue(const struct OptionName *names, int value)
+{
+    for (; names->name; names++) {
+        if (names->value == value) {
+            return names->name;
+        }
+    }
+    return "?";
+}
+
+/*
+** BuildFrameName - Build the file name for one frame of an animation
+** "anim.png" becomes "anim.0007.png"; a name without .png gets it appended
+*/
+static VOID BuildFrameName(const char *targetFile, ULONG frame, char *name, LONG nameSize)
+{
+    LONG len;
+    
+    for (len = 0; targetFile[len]; len++) {
+    }
+    if (len >= 4 && Stricmp((STRPTR)targetFile + len - 4, ".png") == 0) {
+        len -= 4;
+    }
+    if (len > nameSize - 10) {
+        len = nameSize - 10; /* Room for ".nnnn.png" and the terminator */
+    }
+    
+    Strncpy(name, (STRPTR)targetFile, len + 1);
+    name[len] = '\0';
+    SNPrintf((STRPTR)name + len, nameSize - len, ".%04lu.png", frame);
+}
+
+/*
+** WriteNumberedPNG - Write the current image as TARGET.nnnn.png
+** Returns: RETURN_OK on success, RETURN_FAIL on error
+*/
+static LONG WriteNumberedPNG(struct IFFPicture *picture, const char *targetFile, ULONG number,
+                             struct PNGConfig *config, BOOL stripMetadata, BOOL forceOverwrite)
+{
+    char numberedFile[256];
+    BPTR lock;
+    
+    BuildFrameName(targetFile, number, numberedFile, sizeof(numberedFile));
+    if (!forceOverwrite) {
+        lock = Lock((STRPTR)numberedFile, ACCESS_READ);
+        if (lock) {
+            UnLock(lock);
+            PutStr("Error: Output file already exists: ");
+            PutStr((STRPTR)numberedFile);
+            PutStr("\n");
+            return RETURN_FAIL;
+        }
+    }
+    return PNGEncoder_Write((const char *)numberedFile, GetPixelData(picture), config, picture, stripMetadata);
+}
+
+/*
+** WriteAnimation - Convert all frames of an ANIM
+** Returns: RETURN_OK on success, RETURN_FAIL on error
+**
+** The first frame must already be decoded, with config set up for it.
+** With writeAPNG all frames go into one APNG at targetFile and each
+** frame after the first only stores the area that changed. Otherwise
+** every frame goes through the normal PNG path as a numbered file.
+*/
+static LONG WriteAnimation(struct IFFPicture *picture, const char *targetFile,
+                           struct PNGConfig *config, BOOL opaque, BOOL stripMetadata,
+                           BOOL writeAPNG, BOOL forceOverwrite, ULONG *numFrames)
+{
+    struct APNGWriter *writer;
+    struct AnimRect *rect;
+    ULONG width, height;
+    ULONG delayNum, delayDen;
+    LONG result;
+    
+    *numFrames = 0;
+    writer = NULL;
+    width = GetWidth(picture);
+    height = GetHeight(picture);
+    
+    if (writeAPNG) {
+        /* Frames with a mask plane or alpha element decode to RGBA */
+        writer = APNGEncoder_Open(targetFile, (UWORD)width, (UWORD)height,
+                                  (BOOL)(GetPixelDataSize(picture) >= width * height * 4));
+        if (!writer) {
+            return RETURN_FAIL;
+        }
+    }
+    
+    do {
+        if (writer) {
+            rect = GetFrameRect(picture);
+            GetFrameDelay(picture, &delayNum, &delayDen);
+            if (delayNum > 0xFFFF) {
+                delayNum = 0xFFFF;
+            }
+            result = APNGEncoder_WriteFrame(writer, GetPixelData(picture),
+                                            rect->x, rect->y, rect->w, rect->h,
+                                            (UWORD)delayNum, (UWORD)delayDen);
+        } else {
+            result = WriteNumberedPNG(picture, targetFile, GetFrameNumber(picture),
+                                      config, stripMetadata, forceOverwrite);
+        }
+        if (result != RETURN_OK) {
+            break;
+        }
+        (*numFrames)++;
+        
+        result = DecodeNextFrame(picture);
+        if (result == RETURN_OK && !writer) {
+            /* Frames may carry their own CMAP, so redo the PNG setup */
+            PNGEncoder_FreeConfig(config);
+            result = GetOptimalPNGConfig(picture, config, opaque);
+        }
+    } while (result == RETURN_OK);
+    
+    /* RETURN_WARN from DecodeNextFrame() marks the end of the animation */
+    if (result == RETURN_WARN) {
+        result = RETURN_OK;
+    }
+    
+    if (writer && APNGEncoder_Close(writer) != RETURN_OK) {
+        result = RETURN_FAIL;
+    }
+    
+    return result;
+}
+
+/*
+** WriteContainer - Convert every picture of a CAT or LIST
+** Returns: RETURN_OK on success, RETURN_FAIL on error
+**
+** The first picture must already be decoded, with config set up for it.
+** Each following FORM is read, decoded and written in turn, so the file
+** is only read once.
+*/
+static LONG WriteContainer(struct IFFPicture *picture, const char *targetFile,
+                           struct PNGConfig *config, BOOL opaque, BOOL stripMetadata,
+                           BOOL forceOverwrite, ULONG *numImages)
+{
+    UBYTE *rgbData;
+    ULONG rgbSize;
+    LONG result;
+    
+    *numImages = 0;
+    
+    do {
+        result = WriteNumberedPNG(picture, targetFile, GetImageIndex(picture),
+                                  config, stripMetadata, forceOverwrite);
+        if (result != RETURN_OK) {
+            break;
+        }
+        (*numImages)++;
+        
+        result = NextIFFPicture(picture);
+        if (result == RETURN_OK) {
+            PNGEncoder_FreeConfig(config);
+            result = AnalyzeFormat(picture);
+            if (result == RETURN_OK) {
+                result = DecodeToRGB(picture, &rgbData, &rgbSize);
+            }
+            if (result == RETURN_OK) {
+                result = GetOptimalPNGConfig(picture, config, opaque);
+            }
+        }
+    } while (result == RETURN_OK);
+    
+    /* RETURN_WARN from NextIFFPicture() means there are no more pictures */
+    if (result == RETURN_WARN) {
+        result = RETURN_OK;
+    }
+    
+    return result;
+}
+
+/*
+** ProbeFiles - Print the picture header of every file matching a pattern
+** Returns: RETURN_OK, RETURN_WARN if some files are not IFF pictures,
+**          or RETURN_FAIL on error
+**
+** Only the header chunks are read (see ProbeIFFPicture()), so large
+** collections can be inventoried in one run.
+*/
+static LONG ProbeFiles(const char *pattern)
+{
+    struct AnchorPath *ap;
+    struct IFFImageInfo info;
+    BPTR filehandle;
+    LONG error;
+    LONG result;
+    char formName[5];
+    UBYTE outputBuffer[400];
+    
+    ap = (struct AnchorPath *)AllocMem(sizeof(struct AnchorPath) + 256, MEMF_PUBLIC | MEMF_CLEAR);
+    if (!ap) {
+        PutStr("Error: Out of memory\n");
+        return RETURN_FAIL;
+    }
+    ap->ap_BreakBits = SIGBREAKF_CTRL_C;
+    ap->ap_Strlen = 256;
+    
+    result = RETURN_OK;
+    error = MatchFirst((STRPTR)pattern, ap);
+    while (!error) {
+        if (ap->ap_Info.fib_DirEntryType < 0) {
+            filehandle = Open(ap->ap_Buf, MODE_OLDFILE);
+            if (!filehandle) {
+                PrintFault(IoErr(), ap->ap_Buf);
+                result = RETURN_WARN;
+            } else {
+                if (ProbeIFFPicture(filehandle, &info) == RETURN_OK) {
+                    formName[0] = (char)(info.formType >> 24);
+                    formName[1] = (char)(info.formType >> 16);
+                    formName[2] = (char)(info.formType >> 8);
+                    formName[3] = (char)info.formType;
+                    formName[4] = '\0';
+                    SNPrintf((STRPTR)outputBuffer, sizeof(outputBuffer),
+                             "%s: %s %lu x %lu x %lu, CAMG $%08lx, compression %lu, masking %lu, data %lu bytes\n",
+                             ap->ap_Buf, formName, (ULONG)info.width, (ULONG)info.height,
+                             (ULONG)info.depth, info.viewportModes, (ULONG)info.compression,
+                             (ULONG)info.masking, info.compressedSize);
+                } else {
+                    SNPrintf((STRPTR)outputBuffer, sizeof(outputBuffer),
+                             "%s: not a supported IFF picture\n", ap->ap_Buf);
+                    result = RETURN_WARN;
+                }
+                PutStr((STRPTR)outputBuffer);
+                Close(filehandle);
+            }
+        }
+        error = MatchNext(ap);
+    }
+    MatchEnd(ap);
+    FreeMem(ap, sizeof(struct AnchorPath) + 256);
+    
+    if (error != ERROR_NO_MORE_ENTRIES) {
+        PrintFault(error, "iff2png");
+        result = RETURN_FAIL;
+    }
+    return result;
+}
+
 /*
 ** main - Entry point for AmigaDOS command
 ** Returns: RETURN_OK on success, RETURN_FAIL on error
@@ -36,7 +342,7 @@ struct Library *IFFParseBase;
 int main(int argc, char **argv)
 {
     struct RDArgs *rdargs;
-    LONG args[6]; /* SOURCE, TARGET, FORCE, QUIET, OPAQUE, STRIP */
+    LONG args[17]; /* SOURCE, TARGET, FORCE, QUIET, OPAQUE, STRIP, FRAMES, APNG, ALL, PROBE, LEVEL, STRATEGY, FILTER, FAST, OPTIMIZE, BUDGET, BUFFER */
     char sourceFile[256]; /* Local copy of source filename */
     char targetFile[256]; /* Local copy of target filename */
     struct IFFPicture *picture;
@@ -48,6 +354,16 @@ int main(int argc, char **argv)
     BOOL quiet;
     BOOL opaque;
     BOOL stripMetadata;
+    BOOL exportFrames;
+    BOOL writeAPNG;
+    BOOL animExport;
+    BOOL allPictures;
+    BOOL listExport;
+    BPTR sourceHandle;
+    ULONG numWritten;
+    int level;
+    int strategy;
+    int filter;
     BPTR lock;
     BPTR targetLock;
     struct FileInfoBlock fib;
@@ -63,6 +379,20 @@ int main(int argc, char **argv)
     config.num_palette = 0;
     config.trans = NULL;
     config.num_trans = 0;
+    config.trans_gray = 0;
+    config.index_map = NULL;
+    config.remap_indices = FALSE;
+    config.palette_from_rgb = FALSE;
+    config.compression_level = PNGCONFIG_AUTO;
+    config.compression_strategy = PNGCONFIG_AUTO;
+    config.filter = PNGCONFIG_AUTO;
+    config.preset = PNGPRESET_DEFAULT;
+    config.time_budget = 0;
+    config.buffer_size = 0;
+    animExport = FALSE;
+    listExport = FALSE;
+    sourceHandle = 0;
+    numWritten = 0;
     
     /* Open iffparse.library */
     IFFParseBase = OpenLibrary("iffparse.library", 0);
@@ -78,9 +408,20 @@ int main(int argc, char **argv)
     args[3] = 0; /* QUIET (boolean) */
     args[4] = 0; /* OPAQUE (boolean) */
     args[5] = 0; /* STRIP (boolean) */
+    args[6] = 0; /* FRAMES (boolean) */
+    args[7] = 0; /* APNG (boolean) */
+    args[8] = 0; /* ALL (boolean) */
+    args[9] = 0; /* PROBE (boolean) */
+    args[10] = 0; /* LEVEL (pointer to LONG) */
+    args[11] = 0; /* STRATEGY */
+    args[12] = 0; /* FILTER */
+    args[13] = 0; /* FAST (boolean) */
+    args[14] = 0; /* OPTIMIZE (boolean) */
+    args[15] = 0; /* BUDGET (pointer to LONG) */
+    args[16] = 0; /* BUFFER (pointer to LONG) */
     
     /* Parse command-line arguments */
-    /* Template "SOURCE/A,TARGET/A,FORCE/S,QUIET/S,OPAQUE/S,STRIP/S" - two required files and optional switches */
+    /* Template "SOURCE/A,TARGET,FORCE/S,...,PROBE/S,LEVEL/K/N,...,FAST/S" - source, target unless probing, and optional switches */
     rdargs = ReadArgs((STRPTR)TEMPLATE, args, NULL);
     if (!rdargs) {
         /* ReadArgs returns NULL on failure (e.g., missing required /A arguments) */
@@ -91,8 +432,8 @@ int main(int argc, char **argv)
         return (int)RETURN_FAIL;
     }
     
-    /* With /A modifier, ReadArgs ensures args are filled, but check anyway */
-    if (!args[0] || !args[1]) {
+    /* SOURCE has /A; TARGET is only optional for PROBE */
+    if (!args[0] || (!args[1] && !args[9])) {
         PutStr("Error: Missing required arguments\n");
         PutStr((STRPTR)USAGE);
         FreeArgs(rdargs);
@@ -107,18 +448,91 @@ int main(int argc, char **argv)
     Strncpy(sourceFile, (STRPTR)args[0], sizeof(sourceFile) - 1);
     sourceFile[sizeof(sourceFile) - 1] = '\0';
     
-    Strncpy(targetFile, (STRPTR)args[1], sizeof(targetFile) - 1);
-    targetFile[sizeof(targetFile) - 1] = '\0';
+    targetFile[0] = '\0';
+    if (args[1]) {
+        Strncpy(targetFile, (STRPTR)args[1], sizeof(targetFile) - 1);
+        targetFile[sizeof(targetFile) - 1] = '\0';
+    }
     
     /* Get switch values (non-zero if set) - these are just booleans, no need to copy */
     forceOverwrite = (args[2] != 0);
     quiet = (args[3] != 0);
     opaque = (args[4] != 0);
     stripMetadata = (args[5] != 0);
+    exportFrames = (args[6] != 0);
+    writeAPNG = (args[7] != 0);
+    allPictures = (args[8] != 0);
+    
+    /* Compression options - anything not given is chosen per image */
+    if (args[13] && args[14]) {
+        PutStr("Error: FAST and OPTIMIZE cannot be used together\n");
+        FreeArgs(rdargs);
+        CloseLibrary(IFFParseBase);
+        IFFParseBase = NULL;
+        return (int)RETURN_FAIL;
+    }
+    if (args[13]) {
+        config.preset = PNGPRESET_FAST;
+    }
+    if (args[14]) {
+        config.preset = PNGPRESET_OPTIMIZE;
+    }
+    if (args[15]) {
+        config.time_budget = (int)*(LONG *)args[15];
+        if (config.time_budget < 0) {
+            PutStr("Error: BUDGET must not be negative\n");
+            FreeArgs(rdargs);
+            CloseLibrary(IFFParseBase);
+            IFFParseBase = NULL;
+            return (int)RETURN_FAIL;
+        }
+    }
+    if (args[16]) {
+        if (*(LONG *)args[16] < 1 || *(LONG *)args[16] > 16384) {
+            PutStr("Error: BUFFER must be 1 to 16384 kilobytes\n");
+            FreeArgs(rdargs);
+            CloseLibrary(IFFParseBase);
+            IFFParseBase = NULL;
+            return (int)RETURN_FAIL;
+        }
+        config.buffer_size = (int)(*(LONG *)args[16] * 1024);
+    }
+    if (args[10]) {
+        config.compression_level = (int)*(LONG *)args[10];
+        if (config.compression_level < 0 || config.compression_level > 9) {
+            PutStr("Error: LEVEL must be 0 to 9\n");
+            FreeArgs(rdargs);
+            CloseLibrary(IFFParseBase);
+            IFFParseBase = NULL;
+            return (int)RETURN_FAIL;
+        }
+    }
+    if (args[11] && !FindOptionName(strategyNames, (const char *)args[11], &config.compression_strategy)) {
+        PutStr("Error: STRATEGY must be AUTO, DEFAULT, FILTERED, HUFFMAN, RLE or FIXED\n");
+        FreeArgs(rdargs);
+        CloseLibrary(IFFParseBase);
+        IFFParseBase = NULL;
+        return (int)RETURN_FAIL;
+    }
+    if (args[12] && !FindOptionName(filterNames, (const char *)args[12], &config.filter)) {
+        PutStr("Error: FILTER must be AUTO, NONE, SUB, UP, AVG, PAETH or ALL\n");
+        FreeArgs(rdargs);
+        CloseLibrary(IFFParseBase);
+        IFFParseBase = NULL;
+        return (int)RETURN_FAIL;
+    }
     
     /* Free ReadArgs memory now that we've copied the strings we need */
     FreeArgs(rdargs);
     
+    /* PROBE only lists headers - SOURCE may be a pattern and nothing is written */
+    if (args[9]) {
+        result = ProbeFiles(sourceFile);
+        CloseLibrary(IFFParseBase);
+        IFFParseBase = NULL;
+        return (int)result;
+    }
+    
     /* Check if input file exists */
     lock = Lock((STRPTR)sourceFile, ACCESS_READ);
     if (!lock) {
@@ -180,6 +594,11 @@ int main(int argc, char **argv)
         return (int)RETURN_FAIL;
     }
     
+    /* With STRIP the metadata chunks are skipped rather than read and thrown away */
+    if (stripMetadata) {
+        SetIFFPictureMetadata(picture, FALSE);
+    }
+    
     /* Open file with DOS - following iffparse.library pattern */
     {
         BPTR filehandle;
@@ -192,24 +611,60 @@ int main(int argc, char **argv)
             return (int)RETURN_FAIL;
         }
         
-        /* Initialize IFFPicture as DOS stream */
-        InitIFFPictureasDOS(picture);
+        /* Read small files into memory with one Read(); larger ones are streamed */
+        result = InitIFFPictureasBuffered(picture, filehandle, MAX_BUFFERED_FILE);
+        if (result == RETURN_FAIL) {
+            PutStr("Error: Cannot read file: ");
+            PutStr((STRPTR)sourceFile);
+            PutStr("\n");
+            PutStr("  ");
+            PutStr((STRPTR)GetErrorString(picture));
+            PutStr("\n");
+            Close(filehandle);
+            FreeIFFPicture(picture);
+            CloseLibrary(IFFParseBase);
+            IFFParseBase = NULL;
+            return (int)RETURN_FAIL;
+        }
         
-        /* Set the stream handle (must be done after InitIFFPictureasDOS) */
-        /* Following iffparse.library pattern: user sets iff_Stream */
-        {
-            struct IFFHandle *iff;
-            iff = GetIFFHandle(picture);
-            if (!iff) {
-                PutStr("Error: Cannot initialize IFFPicture\n");
+        /* Larger files are read ahead by the filesystem while decoding */
+        if (result == RETURN_WARN) {
+            result = InitIFFPictureasPrefetch(picture, filehandle, PREFETCH_BLOCKSIZE, PREFETCH_BLOCKS);
+            if (result == RETURN_FAIL) {
+                PutStr("Error: Cannot read file: ");
+                PutStr((STRPTR)sourceFile);
+                PutStr("\n");
+                PutStr("  ");
+                PutStr((STRPTR)GetErrorString(picture));
+                PutStr("\n");
                 Close(filehandle);
                 FreeIFFPicture(picture);
                 CloseLibrary(IFFParseBase);
                 IFFParseBase = NULL;
                 return (int)RETURN_FAIL;
             }
-            /* Set stream handle - user responsibility per iffparse pattern */
-            iff->iff_Stream = (ULONG)filehandle;
+        }
+        
+        if (result == RETURN_WARN) {
+            /* Initialize IFFPicture as DOS stream */
+            InitIFFPictureasDOS(picture);
+            
+            /* Set the stream handle (must be done after InitIFFPictureasDOS) */
+            /* Following iffparse.library pattern: user sets iff_Stream */
+            {
+                struct IFFHandle *iff;
+                iff = GetIFFHandle(picture);
+                if (!iff) {
+                    PutStr("Error: Cannot initialize IFFPicture\n");
+                    Close(filehandle);
+                    FreeIFFPicture(picture);
+                    CloseLibrary(IFFParseBase);
+                    IFFParseBase = NULL;
+                    return (int)RETURN_FAIL;
+                }
+                /* Set stream handle - user responsibility per iffparse pattern */
+                iff->iff_Stream = (ULONG)filehandle;
+            }
         }
         
         /* Open IFF for reading */
@@ -221,7 +676,8 @@ int main(int argc, char **argv)
             PutStr("  ");
             PutStr((STRPTR)GetErrorString(picture));
             PutStr("\n");
-            /* Close file handle - user responsibility per iffparse pattern */
+            /* Close file handle after CloseIFFPicture() - user responsibility per iffparse pattern */
+            CloseIFFPicture(picture);
             Close(filehandle);
             FreeIFFPicture(picture);
             CloseLibrary(IFFParseBase);
@@ -286,10 +742,17 @@ int main(int argc, char **argv)
             return (int)RETURN_FAIL;
         }
         
-        /* Close IFF context and file handle - following iffparse.library pattern */
-        /* CloseIFFPicture() closes the IFF context but NOT the file handle */
-        CloseIFFPicture(picture);
-        Close(filehandle); /* User must close file handle after CloseIFFPicture() */
+        /* Animations and containers stay open so the remaining frames or pictures can be read */
+        animExport = (BOOL)((exportFrames || writeAPNG) && IsAnimation(picture));
+        listExport = (BOOL)(allPictures && GetContainerType(picture) != 0);
+        if (animExport || listExport) {
+            sourceHandle = filehandle;
+        } else {
+            /* Close IFF context and file handle - following iffparse.library pattern */
+            /* CloseIFFPicture() closes the IFF context but NOT the file handle */
+            CloseIFFPicture(picture);
+            Close(filehandle); /* User must close file handle after CloseIFFPicture() */
+        }
     }
     
     /* Output header and analysis information (unless quiet) */
@@ -322,6 +785,10 @@ int main(int argc, char **argv)
         if (!bmhd) {
             PutStr("Error: BMHD chunk not available\n");
             PNGEncoder_FreeConfig(&config);
+            if (animExport || listExport) {
+                CloseIFFPicture(picture);
+                Close(sourceHandle);
+            }
             FreeIFFPicture(picture);
             if (IFFParseBase) {
                 CloseLibrary(IFFParseBase);
@@ -372,6 +839,8 @@ int main(int argc, char **argv)
                 case 4: compressionName = "Modified Modified READ (MMR)"; break;
                 default: compressionName = "Unknown"; break;
             }
+        } else if (IsCompressed(picture) && bmhd->compression == 2) {
+            compressionName = "VDAT (vertical RLE)";
         } else if (IsCompressed(picture)) {
             compressionName = "ByteRun1";
         } else {
@@ -440,6 +909,20 @@ int main(int argc, char **argv)
             PutStr("  Mode: EHB (Extra Half-Brite)\n");
         }
         
+        if (IsAnimation(picture)) {
+            if (formType == ID_DEEP) {
+                PutStr("  Animation: DEEP (DCHG tiles)\n");
+            } else {
+                PutStr("  Animation: ANIM (ILBM frames)\n");
+            }
+        }
+        
+        if (GetContainerType(picture) == ID_CAT) {
+            PutStr("  Container: CAT\n");
+        } else if (GetContainerType(picture) == ID_LIST) {
+            PutStr("  Container: LIST\n");
+        }
+        
         SNPrintf((STRPTR)outputBuffer, sizeof(outputBuffer), "  Compression: %s\n", compressionName);
         PutStr((STRPTR)outputBuffer);
         
@@ -474,15 +957,85 @@ int main(int argc, char **argv)
             PutStr("  Transparency: None\n");
         }
         
-        PutStr("  Compression: Deflate (zlib)\n");
-        PutStr("  Filter: Adaptive\n");
+        /* AUTO settings resolved the way the encoder will resolve them */
+        PNGEncoder_GetCompression(&config, picture, &level, &strategy, &filter);
+        if (config.preset == PNGPRESET_OPTIMIZE && config.compression_level == PNGCONFIG_AUTO) {
+            level = Z_BEST_COMPRESSION;
+        }
+        SNPrintf((STRPTR)outputBuffer, sizeof(outputBuffer), "  Compression: Deflate (zlib) level %lu\n",
+                 (ULONG)(level == Z_DEFAULT_COMPRESSION ? 6 : level));
+        PutStr((STRPTR)outputBuffer);
+        if (config.preset == PNGPRESET_OPTIMIZE && config.compression_strategy == PNGCONFIG_AUTO) {
+            PutStr("  Strategy: Smallest of several (OPTIMIZE)\n");
+        } else {
+            SNPrintf((STRPTR)outputBuffer, sizeof(outputBuffer), "  Strategy: %s\n",
+                     FindOptionValue(strategyNames, strategy));
+            PutStr((STRPTR)outputBuffer);
+        }
+        if (config.preset == PNGPRESET_OPTIMIZE && config.filter == PNGCONFIG_AUTO) {
+            PutStr("  Filter: Smallest of several (OPTIMIZE)\n");
+        } else {
+            SNPrintf((STRPTR)outputBuffer, sizeof(outputBuffer), "  Filter: %s\n",
+                     FindOptionValue(filterNames, filter));
+            PutStr((STRPTR)outputBuffer);
+        }
         PutStr("  Interlacing: None\n");
         
         PutStr("\n");
     }
     
+    /* Write all frames of an animation */
+    if (animExport) {
+        result = WriteAnimation(picture, (const char *)targetFile, &config, opaque, stripMetadata,
+                                writeAPNG, forceOverwrite, &numWritten);
+        CloseIFFPicture(picture);
+        Close(sourceHandle); /* Close file handle after CloseIFFPicture() */
+        if (result != RETURN_OK) {
+            PutStr("Error: Cannot convert animation\n");
+            if (GetErrorString(picture)[0]) {
+                PutStr("  ");
+                PutStr((STRPTR)GetErrorString(picture));
+                PutStr("\n");
+            }
+            PNGEncoder_FreeConfig(&config);
+            FreeIFFPicture(picture);
+            CloseLibrary(IFFParseBase);
+            IFFParseBase = NULL;
+            return (int)RETURN_FAIL;
+        }
+        if (!quiet) {
+            SNPrintf((STRPTR)outputBuffer, sizeof(outputBuffer), "Wrote %lu frames\n", numWritten);
+            PutStr((STRPTR)outputBuffer);
+        }
+    }
+    
+    /* Write every picture of a CAT or LIST */
+    if (listExport) {
+        result = WriteContainer(picture, (const char *)targetFile, &config, opaque, stripMetadata,
+                                forceOverwrite, &numWritten);
+        CloseIFFPicture(picture);
+        Close(sourceHandle); /* Close file handle after CloseIFFPicture() */
+        if (result != RETURN_OK) {
+            PutStr("Error: Cannot convert container\n");
+            if (GetErrorString(picture)[0]) {
+                PutStr("  ");
+                PutStr((STRPTR)GetErrorString(picture));
+                PutStr("\n");
+            }
+            PNGEncoder_FreeConfig(&config);
+            FreeIFFPicture(picture);
+            CloseLibrary(IFFParseBase);
+            IFFParseBase = NULL;
+            return (int)RETURN_FAIL;
+        }
+        if (!quiet) {
+            SNPrintf((STRPTR)outputBuffer, sizeof(outputBuffer), "Wrote %lu pictures\n", numWritten);
+            PutStr((STRPTR)outputBuffer);
+        }
+    }
+    
     /* Write PNG file - use local copy of filename */
-    result = PNGEncoder_Write((const char *)targetFile, rgbData, &config, picture, stripMetadata);
+    result = (animExport || listExport) ? RETURN_OK : PNGEncoder_Write((const char *)targetFile, rgbData, &config, picture, stripMetadata);
     if (result != RETURN_OK) {
         PrintFault(IoErr(), "iff2png");
         PNGEncoder_FreeConfig(&config); /* Free palette/trans if allocated */
@@ -494,7 +1047,8 @@ int main(int argc, char **argv)
         return (int)RETURN_FAIL;
     }
     
-    if (!quiet) {
+    /* Numbered frames have no single target file to report on */
+    if (!quiet && !(animExport && !writeAPNG) && !listExport) {
         /* Get target file size */
         targetFileSize = 0;
         targetLock = Lock((STRPTR)targetFile, ACCESS_READ);
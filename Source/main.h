@@ -14,6 +14,7 @@
 #include <exec/libraries.h>
 #include <dos/dos.h>
 #include <dos/rdargs.h>
+#include <dos/dosasl.h>
 #include <libraries/iffparse.h>
 #include <utility/tagitem.h>
 
@@ -25,6 +26,7 @@
 
 /* libpng header - pnglib directory is in INCLUDEDIR */
 #include <png.h>
+#include <zlib.h>  /* Z_* strategies for the STRATEGY option */
 
 /* IFFPicture library public interface */
 #include "iffpicturelib/iffpicture.h"
@@ -10,7 +10,292 @@
 #include "iffpicturelib/iffpicture.h"  /* For ReadCopyright, ReadAuthor */
 #include <proto/exec.h>
 #include <proto/dos.h>
+#include <dos/dosextens.h>
 #include <png.h>  /* For png_text, png_set_text */
+#include <zlib.h> /* For the APNG writer */
+
+/* PNGEncoder_Write output is collected in blocks that the filesystem
+ * handler writes with asynchronous ACTION_WRITE packets, so the disk is
+ * busy while deflate goes on with the next rows */
+#define PNG_OUTBLOCK_SIZE   32768   /* Unless PNGConfig buffer_size is set */
+#define PNG_OUTBLOCKS       2
+
+/* First allocation of a memory output without a size hint */
+#define PNG_MEMOUTPUT_SIZE  65536
+
+struct PNGOutBlock {
+    UBYTE *buffer;
+    struct DosPacket *packet;   /* From AllocDosObject(DOS_STDPKT) */
+    LONG length;                /* Bytes sent with the packet */
+    BOOL pending;               /* Packet is at the handler */
+};
+
+struct PNGOutput {
+    BPTR filehandle;
+    struct MsgPort *replyPort;  /* NULL writes each piece with Write() */
+    struct MsgPort *handler;    /* Filesystem handler of the file */
+    LONG handlerArg;            /* fh_Arg1, identifies the file to the handler */
+    struct PNGOutBlock blocks[PNG_OUTBLOCKS];
+    ULONG blockSize;            /* Bytes in each block */
+    ULONG current;              /* Block being filled */
+    ULONG used;                 /* Bytes in it */
+    BOOL failed;                /* A write came back short */
+    BOOL toMemory;              /* Collect the PNG in memBuffer instead of a file */
+    UBYTE *memBuffer;
+    ULONG memSize;              /* Bytes allocated */
+    BOOL memOwned;              /* memBuffer came from AllocMem() here, not the caller */
+    ULONG memUsed;              /* Bytes of PNG so far */
+};
+
+/*
+** WaitOutBlock - Wait until a block's write packet has come back
+** Replies for other blocks that arrive meanwhile are collected as well
+*/
+static VOID WaitOutBlock(struct PNGOutput *out, struct PNGOutBlock *block)
+{
+    struct Message *msg;
+    struct DosPacket *dp;
+    ULONG i;
+    
+    while (block->pending) {
+        WaitPort(out->replyPort);
+        while ((msg = GetMsg(out->replyPort)) != NULL) {
+            dp = (struct DosPacket *)msg->mn_Node.ln_Name;
+            for (i = 0; i < PNG_OUTBLOCKS; i++) {
+                if (out->blocks[i].packet == dp) {
+                    out->blocks[i].pending = FALSE;
+                    if (dp->dp_Res1 != out->blocks[i].length) {
+                        out->failed = TRUE;
+                    }
+                    break;
+                }
+            }
+        }
+    }
+}
+
+/*
+** SendOutBlock - Queue the block being filled and move on to the next one
+** The next block is free once this returns
+*/
+static VOID SendOutBlock(struct PNGOutput *out)
+{
+    struct PNGOutBlock *block;
+    struct DosPacket *dp;
+    
+    block = &out->blocks[out->current];
+    dp = block->packet;
+    dp->dp_Type = ACTION_WRITE;
+    dp->dp_Arg1 = out->handlerArg;
+    dp->dp_Arg2 = (LONG)block->buffer;
+    dp->dp_Arg3 = (LONG)out->used;
+    SendPkt(dp, out->handler, out->replyPort);
+    block->length = (LONG)out->used;
+    block->pending = TRUE;
+    
+    out->current = (out->current + 1) % PNG_OUTBLOCKS;
+    out->used = 0;
+    WaitOutBlock(out, &out->blocks[out->current]);
+}
+
+/*
+** FreeOutBlocks - Wait for outstanding writes and free the blocks
+*/
+static VOID FreeOutBlocks(struct PNGOutput *out)
+{
+    ULONG i;
+    
+    for (i = 0; i < PNG_OUTBLOCKS; i++) {
+        if (out->replyPort) {
+            WaitOutBlock(out, &out->blocks[i]);
+        }
+        if (out->blocks[i].packet) {
+            FreeDosObject(DOS_STDPKT, out->blocks[i].packet);
+            out->blocks[i].packet = NULL;
+        }
+        if (out->blocks[i].buffer) {
+            FreeMem(out->blocks[i].buffer, out->blockSize);
+            out->blocks[i].buffer = NULL;
+        }
+    }
+    if (out->replyPort) {
+        DeleteMsgPort(out->replyPort);
+        out->replyPort = NULL;
+    }
+}
+
+/*
+** WriteOutBlock - Pass the block being filled on to the file
+** Queued to the handler with asynchronous writes, otherwise one Write()
+*/
+static VOID WriteOutBlock(struct PNGOutput *out)
+{
+    if (out->replyPort) {
+        SendOutBlock(out);
+    } else {
+        if (Write(out->filehandle, out->blocks[0].buffer, (LONG)out->used) != (LONG)out->used) {
+            out->failed = TRUE;
+        }
+        out->used = 0;
+    }
+}
+
+/*
+** OpenPNGOutput - Create the output file and set up buffered writes
+** Returns: TRUE if the file was opened
+** bufferSize is the size of each output block, 0 for PNG_OUTBLOCK_SIZE.
+** Files without a handler of their own (NIL:) and interactive ones are
+** written synchronously through one block; if even that does not fit in
+** memory, every piece libpng hands over gets its own Write()
+*/
+static BOOL OpenPNGOutput(struct PNGOutput *out, const char *filename, ULONG bufferSize)
+{
+    struct FileHandle *fh;
+    ULONG i;
+    
+    out->blockSize = bufferSize ? bufferSize : PNG_OUTBLOCK_SIZE;
+    out->replyPort = NULL;
+    out->handler = NULL;
+    out->current = 0;
+    out->used = 0;
+    out->failed = FALSE;
+    out->toMemory = FALSE;
+    out->memBuffer = NULL;
+    out->memSize = 0;
+    out->memUsed = 0;
+    out->memOwned = FALSE;
+    for (i = 0; i < PNG_OUTBLOCKS; i++) {
+        out->blocks[i].buffer = NULL;
+        out->blocks[i].packet = NULL;
+        out->blocks[i].pending = FALSE;
+    }
+    
+    out->filehandle = Open((STRPTR)filename, MODE_NEWFILE);
+    if (!out->filehandle) {
+        return FALSE;
+    }
+    
+    fh = (struct FileHandle *)BADDR(out->filehandle);
+    if (fh->fh_Type && !IsInteractive(out->filehandle)) {
+        out->handler = fh->fh_Type;
+        out->handlerArg = fh->fh_Arg1;
+        
+        out->replyPort = CreateMsgPort();
+        for (i = 0; out->replyPort && i < PNG_OUTBLOCKS; i++) {
+            out->blocks[i].buffer = (UBYTE *)AllocMem(out->blockSize, MEMF_PUBLIC);
+            out->blocks[i].packet = (struct DosPacket *)AllocDosObject(DOS_STDPKT, NULL);
+            if (!out->blocks[i].buffer || !out->blocks[i].packet) {
+                FreeOutBlocks(out);
+            }
+        }
+    }
+    
+    /* Synchronous writes still gather libpng's small pieces into one block */
+    if (!out->replyPort) {
+        out->blocks[0].buffer = (UBYTE *)AllocMem(out->blockSize, MEMF_PUBLIC);
+    }
+    return TRUE;
+}
+
+/*
+** ClosePNGOutput - Write what is left, wait for the handler and close the file
+** Returns: RETURN_OK if every write succeeded, RETURN_FAIL otherwise
+*/
+static LONG ClosePNGOutput(struct PNGOutput *out)
+{
+    if (out->used > 0 && !out->failed) {
+        WriteOutBlock(out);
+    }
+    FreeOutBlocks(out);
+    Close(out->filehandle);
+    out->filehandle = 0;
+    return out->failed ? RETURN_FAIL : RETURN_OK;
+}
+
+/*
+** OpenPNGMemOutput - Set up output into a growable memory buffer
+** buffer is the caller's memory of size bytes, or NULL to allocate size
+** bytes here; size is then the expected PNG size, or 0. Output that does
+** not fit moves to a larger buffer allocated here, the caller's is kept
+*/
+static VOID OpenPNGMemOutput(struct PNGOutput *out, UBYTE *buffer, ULONG size)
+{
+    ULONG i;
+    
+    out->filehandle = 0;
+    out->replyPort = NULL;
+    out->handler = NULL;
+    out->current = 0;
+    out->used = 0;
+    out->failed = FALSE;
+    for (i = 0; i < PNG_OUTBLOCKS; i++) {
+        out->blocks[i].buffer = NULL;
+        out->blocks[i].packet = NULL;
+        out->blocks[i].pending = FALSE;
+    }
+    
+    out->blockSize = 0;
+    out->toMemory = TRUE;
+    out->memUsed = 0;
+    out->memSize = size;
+    out->memBuffer = buffer;
+    out->memOwned = FALSE;
+    if (!buffer && size > 0) {
+        out->memBuffer = (UBYTE *)AllocMem(size, MEMF_PUBLIC);
+        out->memOwned = TRUE;
+    }
+    if (!out->memBuffer) {
+        out->memSize = 0;
+    }
+}
+
+/*
+** GrowMemOutput - Make room for extra more bytes in a memory output
+** Returns: FALSE if out of memory
+*/
+static BOOL GrowMemOutput(struct PNGOutput *out, ULONG extra)
+{
+    UBYTE *buffer;
+    ULONG size;
+    
+    if (out->memSize - out->memUsed >= extra) {
+        return TRUE;
+    }
+    
+    /* Double the buffer so the copying stays linear in the PNG size */
+    size = out->memSize ? out->memSize * 2 : PNG_MEMOUTPUT_SIZE;
+    while (size - out->memUsed < extra) {
+        size *= 2;
+    }
+    buffer = (UBYTE *)AllocMem(size, MEMF_PUBLIC);
+    if (!buffer) {
+        return FALSE;
+    }
+    if (out->memBuffer) {
+        CopyMem(out->memBuffer, buffer, out->memUsed);
+        if (out->memOwned) {
+            FreeMem(out->memBuffer, out->memSize);
+        }
+    }
+    out->memBuffer = buffer;
+    out->memSize = size;
+    out->memOwned = TRUE;
+    return TRUE;
+}
+
+/*
+** FreePNGMemOutput - Free the buffer of a memory output, unless it is the caller's
+*/
+static VOID FreePNGMemOutput(struct PNGOutput *out)
+{
+    if (out->memBuffer && out->memOwned) {
+        FreeMem(out->memBuffer, out->memSize);
+    }
+    out->memBuffer = NULL;
+    out->memOwned = FALSE;
+    out->memSize = 0;
+    out->memUsed = 0;
+}
 
 /*
 ** PNG write callback for AmigaOS file I/O
@@ -18,32 +303,168 @@
 */
 static VOID PNGWriteCallback(png_structp png_ptr, png_bytep data, png_size_t length)
 {
-    BPTR filehandle;
-    LONG bytesWritten;
+    struct PNGOutput *out;
+    ULONG count;
     
-    filehandle = (BPTR)png_get_io_ptr(png_ptr);
-    if (!filehandle) {
+    out = (struct PNGOutput *)png_get_io_ptr(png_ptr);
+    if (!out || (!out->filehandle && !out->toMemory)) {
         png_error(png_ptr, "Invalid file handle in write callback");
         return;
     }
     
-    bytesWritten = Write(filehandle, data, length);
-    if (bytesWritten != (LONG)length) {
+    if (out->toMemory) {
+        if (GrowMemOutput(out, length)) {
+            CopyMem(data, out->memBuffer + out->memUsed, length);
+            out->memUsed += length;
+        } else {
+            out->failed = TRUE;
+        }
+    } else if (!out->blocks[0].buffer) {
+        if (Write(out->filehandle, data, length) != (LONG)length) {
+            out->failed = TRUE;
+        }
+    } else {
+        while (length > 0 && !out->failed) {
+            /* Synchronous writes skip the copy for pieces of a block or more */
+            if (!out->replyPort && out->used == 0 && length >= out->blockSize) {
+                if (Write(out->filehandle, data, length) != (LONG)length) {
+                    out->failed = TRUE;
+                }
+                break;
+            }
+            count = out->blockSize - out->used;
+            if (count > length) {
+                count = length;
+            }
+            CopyMem(data, out->blocks[out->current].buffer + out->used, count);
+            out->used += count;
+            data += count;
+            length -= count;
+            if (out->used == out->blockSize) {
+                WriteOutBlock(out);
+            }
+        }
+    }
+    
+    if (out->failed) {
         png_error(png_ptr, "Write error in PNG write callback");
     }
 }
 
 /*
 ** PNG flush callback for AmigaOS file I/O
-** Called by libpng to flush file buffers
+** Called by libpng to flush file buffers. Buffered output is only written
+** out by ClosePNGOutput(), so a flush in the middle of the image would
+** just cost a small write - nothing is done here
 */
 static VOID PNGFlushCallback(png_structp png_ptr)
 {
-    BPTR filehandle;
+}
+
+/*
+** PNGEncoder_GetCompression - Get the zlib level, strategy and row filters of a config
+** Settings left at PNGCONFIG_AUTO are chosen by image class:
+**   FAXX bilevel scans      - no filter, Z_RLE
+**   palette, gray below 8   - no filter, Z_DEFAULT_STRATEGY
+**   truecolour, 8-bit gray  - adaptive filtering, Z_FILTERED
+** The FAST preset uses zlib level 1 and the SUB filter for truecolour.
+*/
+VOID PNGEncoder_GetCompression(struct PNGConfig *config, struct IFFPicture *picture,
+                               int *level, int *strategy, int *filter)
+{
+    if (picture && picture->formtype == ID_FAXX) {
+        *filter = PNG_FILTER_NONE;
+        *strategy = Z_RLE;
+    } else if (config->color_type == PNG_COLOR_TYPE_PALETTE || config->bit_depth < 8) {
+        /* Filters rarely help packed or indexed pixels */
+        *filter = PNG_FILTER_NONE;
+        *strategy = Z_DEFAULT_STRATEGY;
+    } else if (config->preset == PNGPRESET_FAST) {
+        *filter = PNG_FILTER_SUB;
+        *strategy = Z_DEFAULT_STRATEGY;
+    } else {
+        *filter = PNG_ALL_FILTERS;
+        *strategy = Z_FILTERED;
+    }
+    *level = (config->preset == PNGPRESET_FAST) ? Z_BEST_SPEED : Z_DEFAULT_COMPRESSION;
     
-    filehandle = (BPTR)png_get_io_ptr(png_ptr);
-    if (filehandle) {
-        Flush(filehandle);
+    if (config->compression_level != PNGCONFIG_AUTO) {
+        *level = config->compression_level;
+    }
+    if (config->compression_strategy != PNGCONFIG_AUTO) {
+        *strategy = config->compression_strategy;
+    }
+    if (config->filter != PNGCONFIG_AUTO) {
+        *filter = config->filter;
+    }
+}
+
+/* OPTIMIZE trials, most promising first - the first is the automatic choice */
+static const struct PNGTrial {
+    int filter;
+    int strategy;
+} optimizeTrials[] = {
+    { PNGCONFIG_AUTO, PNGCONFIG_AUTO },
+    { PNG_FILTER_NONE, Z_DEFAULT_STRATEGY },
+    { PNG_ALL_FILTERS, Z_FILTERED },
+    { PNG_ALL_FILTERS, Z_DEFAULT_STRATEGY },
+    { PNG_FILTER_PAETH, Z_FILTERED },
+    { PNG_FILTER_SUB, Z_FILTERED },
+    { PNG_FILTER_UP, Z_FILTERED },
+    { PNG_FILTER_NONE, Z_RLE },
+    { PNG_FILTER_SUB, Z_RLE },
+    { PNG_FILTER_NONE, Z_FILTERED }
+};
+
+#define PNG_TRIALS (sizeof(optimizeTrials) / sizeof(optimizeTrials[0]))
+
+/*
+** PackIndexRow - Pack a row of one-byte values into 1, 2 or 4 bits per pixel
+** PNG wants the leftmost pixel in the most significant bits. Whole bytes
+** are packed with fixed shifts for each depth; a partial last byte is
+** padded with zero bits. Values are masked to bitDepth bits.
+*/
+static VOID PackIndexRow(const UBYTE *src, UBYTE *dst, ULONG width, int bitDepth)
+{
+    ULONG count;
+    UBYTE packed;
+    UBYTE mask;
+    
+    switch (bitDepth) {
+        case 1:
+            for (count = width >> 3; count > 0; count--, src += 8) {
+                *dst++ = (UBYTE)(((src[0] & 1) << 7) | ((src[1] & 1) << 6) |
+                                 ((src[2] & 1) << 5) | ((src[3] & 1) << 4) |
+                                 ((src[4] & 1) << 3) | ((src[5] & 1) << 2) |
+                                 ((src[6] & 1) << 1) | (src[7] & 1));
+            }
+            width &= 7;
+            break;
+        case 2:
+            for (count = width >> 2; count > 0; count--, src += 4) {
+                *dst++ = (UBYTE)(((src[0] & 3) << 6) | ((src[1] & 3) << 4) |
+                                 ((src[2] & 3) << 2) | (src[3] & 3));
+            }
+            width &= 3;
+            break;
+        case 4:
+            for (count = width >> 1; count > 0; count--, src += 2) {
+                *dst++ = (UBYTE)((src[0] << 4) | (src[1] & 15));
+            }
+            width &= 1;
+            break;
+        default:
+            return;
+    }
+    
+    /* Left-over pixels go in the high bits of the last byte */
+    if (width > 0) {
+        mask = (UBYTE)((1 << bitDepth) - 1);
+        packed = 0;
+        for (count = 0; count < width; count++) {
+            packed = (UBYTE)((packed << bitDepth) | (src[count] & mask));
+        }
+        *dst = (UBYTE)(packed << (8 - width * bitDepth));
     }
 }
 
@@ -67,20 +488,25 @@ VOID PNGEncoder_FreeConfig(struct PNGConfig *config)
         config->trans = NULL;
     }
     
+    if (config->index_map) {
+        FreeMem(config->index_map, 256);
+        config->index_map = NULL;
+    }
+    
     config->num_palette = 0;
     config->num_trans = 0;
+    config->remap_indices = FALSE;
 }
 
 /*
-** PNGEncoder_Write - Write RGB data to PNG file
+** EncodePNG - Encode RGB data as a PNG into an opened output
 ** Returns: RETURN_OK on success, RETURN_FAIL on error
 **
-** Uses libpng with custom AmigaOS file I/O callbacks
+** Uses libpng with custom AmigaOS I/O callbacks; the output is not closed
 */
-LONG PNGEncoder_Write(const char *filename, UBYTE *rgbData, 
+static LONG EncodePNG(struct PNGOutput *out, UBYTE *rgbData,
                       struct PNGConfig *config, struct IFFPicture *picture, BOOL stripMetadata)
 {
-    BPTR filehandle;
     png_structp png_ptr;
     png_infop info_ptr;
     png_colorp palette;
@@ -88,12 +514,10 @@ LONG PNGEncoder_Write(const char *filename, UBYTE *rgbData,
     UWORD width, height;
     UWORD row;
     png_bytep row_pointers[1];
-    LONG result;
     struct BitMapHeader *bmhd;
-    
-    if (!filename || !rgbData || !config || !picture) {
-        return RETURN_FAIL;
-    }
+    int level;
+    int strategy;
+    int filter;
     
     bmhd = GetBMHD(picture);
     if (!bmhd) {
@@ -107,18 +531,10 @@ LONG PNGEncoder_Write(const char *filename, UBYTE *rgbData,
     info_ptr = NULL;
     palette = NULL;
     trans = NULL;
-    filehandle = NULL;
-    
-    /* Open file for writing */
-    filehandle = Open((STRPTR)filename, MODE_NEWFILE);
-    if (!filehandle) {
-        return RETURN_FAIL;
-    }
     
     /* Initialize PNG write structure */
     png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     if (!png_ptr) {
-        Close(filehandle);
         return RETURN_FAIL;
     }
     
@@ -126,7 +542,6 @@ LONG PNGEncoder_Write(const char *filename, UBYTE *rgbData,
     info_ptr = png_create_info_struct(png_ptr);
     if (!info_ptr) {
         png_destroy_write_struct(&png_ptr, NULL);
-        Close(filehandle);
         return RETURN_FAIL;
     }
     
@@ -140,12 +555,11 @@ LONG PNGEncoder_Write(const char *filename, UBYTE *rgbData,
             FreeMem(trans, config->num_trans);
         }
         png_destroy_write_struct(&png_ptr, &info_ptr);
-        Close(filehandle);
         return RETURN_FAIL;
     }
     
     /* Set up custom I/O callbacks for AmigaOS file handles */
-    png_set_write_fn(png_ptr, (png_voidp)filehandle, PNGWriteCallback, PNGFlushCallback);
+    png_set_write_fn(png_ptr, (png_voidp)out, PNGWriteCallback, PNGFlushCallback);
     
     /* Set PNG header information */
     png_set_IHDR(png_ptr, info_ptr, width, height,
@@ -159,7 +573,6 @@ LONG PNGEncoder_Write(const char *filename, UBYTE *rgbData,
         palette = (png_colorp)AllocMem(config->num_palette * sizeof(png_color), MEMF_PUBLIC | MEMF_CLEAR);
         if (!palette) {
             png_destroy_write_struct(&png_ptr, &info_ptr);
-            Close(filehandle);
             return RETURN_FAIL;
         }
         
@@ -184,7 +597,6 @@ LONG PNGEncoder_Write(const char *filename, UBYTE *rgbData,
                 FreeMem(palette, config->num_palette * sizeof(png_color));
             }
             png_destroy_write_struct(&png_ptr, &info_ptr);
-            Close(filehandle);
             return RETURN_FAIL;
         }
         
@@ -196,7 +608,19 @@ LONG PNGEncoder_Write(const char *filename, UBYTE *rgbData,
             }
         }
         
-        png_set_tRNS(png_ptr, info_ptr, trans, config->num_trans, NULL);
+        if (config->color_type == PNG_COLOR_TYPE_GRAY) {
+            /* Gray tRNS names one sample value, not per-entry alphas */
+            png_color_16 transGray;
+            
+            transGray.index = 0;
+            transGray.red = 0;
+            transGray.green = 0;
+            transGray.blue = 0;
+            transGray.gray = (png_uint_16)config->trans_gray;
+            png_set_tRNS(png_ptr, info_ptr, NULL, 0, &transGray);
+        } else {
+            png_set_tRNS(png_ptr, info_ptr, trans, config->num_trans, NULL);
+        }
     }
     
     /* Add metadata from IFF to PNG (unless stripped) */
@@ -233,6 +657,12 @@ LONG PNGEncoder_Write(const char *filename, UBYTE *rgbData,
         }
     }
     
+    /* zlib level, strategy and row filters for the image data */
+    PNGEncoder_GetCompression(config, picture, &level, &strategy, &filter);
+    png_set_compression_level(png_ptr, level);
+    png_set_compression_strategy(png_ptr, strategy);
+    png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, filter);
+    
     /* Write PNG header */
     png_write_info(png_ptr, info_ptr);
     
@@ -241,21 +671,22 @@ LONG PNGEncoder_Write(const char *filename, UBYTE *rgbData,
         /* For palette images, use original palette indices if available */
         /* Otherwise convert RGB data to palette indices */
         UBYTE *paletteIndices;
+        UBYTE *mappedRow;
+        const UBYTE *src;
         ULONG i, j;
-        ULONG bestMatch;
-        ULONG bestDist;
-        ULONG dist;
         BOOL useOriginalIndices = FALSE;
         
         /* Check if we have original palette indices (for indexed formats like ILBM) */
-        if (picture && picture->paletteIndices) {
+        /* A palette made from true-color data does not match them (EHB) */
+        if (picture && picture->paletteIndices && !config->palette_from_rgb) {
             paletteIndices = picture->paletteIndices;
             useOriginalIndices = TRUE;
         } else {
             /* Need to convert RGB to palette indices */
             
             /* Use public memory (not chip RAM, we're not rendering to display) */
-            paletteIndices = (UBYTE *)AllocMem(width * height, MEMF_PUBLIC | MEMF_CLEAR);
+            /* Every index is written below, so it need not be cleared */
+            paletteIndices = (UBYTE *)AllocMem(width * height, MEMF_PUBLIC);
             if (!paletteIndices) {
                 if (palette) {
                     FreeMem(palette, config->num_palette * sizeof(png_color));
@@ -264,81 +695,79 @@ LONG PNGEncoder_Write(const char *filename, UBYTE *rgbData,
                     FreeMem(trans, config->num_trans);
                 }
                 png_destroy_write_struct(&png_ptr, &info_ptr);
-                Close(filehandle);
                 return RETURN_FAIL;
             }
             
-            /* Convert RGB to palette indices by finding closest match */
+            /* Convert RGB to palette indices through an inverse colour map */
             {
-                UBYTE r, g, b;
+                struct InverseCMap *icm;
+                UBYTE *cmap;
                 ULONG rgbIndex;
-                LONG dr, dg, db;
                 
-                for (i = 0; i < (ULONG)width * height; i++) {
-                    rgbIndex = i * 3;
-                    r = rgbData[rgbIndex];
-                    g = rgbData[rgbIndex + 1];
-                    b = rgbData[rgbIndex + 2];
-                    
-                    /* Find closest palette entry */
-                    bestMatch = 0;
-                    bestDist = 0xFFFFFFFFUL;
-                    for (j = 0; j < (ULONG)config->num_palette; j++) {
-                        dr = (LONG)r - (LONG)palette[j].red;
-                        dg = (LONG)g - (LONG)palette[j].green;
-                        db = (LONG)b - (LONG)palette[j].blue;
-                        dist = (ULONG)(dr * dr + dg * dg + db * db);
-                        
-                        if (dist < bestDist) {
-                            bestDist = dist;
-                            bestMatch = j;
-                        }
+                /* Packed RGB copy of the palette - kept off the 4K stack */
+                icm = NULL;
+                cmap = (UBYTE *)AllocMem(256 * 3, MEMF_PUBLIC);
+                if (cmap) {
+                    for (j = 0; palette && j < (ULONG)config->num_palette && j < 256; j++) {
+                        cmap[j * 3] = palette[j].red;
+                        cmap[j * 3 + 1] = palette[j].green;
+                        cmap[j * 3 + 2] = palette[j].blue;
+                    }
+                    icm = AllocInverseCMap(cmap, j, FALSE);
+                    FreeMem(cmap, 256 * 3);
+                }
+                if (!icm) {
+                    FreeMem(paletteIndices, width * height);
+                    if (palette) {
+                        FreeMem(palette, config->num_palette * sizeof(png_color));
                     }
-                    
-                    paletteIndices[i] = (UBYTE)bestMatch;
-                    
-                    /* Debug first few pixels */
-                    if (i < 10) {
-                        printf("PNGEncoder: Pixel %lu: RGB=(%d,%d,%d) -> palette index %lu (palette RGB=(%d,%d,%d))\n",
-                               i, r, g, b, bestMatch, palette[bestMatch].red, palette[bestMatch].green, palette[bestMatch].blue);
-                        fflush(stdout);
+                    if (trans) {
+                        FreeMem(trans, config->num_trans);
                     }
+                    png_destroy_write_struct(&png_ptr, &info_ptr);
+                    return RETURN_FAIL;
+                }
+                
+                for (i = 0, rgbIndex = 0; i < (ULONG)width * height; i++, rgbIndex += 3) {
+                    paletteIndices[i] = MapRGBToIndex(icm, rgbData[rgbIndex], rgbData[rgbIndex + 1], rgbData[rgbIndex + 2]);
                 }
+                FreeInverseCMap(icm);
             }
         }
         
+        /* Decoded indices of a compacted palette are renumbered a row at a time */
+        mappedRow = NULL;
+        if (useOriginalIndices && config->remap_indices) {
+            mappedRow = (UBYTE *)AllocMem(width, MEMF_PUBLIC);
+            if (!mappedRow) {
+                if (palette) {
+                    FreeMem(palette, config->num_palette * sizeof(png_color));
+                }
+                if (trans) {
+                    FreeMem(trans, config->num_trans);
+                }
+                png_destroy_write_struct(&png_ptr, &info_ptr);
+                return RETURN_FAIL;
+            }
+        }
         
         /* For bit depths < 8, we need to pack indices */
         if (config->bit_depth < 8) {
             UBYTE *packedRow;
             ULONG packedRowSize;
-            ULONG col;
-            ULONG pixelsPerByte;
-            ULONG shiftPerPixel;
             
-            /* Calculate packing parameters */
-            if (config->bit_depth == 1) {
-                pixelsPerByte = 8;
-                shiftPerPixel = 7;
-                packedRowSize = (width + 7) / 8; /* Round up */
-            } else if (config->bit_depth == 2) {
-                pixelsPerByte = 4;
-                shiftPerPixel = 6;
-                packedRowSize = (width + 3) / 4; /* Round up */
-            } else if (config->bit_depth == 4) {
-                pixelsPerByte = 2;
-                shiftPerPixel = 4;
-                packedRowSize = (width + 1) / 2; /* Round up */
-            } else {
-                /* Should not happen, but fallback to 8-bit */
-                pixelsPerByte = 1;
-                shiftPerPixel = 0;
-                packedRowSize = width;
-            }
+            /* Round up to whole bytes */
+            packedRowSize = ((ULONG)width * config->bit_depth + 7) >> 3;
             
-            packedRow = (UBYTE *)AllocMem(packedRowSize, MEMF_PUBLIC | MEMF_CLEAR);
+            /* PackIndexRow() writes every byte, so no need to clear */
+            packedRow = (UBYTE *)AllocMem(packedRowSize, MEMF_PUBLIC);
             if (!packedRow) {
-                FreeMem(paletteIndices, width * height);
+                if (mappedRow) {
+                    FreeMem(mappedRow, width);
+                }
+                if (!useOriginalIndices) {
+                    FreeMem(paletteIndices, width * height);
+                }
                 if (palette) {
                     FreeMem(palette, config->num_palette * sizeof(png_color));
                 }
@@ -346,43 +775,19 @@ LONG PNGEncoder_Write(const char *filename, UBYTE *rgbData,
                     FreeMem(trans, config->num_trans);
                 }
                 png_destroy_write_struct(&png_ptr, &info_ptr);
-                Close(filehandle);
                 return RETURN_FAIL;
             }
             
             /* Write palette indices row by row, packing according to bit depth */
             for (row = 0; row < height; row++) {
-                UBYTE *rowIndices = paletteIndices + (ULONG)row * width;
-                ULONG byteIndex;
-                ULONG bitPos;
-                
-                /* Clear packed row */
-                for (byteIndex = 0; byteIndex < packedRowSize; byteIndex++) {
-                    packedRow[byteIndex] = 0;
-                }
-                
-                /* Pack pixels into bytes - PNG expects MSB first */
-                for (col = 0; col < width; col++) {
-                    UBYTE pixelValue;
-                    ULONG pixelInByte;
-                    
-                    byteIndex = col / pixelsPerByte;
-                    pixelInByte = col % pixelsPerByte;
-                    pixelValue = (UBYTE)(rowIndices[col] & ((1 << config->bit_depth) - 1));
-                    
-                    /* Calculate bit position - MSB first */
-                    /* For 2-bit: pixel 0 at bits 6-7, pixel 1 at bits 4-5, etc. */
-                    bitPos = shiftPerPixel - (pixelInByte * (8 / pixelsPerByte));
-                    packedRow[byteIndex] |= (UBYTE)(pixelValue << bitPos);
-                    
-                    /* Debug first row packing */
-                    if (row == 0 && col < 8 && config->bit_depth == 2) {
-                        printf("PNGEncoder: Packing row %ld, col %ld: pixelValue=%d, byteIndex=%lu, bitPos=%lu, packedByte=0x%02x\n",
-                               row, col, pixelValue, byteIndex, bitPos, packedRow[byteIndex]);
-                        fflush(stdout);
+                src = paletteIndices + (ULONG)row * width;
+                if (mappedRow) {
+                    for (i = 0; i < width; i++) {
+                        mappedRow[i] = config->index_map[src[i]];
                     }
+                    src = mappedRow;
                 }
-                
+                PackIndexRow(src, packedRow, width, config->bit_depth);
                 row_pointers[0] = packedRow;
                 png_write_row(png_ptr, row_pointers[0]);
             }
@@ -391,22 +796,45 @@ LONG PNGEncoder_Write(const char *filename, UBYTE *rgbData,
         } else {
             /* 8-bit - write directly (one index per byte) */
             for (row = 0; row < height; row++) {
-                row_pointers[0] = paletteIndices + (ULONG)row * width;
+                src = paletteIndices + (ULONG)row * width;
+                if (mappedRow) {
+                    for (i = 0; i < width; i++) {
+                        mappedRow[i] = config->index_map[src[i]];
+                    }
+                    src = mappedRow;
+                }
+                row_pointers[0] = (png_bytep)src;
                 png_write_row(png_ptr, row_pointers[0]);
             }
         }
         
+        if (mappedRow) {
+            FreeMem(mappedRow, width);
+        }
+        
         /* Only free if we allocated it (not using original indices) */
         if (!useOriginalIndices) {
             FreeMem(paletteIndices, width * height);
         }
     } else if (config->color_type == PNG_COLOR_TYPE_GRAY) {
-        /* For grayscale, convert RGB to grayscale */
-        UBYTE *grayData;
+        /* For grayscale, convert and pack one row at a time */
+        UBYTE *grayBuffer;
+        ULONG grayBufferSize;
+        UBYTE *grayRow;
+        UBYTE *packedRow;
+        ULONG packedRowSize;
+        UBYTE *grayLevel;       /* 8-bit gray to a sample of bit_depth bits */
+        UBYTE *indexGray;       /* Palette index to sample, for indexed images */
+        const UBYTE *src;
+        BOOL useIndices;
+        ULONG maxLevel;
+        ULONG col;
         ULONG i;
         
-        grayData = (UBYTE *)AllocMem(width * height, MEMF_PUBLIC | MEMF_CLEAR);
-        if (!grayData) {
+        /* One allocation for both lookup tables and the row, off the 4K stack */
+        grayBufferSize = 512 + (ULONG)width;
+        grayBuffer = (UBYTE *)AllocMem(grayBufferSize, MEMF_PUBLIC);
+        if (!grayBuffer) {
             if (palette) {
                 FreeMem(palette, config->num_palette * sizeof(png_color));
             }
@@ -414,33 +842,86 @@ LONG PNGEncoder_Write(const char *filename, UBYTE *rgbData,
                 FreeMem(trans, config->num_trans);
             }
             png_destroy_write_struct(&png_ptr, &info_ptr);
-            Close(filehandle);
             return RETURN_FAIL;
         }
+        grayLevel = grayBuffer;
+        indexGray = grayBuffer + 256;
+        grayRow = grayBuffer + 512;
         
-        /* Convert RGB to grayscale using standard formula */
-        {
-            ULONG rgbIndex;
+        maxLevel = (1UL << config->bit_depth) - 1;
+        for (i = 0; i < 256; i++) {
+            grayLevel[i] = (UBYTE)((i * maxLevel + 127) / 255);
+        }
+        
+        /* Indexed images look the gray of each palette entry up instead of
+         * converting every pixel back from RGB */
+        useIndices = FALSE;
+        if (picture->isIndexed && picture->paletteIndices && picture->cmap && picture->cmap->data) {
             UBYTE r, g, b;
             
-            for (i = 0; i < (ULONG)width * height; i++) {
-                rgbIndex = i * 3;
-                r = rgbData[rgbIndex];
-                g = rgbData[rgbIndex + 1];
-                b = rgbData[rgbIndex + 2];
+            for (i = 0; i < 256; i++) {
+                indexGray[i] = 0;
+            }
+            for (i = 0; i < picture->cmap->numcolors && i < 256; i++) {
+                r = picture->cmap->data[i * 3];
+                g = picture->cmap->data[i * 3 + 1];
+                b = picture->cmap->data[i * 3 + 2];
+                if (picture->cmap->is4Bit) {
+                    r |= (r >> 4);
+                    g |= (g >> 4);
+                    b |= (b >> 4);
+                }
                 
                 /* Standard grayscale conversion: 0.299*R + 0.587*G + 0.114*B */
-                grayData[i] = (UBYTE)((77UL * r + 150UL * g + 29UL * b) >> 8);
+                indexGray[i] = grayLevel[(77UL * r + 150UL * g + 29UL * b) >> 8];
             }
+            useIndices = TRUE;
+        }
+        
+        /* Bit depths below 8 are packed with PackIndexRow() */
+        packedRowSize = ((ULONG)width * config->bit_depth + 7) >> 3;
+        packedRow = NULL;
+        if (config->bit_depth < 8) {
+            packedRow = (UBYTE *)AllocMem(packedRowSize, MEMF_PUBLIC);
+        }
+        if (config->bit_depth < 8 && !packedRow) {
+            FreeMem(grayBuffer, grayBufferSize);
+            if (palette) {
+                FreeMem(palette, config->num_palette * sizeof(png_color));
+            }
+            if (trans) {
+                FreeMem(trans, config->num_trans);
+            }
+            png_destroy_write_struct(&png_ptr, &info_ptr);
+            return RETURN_FAIL;
         }
         
-        /* Write grayscale data row by row */
         for (row = 0; row < height; row++) {
-            row_pointers[0] = grayData + (ULONG)row * width;
+            if (useIndices) {
+                src = picture->paletteIndices + (ULONG)row * width;
+                for (col = 0; col < width; col++) {
+                    grayRow[col] = indexGray[src[col]];
+                }
+            } else {
+                src = rgbData + (ULONG)row * width * 3;
+                for (col = 0; col < width; col++, src += 3) {
+                    grayRow[col] = grayLevel[(77UL * src[0] + 150UL * src[1] + 29UL * src[2]) >> 8];
+                }
+            }
+            
+            if (packedRow) {
+                PackIndexRow(grayRow, packedRow, width, config->bit_depth);
+                row_pointers[0] = packedRow;
+            } else {
+                row_pointers[0] = grayRow;
+            }
             png_write_row(png_ptr, row_pointers[0]);
         }
         
-        FreeMem(grayData, width * height);
+        if (packedRow) {
+            FreeMem(packedRow, packedRowSize);
+        }
+        FreeMem(grayBuffer, grayBufferSize);
     } else {
         /* RGB or RGBA - write directly */
         for (row = 0; row < height; row++) {
@@ -464,9 +945,555 @@ LONG PNGEncoder_Write(const char *filename, UBYTE *rgbData,
         FreeMem(trans, config->num_trans);
     }
     png_destroy_write_struct(&png_ptr, &info_ptr);
-    Close(filehandle);
     
-    result = RETURN_OK;
+    return RETURN_OK;
+}
+
+/*
+** EncodeOptimized - Encode under several filter and strategy choices and keep the smallest
+** Returns: RETURN_OK with the smallest PNG in best, which must be freed
+** with FreePNGMemOutput(), or RETURN_WARN if no trial fitted in memory
+**
+** Every trial encodes the same decoded rows into memory at zlib level 9.
+** The first trial uses the automatic choices, so the result is never
+** larger than a plain write at that level. Trials stop once the time
+** budget is spent; settings given explicitly in the config are kept.
+*/
+static LONG EncodeOptimized(struct PNGOutput *best, UBYTE *rgbData,
+                            struct PNGConfig *config, struct IFFPicture *picture, BOOL stripMetadata)
+{
+    struct PNGConfig trialConfig;
+    struct PNGOutput trial;
+    struct DateStamp start;
+    struct DateStamp now;
+    int tried[PNG_TRIALS][3];
+    ULONG numTried;
+    ULONG i, j;
+    LONG elapsed;
+    
+    best->memBuffer = NULL;
+    best->memSize = 0;
+    best->memUsed = 0;
+    best->memOwned = FALSE;
+    numTried = 0;
+    DateStamp(&start);
+    
+    for (i = 0; i < PNG_TRIALS; i++) {
+        trialConfig = *config;
+        trialConfig.preset = PNGPRESET_DEFAULT;
+        if (config->compression_level == PNGCONFIG_AUTO) {
+            trialConfig.compression_level = Z_BEST_COMPRESSION;
+        }
+        if (config->filter == PNGCONFIG_AUTO) {
+            trialConfig.filter = optimizeTrials[i].filter;
+        }
+        if (config->compression_strategy == PNGCONFIG_AUTO) {
+            trialConfig.compression_strategy = optimizeTrials[i].strategy;
+        }
+        
+        /* Explicit settings can make trials the same - only run each once */
+        PNGEncoder_GetCompression(&trialConfig, picture, &tried[numTried][0], &tried[numTried][1], &tried[numTried][2]);
+        for (j = 0; j < numTried; j++) {
+            if (tried[j][0] == tried[numTried][0] && tried[j][1] == tried[numTried][1] &&
+                tried[j][2] == tried[numTried][2]) {
+                break;
+            }
+        }
+        if (j < numTried) {
+            continue;
+        }
+        numTried++;
+        
+        /* The best size so far is a good guess for the buffer */
+        OpenPNGMemOutput(&trial, NULL, best->memUsed);
+        if (EncodePNG(&trial, rgbData, &trialConfig, picture, stripMetadata) == RETURN_OK &&
+            (!best->memBuffer || trial.memUsed < best->memUsed)) {
+            FreePNGMemOutput(best);
+            *best = trial;
+        } else {
+            FreePNGMemOutput(&trial);
+        }
+        
+        if (best->memBuffer && config->time_budget > 0) {
+            DateStamp(&now);
+            elapsed = ((now.ds_Days - start.ds_Days) * 1440 + (now.ds_Minute - start.ds_Minute)) *
+                      60 * TICKS_PER_SECOND + (now.ds_Tick - start.ds_Tick);
+            if (elapsed >= config->time_budget * TICKS_PER_SECOND) {
+                break;
+            }
+        }
+    }
+    
+    return best->memBuffer ? RETURN_OK : RETURN_WARN;
+}
+
+/*
+** PNGEncoder_Write - Write RGB data to PNG file
+** Returns: RETURN_OK on success, RETURN_FAIL on error
+**
+** With the OPTIMIZE preset the image is encoded several times in memory
+** and the smallest result is written; if that does not fit in memory it
+** is written once with the automatic settings.
+*/
+LONG PNGEncoder_Write(const char *filename, UBYTE *rgbData, 
+                      struct PNGConfig *config, struct IFFPicture *picture, BOOL stripMetadata)
+{
+    struct PNGOutput output;
+    BPTR filehandle;
+    LONG result;
+    
+    if (!filename || !rgbData || !config || !picture) {
+        return RETURN_FAIL;
+    }
+    
+    if (config->preset == PNGPRESET_OPTIMIZE &&
+        EncodeOptimized(&output, rgbData, config, picture, stripMetadata) == RETURN_OK) {
+        /* One Write() of the winner */
+        result = RETURN_FAIL;
+        filehandle = Open((STRPTR)filename, MODE_NEWFILE);
+        if (filehandle) {
+            if (Write(filehandle, output.memBuffer, (LONG)output.memUsed) == (LONG)output.memUsed) {
+                result = RETURN_OK;
+            }
+            Close(filehandle);
+        }
+        FreePNGMemOutput(&output);
+        return result;
+    }
+    
+    /* Open file for writing */
+    if (!OpenPNGOutput(&output, filename, (ULONG)config->buffer_size)) {
+        return RETURN_FAIL;
+    }
+    
+    result = EncodePNG(&output, rgbData, config, picture, stripMetadata);
+    
+    /* The last block is written here, so a full disk shows up now */
+    if (ClosePNGOutput(&output) != RETURN_OK) {
+        result = RETURN_FAIL;
+    }
+    return result;
+}
+
+/*
+** PNGEncoder_WriteMem - Encode RGB data to a PNG in memory
+** Returns: RETURN_OK on success, RETURN_FAIL on error
+**
+** On entry mem->data is a buffer of mem->size bytes, or NULL to have one
+** allocated; mem->size is then the expected PNG size, or 0. mem->owned
+** tells whether mem->data came from an earlier call, so a buffer can be
+** passed back in to be reused.
+** A PNG that does not fit moves to a larger buffer allocated here, and
+** mem->owned is set; the old buffer is freed at that point only if it
+** was owned. On success mem->data holds mem->length bytes of PNG; on
+** failure mem is left as it was given, apart from length being 0.
+** Settings and OPTIMIZE behave as for PNGEncoder_Write().
+*/
+LONG PNGEncoder_WriteMem(struct PNGMemBuffer *mem, UBYTE *rgbData,
+                         struct PNGConfig *config, struct IFFPicture *picture, BOOL stripMetadata)
+{
+    struct PNGOutput output;
+    LONG result;
+    
+    if (!mem || !rgbData || !config || !picture) {
+        return RETURN_FAIL;
+    }
+    mem->length = 0;
+    
+    if (config->preset == PNGPRESET_OPTIMIZE &&
+        EncodeOptimized(&output, rgbData, config, picture, stripMetadata) == RETURN_OK) {
+        /* The winner goes to the given buffer if it fits */
+        if (mem->data && output.memUsed <= mem->size) {
+            CopyMem(output.memBuffer, mem->data, output.memUsed);
+            mem->length = output.memUsed;
+            FreePNGMemOutput(&output);
+        } else {
+            if (mem->data && mem->owned) {
+                FreeMem(mem->data, mem->size);
+            }
+            mem->data = output.memBuffer;
+            mem->size = output.memSize;
+            mem->length = output.memUsed;
+            mem->owned = TRUE;
+        }
+        return RETURN_OK;
+    }
+    
+    /* The given buffer is never freed while encoding, so a failure
+     * leaves it as it was */
+    OpenPNGMemOutput(&output, mem->data, mem->size);
+    result = EncodePNG(&output, rgbData, config, picture, stripMetadata);
+    if (result != RETURN_OK) {
+        FreePNGMemOutput(&output);
+        return result;
+    }
+    
+    if (output.memBuffer != mem->data) {
+        /* Moved to a buffer allocated here */
+        if (mem->data && mem->owned) {
+            FreeMem(mem->data, mem->size);
+        }
+        mem->data = output.memBuffer;
+        mem->size = output.memSize;
+        mem->owned = TRUE;
+    }
+    mem->length = output.memUsed;
+    return RETURN_OK;
+}
+
+/*
+** PNGEncoder_FreeMem - Free a buffer PNGEncoder_WriteMem() allocated
+** A buffer supplied by the caller is left alone
+*/
+VOID PNGEncoder_FreeMem(struct PNGMemBuffer *mem)
+{
+    if (!mem) {
+        return;
+    }
+    
+    if (mem->data && mem->owned) {
+        FreeMem(mem->data, mem->size);
+        mem->data = NULL;
+        mem->size = 0;
+    }
+    mem->length = 0;
+    mem->owned = FALSE;
+}
+
+/*
+** APNG writer
+**
+** The bundled libpng has no APNG support, so animated PNGs are assembled
+** chunk by chunk here with zlib. Frames are written as 8-bit RGB or RGBA;
+** every frame after the first only carries the rectangle that changed
+** (fcTL + fdAT, dispose NONE, blend SOURCE), which is what keeps ANIM
+** conversions small.
+*/
+
+/* Deflate output is flushed as one IDAT/fdAT chunk per buffer */
+#define APNG_ZBUF_SIZE  8192
+
+/* APNG chunk IDs */
+#define PNG_ID_IHDR 0x49484452UL
+#define PNG_ID_IDAT 0x49444154UL
+#define PNG_ID_IEND 0x49454E44UL
+#define PNG_ID_acTL 0x6163544CUL
+#define PNG_ID_fcTL 0x6663544CUL
+#define PNG_ID_fdAT 0x66644154UL
+
+/* Size of the fcTL payload */
+#define APNG_FCTL_SIZE  26
+
+/* PNG row filter used for APNG frames */
+#define APNG_FILTER_SUB 1
+
+struct APNGWriter {
+    BPTR filehandle;
+    UWORD width, height;
+    UWORD channels;                     /* 3 (RGB) or 4 (RGBA) */
+    ULONG numFrames;                    /* Frames written so far */
+    ULONG sequence;                     /* Next fcTL/fdAT sequence number */
+    LONG actlPos;                       /* File offset of the acTL chunk */
+    LONG fctlPos;                       /* File offset of the last fcTL chunk */
+    UBYTE fctl[APNG_FCTL_SIZE];         /* Last fcTL payload, kept to patch its delay */
+    z_stream zs;
+    BOOL zsInit;
+    UBYTE *rowBuffer;                   /* Filter byte plus one filtered row */
+    ULONG rowBufferSize;
+    UBYTE zBuffer[4 + APNG_ZBUF_SIZE];  /* fdAT sequence number, then deflate output */
+};
+
+/*
+** PutBE32/PutBE16 - Store big-endian values into a chunk payload
+*/
+static VOID PutBE32(UBYTE *p, ULONG value)
+{
+    p[0] = (UBYTE)(value >> 24);
+    p[1] = (UBYTE)(value >> 16);
+    p[2] = (UBYTE)(value >> 8);
+    p[3] = (UBYTE)value;
+}
+
+static VOID PutBE16(UBYTE *p, UWORD value)
+{
+    p[0] = (UBYTE)(value >> 8);
+    p[1] = (UBYTE)value;
+}
+
+/*
+** APNGWriteChunk - Write one PNG chunk (length, type, data, CRC)
+** Returns: RETURN_OK on success, RETURN_FAIL on write error
+*/
+static LONG APNGWriteChunk(struct APNGWriter *writer, ULONG type, const UBYTE *data, ULONG length)
+{
+    UBYTE header[8];
+    UBYTE crcBytes[4];
+    ULONG crc;
+    
+    PutBE32(header, length);
+    PutBE32(header + 4, type);
+    crc = crc32(0L, header + 4, 4);
+    if (length > 0) {
+        crc = crc32(crc, data, length);
+    }
+    PutBE32(crcBytes, crc);
+    
+    if (Write(writer->filehandle, header, 8) != 8) {
+        return RETURN_FAIL;
+    }
+    if (length > 0 && Write(writer->filehandle, (APTR)data, (LONG)length) != (LONG)length) {
+        return RETURN_FAIL;
+    }
+    if (Write(writer->filehandle, crcBytes, 4) != 4) {
+        return RETURN_FAIL;
+    }
+    
+    return RETURN_OK;
+}
+
+/*
+** APNGFlushImageData - Write the pending deflate output as IDAT or fdAT
+** Returns: RETURN_OK on success, RETURN_FAIL on write error
+*/
+static LONG APNGFlushImageData(struct APNGWriter *writer, ULONG length)
+{
+    if (length == 0) {
+        return RETURN_OK;
+    }
+    
+    /* The first frame is the default image and goes in IDAT */
+    if (writer->numFrames == 0) {
+        return APNGWriteChunk(writer, PNG_ID_IDAT, writer->zBuffer + 4, length);
+    }
+    
+    PutBE32(writer->zBuffer, writer->sequence++);
+    return APNGWriteChunk(writer, PNG_ID_fdAT, writer->zBuffer, length + 4);
+}
+
+/*
+** APNGEncoder_Close - Finish an APNG file and free the writer
+** Returns: RETURN_OK on success, RETURN_FAIL on error or if no frame was written
+**
+** Patches the frame count into acTL, which is only known at the end.
+*/
+LONG APNGEncoder_Close(struct APNGWriter *writer)
+{
+    UBYTE actl[8];
+    LONG result;
+    
+    if (!writer) {
+        return RETURN_FAIL;
+    }
+    
+    result = (writer->numFrames > 0) ? RETURN_OK : RETURN_FAIL;
+    
+    if (writer->filehandle) {
+        if (result == RETURN_OK) {
+            PutBE32(actl, writer->numFrames);
+            PutBE32(actl + 4, 0); /* Loop forever */
+            if (Seek(writer->filehandle, writer->actlPos, OFFSET_BEGINNING) < 0 ||
+                APNGWriteChunk(writer, PNG_ID_acTL, actl, 8) != RETURN_OK ||
+                Seek(writer->filehandle, 0, OFFSET_END) < 0 ||
+                APNGWriteChunk(writer, PNG_ID_IEND, NULL, 0) != RETURN_OK) {
+                result = RETURN_FAIL;
+            }
+        }
+        Close(writer->filehandle);
+    }
+    
+    if (writer->zsInit) {
+        deflateEnd(&writer->zs);
+    }
+    if (writer->rowBuffer) {
+        FreeMem(writer->rowBuffer, writer->rowBufferSize);
+    }
+    FreeMem(writer, sizeof(struct APNGWriter));
+    
     return result;
 }
 
+/*
+** APNGEncoder_Open - Create an APNG file and write its header chunks
+** Returns: Writer handle, or NULL on failure
+**
+** Frames are added with APNGEncoder_WriteFrame() and the file is
+** completed by APNGEncoder_Close().
+*/
+struct APNGWriter *APNGEncoder_Open(const char *filename, UWORD width, UWORD height, BOOL hasAlpha)
+{
+    static const UBYTE signature[8] = { 0x89, 'P', 'N', 'G', 0x0D, 0x0A, 0x1A, 0x0A };
+    struct APNGWriter *writer;
+    UBYTE ihdr[13];
+    UBYTE actl[8];
+    
+    if (!filename || width == 0 || height == 0) {
+        return NULL;
+    }
+    
+    writer = (struct APNGWriter *)AllocMem(sizeof(struct APNGWriter), MEMF_PUBLIC | MEMF_CLEAR);
+    if (!writer) {
+        return NULL;
+    }
+    
+    writer->width = width;
+    writer->height = height;
+    writer->channels = hasAlpha ? 4 : 3;
+    writer->rowBufferSize = 1 + (ULONG)width * writer->channels;
+    writer->rowBuffer = (UBYTE *)AllocMem(writer->rowBufferSize, MEMF_PUBLIC);
+    if (!writer->rowBuffer) {
+        APNGEncoder_Close(writer);
+        return NULL;
+    }
+    
+    if (deflateInit(&writer->zs, Z_DEFAULT_COMPRESSION) != Z_OK) {
+        APNGEncoder_Close(writer);
+        return NULL;
+    }
+    writer->zsInit = TRUE;
+    
+    writer->filehandle = Open((STRPTR)filename, MODE_NEWFILE);
+    if (!writer->filehandle) {
+        APNGEncoder_Close(writer);
+        return NULL;
+    }
+    
+    PutBE32(ihdr, width);
+    PutBE32(ihdr + 4, height);
+    ihdr[8] = 8;                                                /* Bit depth */
+    ihdr[9] = hasAlpha ? PNG_COLOR_TYPE_RGBA : PNG_COLOR_TYPE_RGB;
+    ihdr[10] = 0;                                               /* Deflate */
+    ihdr[11] = 0;                                               /* Adaptive filtering */
+    ihdr[12] = 0;                                               /* No interlace */
+    
+    /* acTL is rewritten with the real frame count on close */
+    PutBE32(actl, 0);
+    PutBE32(actl + 4, 0);
+    
+    if (Write(writer->filehandle, (APTR)signature, 8) != 8 ||
+        APNGWriteChunk(writer, PNG_ID_IHDR, ihdr, 13) != RETURN_OK) {
+        APNGEncoder_Close(writer);
+        return NULL;
+    }
+    writer->actlPos = Seek(writer->filehandle, 0, OFFSET_CURRENT);
+    if (writer->actlPos < 0 || APNGWriteChunk(writer, PNG_ID_acTL, actl, 8) != RETURN_OK) {
+        APNGEncoder_Close(writer);
+        return NULL;
+    }
+    
+    return writer;
+}
+
+/*
+** APNGEncoder_WriteFrame - Append one frame to an APNG file
+** Returns: RETURN_OK on success, RETURN_FAIL on error
+**
+** rgbData is the whole image (width x height, RGB or RGBA as opened);
+** only the x/y/w/h rectangle is stored. The first frame is always stored
+** whole. delayNum/delayDen is the delay before this frame is shown, which
+** is patched into the previous frame's fcTL as that frame's duration.
+*/
+LONG APNGEncoder_WriteFrame(struct APNGWriter *writer, UBYTE *rgbData,
+                            UWORD x, UWORD y, UWORD w, UWORD h,
+                            UWORD delayNum, UWORD delayDen)
+{
+    UBYTE *src;
+    UBYTE *out;
+    ULONG rowLength;
+    ULONG i;
+    UWORD row;
+    UWORD bpp;
+    int flush;
+    int zresult;
+    
+    if (!writer || !rgbData) {
+        return RETURN_FAIL;
+    }
+    
+    if (writer->numFrames == 0) {
+        x = 0;
+        y = 0;
+        w = writer->width;
+        h = writer->height;
+    } else if (w == 0 || h == 0) {
+        /* Nothing changed - APNG frames cannot be empty, so repeat one pixel */
+        x = 0;
+        y = 0;
+        w = 1;
+        h = 1;
+    }
+    if ((ULONG)x + w > writer->width || (ULONG)y + h > writer->height) {
+        return RETURN_FAIL;
+    }
+    
+    /* This frame's delay is how long the previous frame stays up */
+    if (writer->numFrames > 0) {
+        PutBE16(writer->fctl + 20, delayNum);
+        PutBE16(writer->fctl + 22, delayDen);
+        if (Seek(writer->filehandle, writer->fctlPos, OFFSET_BEGINNING) < 0 ||
+            APNGWriteChunk(writer, PNG_ID_fcTL, writer->fctl, APNG_FCTL_SIZE) != RETURN_OK ||
+            Seek(writer->filehandle, 0, OFFSET_END) < 0) {
+            return RETURN_FAIL;
+        }
+    }
+    
+    /* Frame control; the delay is provisional until the next frame arrives */
+    PutBE32(writer->fctl, writer->sequence++);
+    PutBE32(writer->fctl + 4, w);
+    PutBE32(writer->fctl + 8, h);
+    PutBE32(writer->fctl + 12, x);
+    PutBE32(writer->fctl + 16, y);
+    PutBE16(writer->fctl + 20, delayNum);
+    PutBE16(writer->fctl + 22, delayDen);
+    writer->fctl[24] = 0; /* APNG_DISPOSE_OP_NONE */
+    writer->fctl[25] = 0; /* APNG_BLEND_OP_SOURCE */
+    writer->fctlPos = Seek(writer->filehandle, 0, OFFSET_CURRENT);
+    if (writer->fctlPos < 0 ||
+        APNGWriteChunk(writer, PNG_ID_fcTL, writer->fctl, APNG_FCTL_SIZE) != RETURN_OK) {
+        return RETURN_FAIL;
+    }
+    
+    /* Deflate the Sub-filtered rows of the rectangle */
+    if (deflateReset(&writer->zs) != Z_OK) {
+        return RETURN_FAIL;
+    }
+    writer->zs.next_out = writer->zBuffer + 4;
+    writer->zs.avail_out = APNG_ZBUF_SIZE;
+    
+    bpp = writer->channels;
+    rowLength = (ULONG)w * bpp;
+    for (row = 0; row < h; row++) {
+        src = rgbData + ((ULONG)(y + row) * writer->width + x) * bpp;
+        out = writer->rowBuffer;
+        out[0] = APNG_FILTER_SUB;
+        for (i = 0; i < bpp; i++) {
+            out[1 + i] = src[i];
+        }
+        for (i = bpp; i < rowLength; i++) {
+            out[1 + i] = (UBYTE)(src[i] - src[i - bpp]);
+        }
+        
+        writer->zs.next_in = writer->rowBuffer;
+        writer->zs.avail_in = (uInt)(rowLength + 1);
+        flush = (row == h - 1) ? Z_FINISH : Z_NO_FLUSH;
+        do {
+            zresult = deflate(&writer->zs, flush);
+            if (zresult != Z_OK && zresult != Z_STREAM_END && zresult != Z_BUF_ERROR) {
+                return RETURN_FAIL;
+            }
+            if (writer->zs.avail_out == 0) {
+                if (APNGFlushImageData(writer, APNG_ZBUF_SIZE) != RETURN_OK) {
+                    return RETURN_FAIL;
+                }
+                writer->zs.next_out = writer->zBuffer + 4;
+                writer->zs.avail_out = APNG_ZBUF_SIZE;
+            }
+        } while (writer->zs.avail_in > 0 || (flush == Z_FINISH && zresult != Z_STREAM_END));
+    }
+    
+    if (APNGFlushImageData(writer, APNG_ZBUF_SIZE - writer->zs.avail_out) != RETURN_OK) {
+        return RETURN_FAIL;
+    }
+    
+    writer->numFrames++;
+    return RETURN_OK;
+}
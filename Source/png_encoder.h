@@ -18,6 +18,14 @@ struct PNGColor {
     UBYTE blue;
 };
 
+/* Compression settings left at PNGCONFIG_AUTO are chosen per image class */
+#define PNGCONFIG_AUTO      (-1)
+
+/* Presets the PNGCONFIG_AUTO choices are made for */
+#define PNGPRESET_DEFAULT   0   /* Smallest file for reasonable time */
+#define PNGPRESET_FAST      1   /* Throughput first - zlib level 1, one cheap filter */
+#define PNGPRESET_OPTIMIZE  2   /* Try several filters and strategies, keep the smallest */
+
 /* PNG configuration structure */
 struct PNGConfig {
     int color_type;      /* PNG_COLOR_TYPE_* */
@@ -27,12 +35,47 @@ struct PNGConfig {
     int num_palette;     /* Number of palette entries */
     UBYTE *trans;        /* Transparency array */
     int num_trans;       /* Number of transparent entries */
+    int trans_gray;      /* Transparent sample of a gray image with trans set */
+    UBYTE *index_map;    /* Decoded palette index to PLTE index, 256 entries */
+    int remap_indices;   /* TRUE if index_map must be applied to the decoded indices */
+    int palette_from_rgb;      /* TRUE if the palette was made from the RGB data */
+    int compression_level;     /* zlib level 0-9, or PNGCONFIG_AUTO */
+    int compression_strategy;  /* Z_* strategy, or PNGCONFIG_AUTO */
+    int filter;          /* PNG_FILTER_* mask, or PNGCONFIG_AUTO */
+    int preset;          /* PNGPRESET_* */
+    int time_budget;     /* Seconds OPTIMIZE may spend on trials, 0 for no limit */
+    int buffer_size;     /* Bytes gathered per file write, 0 for the default */
+};
+
+/* PNG encoded into memory by PNGEncoder_WriteMem() */
+struct PNGMemBuffer {
+    UBYTE *data;         /* Buffer to fill or NULL on entry; the PNG on return */
+    ULONG size;          /* Bytes at data, or the expected PNG size if data is NULL */
+    ULONG length;        /* Bytes of PNG at data */
+    BOOL owned;          /* TRUE if data was allocated here - free with PNGEncoder_FreeMem() */
 };
 
+/* APNG writer handle (opaque) */
+struct APNGWriter;
+
 /* Function prototypes */
 LONG PNGEncoder_Write(const char *filename, UBYTE *rgbData, 
                       struct PNGConfig *config, struct IFFPicture *picture, BOOL stripMetadata);
 VOID PNGEncoder_FreeConfig(struct PNGConfig *config);
+VOID PNGEncoder_GetCompression(struct PNGConfig *config, struct IFFPicture *picture,
+                               int *level, int *strategy, int *filter);
+
+/* PNG output to memory - no file is touched, the buffer grows as needed */
+LONG PNGEncoder_WriteMem(struct PNGMemBuffer *mem, UBYTE *rgbData,
+                         struct PNGConfig *config, struct IFFPicture *picture, BOOL stripMetadata);
+VOID PNGEncoder_FreeMem(struct PNGMemBuffer *mem);
+
+/* APNG output - RGB/RGBA frames, each after the first cropped to a rectangle */
+struct APNGWriter *APNGEncoder_Open(const char *filename, UWORD width, UWORD height, BOOL hasAlpha);
+LONG APNGEncoder_WriteFrame(struct APNGWriter *writer, UBYTE *rgbData,
+                            UWORD x, UWORD y, UWORD w, UWORD h,
+                            UWORD delayNum, UWORD delayDen);
+LONG APNGEncoder_Close(struct APNGWriter *writer);
 
 #endif /* PNG_ENCODER_H */
 